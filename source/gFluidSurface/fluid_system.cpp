@@ -13,12 +13,16 @@
 #include "cutil_math.h"			// cutil32.lib
 
 #include "app_perf.h"
+#include "gvdb_parallel.h"
+#include "gvdb_volume_gvdb.h"
+#include "gvdb_generate.h"
 
 #include "main.h"
 #include "fluid_system.h"
 #include "nv_gui.h"
 
 #include <GL/glew.h>
+#include <algorithm>
 
 extern bool gProfileRend;
 
@@ -28,6 +32,12 @@ extern bool gProfileRend;
 
 // #define FLUID_INTEGRITY						// debugging, enable this to check fluid integrity 
 
+// SSE2 is part of x86-64; the parallel CPU solver uses it for the neighbor loops
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define FLUID_SSE
+	#include <emmintrin.h>
+#endif
+
 bool cuCheck (CUresult launch_stat, char* method, char* apicall, char* arg, bool bDebug)
 {
 	CUresult kern_stat = CUDA_SUCCESS;
@@ -70,6 +80,8 @@ FluidSystem::FluidSystem ()
 	m_Frame = 0;
 	m_Module = 0;
 	m_Thresh = 0;	
+	mSurfaceGVDB = 0x0;
+	mSurfaceOwned = false;
 	m_NeighborTable = 0x0;
 	m_NeighborDist = 0x0;		
 	for (int n=0; n < FUNC_MAX; n++ ) m_Func[n] = (CUfunction) -1;
@@ -80,6 +92,7 @@ FluidSystem::FluidSystem ()
 }
 
 FluidSystem::~FluidSystem() {
+	SetSurfaceVolume ( 0x0 );
 	ClearNeighborTable();
 	if (mSaveNdx != 0x0) free(mSaveNdx);
 	if (mSaveCnt != 0x0) free(mSaveCnt);
@@ -144,6 +157,7 @@ void FluidSystem::Start ( int num )
 	m_Time = 0;
 
 	ClearNeighborTable ();
+	m_Verlet.off.clear ();	// lists refer to the old particles
 	mNumPoints = 0;			// reset count
 	
 	SetupDefaultParams ();	
@@ -516,6 +530,18 @@ void FluidSystem::Run ()
 		ComputeForceGrid ();
 		Advance ();
 		break;
+	case RUN_CPU_PARALLEL:				// CPU multithreaded, sorted SoA
+		InsertParticlesSoA ();
+		ComputePressureSoA ();
+		ComputeForceSoA ();
+		Advance ();
+		break;
+	case RUN_CPU_VERLET:				// CPU multithreaded, cached neighbor lists
+		UpdateVerletLists ();
+		ComputePressureVerlet ();
+		ComputeForceVerlet ();
+		Advance ();
+		break;
 	case RUN_VALIDATE:					// GPU Validation
 		ValidateCUDA();
 		break;
@@ -549,6 +575,7 @@ void FluidSystem::AdvanceTime ()
 		mbRecord = false;
 		mbRecordBricks = false;
 		m_Toggle[ PCAPTURE ] = false;
+		mSeqOut.Close ();
 		
 		nvprintf ( "Exiting.\n" );
 		exit ( 1 );
@@ -586,14 +613,9 @@ void FluidSystem::DrawDomain ()
 
 void FluidSystem::Advance ()
 {
-	Vector3DF norm, z;
-	Vector3DF dir, accel;
-	Vector3DF vnext;
 	Vector3DF bmin, bmax;
-	Vector4DF clr;
-	float adj;
 	float AL, AL2, SL, SL2, ss, radius;
-	float stiff, damp, speed, diff; 
+	float stiff, damp; 
 	
 	AL = m_Param[PACCEL_LIMIT];	AL2 = AL*AL;
 	SL = m_Param[PVEL_LIMIT];	SL2 = SL*SL;
@@ -605,190 +627,188 @@ void FluidSystem::Advance ()
 	bmax = m_Vec[PBOUNDMAX];
 	ss = m_Param[PSIMSCALE];
 
-	// Get particle buffers
-	Vector3DF*	ppos =		m_Fluid.bufV3(FPOS);
-	Vector3DF*	pvel =		m_Fluid.bufV3(FVEL);
-	Vector3DF*	pveleval =	m_Fluid.bufV3(FVEVAL);
-	Vector3DF*	pforce =	m_Fluid.bufV3(FFORCE);
-	uint*		pclr =		m_Fluid.bufI(FCLR);
-	float*		ppress =	m_Fluid.bufF(FPRESS);
-	float*		pdensity =	m_Fluid.bufF(FDENSITY);
-
-	// Advance each particle
-	for ( int n=0; n < NumPoints(); n++ ) {
-
-		if ( m_Fluid.bufI(FGCELL)[n] == GRID_UNDEF) continue;
-
-		// Compute Acceleration		
-		accel = *pforce;
-		accel *= m_Param[PMASS];
-	
-		// Boundary Conditions
-		// Y-axis walls
-		diff = radius - ( ppos->y - (bmin.y+ (ppos->x-bmin.x)*m_Param[PGROUND_SLOPE] ) )*ss;
-		if (diff > EPSILON ) {			
-			norm.Set ( -m_Param[PGROUND_SLOPE], 1.0f - m_Param[PGROUND_SLOPE], 0 );
-			adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
-			accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
-		}		
-		diff = radius - ( bmax.y - ppos->y )*ss;
-		if (diff > EPSILON) {
-			norm.Set ( 0, -1, 0 );
-			adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
-			accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
-		}		
+	// Advance each particle. Particles are independent, so the loop is split across threads.
+	ParallelChunks ( NumPoints(), 0, [&]( int, uint64 s, uint64 e ) {
+		Vector3DF norm, accel, vnext;
+		Vector4DF clr;
+		float adj, speed, diff;
+
+		// Get particle buffers
+		Vector3DF*	ppos =		m_Fluid.bufV3(FPOS) + s;
+		Vector3DF*	pvel =		m_Fluid.bufV3(FVEL) + s;
+		Vector3DF*	pveleval =	m_Fluid.bufV3(FVEVAL) + s;
+		Vector3DF*	pforce =	m_Fluid.bufV3(FFORCE) + s;
+		uint*		pclr =		m_Fluid.bufI(FCLR) + s;
+
+		// Pointers advance in the loop header so skipped particles stay aligned
+		for ( int n=(int) s; n < (int) e; n++, ppos++, pvel++, pveleval++, pforce++, pclr++ ) {
+
+			if ( m_Fluid.bufI(FGCELL)[n] == GRID_UNDEF) continue;
+
+			// Compute Acceleration		
+			accel = *pforce;
+			accel *= m_Param[PMASS];
+	
+			// Boundary Conditions
+			// Y-axis walls
+			diff = radius - ( ppos->y - (bmin.y+ (ppos->x-bmin.x)*m_Param[PGROUND_SLOPE] ) )*ss;
+			if (diff > EPSILON ) {			
+				norm.Set ( -m_Param[PGROUND_SLOPE], 1.0f - m_Param[PGROUND_SLOPE], 0 );
+				adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
+				accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
+			}		
+			diff = radius - ( bmax.y - ppos->y )*ss;
+			if (diff > EPSILON) {
+				norm.Set ( 0, -1, 0 );
+				adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
+				accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
+			}		
 		
-		// X-axis walls
-		if ( !m_Toggle[PWRAP_X] ) {
-			diff = radius - ( ppos->x - (bmin.x + (sin(m_Time*m_Param[PFORCE_FREQ])+1)*0.5f * m_Param[PFORCE_MIN]) )*ss;	
-			//diff = 2 * radius - ( p->pos.x - min.x + (sin(m_Time*10.0)-1) * m_Param[FORCE_XMIN_SIN] )*ss;	
-			if (diff > EPSILON ) {
-				norm.Set ( 1.0, 0, 0 );
-				adj = (m_Param[ PFORCE_MIN ]+1) * stiff * diff - damp * (float) norm.Dot ( *pveleval ) ;
-				accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;					
+			// X-axis walls
+			if ( !m_Toggle[PWRAP_X] ) {
+				diff = radius - ( ppos->x - (bmin.x + (sin(m_Time*m_Param[PFORCE_FREQ])+1)*0.5f * m_Param[PFORCE_MIN]) )*ss;	
+				//diff = 2 * radius - ( p->pos.x - min.x + (sin(m_Time*10.0)-1) * m_Param[FORCE_XMIN_SIN] )*ss;	
+				if (diff > EPSILON ) {
+					norm.Set ( 1.0, 0, 0 );
+					adj = (m_Param[ PFORCE_MIN ]+1) * stiff * diff - damp * (float) norm.Dot ( *pveleval ) ;
+					accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;					
+				}
+
+				diff = radius - ( (bmax.x - (sin(m_Time*m_Param[PFORCE_FREQ])+1)*0.5f* m_Param[PFORCE_MAX]) - ppos->x )*ss;	
+				if (diff > EPSILON) {
+					norm.Set ( -1, 0, 0 );
+					adj = (m_Param[ PFORCE_MAX ]+1) * stiff * diff - damp * (float) norm.Dot ( *pveleval );
+					accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
+				}
 			}
 
-			diff = radius - ( (bmax.x - (sin(m_Time*m_Param[PFORCE_FREQ])+1)*0.5f* m_Param[PFORCE_MAX]) - ppos->x )*ss;	
+			// Z-axis walls
+			diff = radius - ( ppos->z - bmin.z )*ss;			
 			if (diff > EPSILON) {
-				norm.Set ( -1, 0, 0 );
-				adj = (m_Param[ PFORCE_MAX ]+1) * stiff * diff - damp * (float) norm.Dot ( *pveleval );
+				norm.Set ( 0, 0, 1 );
+				adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
+				accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
+			}
+			diff = radius - ( bmax.z - ppos->z )*ss;
+			if (diff > EPSILON) {
+				norm.Set ( 0, 0, -1 );
+				adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
 				accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
 			}
-		}
-
-		// Z-axis walls
-		diff = radius - ( ppos->z - bmin.z )*ss;			
-		if (diff > EPSILON) {
-			norm.Set ( 0, 0, 1 );
-			adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
-			accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
-		}
-		diff = radius - ( bmax.z - ppos->z )*ss;
-		if (diff > EPSILON) {
-			norm.Set ( 0, 0, -1 );
-			adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
-			accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
-		}
 		
 
-		// Wall barrier
-		if ( m_Toggle[PWALL_BARRIER] ) {
-			diff = 2 * radius - ( ppos->x - 0 )*ss;					
-			if (diff < 2*radius && diff > EPSILON && fabsf(ppos->y) < 3 && ppos->z < 10) {
-				norm.Set ( 1.0, 0, 0 );
-				adj = 2*stiff * diff - damp * (float) norm.Dot ( *pveleval ) ;	
-				accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;					
+			// Wall barrier
+			if ( m_Toggle[PWALL_BARRIER] ) {
+				diff = 2 * radius - ( ppos->x - 0 )*ss;					
+				if (diff < 2*radius && diff > EPSILON && fabsf(ppos->y) < 3 && ppos->z < 10) {
+					norm.Set ( 1.0, 0, 0 );
+					adj = 2*stiff * diff - damp * (float) norm.Dot ( *pveleval ) ;	
+					accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;					
+				}
 			}
-		}
 		
-		// Levy barrier
-		if ( m_Toggle[PLEVY_BARRIER] ) {
-			diff = 2 * radius - ( ppos->x - 0 )*ss;					
-			if (diff < 2*radius && diff > EPSILON && fabsf(ppos->y) > 5 && ppos->z < 10) {
-				norm.Set ( 1.0, 0, 0 );
-				adj = 2*stiff * diff - damp * (float) norm.Dot ( *pveleval ) ;	
-				accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;					
+			// Levy barrier
+			if ( m_Toggle[PLEVY_BARRIER] ) {
+				diff = 2 * radius - ( ppos->x - 0 )*ss;					
+				if (diff < 2*radius && diff > EPSILON && fabsf(ppos->y) > 5 && ppos->z < 10) {
+					norm.Set ( 1.0, 0, 0 );
+					adj = 2*stiff * diff - damp * (float) norm.Dot ( *pveleval ) ;	
+					accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;					
+				}
 			}
-		}
-		// Drain barrier
-		if ( m_Toggle[PDRAIN_BARRIER] ) {
-			diff = 2 * radius - ( ppos->z - bmin.z-15 )*ss;
-			if (diff < 2*radius && diff > EPSILON && (fabsf(ppos->x)>3 || fabsf(ppos->y)>3) ) {
-				norm.Set ( 0, 0, 1);
-				adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
-				accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
+			// Drain barrier
+			if ( m_Toggle[PDRAIN_BARRIER] ) {
+				diff = 2 * radius - ( ppos->z - bmin.z-15 )*ss;
+				if (diff < 2*radius && diff > EPSILON && (fabsf(ppos->x)>3 || fabsf(ppos->y)>3) ) {
+					norm.Set ( 0, 0, 1);
+					adj = stiff * diff - damp * (float) norm.Dot ( *pveleval );
+					accel.x += adj * norm.x; accel.y += adj * norm.y; accel.z += adj * norm.z;
+				}
 			}
-		}
-
-		// Plane gravity
-		accel += m_Vec[PPLANE_GRAV_DIR] * m_Param[PGRAV];
-
-		// Point gravity
-		if ( m_Vec[PPOINT_GRAV_POS].x > 0 && m_Param[PGRAV] > 0 ) {
-			norm.x = ( ppos->x - m_Vec[PPOINT_GRAV_POS].x );
-			norm.y = ( ppos->y - m_Vec[PPOINT_GRAV_POS].y );
-			norm.z = ( ppos->z - m_Vec[PPOINT_GRAV_POS].z );
-			norm.Normalize ();
-			norm *= m_Param[PGRAV];
-			accel -= norm;
-		}
-
-		// Acceleration limiting 
-		speed = accel.x*accel.x + accel.y*accel.y + accel.z*accel.z;
-		if ( speed > AL2 ) {
-			accel *= AL / sqrt(speed);
-		}		
 
-		// Velocity limiting 
-		speed = pvel->x*pvel->x + pvel->y*pvel->y + pvel->z*pvel->z;
-		if ( speed > SL2 ) {
-			speed = SL2;
-			(*pvel) *= SL / sqrt(speed);
-		}		
+			// Plane gravity
+			accel += m_Vec[PPLANE_GRAV_DIR] * m_Param[PGRAV];
+
+			// Point gravity
+			if ( m_Vec[PPOINT_GRAV_POS].x > 0 && m_Param[PGRAV] > 0 ) {
+				norm.x = ( ppos->x - m_Vec[PPOINT_GRAV_POS].x );
+				norm.y = ( ppos->y - m_Vec[PPOINT_GRAV_POS].y );
+				norm.z = ( ppos->z - m_Vec[PPOINT_GRAV_POS].z );
+				norm.Normalize ();
+				norm *= m_Param[PGRAV];
+				accel -= norm;
+			}
 
-		// Leapfrog Integration ----------------------------
-		vnext = accel;							
-		vnext *= m_DT;
-		vnext += *pvel;						// v(t+1/2) = v(t-1/2) + a(t) dt
-
-		*pveleval = *pvel;
-		*pveleval += vnext;
-		*pveleval *= 0.5;					// v(t+1) = [v(t-1/2) + v(t+1/2)] * 0.5		used to compute forces later
-		*pvel = vnext;
-		vnext *= m_DT/ss;
-		*ppos += vnext;						// p(t+1) = p(t) + v(t+1/2) dt
-
-		/*if ( m_Param[PCLR_MODE]==1.0 ) {
-			adj = fabs(vnext.x)+fabs(vnext.y)+fabs(vnext.z) / 7000.0;
-			adj = (adj > 1.0) ? 1.0 : adj;
-			*pclr = COLORA( 0, adj, adj, 1 );
-		}
-		if ( m_Param[PCLR_MODE]==2.0 ) {
-			float v = 0.5 + ( *ppress / 1500.0); 
-			if ( v < 0.1 ) v = 0.1;
-			if ( v > 1.0 ) v = 1.0;
-			*pclr = COLORA ( v, 1-v, 0, 1 );
-		}*/
-		if ( speed > SL2*0.1f) {
-			adj = SL2*0.1f;
-			clr.fromClr ( *pclr );
-			clr += Vector4DF( 2/255.0f, 2/255.0f, 2/255.0f, 2/255.0f);
-			clr.Clamp ( 1, 1, 1, 1);
-			*pclr = clr.toClr();
-		}
-		if ( speed < 0.01 ) {
-			clr.fromClr ( *pclr);
-			clr.x -= float(1/255.0f);		if ( clr.x < 0.2f ) clr.x = 0.2f;
-			clr.y -= float(1/255.0f);		if ( clr.y < 0.2f ) clr.y = 0.2f;
-			*pclr = clr.toClr();
-		}
-		
-		// Euler integration -------------------------------
-		/* accel += m_Gravity;
-		accel *= m_DT;
-		p->vel += accel;				// v(t+1) = v(t) + a(t) dt
-		p->vel_eval += accel;
-		p->vel_eval *= m_DT/d;
-		p->pos += p->vel_eval;
-		p->vel_eval = p->vel;  */	
-
-
-		if ( m_Toggle[PWRAP_X] ) {
-			diff = ppos->x - (m_Vec[PBOUNDMIN].x + 2);			// -- Simulates object in center of flow
-			if ( diff <= 0 ) {
-				ppos->x = (m_Vec[PBOUNDMAX].x - 2) + diff*2;				
-				ppos->z = 10;
+			// Acceleration limiting 
+			speed = accel.x*accel.x + accel.y*accel.y + accel.z*accel.z;
+			if ( speed > AL2 ) {
+				accel *= AL / sqrt(speed);
+			}		
+
+			// Velocity limiting 
+			speed = pvel->x*pvel->x + pvel->y*pvel->y + pvel->z*pvel->z;
+			if ( speed > SL2 ) {
+				speed = SL2;
+				(*pvel) *= SL / sqrt(speed);
+			}		
+
+			// Leapfrog Integration ----------------------------
+			vnext = accel;							
+			vnext *= m_DT;
+			vnext += *pvel;						// v(t+1/2) = v(t-1/2) + a(t) dt
+
+			*pveleval = *pvel;
+			*pveleval += vnext;
+			*pveleval *= 0.5;					// v(t+1) = [v(t-1/2) + v(t+1/2)] * 0.5		used to compute forces later
+			*pvel = vnext;
+			vnext *= m_DT/ss;
+			*ppos += vnext;						// p(t+1) = p(t) + v(t+1/2) dt
+
+			/*if ( m_Param[PCLR_MODE]==1.0 ) {
+				adj = fabs(vnext.x)+fabs(vnext.y)+fabs(vnext.z) / 7000.0;
+				adj = (adj > 1.0) ? 1.0 : adj;
+				*pclr = COLORA( 0, adj, adj, 1 );
 			}
-		}	
+			if ( m_Param[PCLR_MODE]==2.0 ) {
+				float v = 0.5 + ( *ppress / 1500.0); 
+				if ( v < 0.1 ) v = 0.1;
+				if ( v > 1.0 ) v = 1.0;
+				*pclr = COLORA ( v, 1-v, 0, 1 );
+			}*/
+			if ( speed > SL2*0.1f) {
+				adj = SL2*0.1f;
+				clr.fromClr ( *pclr );
+				clr += Vector4DF( 2/255.0f, 2/255.0f, 2/255.0f, 2/255.0f);
+				clr.Clamp ( 1, 1, 1, 1);
+				*pclr = clr.toClr();
+			}
+			if ( speed < 0.01 ) {
+				clr.fromClr ( *pclr);
+				clr.x -= float(1/255.0f);		if ( clr.x < 0.2f ) clr.x = 0.2f;
+				clr.y -= float(1/255.0f);		if ( clr.y < 0.2f ) clr.y = 0.2f;
+				*pclr = clr.toClr();
+			}
+		
+			// Euler integration -------------------------------
+			/* accel += m_Gravity;
+			accel *= m_DT;
+			p->vel += accel;				// v(t+1) = v(t) + a(t) dt
+			p->vel_eval += accel;
+			p->vel_eval *= m_DT/d;
+			p->pos += p->vel_eval;
+			p->vel_eval = p->vel;  */	
+
+
+			if ( m_Toggle[PWRAP_X] ) {
+				diff = ppos->x - (m_Vec[PBOUNDMIN].x + 2);			// -- Simulates object in center of flow
+				if ( diff <= 0 ) {
+					ppos->x = (m_Vec[PBOUNDMAX].x - 2) + diff*2;				
+					ppos->z = 10;
+				}
+			}	
 
-		ppos++;
-		pvel++;
-		pveleval++;
-		pforce++;
-		pclr++;
-		ppress++;
-		pdensity++;
-	}
+		}
+	} );
 
 }
 
@@ -1311,6 +1331,446 @@ void FluidSystem::ComputeForceGridNC ()
 }
 
 
+//-------------------------------------------------------- Parallel CPU solver
+
+// Counting sort by grid cell, mirrors insertParticles + PrefixSumCellsCUDA + countingSortFull
+void FluidSystem::InsertParticlesSoA ()
+{
+	int num = NumPoints();
+	Vector3DF*	ppos =		m_Fluid.bufV3(FPOS);
+	Vector3DF*	pveleval =	m_Fluid.bufV3(FVEVAL);
+	Vector3DF*	pforce =	m_Fluid.bufV3(FFORCE);
+	uint*		pgcell =	m_Fluid.bufI(FGCELL);
+	uint*		pgndx =		m_Fluid.bufI(FGNDX);
+	uint*		m_GridCnt = m_Fluid.bufI(FGRIDCNT);
+	uint*		m_GridOff = m_Fluid.bufI(FGRIDOFF);
+	int xns = m_GridRes.x - m_GridSrch;
+	int yns = m_GridRes.y - m_GridSrch;
+	int zns = m_GridRes.z - m_GridSrch;
+
+	// Cell of each particle
+	ParallelChunks ( num, 0, [&]( int, uint64 s, uint64 e ) {
+		Vector3DI gc;
+		for (uint64 n = s; n < e; n++) {
+			int gs = getGridCell ( ppos[n], gc );
+			if ( gc.x >= 1 && gc.x <= xns && gc.y >= 1 && gc.y <= yns && gc.z >= 1 && gc.z <= zns ) {
+				pgcell[n] = gs;
+			} else {
+				pgcell[n] = GRID_UNDEF;
+				pforce[n].Set ( 0, 0, 0 );
+			}
+		}
+	} );
+
+	// Counts and index within cell (deterministic, unlike the atomic version), then offsets
+	memset ( m_GridCnt, 0, m_GridTotal*sizeof(uint) );
+	for (int n = 0; n < num; n++)
+		if ( pgcell[n] != GRID_UNDEF ) pgndx[n] = m_GridCnt[ pgcell[n] ]++;
+
+	uint total = 0;
+	int occupy = 0;
+	for (int c = 0; c < m_GridTotal; c++) {
+		m_GridOff[c] = total;
+		total += m_GridCnt[c];
+		if ( m_GridCnt[c] > 0 ) occupy++;
+	}
+	m_Param[ PSTAT_OCCUPY ] = float(occupy);
+	m_Param[ PSTAT_GRIDCNT ] = float(total);
+
+	// Deep copy into sorted SoA. Verlet lists index the previous order.
+	m_Verlet.off.clear ();
+	SortedParticles& sp = m_Sorted;
+	sp.px.resize ( total );		sp.py.resize ( total );		sp.pz.resize ( total );
+	sp.vx.resize ( total );		sp.vy.resize ( total );		sp.vz.resize ( total );
+	sp.press.resize ( total );	sp.dens.resize ( total );	sp.ndx.resize ( total );
+	ParallelChunks ( num, 0, [&]( int, uint64 s, uint64 e ) {
+		for (uint64 n = s; n < e; n++) {
+			uint c = pgcell[n];
+			if ( c == GRID_UNDEF ) continue;
+			uint k = m_GridOff[c] + pgndx[n];
+			sp.px[k] = ppos[n].x;		sp.py[k] = ppos[n].y;		sp.pz[k] = ppos[n].z;
+			sp.vx[k] = pveleval[n].x;	sp.vy[k] = pveleval[n].y;	sp.vz[k] = pveleval[n].z;
+			sp.ndx[k] = (uint) n;
+		}
+	} );
+}
+
+// Neighbor candidates for the sorted-particle kernels: a contiguous range of sorted
+// particles (grid search) or a Verlet list.
+struct RangeIdx {
+	int j0;
+	int operator[] ( int k ) const						{ return j0 + k; }
+#ifdef FLUID_SSE
+	__m128 load4 ( const float* a, int k ) const		{ return _mm_loadu_ps ( a + j0 + k ); }
+#endif
+};
+struct ListIdx {
+	const uint* nbr;
+	int operator[] ( int k ) const						{ return (int) nbr[k]; }
+#ifdef FLUID_SSE
+	__m128 load4 ( const float* a, int k ) const		{ return _mm_set_ps ( a[nbr[k+3]], a[nbr[k+2]], a[nbr[k+1]], a[nbr[k]] ); }
+#endif
+};
+
+// Poly6 density sum of `cnt` candidates around (ix,iy,iz). Counts neighbors within radius.
+template<class Idx> static float densitySum ( const float* px, const float* py, const float* pz, const Idx& idx, int cnt,
+											  float ix, float iy, float iz, float d2, float r2, int& nbr )
+{
+	float sum = 0;
+	int k = 0;
+#ifdef FLUID_SSE
+	__m128 vix = _mm_set1_ps ( ix ), viy = _mm_set1_ps ( iy ), viz = _mm_set1_ps ( iz );
+	__m128 vd2 = _mm_set1_ps ( d2 ), vr2 = _mm_set1_ps ( r2 );
+	__m128 acc = _mm_setzero_ps ();
+	for (; k+4 <= cnt; k += 4) {
+		__m128 dx = _mm_sub_ps ( idx.load4 ( px, k ), vix );
+		__m128 dy = _mm_sub_ps ( idx.load4 ( py, k ), viy );
+		__m128 dz = _mm_sub_ps ( idx.load4 ( pz, k ), viz );
+		__m128 dsq = _mm_mul_ps ( vd2, _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( dx, dx ), _mm_mul_ps ( dy, dy ) ), _mm_mul_ps ( dz, dz ) ) );
+		__m128 in = _mm_cmple_ps ( dsq, vr2 );
+		__m128 c = _mm_sub_ps ( vr2, dsq );
+		acc = _mm_add_ps ( acc, _mm_and_ps ( in, _mm_mul_ps ( _mm_mul_ps ( c, c ), c ) ) );
+		int m = _mm_movemask_ps ( in );
+		nbr += (m & 1) + ((m >> 1) & 1) + ((m >> 2) & 1) + ((m >> 3) & 1);
+	}
+	float a[4];
+	_mm_storeu_ps ( a, acc );
+	sum = (a[0] + a[1]) + (a[2] + a[3]);
+#endif
+	for (; k < cnt; k++) {
+		int j = idx[k];
+		float dx = px[j] - ix, dy = py[j] - iy, dz = pz[j] - iz;
+		float dsq = d2*(dx*dx + dy*dy + dz*dz);
+		if ( dsq <= r2 ) { float c = r2 - dsq; sum += c * c * c; nbr++; }
+	}
+	return sum;
+}
+
+void FluidSystem::ComputePressureSoA ()
+{
+	SortedParticles& sp = m_Sorted;
+	int total = (int) sp.ndx.size();
+	float d2 = m_Param[PSIMSCALE] * m_Param[PSIMSCALE];
+	float r2 = m_R2;
+	float self = r2 * r2 * r2;						// the particle itself is inside every range
+	float mass = m_Param[PMASS], rest = m_Param[PRESTDENSITY], stiff = m_Param[PINTSTIFF];
+	int nadj = (m_GridRes.z + 1)*m_GridRes.x + 1;
+	int srch = m_GridSrch;
+	uint* pgcell = m_Fluid.bufI(FGCELL);
+	uint* m_GridCnt = m_Fluid.bufI(FGRIDCNT);
+	uint* m_GridOff = m_Fluid.bufI(FGRIDOFF);
+	float* ppress = m_Fluid.bufF(FPRESS);
+	float* pdensity = m_Fluid.bufF(FDENSITY);
+
+	int nth = getNumThreads ();
+	std::vector<double> nbrs ( nth, 0 ), srchs ( nth, 0 );
+	ParallelChunks ( total, nth, [&]( int t, uint64 s, uint64 e ) {
+		for (uint64 i = s; i < e; i++) {
+			int cell = (int) pgcell[ sp.ndx[i] ];
+			float sum = 0;
+			int nbr = 0, cnt = 0;
+			// Each (y,z) row of the search block is srch consecutive cells: one contiguous range
+			for (int y = 0; y < srch; y++)
+				for (int z = 0; z < srch; z++) {
+					int c0 = cell - nadj + (y*m_GridRes.z + z)*m_GridRes.x;
+					int c1 = c0 + srch - 1;
+					int j0 = m_GridOff[c0], j1 = m_GridOff[c1] + m_GridCnt[c1];
+					RangeIdx r = { j0 };
+					sum += densitySum ( sp.px.data(), sp.py.data(), sp.pz.data(), r, j1 - j0, sp.px[i], sp.py[i], sp.pz[i], d2, r2, nbr );
+					cnt += j1 - j0;
+				}
+			nbrs[t] += nbr - 1;						// self excluded, as in ComputePressureGrid
+			srchs[t] += cnt - 1;
+			float dens = (sum - self) * mass * m_Poly6Kern;
+			float press = ( dens - rest ) * stiff;
+			sp.press[i] = press;
+			sp.dens[i] = 1.0f / dens;
+			ppress[ sp.ndx[i] ] = press;
+			pdensity[ sp.ndx[i] ] = sp.dens[i];
+		}
+	} );
+
+	// Stats:
+	double nbr = 0, sr = 0;
+	for (int t = 0; t < nth; t++) { nbr += nbrs[t]; sr += srchs[t]; }
+	m_Param [ PSTAT_NBR ] = float(nbr);
+	m_Param [ PSTAT_SRCH ] = float(sr);
+	if ( m_Param[PSTAT_NBR] > m_Param [ PSTAT_NBRMAX ] ) m_Param [ PSTAT_NBRMAX ] = m_Param[PSTAT_NBR];
+	if ( m_Param[PSTAT_SRCH] > m_Param [ PSTAT_SRCHMAX ] ) m_Param [ PSTAT_SRCHMAX ] = m_Param[PSTAT_SRCH];
+}
+
+// Pressure and viscosity force on sorted particle i from `cnt` candidates, as in ComputeForceGrid.
+// Pairs at zero distance (including i itself) are skipped.
+struct ForceTerms {
+	float d2, r2, mR, pk, vterm;			// pk = simscale * -0.5 * spiky kernel, vterm = lap kernel * visc
+};
+
+template<class Idx> static void forceSum ( const FluidSystem::SortedParticles& sp, int i, const Idx& idx, int cnt, const ForceTerms& k, Vector3DF& f )
+{
+	float ix = sp.px[i], iy = sp.py[i], iz = sp.pz[i];
+	float ivx = sp.vx[i], ivy = sp.vy[i], ivz = sp.vz[i];
+	float ip = sp.press[i], id = sp.dens[i];
+	float fx = 0, fy = 0, fz = 0;
+	int n = 0;
+#ifdef FLUID_SSE
+	__m128 vix = _mm_set1_ps ( ix ), viy = _mm_set1_ps ( iy ), viz = _mm_set1_ps ( iz );
+	__m128 vivx = _mm_set1_ps ( ivx ), vivy = _mm_set1_ps ( ivy ), vivz = _mm_set1_ps ( ivz );
+	__m128 vip = _mm_set1_ps ( ip ), vid = _mm_set1_ps ( id );
+	__m128 vd2 = _mm_set1_ps ( k.d2 ), vr2 = _mm_set1_ps ( k.r2 ), vmR = _mm_set1_ps ( k.mR );
+	__m128 vpk = _mm_set1_ps ( k.pk ), vvt = _mm_set1_ps ( k.vterm ), zero = _mm_setzero_ps ();
+	__m128 ax = zero, ay = zero, az = zero;
+	for (; n+4 <= cnt; n += 4) {
+		__m128 dx = _mm_sub_ps ( vix, idx.load4 ( sp.px.data(), n ) );
+		__m128 dy = _mm_sub_ps ( viy, idx.load4 ( sp.py.data(), n ) );
+		__m128 dz = _mm_sub_ps ( viz, idx.load4 ( sp.pz.data(), n ) );
+		__m128 dsq = _mm_mul_ps ( vd2, _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( dx, dx ), _mm_mul_ps ( dy, dy ) ), _mm_mul_ps ( dz, dz ) ) );
+		__m128 in = _mm_and_ps ( _mm_cmple_ps ( dsq, vr2 ), _mm_cmpgt_ps ( dsq, zero ) );
+		if ( _mm_movemask_ps ( in ) == 0 ) continue;
+		__m128 jdist = _mm_sqrt_ps ( _mm_max_ps ( dsq, _mm_set1_ps ( 1e-12f ) ) );
+		__m128 c = _mm_sub_ps ( vmR, jdist );
+		__m128 pterm = _mm_div_ps ( _mm_mul_ps ( _mm_mul_ps ( vpk, c ), _mm_add_ps ( vip, idx.load4 ( sp.press.data(), n ) ) ), jdist );
+		__m128 dterm = _mm_and_ps ( in, _mm_mul_ps ( _mm_mul_ps ( c, vid ), idx.load4 ( sp.dens.data(), n ) ) );
+		ax = _mm_add_ps ( ax, _mm_mul_ps ( _mm_add_ps ( _mm_mul_ps ( pterm, dx ), _mm_mul_ps ( vvt, _mm_sub_ps ( idx.load4 ( sp.vx.data(), n ), vivx ) ) ), dterm ) );
+		ay = _mm_add_ps ( ay, _mm_mul_ps ( _mm_add_ps ( _mm_mul_ps ( pterm, dy ), _mm_mul_ps ( vvt, _mm_sub_ps ( idx.load4 ( sp.vy.data(), n ), vivy ) ) ), dterm ) );
+		az = _mm_add_ps ( az, _mm_mul_ps ( _mm_add_ps ( _mm_mul_ps ( pterm, dz ), _mm_mul_ps ( vvt, _mm_sub_ps ( idx.load4 ( sp.vz.data(), n ), vivz ) ) ), dterm ) );
+	}
+	float a[4];
+	_mm_storeu_ps ( a, ax );	fx = (a[0] + a[1]) + (a[2] + a[3]);
+	_mm_storeu_ps ( a, ay );	fy = (a[0] + a[1]) + (a[2] + a[3]);
+	_mm_storeu_ps ( a, az );	fz = (a[0] + a[1]) + (a[2] + a[3]);
+#endif
+	for (; n < cnt; n++) {
+		int j = idx[n];
+		float dx = ix - sp.px[j], dy = iy - sp.py[j], dz = iz - sp.pz[j];
+		float dsq = k.d2*(dx*dx + dy*dy + dz*dz);
+		if ( dsq > k.r2 || dsq <= 0 ) continue;
+		float jdist = sqrt(dsq);
+		float c = k.mR - jdist;
+		float pterm = k.pk * c * ( ip + sp.press[j] ) / jdist;
+		float dterm = c * id * sp.dens[j];
+		fx += ( pterm * dx + k.vterm * ( sp.vx[j] - ivx ) ) * dterm;
+		fy += ( pterm * dy + k.vterm * ( sp.vy[j] - ivy ) ) * dterm;
+		fz += ( pterm * dz + k.vterm * ( sp.vz[j] - ivz ) ) * dterm;
+	}
+	f.x += fx;	f.y += fy;	f.z += fz;
+}
+
+void FluidSystem::ComputeForceSoA ()
+{
+	SortedParticles& sp = m_Sorted;
+	int total = (int) sp.ndx.size();
+	ForceTerms k;
+	k.d2 = m_Param[PSIMSCALE] * m_Param[PSIMSCALE];
+	k.r2 = m_R2;
+	k.mR = m_Param[PSMOOTHRADIUS];
+	k.pk = m_Param[PSIMSCALE] * -0.5f * m_SpikyKern;
+	k.vterm = m_LapKern * m_Param[PVISC];
+	int nadj = (m_GridRes.z + 1)*m_GridRes.x + 1;
+	int srch = m_GridSrch;
+	uint* pgcell = m_Fluid.bufI(FGCELL);
+	uint* m_GridCnt = m_Fluid.bufI(FGRIDCNT);
+	uint* m_GridOff = m_Fluid.bufI(FGRIDOFF);
+	Vector3DF* pforce = m_Fluid.bufV3(FFORCE);
+
+	ParallelChunks ( total, 0, [&]( int, uint64 s, uint64 e ) {
+		for (uint64 i = s; i < e; i++) {
+			int cell = (int) pgcell[ sp.ndx[i] ];
+			Vector3DF f ( 0, 0, 0 );
+			for (int y = 0; y < srch; y++)
+				for (int z = 0; z < srch; z++) {
+					int c0 = cell - nadj + (y*m_GridRes.z + z)*m_GridRes.x;
+					int c1 = c0 + srch - 1;
+					int j0 = m_GridOff[c0], j1 = m_GridOff[c1] + m_GridCnt[c1];
+					RangeIdx r = { j0 };
+					forceSum ( sp, (int) i, r, j1 - j0, k, f );
+				}
+			pforce[ sp.ndx[i] ] = f;
+		}
+	} );
+}
+
+// Refreshes the sorted copy from the particle buffers and rebuilds the Verlet lists only
+// if some particle has moved more than half the skin since they were built.
+void FluidSystem::UpdateVerletLists ()
+{
+	SortedParticles& sp = m_Sorted;
+	VerletLists& vl = m_Verlet;
+
+	if ( !vl.off.empty() ) {
+		Vector3DF* ppos =		m_Fluid.bufV3(FPOS);
+		Vector3DF* pveleval =	m_Fluid.bufV3(FVEVAL);
+		float half = 0.5f * m_Param[PVERLET_SKIN] * m_Param[PSMOOTHRADIUS] / m_Param[PSIMSCALE];	// world units
+		int nth = getNumThreads ();
+		std::vector<float> maxd ( nth, 0 );
+		ParallelChunks ( sp.ndx.size(), nth, [&]( int t, uint64 s, uint64 e ) {
+			float m = 0;
+			for (uint64 i = s; i < e; i++) {
+				uint n = sp.ndx[i];
+				sp.px[i] = ppos[n].x;		sp.py[i] = ppos[n].y;		sp.pz[i] = ppos[n].z;
+				sp.vx[i] = pveleval[n].x;	sp.vy[i] = pveleval[n].y;	sp.vz[i] = pveleval[n].z;
+				float dx = sp.px[i] - vl.rx[i], dy = sp.py[i] - vl.ry[i], dz = sp.pz[i] - vl.rz[i];
+				m = std::max ( m, dx*dx + dy*dy + dz*dz );
+			}
+			maxd[t] = m;
+		} );
+		if ( *std::max_element ( maxd.begin(), maxd.end() ) <= half*half ) {
+			m_Param[ PSTAT_VERLET ] += 1.0f;
+			return;
+		}
+	}
+	InsertParticlesSoA ();
+	BuildVerletLists ();
+	m_Param[ PSTAT_VERLET ] = 0;
+}
+
+// Appends the sorted particles of [j0, j1) within the cutoff of (ix,iy,iz) at `o`. Returns the new end.
+static uint* appendNeighbors ( const FluidSystem::SortedParticles& sp, uint j0, uint j1, float ix, float iy, float iz, float d2, float cut2, uint* o )
+{
+	uint j = j0;
+#ifdef FLUID_SSE
+	__m128 vix = _mm_set1_ps ( ix ), viy = _mm_set1_ps ( iy ), viz = _mm_set1_ps ( iz );
+	__m128 vd2 = _mm_set1_ps ( d2 ), vc2 = _mm_set1_ps ( cut2 );
+	for (; j+4 <= j1; j += 4) {
+		__m128 dx = _mm_sub_ps ( _mm_loadu_ps ( &sp.px[j] ), vix );
+		__m128 dy = _mm_sub_ps ( _mm_loadu_ps ( &sp.py[j] ), viy );
+		__m128 dz = _mm_sub_ps ( _mm_loadu_ps ( &sp.pz[j] ), viz );
+		__m128 dsq = _mm_mul_ps ( vd2, _mm_add_ps ( _mm_add_ps ( _mm_mul_ps ( dx, dx ), _mm_mul_ps ( dy, dy ) ), _mm_mul_ps ( dz, dz ) ) );
+		int m = _mm_movemask_ps ( _mm_cmple_ps ( dsq, vc2 ) );
+		o[0] = j;		o += m & 1;						// branchless compaction
+		o[0] = j+1;		o += (m >> 1) & 1;
+		o[0] = j+2;		o += (m >> 2) & 1;
+		o[0] = j+3;		o += (m >> 3) & 1;
+	}
+#endif
+	for (; j < j1; j++) {
+		float dx = sp.px[j] - ix, dy = sp.py[j] - iy, dz = sp.pz[j] - iz;
+		o[0] = j;
+		o += ( d2*(dx*dx + dy*dy + dz*dz) <= cut2 );
+	}
+	return o;
+}
+
+void FluidSystem::BuildVerletLists ()
+{
+	SortedParticles& sp = m_Sorted;
+	VerletLists& vl = m_Verlet;
+	uint64 total = sp.ndx.size();
+	float d2 = m_Param[PSIMSCALE] * m_Param[PSIMSCALE];
+	float reach = m_Param[PSMOOTHRADIUS] * ( 1.0f + m_Param[PVERLET_SKIN] );
+	float cut2 = reach * reach;
+	reach /= m_Param[PSIMSCALE];						// world units
+	uint* m_GridCnt = m_Fluid.bufI(FGRIDCNT);
+	uint* m_GridOff = m_Fluid.bufI(FGRIDOFF);
+
+	vl.rx = sp.px;	vl.ry = sp.py;	vl.rz = sp.pz;
+	vl.off.resize ( total + 1 );
+
+	// Lists per chunk with chunk-relative offsets, then concatenated in chunk order
+	int nth = getNumThreads ();
+	std::vector< std::vector<uint> > lists ( nth );
+	std::vector<uint64> first ( nth, 0 ), last ( nth, 0 );
+	ParallelChunks ( total, nth, [&]( int t, uint64 s, uint64 e ) {
+		std::vector<uint>& out = lists[t];
+		size_t cnt = 0;
+		first[t] = s;
+		last[t] = e;
+		for (uint64 i = s; i < e; i++) {
+			vl.off[i] = (uint) cnt;
+			float ix = sp.px[i], iy = sp.py[i], iz = sp.pz[i];
+			// Cells overlapping the cutoff box around i
+			int x0 = std::max ( int( (ix - reach - m_GridMin.x) * m_GridDelta.x ), 0 ), x1 = std::min ( int( (ix + reach - m_GridMin.x) * m_GridDelta.x ), m_GridRes.x - 1 );
+			int y0 = std::max ( int( (iy - reach - m_GridMin.y) * m_GridDelta.y ), 0 ), y1 = std::min ( int( (iy + reach - m_GridMin.y) * m_GridDelta.y ), m_GridRes.y - 1 );
+			int z0 = std::max ( int( (iz - reach - m_GridMin.z) * m_GridDelta.z ), 0 ), z1 = std::min ( int( (iz + reach - m_GridMin.z) * m_GridDelta.z ), m_GridRes.z - 1 );
+			for (int y = y0; y <= y1; y++)
+				for (int z = z0; z <= z1; z++) {
+					int c0 = (y*m_GridRes.z + z)*m_GridRes.x + x0;
+					int c1 = c0 + (x1 - x0);
+					uint j0 = m_GridOff[c0], j1 = m_GridOff[c1] + m_GridCnt[c1];
+					if ( cnt + (j1 - j0) > out.size() ) out.resize ( std::max ( out.size() * 2, cnt + (j1 - j0) ) );
+					uint* o = out.data() + cnt;
+					if ( i >= j0 && i < j1 ) {					// skip self
+						o = appendNeighbors ( sp, j0, (uint) i, ix, iy, iz, d2, cut2, o );
+						o = appendNeighbors ( sp, (uint) i+1, j1, ix, iy, iz, d2, cut2, o );
+					} else {
+						o = appendNeighbors ( sp, j0, j1, ix, iy, iz, d2, cut2, o );
+					}
+					cnt = o - out.data();
+				}
+		}
+		out.resize ( cnt );
+	} );
+
+	uint base = 0;
+	for (int t = 0; t < nth; t++) {
+		for (uint64 i = first[t]; i < last[t]; i++) vl.off[i] += base;
+		base += (uint) lists[t].size();
+	}
+	vl.off[total] = base;
+	vl.nbr.resize ( base );
+	for (int t = 0; t < nth; t++)
+		if ( !lists[t].empty() ) memcpy ( &vl.nbr[ vl.off[ first[t] ] ], lists[t].data(), lists[t].size()*sizeof(uint) );
+}
+
+void FluidSystem::ComputePressureVerlet ()
+{
+	SortedParticles& sp = m_Sorted;
+	VerletLists& vl = m_Verlet;
+	float d2 = m_Param[PSIMSCALE] * m_Param[PSIMSCALE];
+	float r2 = m_R2;
+	float mass = m_Param[PMASS], rest = m_Param[PRESTDENSITY], stiff = m_Param[PINTSTIFF];
+	float* ppress = m_Fluid.bufF(FPRESS);
+	float* pdensity = m_Fluid.bufF(FDENSITY);
+
+	int nth = getNumThreads ();
+	std::vector<double> nbrs ( nth, 0 );
+	ParallelChunks ( sp.ndx.size(), nth, [&]( int t, uint64 s, uint64 e ) {
+		double nbr = 0;
+		for (uint64 i = s; i < e; i++) {
+			int cnt = 0;
+			ListIdx l = { vl.nbr.data() + vl.off[i] };
+			float sum = densitySum ( sp.px.data(), sp.py.data(), sp.pz.data(), l, vl.off[i+1] - vl.off[i], sp.px[i], sp.py[i], sp.pz[i], d2, r2, cnt );
+			nbr += cnt;
+			float dens = sum * mass * m_Poly6Kern;
+			float press = ( dens - rest ) * stiff;
+			sp.press[i] = press;
+			sp.dens[i] = 1.0f / dens;
+			ppress[ sp.ndx[i] ] = press;
+			pdensity[ sp.ndx[i] ] = sp.dens[i];
+		}
+		nbrs[t] = nbr;
+	} );
+
+	// Stats: search count is the list size
+	double nbr = 0;
+	for (int t = 0; t < nth; t++) nbr += nbrs[t];
+	m_Param [ PSTAT_NBR ] = float(nbr);
+	m_Param [ PSTAT_SRCH ] = float(vl.nbr.size());
+	if ( m_Param[PSTAT_NBR] > m_Param [ PSTAT_NBRMAX ] ) m_Param [ PSTAT_NBRMAX ] = m_Param[PSTAT_NBR];
+	if ( m_Param[PSTAT_SRCH] > m_Param [ PSTAT_SRCHMAX ] ) m_Param [ PSTAT_SRCHMAX ] = m_Param[PSTAT_SRCH];
+}
+
+void FluidSystem::ComputeForceVerlet ()
+{
+	SortedParticles& sp = m_Sorted;
+	VerletLists& vl = m_Verlet;
+	ForceTerms k;
+	k.d2 = m_Param[PSIMSCALE] * m_Param[PSIMSCALE];
+	k.r2 = m_R2;
+	k.mR = m_Param[PSMOOTHRADIUS];
+	k.pk = m_Param[PSIMSCALE] * -0.5f * m_SpikyKern;
+	k.vterm = m_LapKern * m_Param[PVISC];
+	Vector3DF* pforce = m_Fluid.bufV3(FFORCE);
+
+	ParallelChunks ( sp.ndx.size(), 0, [&]( int, uint64 s, uint64 e ) {
+		for (uint64 i = s; i < e; i++) {
+			Vector3DF f ( 0, 0, 0 );
+			ListIdx l = { vl.nbr.data() + vl.off[i] };
+			forceSum ( sp, (int) i, l, vl.off[i+1] - vl.off[i], k, f );
+			pforce[ sp.ndx[i] ] = f;
+		}
+	} );
+}
+
 void FluidSystem::SetupRender ()
 {
 	glEnable ( GL_TEXTURE_2D );
@@ -1748,46 +2208,23 @@ void FluidSystem::Draw ( int frame, Camera3D& cam, float rad )
 void FluidSystem::StartRecord ()
 {
 	mbRecord = !mbRecord;	
+	if ( !mbRecord ) mSeqOut.Close ();
 }
 void FluidSystem::StartRecordBricks ()
 {
 	mbRecordBricks = !mbRecordBricks;
 }
 
+// Appends the frame to the recorded sequence jet.pseq, see point_sequence.h
 void FluidSystem::SavePoints ( int frame )
 {
-	char buf[256];
-	sprintf ( buf, "jet%04d.pts", frame );
-	FILE* fp = fopen ( buf, "wb" );
-
-	int numpnt = NumPoints();
-	int numfield = 3;
-	int ftype;		// 0=char, 1=int, 2=float, 3=double
-	int fcnt;
-	fwrite ( &numpnt, sizeof(int), 1, fp );
-	fwrite ( &numfield, sizeof(int), 1, fp );
-				
-	// write positions
-	ftype = 2; fcnt = 3;		// float, 3 channel
-	fwrite ( &ftype, sizeof(int), 1, fp );		
-	fwrite ( &fcnt,  sizeof(int), 1, fp );	
-	fwrite ( m_Fluid.bufC(FPOS),  numpnt*sizeof(Vector3DF), 1, fp );
-
-	// write velocities
-	ftype = 2; fcnt = 3;		// float, 3 channel
-	fwrite ( &ftype, sizeof(int), 1, fp );		
-	fwrite ( &fcnt,  sizeof(int), 1, fp );	
-	fwrite ( m_Fluid.bufC(FVEL),  numpnt*sizeof(Vector3DF), 1, fp );
-
-	// write colors
-	ftype = 0; fcnt = 4;		// char, 4 channel
-	fwrite ( &ftype, sizeof(int), 1, fp );		
-	fwrite ( &fcnt,  sizeof(int), 1, fp );	
-	fwrite ( m_Fluid.bufC(FCLR),  numpnt*sizeof(unsigned char)*4, 1, fp );
-
-	fclose ( fp );
-
-	fflush ( fp );
+	if ( !mSeqOut.isOpen() ) {
+		if ( !mSeqOut.Open ( "jet.pseq", m_Vec[PVOLMIN], m_Vec[PVOLMAX], m_Param[PVEL_LIMIT] ) ) {
+			mbRecord = false;
+			return;
+		}
+	}
+	mSeqOut.Write ( frame, NumPoints(), m_Fluid.bufV3(FPOS), m_Fluid.bufV3(FVEL), m_Fluid.bufI(FCLR) );
 }
 
 float FluidSystem::Sample ( Vector3DF p )
@@ -1841,161 +2278,131 @@ float FluidSystem::Sample ( Vector3DF p )
 }
 
 
-void FluidSystem::SaveBricks ( int frame )
+// Particle density straight into GVDB. Leaves are activated only within the smoothing radius
+// of some particle; each leaf then splats the Gaussian kernel of Sample from the particles in
+// the grid cells it overlaps. Voxel v is centered at volmin + (v+0.5)*voxelsize.
+int FluidSystem::SurfaceGVDB ( VolumeGVDB* gvdb, uchar chan, float voxelsize )
 {
-	char buf[256];
-
-	// Needed if we eval on CPU
-	/*InsertParticles ();								// make sure paricles are binned
-	ComputePressureGrid ();							// make sure we have density */
-
-	// Needed if we eval on GPU	
-	TransferToCUDA ();
-	InsertParticlesCUDA ( 0x0, 0x0, 0x0 );			// make sure particles are binned
-	PrefixSumCellsCUDA ( 0x0, 1 );
-	CountingSortFullCUDA ( 0x0 );	
-	ComputePressureCUDA();							// make sure we have density
-	
-	Vector3DF volmin, volmax, p;
-	volmin = m_Vec[PVOLMIN];
-	volmax = m_Vec[PVOLMAX];
-
-	//Vector3DI res ( 2048, 768, 1024 );	
-	Vector3DI res = m_VolRes;
-
-	Vector3DI brk ( m_BrkRes, m_BrkRes, m_BrkRes );
-	Vector3DI resdiv ( res.x/brk.x, res.y/brk.y, res.z/brk.z );
-	Vector3DI b;
-	Vector3DF bmin, bmax;
-	float chksum;
-
-	// Brick memory storage
-	float* vdata = (float*) malloc ( brk.x*brk.y*brk.z* sizeof(float) );
-	float* vchk  = (float*) malloc ( 2*2*2* sizeof(float) );	
-	Vector3DI chkres ( 2, 2, 2 );
-
-	int brkmax = resdiv.x*resdiv.y*resdiv.z;		// maximum possible bricks
-	int brkcnt = 0;									// number accepted
-
-	// Open brick file to write
-	sprintf ( buf, "%s", getResolvedName ( false, m_Frame).c_str() );	// output filename	
-	FILE* fp = fopen ( buf, "wb" );
-	if ( fp == 0x0 ) {
-		nvprintf ( "ERROR: Creating %s\n. Folder may not exist.", buf );
-		exit (-1);
+	if ( gvdb->mPool->getAtlas(chan).type != T_FLOAT ) {
+		nvprintf ( "ERROR: SurfaceGVDB requires a T_FLOAT channel.\n" );
+		return 0;
 	}
-	
-	fwrite ( &brkcnt, sizeof(int), 1, fp );			// number of bricks (not known yet)
-
-	Vector3DF bkmin, bkmax;
-	bkmin.Set ( 1e20f, 1e20f, 1e20f );
-	bkmax.Set (-1e20f, -1e20f,-1e20f );
-
-	// Scan volume domain
-	for (b.y=0; b.y < resdiv.y; b.y++ ) {
-		for (b.z=0; b.z < resdiv.z; b.z++ ) {
-			for (b.x=0; b.x < resdiv.x; b.x++ ) {				
-
-				// Bounding box of brick
-				bmin = (volmax-volmin) * Vector3DF(b*brk); bmin /= res; bmin += volmin;
-				bmax = (volmax-volmin) * Vector3DF((b+Vector3DI(1,1,1))*brk); bmax /= res; bmax += volmin;
-				if ( bmin.x < bkmin.x ) bkmin.x = bmin.x;
-				if ( bmin.y < bkmin.y ) bkmin.y = bmin.y;
-				if ( bmin.z < bkmin.z ) bkmin.z = bmin.z;
-				if ( bmax.x > bkmax.x ) bkmax.x = bmax.x;
-				if ( bmax.y > bkmax.y ) bkmax.y = bmax.y;
-				if ( bmax.z > bkmax.z ) bkmax.z = bmax.z;
-				
-				// Sample corners
-				SampleParticlesCUDA ( (float*) vchk, *(uint3*)& chkres, *(float3*)& bmin, *(float3*)& bmax, 1.0f/100.0f );
-
-				/*chk[0] = Sample ( Vector3DF(bmin.x,bmin.y,bmin.z) );
-				chk[1] = Sample ( Vector3DF(bmax.x,bmin.y,bmin.z) );
-				chk[2] = Sample ( Vector3DF(bmax.x,bmax.y,bmin.z) );
-				chk[3] = Sample ( Vector3DF(bmin.x,bmax.y,bmin.z) );
-				chk[4] = Sample ( Vector3DF(bmin.x,bmin.y,bmax.z) );
-				chk[5] = Sample ( Vector3DF(bmax.x,bmin.y,bmax.z) );
-				chk[6] = Sample ( Vector3DF(bmax.x,bmax.y,bmax.z) );
-				chk[7] = Sample ( Vector3DF(bmin.x,bmax.y,bmax.z) );*/
-
-				chksum = 0;				
-				for (int ck=0; ck<8; ck++)
-					chksum += vchk[ck];
-				chksum /= 8.0;
-
-				if ( chksum > m_Thresh ) {
-					// Accept this brick						
-					// 1.0/1500000000.0 
-					SampleParticlesCUDA ( (float*) vdata, *(uint3*)& brk, *(float3*)& bmin, *(float3*)& bmax, 1.0f/100.0f );
-					brkcnt++;
-
-					// Write brick dimensions				
-					Vector3DI bndx = b * brk;
-					fwrite ( &bndx, sizeof(Vector3DI), 1, fp );
-					fwrite ( &bmin, sizeof(Vector3DF), 1, fp );
-					fwrite ( &bmax, sizeof(Vector3DF), 1, fp );
-					fwrite ( &brk,  sizeof(Vector3DI), 1, fp );
-				
-					// Write brick data
-					fwrite ( vdata, sizeof(float), brk.x*brk.y*brk.z, fp );
-
-					//-- debug, write to png
-					/*float vmin = +1.0e20, vmax = -1.0e20;
-					pix = img.getData();
-					for (int py=0; py < brk.z * zd; py++ ) {
-						for (int px = 0; px < brk.x * zd; px++ ) {
-							vx = px % brk.x;
-							vy = py % brk.y; 
-							vz = (px/brk.x)*zd + int(py/brk.y);
-							v = vdata[ (vz*int(brk.z)+vy)*int(brk.x) + vx ];
-							*pix++ = uchar(v*255.0); *pix++ = uchar(v*255.0); *pix++ = uchar(v*255.0); *pix++ = 255;
+	if ( getMode() == RUN_GPU_FULL ) TransferFromCUDA ();
+	InsertParticlesSoA ();									// bin particles, sorted by cell
+
+	SortedParticles& sp = m_Sorted;
+	int num = (int) sp.px.size();
+	int bw = gvdb->getRes(0);
+	Vector3DF vmin = m_Vec[PVOLMIN];
+	float rw = m_Param[PSMOOTHRADIUS] / m_Param[PSIMSCALE];	// kernel radius, world units
+	float rv = rw / voxelsize;								// kernel radius, voxels
+
+	// Leaves touched by each particle, keyed 21 bits per axis
+	int chunks = getNumThreads ();
+	std::vector< std::vector<uint64> > keys ( chunks );
+	ParallelChunks ( num, chunks, [&]( int c, uint64 s, uint64 e ) {
+		std::vector<uint64>& k = keys[c];
+		for (uint64 n = s; n < e; n++) {
+			Vector3DF q ( (sp.px[n] - vmin.x) / voxelsize, (sp.py[n] - vmin.y) / voxelsize, (sp.pz[n] - vmin.z) / voxelsize );
+			Vector3DI b0, b1, b;
+			b0.x = std::max ( 0, int( floor ( (q.x - rv) / bw ) ) );	b1.x = int( floor ( (q.x + rv) / bw ) );
+			b0.y = std::max ( 0, int( floor ( (q.y - rv) / bw ) ) );	b1.y = int( floor ( (q.y + rv) / bw ) );
+			b0.z = std::max ( 0, int( floor ( (q.z - rv) / bw ) ) );	b1.z = int( floor ( (q.z + rv) / bw ) );
+			for (b.z = b0.z; b.z <= b1.z; b.z++)
+				for (b.y = b0.y; b.y <= b1.y; b.y++)
+					for (b.x = b0.x; b.x <= b1.x; b.x++)
+						k.push_back ( (uint64(b.z) << 42) | (uint64(b.y) << 21) | uint64(b.x) );
+		}
+		std::sort ( k.begin(), k.end() );
+		k.erase ( std::unique ( k.begin(), k.end() ), k.end() );
+	} );
+	std::vector<uint64> all;
+	for (int c = 0; c < chunks; c++) all.insert ( all.end(), keys[c].begin(), keys[c].end() );
+	std::sort ( all.begin(), all.end() );
+	all.erase ( std::unique ( all.begin(), all.end() ), all.end() );
+
+	std::vector<Vector3DI> bricks ( all.size() );
+	uint64 mask = (uint64(1) << 21) - 1;
+	for (size_t n = 0; n < all.size(); n++)
+		bricks[n].Set ( int( all[n] & mask ) * bw, int( (all[n] >> 21) & mask ) * bw, int( all[n] >> 42 ) * bw );
+
+	gvdb->Clear ();
+	gvdb->SetTransform ( Vector3DF(0,0,0), Vector3DF(voxelsize, voxelsize, voxelsize), Vector3DF(0,0,0), vmin );
+	int cnt = (int) ActivateBricks ( gvdb, bricks );
+
+	// Splat, as in Sample
+	float d2 = m_Param[PSIMSCALE]*m_Param[PSIMSCALE];
+	float mR = m_Param[PSMOOTHRADIUS];
+	float h2 = 2.0f*mR*mR / 16.0f;
+	float kern = 1.0f / pow ( 3.141592f * 2.0f*mR*mR, 3.0f/2.0f ) / 100.0f;
+	uint* m_GridCnt = m_Fluid.bufI(FGRIDCNT);
+	uint* m_GridOff = m_Fluid.bufI(FGRIDOFF);
+
+	FillBricks ( gvdb, chan, 0.0f, [&]( Node* node, float* dst ) {
+		Vector3DF lo ( vmin.x + (node->mPos.x + 0.5f)*voxelsize, vmin.y + (node->mPos.y + 0.5f)*voxelsize, vmin.z + (node->mPos.z + 0.5f)*voxelsize );
+		Vector3DF hi = lo + Vector3DF( float(bw-1), float(bw-1), float(bw-1) ) * voxelsize;
+		Vector3DI c0, c1, gc;
+		c0.x = std::max ( 0, int( (lo.x - rw - m_GridMin.x) * m_GridDelta.x ) );	c1.x = std::min ( m_GridRes.x-1, int( (hi.x + rw - m_GridMin.x) * m_GridDelta.x ) );
+		c0.y = std::max ( 0, int( (lo.y - rw - m_GridMin.y) * m_GridDelta.y ) );	c1.y = std::min ( m_GridRes.y-1, int( (hi.y + rw - m_GridMin.y) * m_GridDelta.y ) );
+		c0.z = std::max ( 0, int( (lo.z - rw - m_GridMin.z) * m_GridDelta.z ) );	c1.z = std::min ( m_GridRes.z-1, int( (hi.z + rw - m_GridMin.z) * m_GridDelta.z ) );
+
+		for (gc.y = c0.y; gc.y <= c1.y; gc.y++)
+		for (gc.z = c0.z; gc.z <= c1.z; gc.z++)
+		for (gc.x = c0.x; gc.x <= c1.x; gc.x++) {
+			int c = (gc.y*m_GridRes.z + gc.z)*m_GridRes.x + gc.x;
+			for (uint j = m_GridOff[c]; j < m_GridOff[c] + m_GridCnt[c]; j++) {
+				// Voxels of this leaf within the kernel radius of particle j
+				float qx = (sp.px[j] - lo.x) / voxelsize, qy = (sp.py[j] - lo.y) / voxelsize, qz = (sp.pz[j] - lo.z) / voxelsize;
+				int x0 = std::max ( 0, int( ceil ( qx - rv ) ) ), x1 = std::min ( bw-1, int( floor ( qx + rv ) ) );
+				int y0 = std::max ( 0, int( ceil ( qy - rv ) ) ), y1 = std::min ( bw-1, int( floor ( qy + rv ) ) );
+				int z0 = std::max ( 0, int( ceil ( qz - rv ) ) ), z1 = std::min ( bw-1, int( floor ( qz + rv ) ) );
+				for (int z = z0; z <= z1; z++) {
+					float dz = (lo.z + z*voxelsize) - sp.pz[j];
+					for (int y = y0; y <= y1; y++) {
+						float dy = (lo.y + y*voxelsize) - sp.py[j];
+						float* row = dst + (z*bw + y)*bw;
+						for (int x = x0; x <= x1; x++) {
+							float dx = (lo.x + x*voxelsize) - sp.px[j];
+							float dsq = d2*(dx*dx + dy*dy + dz*dz);
+							if ( dsq <= m_R2 ) row[x] += kern * exp ( -dsq / h2 );
 						}
 					}
-					img.SavePng ( "test.png" );*/
 				}
 			}
 		}
-	}
-
-	// write number of bricks
-	fseek ( fp, 0, SEEK_SET );
-	fwrite ( &brkcnt, sizeof(int), 1, fp );
-
-	/*nvprintf ( "Bricks: %d of %d\n", brkcnt, brkmax );
-	nvprintf ( "Brick min: %f,%f,%f (vmin %f,%f,%f)\n", bkmin.x, bkmin.y, bkmin.z, volmin.x, volmin.y, volmin.z);
-	nvprintf ( "Brick max: %f,%f,%f (vmax %f,%f,%f)\n", bkmax.x, bkmax.y, bkmax.z, volmax.x, volmax.y, volmax.z);*/
-
-	free ( vdata );
-
-	fclose ( fp );
-
-	fflush ( fp );
+	} );
+	return cnt;
+}
 
+void FluidSystem::SetSurfaceVolume ( VolumeGVDB* gvdb )
+{
+	if ( mSurfaceOwned ) delete mSurfaceGVDB;
+	mSurfaceGVDB = gvdb;
+	mSurfaceOwned = false;
+}
 
-	//--- generate slice
-	/*Vector3DI res ( 4096, 1, 2048 );		
-	nvImg img;
-	img.Create ( res.x, res.z, IMG_RGBA );
-	uchar* pix = img.getData();
-	Vector3DF* vdata = (Vector3DF*) malloc ( res.x*res.y*res.z* sizeof(float)*3 );
-	
-	SampleParticlesCUDA ( (float3*) vdata, *(uint3*)& res, *(float3*)& volmin, *(float3*)& volmax );
-
-	float vmin = +1.0e20, vmax = -1.0e20;
-	for (int y=0; y < res.z; y++ ) {
-		for (int x = 0; x < res.x; x++ ) {
-			// p = volmin + Vector3DF(x/float(xres), 0.05, y/float(yres)) * (volmax-volmin);
-			// v = Sample ( p ).Length() / 1500000000.0;    // -- CPU Sampling
-
-			v = vdata[ y*int(res.x) + x ].Length() / 1500000000.0;
-			if ( v < vmin ) vmin = v;
-			if ( v > vmax ) vmax = v;
-			*pix++ = uchar(v*255.0); *pix++ = uchar(v*255.0); *pix++ = uchar(v*255.0); *pix++ = 255;
-		}
+// Writes the particle density as a VBX, through the volume given to SetSurfaceVolume.
+// Without one, a volume with 8^3 bricks is created on the current CUDA context at the first
+// recorded frame. Voxel size follows the requested volume resolution; brick size is the
+// volume's leaf size.
+void FluidSystem::SaveBricks ( int frame )
+{
+	if ( mSurfaceGVDB == 0x0 ) {
+		mSurfaceGVDB = new VolumeGVDB;
+		mSurfaceOwned = true;
+		mSurfaceGVDB->SetVerbose ( mbDebug );
+		mSurfaceGVDB->SetCudaDevice ( GVDB_DEV_CURRENT );
+		mSurfaceGVDB->Initialize ();
+		mSurfaceGVDB->Configure ( 3, 3, 3, 3, 3 );
+		mSurfaceGVDB->AddChannel ( 0, T_FLOAT, 1 );
 	}
-	nvprintf ( "Range: %f %f\n", vmin, vmax );
-	free ( vdata );
-	img.SavePng ( "test.png" );	*/
+	Vector3DF volmin = m_Vec[PVOLMIN];
+	Vector3DF volmax = m_Vec[PVOLMAX];
+	float voxelsize = (volmax.x - volmin.x) / m_VolRes.x;
+
+	int cnt = SurfaceGVDB ( mSurfaceGVDB, 0, voxelsize );
+	mSurfaceGVDB->SaveVBX ( getResolvedName ( false, m_Frame ) );
+	if ( mbDebug ) nvprintf ( "Bricks: %d\n", cnt );
 }
 
 void FluidSystem::StartPlayback ()
@@ -2031,60 +2438,66 @@ std::string FluidSystem::getResolvedName ( bool bIn, int frame )
 	return datastr;
 }
 
+// Plays a recorded sequence (.pseq), decoded ahead on a background thread, or
+// one .pts file per frame.
 void FluidSystem::RunPlayback ()
 {	
-	char buf[1024];
-	sprintf ( buf, "%s", getResolvedName ( true, m_Frame).c_str() );	// input filename
-	
+	std::string name = getResolvedName ( true, m_Frame );
+	const PointSeqReader::Frame* seq = 0x0;
+	FILE* fp = 0x0;
+	int numpnt = 0;
 
-	FILE* fp = fopen ( buf, "rb" );
-	if ( fp == 0x0 ) {
-		nvprintf ( "WARNING: File not found %s\n", buf );
-		return;
+	if ( name.size() > 5 && name.compare ( name.size()-5, 5, ".pseq" ) == 0 ) {
+		if ( !mSeqIn.isOpen() && !mSeqIn.Open ( name ) ) return;
+		seq = mSeqIn.Acquire ( m_Frame );
+		if ( seq == 0x0 ) {
+			nvprintf ( "WARNING: Frame %d not in %s\n", m_Frame, name.c_str() );
+			return;
+		}
+		numpnt = seq->num;
+	} else {
+		fp = fopen ( name.c_str(), "rb" );
+		if ( fp == 0x0 ) {
+			nvprintf ( "WARNING: File not found %s\n", name.c_str() );
+			return;
+		}
+		int numfield;
+		fread ( &numpnt, sizeof(int), 1, fp );
+		fread ( &numfield, sizeof(int), 1, fp );
 	}
-
-	int numpnt = 0;
-	int numfield = 2;
-	int ftype;		// 0=char, 1=int, 2=float, 3=double
-	int fcnt;
-	fread ( &numpnt, sizeof(int), 1, fp );
-	fread ( &numfield, sizeof(int), 1, fp );
 	mNumPoints = numpnt;
 	
-	
 	if ( mNumPoints > mMaxPoints ) {
 		// Quick setup		
 		m_Param [PNUM] = (float) mNumPoints;
 		AllocateParticles ( mNumPoints );
 		FluidSetupCUDA ( NumPoints(), m_GridSrch, *(int3*)& m_GridRes, *(float3*)& m_GridSize, *(float3*)& m_GridDelta, *(float3*)& m_GridMin, *(float3*)& m_GridMax, m_GridTotal, (int) m_Vec[PEMIT_RATE].x );		
 	}	
-				
-	// read positions	
+
+	if ( seq != 0x0 ) {
+		if ( numpnt > 0 ) {
+			memcpy ( m_Fluid.bufC(FPOS), &seq->pos[0], numpnt*sizeof(Vector3DF) );
+			memcpy ( m_Fluid.bufC(FVEL), &seq->vel[0], numpnt*sizeof(Vector3DF) );
+			memcpy ( m_Fluid.bufC(FCLR), &seq->clr[0], numpnt*sizeof(uint) );
+		}
+		return;
+	}
+
+	// Each field: type (0=char, 1=int, 2=float, 3=double), channel count, data
+	int ftype, fcnt;
 	fread ( &ftype, sizeof(int), 1, fp );		
 	fread ( &fcnt,  sizeof(int), 1, fp );	
 	fread ( m_Fluid.bufC(FPOS),  numpnt*sizeof(Vector3DF), 1, fp );
 	
-	// read velocities	
 	fread ( &ftype, sizeof(int), 1, fp );		
 	fread ( &fcnt,  sizeof(int), 1, fp );	
 	fread ( m_Fluid.bufC(FVEL),  numpnt*sizeof(Vector3DF), 1, fp );
-	Vector3DF s;
-	s.Set(0,0,0);
-	for (int n=0; n < numpnt; n++ ) {
-		s += m_Fluid.bufV3(FVEL)[n];
-	}
-	if ( s.Length()==0 ) {
-		nvprintf ( "NO VEL DATA.\n" );
 
-	}
-
-	// read colors	
 	fread ( &ftype, sizeof(int), 1, fp );		
 	fread ( &fcnt,  sizeof(int), 1, fp );	
 	fread ( m_Fluid.bufI(FCLR),  numpnt*sizeof(unsigned char)*4, 1, fp );
 
 	fclose ( fp );
-
 }
 
 
@@ -2098,6 +2511,8 @@ std::string FluidSystem::getModeStr ()
 	case RUN_VALIDATE:		sprintf ( buf, "VALIDATE GPU to CPU");		break;
 	case RUN_CPU_SLOW:		sprintf ( buf, "SIMULATE CPU Slow");		break;
 	case RUN_CPU_GRID:		sprintf ( buf, "SIMULATE CPU Grid");		break;	
+	case RUN_CPU_PARALLEL:	sprintf ( buf, "SIMULATE CPU Parallel");	break;
+	case RUN_CPU_VERLET:	sprintf ( buf, "SIMULATE CPU Verlet");		break;
 	case RUN_GPU_FULL:		sprintf ( buf, "SIMULATE CUDA Full Sort" );	break;	
 	case RUN_PLAYBACK:		sprintf ( buf, "PLAYBACK" ); break;
 	};
@@ -2255,6 +2670,7 @@ void FluidSystem::SetupDefaultParams ()
 	m_Param [ PFORCE_MIN ] =	0.0f;
 	m_Param [ PFORCE_MAX ] =	0.0f;
 	m_Param [ PFORCE_FREQ ] =	16.0f;
+	m_Param [ PVERLET_SKIN ] =	0.2f;			// fraction of smoothing radius
 	m_Toggle [ PWRAP_X ] = false;
 	m_Toggle [ PWALL_BARRIER ] = false;
 	m_Toggle [ PLEVY_BARRIER ] = false;
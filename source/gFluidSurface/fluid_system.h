@@ -19,6 +19,8 @@
 	#include "fluid.h"
 	#include "gvdb_vec.h"
 	#include "gvdb_camera.h"
+	#include "point_sequence.h"
+	namespace nvdb { class VolumeGVDB; }
 	using namespace nvdb;
 
 	#define MAX_PARAM			50
@@ -38,6 +40,8 @@
 	#define RUN_CPU_GRID		4	
 	#define RUN_GPU_FULL		5
 	#define RUN_PLAYBACK		6
+	#define RUN_CPU_PARALLEL	7		// CPU multithreaded, counting-sorted SoA
+	#define RUN_CPU_VERLET		8		// CPU multithreaded, cached Verlet neighbor lists
 
 	// Scalar params
 	#define PMODE				0
@@ -88,6 +92,8 @@
 	#define PTIME_TOGPU			45
 	#define PTIME_FROMGPU		46
 	#define PFORCE_FREQ			47	
+	#define PVERLET_SKIN		48		// Verlet list skin, fraction of smoothing radius
+	#define PSTAT_VERLET		49		// steps the current Verlet lists have been reused
 
 	// Vector params
 	#define PVOLMIN				0
@@ -246,6 +252,32 @@
 		void ComputeForceGrid ();				// O(kn) - spatial grid
 		void ComputeForceGridNC ();				// O(cn) - neighbor table		
 
+		// Parallel CPU solver. Particles are counting-sorted by grid cell each step (as in
+		// CountingSortFullCUDA) into SoA arrays, so the cells of each search row are one
+		// contiguous range. Results are written back in the original particle order.
+		void InsertParticlesSoA ();
+		void ComputePressureSoA ();
+		void ComputeForceSoA ();
+		struct SortedParticles {
+			std::vector<float>	px, py, pz;				// position
+			std::vector<float>	vx, vy, vz;				// eval velocity
+			std::vector<float>	press, dens;			// pressure, inverse density
+			std::vector<uint>	ndx;					// source particle
+		};
+
+		// Verlet neighbor lists on the sorted particles, with cutoff smoothing radius + skin.
+		// Shared by the density and force passes and reused across steps (without re-sorting)
+		// until some particle has moved more than half the skin.
+		void UpdateVerletLists ();
+		void BuildVerletLists ();
+		void ComputePressureVerlet ();
+		void ComputeForceVerlet ();
+		struct VerletLists {
+			std::vector<uint>	off;					// neighbors of sorted i are nbr[ off[i] .. off[i+1] )
+			std::vector<uint>	nbr;					// sorted indices, self excluded
+			std::vector<float>	rx, ry, rz;				// positions at build
+		};
+
 		void FluidSetupCUDA (  int num, int gsrch, int3 res, float3 size, float3 delta, float3 gmin, float3 gmax, int total, int chk );
 		void FluidParamCUDA ( float ss, float sr, float pr, float mass, float rest, float3 bmin, float3 bmax, float estiff, float istiff, float visc, float damp, float fmin, float fmax, float ffreq, float gslope, float gx, float gy, float gz, float al, float vl, int emit );
 
@@ -272,6 +304,11 @@
 		void StartPlayback ();
 		void SavePoints ( int frame );
 		void SaveBricks ( int frame );
+		void SetSurfaceVolume ( VolumeGVDB* gvdb );	// volume for SaveBricks; if none is set, FluidSystem creates its own
+
+		// Surfacing: particle density into float channel `chan` of `gvdb`, replacing its topology.
+		// Returns the number of bricks.
+		int SurfaceGVDB ( VolumeGVDB* gvdb, uchar chan, float voxelsize );
 
 		int getMode ()		{ return (int) m_Param[PMODE]; }
 		std::string getModeStr ();
@@ -357,6 +394,10 @@
 		int						m_GridAdjCnt;
 		int						m_GridAdj[216];
 
+		// Sorted particles (parallel CPU solver)
+		SortedParticles			m_Sorted;
+		VerletLists				m_Verlet;				// empty when invalid
+
 		// Acceleration Neighbor Table
 		int						m_NeighborNum;
 		int						m_NeighborMax;
@@ -367,7 +408,11 @@
 
 		// Record/Playback
 		bool					mbRecord;		
+		PointSeqWriter			mSeqOut;				// recorded sequence
+		PointSeqReader			mSeqIn;					// playback sequence
 		bool					mbRecordBricks;
+		VolumeGVDB*				mSurfaceGVDB;			// target of SaveBricks
+		bool					mSurfaceOwned;			// mSurfaceGVDB was created by SaveBricks
 		int						mSpherePnts;
 		int						mTex[1];		
 
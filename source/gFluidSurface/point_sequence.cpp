@@ -0,0 +1,366 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+#include "point_sequence.h"
+#include "gvdb_parallel.h"
+#include "main.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Sequences exceed 2 GB
+#ifdef _WIN32
+	#define seq_fseek	_fseeki64
+#else
+	#define seq_fseek	fseeko
+#endif
+
+#define SEQ_VERSION		1
+#define SEQ_CHUNK		16384			// particles per independently coded chunk
+
+static int numChunks ( int num )		{ return std::max ( 1, (num + SEQ_CHUNK - 1) / SEQ_CHUNK ); }
+
+static inline ushort quantize ( float v, float lo, float scale )
+{
+	float q = (v - lo) * scale + 0.5f;
+	return (ushort) ( q < 0 ? 0 : ( q > 65535.0f ? 65535 : q ) );
+}
+
+// Linear prediction from the two previous frames
+static inline int predict ( ushort q0, ushort q1 )
+{
+	int p = 2 * int(q1) - int(q0);
+	return p < 0 ? 0 : ( p > 65535 ? 65535 : p );
+}
+
+static inline void putVarint ( std::vector<uchar>& out, uint v )
+{
+	while ( v >= 0x80 ) { out.push_back ( uchar(v | 0x80) ); v >>= 7; }
+	out.push_back ( uchar(v) );
+}
+static inline bool getVarint ( const uchar*& p, const uchar* end, uint& v )
+{
+	v = 0;
+	for (int shift = 0; shift < 35 && p < end; shift += 7) {
+		uchar b = *p++;
+		v |= uint(b & 0x7F) << shift;
+		if ( (b & 0x80) == 0 ) return true;
+	}
+	return false;
+}
+static inline uint zigzag ( int r )		{ return (uint(r) << 1) ^ uint(r >> 31); }
+static inline int unzigzag ( uint v )	{ return int(v >> 1) ^ -int(v & 1); }
+
+//-------------------------------------------------------- Writer
+
+PointSeqWriter::PointSeqWriter ()
+{
+	mFP = 0x0;
+	mOffset = 0;
+	mSinceKey = 0;
+}
+
+bool PointSeqWriter::Open ( std::string fname, Vector3DF bmin, Vector3DF bmax, float vmax, int keyint )
+{
+	Close ();
+	mFP = fopen ( fname.c_str(), "wb" );
+	if ( mFP == 0x0 ) {
+		nvprintf ( "ERROR: Creating %s. Folder may not exist.\n", fname.c_str() );
+		return false;
+	}
+	mHdr = PointSeqHeader();
+	memcpy ( mHdr.magic, "PSEQ", 4 );
+	mHdr.version = SEQ_VERSION;
+	mHdr.keyint = std::max ( keyint, 1 );
+	mHdr.numframes = 0;
+	mHdr.bmin = bmin;
+	mHdr.bmax = bmax;
+	mHdr.vmax = vmax;
+	mHdr.pad = 0;
+	mHdr.index = 0;
+	fwrite ( &mHdr, sizeof(mHdr), 1, mFP );			// rewritten by Close
+	mOffset = sizeof(mHdr);
+	mIndex.clear ();
+	mQ0.clear ();	mQ1.clear ();	mClr.clear ();
+	return true;
+}
+
+bool PointSeqWriter::Write ( int frame, int num, Vector3DF* pos, Vector3DF* vel, uint* clr )
+{
+	if ( mFP == 0x0 ) return false;
+
+	PointSeqEntry ent;
+	ent.frame = frame;
+	ent.key = ( mIndex.empty() || mSinceKey >= mHdr.keyint || (size_t) num * 6 != mQ1.size() ) ? 1 : 0;
+	ent.offset = mOffset;
+	if ( ent.key ) {
+		mQ0.resize ( num * 6 );		mQ1.resize ( num * 6 );		mClr.resize ( num );
+		mSinceKey = 0;
+	}
+	mSinceKey++;
+
+	Vector3DF lo = mHdr.bmin;
+	Vector3DF ps = mHdr.bmax - mHdr.bmin;
+	ps.Set ( ps.x > 0 ? 65535.0f / ps.x : 0, ps.y > 0 ? 65535.0f / ps.y : 0, ps.z > 0 ? 65535.0f / ps.z : 0 );
+	float vs = (mHdr.vmax > 0) ? 65535.0f / (2 * mHdr.vmax) : 0;
+
+	// Code chunks in parallel
+	int chunks = numChunks ( num );
+	std::vector< std::vector<uchar> > bufs ( chunks );
+	ParallelChunks ( chunks, 0, [&]( int, uint64 cs, uint64 ce ) {
+		for (uint64 c = cs; c < ce; c++) {
+			std::vector<uchar>& out = bufs[c];
+			int s = int( uint64(num) * c / chunks ), e = int( uint64(num) * (c+1) / chunks );
+			out.reserve ( (e - s) * (ent.key ? 16 : 8) );
+			for (int i = s; i < e; i++) {
+				ushort q[6];
+				q[0] = quantize ( pos[i].x, lo.x, ps.x );				q[1] = quantize ( pos[i].y, lo.y, ps.y );				q[2] = quantize ( pos[i].z, lo.z, ps.z );
+				q[3] = quantize ( vel[i].x, -mHdr.vmax, vs );			q[4] = quantize ( vel[i].y, -mHdr.vmax, vs );			q[5] = quantize ( vel[i].z, -mHdr.vmax, vs );
+				ushort* q0 = &mQ0[i*6];
+				ushort* q1 = &mQ1[i*6];
+				if ( ent.key ) {
+					uchar raw[16];
+					memcpy ( raw, q, 12 );
+					memcpy ( raw + 12, &clr[i], 4 );
+					out.insert ( out.end(), raw, raw + 16 );
+					for (int k = 0; k < 6; k++) q0[k] = q1[k] = q[k];
+				} else {
+					for (int k = 0; k < 6; k++) {
+						putVarint ( out, zigzag ( int(q[k]) - predict ( q0[k], q1[k] ) ) );
+						q0[k] = q1[k];	q1[k] = q[k];
+					}
+					putVarint ( out, clr[i] ^ mClr[i] );
+				}
+				mClr[i] = clr[i];
+			}
+		}
+	} );
+
+	int fhdr[4] = { frame, num, ent.key, chunks };
+	std::vector<uint> sizes ( chunks );
+	for (int c = 0; c < chunks; c++) sizes[c] = (uint) bufs[c].size();
+	fwrite ( fhdr, sizeof(int), 4, mFP );
+	fwrite ( &sizes[0], sizeof(uint), chunks, mFP );
+	mOffset += sizeof(fhdr) + chunks * sizeof(uint);
+	for (int c = 0; c < chunks; c++) {
+		if ( sizes[c] > 0 ) fwrite ( &bufs[c][0], 1, sizes[c], mFP );
+		mOffset += sizes[c];
+	}
+	mIndex.push_back ( ent );
+	return !ferror ( mFP );
+}
+
+void PointSeqWriter::Close ()
+{
+	if ( mFP == 0x0 ) return;
+	mHdr.numframes = (int) mIndex.size();
+	mHdr.index = mOffset;
+	if ( !mIndex.empty() ) fwrite ( &mIndex[0], sizeof(PointSeqEntry), mIndex.size(), mFP );
+	seq_fseek ( mFP, 0, SEEK_SET );
+	fwrite ( &mHdr, sizeof(mHdr), 1, mFP );
+	fclose ( mFP );
+	mFP = 0x0;
+}
+
+//-------------------------------------------------------- Reader
+
+PointSeqReader::PointSeqReader ()
+{
+	mFP = 0x0;
+	mDepth = 4;
+	mNext = 0;
+	mSkipTo = 0;
+	mSeek = -1;
+	mGen = 0;
+	mFailed = false;
+	mFailedNdx = -1;
+	mQuit = false;
+}
+
+bool PointSeqReader::Open ( std::string fname, int depth )
+{
+	Close ();
+	mFP = fopen ( fname.c_str(), "rb" );
+	if ( mFP == 0x0 ) {
+		nvprintf ( "WARNING: File not found %s\n", fname.c_str() );
+		return false;
+	}
+	if ( fread ( &mHdr, sizeof(mHdr), 1, mFP ) != 1 || memcmp ( mHdr.magic, "PSEQ", 4 ) != 0 || mHdr.version != SEQ_VERSION || mHdr.index == 0 ) {
+		nvprintf ( "ERROR: %s is not a complete point sequence.\n", fname.c_str() );
+		fclose ( mFP );
+		mFP = 0x0;
+		return false;
+	}
+	mIndex.resize ( mHdr.numframes );
+	seq_fseek ( mFP, mHdr.index, SEEK_SET );
+	if ( mHdr.numframes > 0 && fread ( &mIndex[0], sizeof(PointSeqEntry), mHdr.numframes, mFP ) != (size_t) mHdr.numframes ) {
+		nvprintf ( "ERROR: %s has a damaged frame index.\n", fname.c_str() );
+		fclose ( mFP );
+		mFP = 0x0;
+		return false;
+	}
+
+	mDepth = std::max ( depth, 1 );
+	mNext = 0;
+	mSkipTo = 0;
+	mSeek = -1;
+	mFailed = false;
+	mFailedNdx = -1;
+	mQuit = false;
+	mWorker = std::thread ( &PointSeqReader::Worker, this );
+	return true;
+}
+
+void PointSeqReader::Close ()
+{
+	if ( mFP == 0x0 ) return;
+	{
+		std::lock_guard<std::mutex> lock ( mMutex );
+		mQuit = true;
+	}
+	mWake.notify_all ();
+	mWorker.join ();
+	fclose ( mFP );
+	mFP = 0x0;
+	mIndex.clear ();
+	mQueue.clear ();
+}
+
+const PointSeqReader::Frame* PointSeqReader::Acquire ( int frame )
+{
+	std::vector<PointSeqEntry>::iterator it = std::lower_bound ( mIndex.begin(), mIndex.end(), frame,
+		[]( const PointSeqEntry& e, int f ) { return e.frame < f; } );
+	if ( it == mIndex.end() || it->frame != frame ) return 0x0;
+	int ndx = int( it - mIndex.begin() );
+
+	std::unique_lock<std::mutex> lock ( mMutex );
+	for (;;) {
+		while ( !mQueue.empty() && mQueue.front().ndx < ndx ) mQueue.pop_front ();
+		if ( !mQueue.empty() && mQueue.front().ndx == ndx ) {
+			mCurrent = std::move ( mQueue.front() );
+			mQueue.pop_front ();
+			mWake.notify_all ();
+			return &mCurrent;
+		}
+		if ( mFailed ) {
+			// Frames decoded through the failed one fail too; others restart from their keyframe
+			int k = ndx;
+			while ( k > 0 && !mIndex[k].key ) k--;
+			if ( mFailedNdx >= k && mFailedNdx <= ndx ) return 0x0;
+		}
+
+		// Seek unless the frame is already on its way
+		int lo = mQueue.empty() ? mNext - 1 : mQueue.front().ndx;
+		bool coming = !mFailed && ( ndx >= lo && ndx <= std::max ( mNext, mSkipTo ) + mDepth );
+		if ( mSeek != ndx && ( mSeek >= 0 || !coming ) ) {
+			mSeek = ndx;
+			mQueue.clear ();
+		}
+		mWake.notify_all ();
+		mReady.wait ( lock );
+	}
+}
+
+void PointSeqReader::Worker ()
+{
+	std::unique_lock<std::mutex> lock ( mMutex );
+	for (;;) {
+		mWake.wait ( lock, [this]() {
+			return mQuit || mSeek >= 0 || ( !mFailed && (int) mQueue.size() < mDepth && mNext < (int) mIndex.size() );
+		} );
+		if ( mQuit ) return;
+		if ( mSeek >= 0 ) {
+			// Restart from the nearest keyframe
+			int k = mSeek;
+			while ( k > 0 && !mIndex[k].key ) k--;
+			mNext = k;
+			mSkipTo = mSeek;
+			mSeek = -1;
+			mFailed = false;
+			mQueue.clear ();
+			mGen++;
+			continue;
+		}
+		int ndx = mNext++;
+		uint64 gen = mGen;
+		lock.unlock ();
+
+		Frame f;
+		bool ok = Decode ( ndx, f );
+
+		lock.lock ();
+		if ( gen != mGen ) continue;
+		if ( !ok ) { mFailed = true; mFailedNdx = ndx; }
+		else if ( ndx >= mSkipTo ) mQueue.push_back ( std::move(f) );
+		mReady.notify_all ();
+	}
+}
+
+bool PointSeqReader::Decode ( int ndx, Frame& f )
+{
+	int fhdr[4];
+	seq_fseek ( mFP, mIndex[ndx].offset, SEEK_SET );
+	if ( fread ( fhdr, sizeof(int), 4, mFP ) != 4 ) return false;
+	int num = fhdr[1], key = fhdr[2], chunks = fhdr[3];
+	if ( num < 0 || chunks != numChunks ( num ) ) return false;
+	if ( !key && (size_t) num * 6 != mQ1.size() ) return false;		// no matching previous frame
+
+	std::vector<uint> sizes ( chunks );
+	if ( fread ( &sizes[0], sizeof(uint), chunks, mFP ) != (size_t) chunks ) return false;
+	std::vector<uint64> off ( chunks + 1, 0 );
+	for (int c = 0; c < chunks; c++) off[c+1] = off[c] + sizes[c];
+	std::vector<uchar> buf ( off[chunks] );
+	if ( off[chunks] > 0 && fread ( &buf[0], 1, off[chunks], mFP ) != off[chunks] ) return false;
+
+	f.ndx = ndx;
+	f.frame = fhdr[0];
+	f.num = num;
+	f.pos.resize ( num );	f.vel.resize ( num );	f.clr.resize ( num );
+	if ( key ) { mQ0.resize ( num * 6 );	mQ1.resize ( num * 6 );		mClr.resize ( num ); }
+
+	Vector3DF lo = mHdr.bmin;
+	Vector3DF pd = (mHdr.bmax - mHdr.bmin) / 65535.0f;
+	float vd = 2 * mHdr.vmax / 65535.0f;
+
+	// Decode chunks in parallel
+	std::vector<uchar> good ( chunks, 0 );
+	ParallelChunks ( chunks, 0, [&]( int, uint64 cs, uint64 ce ) {
+		for (uint64 c = cs; c < ce; c++) {
+			const uchar* p = buf.data() + off[c];
+			const uchar* end = buf.data() + off[c+1];
+			int s = int( uint64(num) * c / chunks ), e = int( uint64(num) * (c+1) / chunks );
+			int i = s;
+			for (; i < e; i++) {
+				ushort* q0 = &mQ0[i*6];
+				ushort* q1 = &mQ1[i*6];
+				if ( key ) {
+					if ( end - p < 16 ) break;
+					memcpy ( q1, p, 12 );
+					memcpy ( &mClr[i], p + 12, 4 );
+					p += 16;
+					for (int k = 0; k < 6; k++) q0[k] = q1[k];
+				} else {
+					uint v;
+					int k = 0;
+					for (; k < 6; k++) {
+						if ( !getVarint ( p, end, v ) ) break;
+						int q = predict ( q0[k], q1[k] ) + unzigzag ( v );
+						q0[k] = q1[k];	q1[k] = (ushort) q;
+					}
+					if ( k < 6 || !getVarint ( p, end, v ) ) break;
+					mClr[i] ^= v;
+				}
+				f.pos[i].Set ( lo.x + q1[0] * pd.x, lo.y + q1[1] * pd.y, lo.z + q1[2] * pd.z );
+				f.vel[i].Set ( q1[3] * vd - mHdr.vmax, q1[4] * vd - mHdr.vmax, q1[5] * vd - mHdr.vmax );
+				f.clr[i] = mClr[i];
+			}
+			good[c] = ( i == e && p == end ) ? 1 : 0;
+		}
+	} );
+	for (int c = 0; c < chunks; c++)
+		if ( !good[c] ) { mQ1.clear (); return false; }
+	return true;
+}
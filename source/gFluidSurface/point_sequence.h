@@ -0,0 +1,122 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+// Recorded particle sequences (.pseq): positions, velocities and colors of every frame in
+// one file.
+//
+// Positions are quantized to 16 bits per axis relative to fixed bounds, as in gPointCloud's
+// ushort format; velocities to 16 bits in [-vmax, vmax]. A keyframe stores the quantized
+// values directly. Frames in between store the difference to a linear prediction from the
+// two previous frames (zigzag varints), and colors as an xor with the previous frame.
+// Decoding is exact with respect to the quantized values, so errors do not accumulate.
+// A keyframe is written every `keyint` frames and whenever the particle count changes.
+//
+// Each frame is split into chunks of particles that are coded independently, so both
+// ends run in parallel. A frame index at the end of the file allows seeking: decoding
+// restarts from the nearest keyframe.
+//
+// PointSeqReader decodes ahead on a background thread; Acquire returns frames in any
+// order but is fastest when called for increasing frames.
+
+#ifndef DEF_POINT_SEQUENCE
+	#define DEF_POINT_SEQUENCE
+
+	#include "gvdb_types.h"
+	#include "gvdb_vec.h"
+	#include <condition_variable>
+	#include <deque>
+	#include <mutex>
+	#include <stdio.h>
+	#include <string>
+	#include <thread>
+	#include <vector>
+	using namespace nvdb;
+
+	struct PointSeqHeader {
+		char		magic[4];			// "PSEQ"
+		int			version;
+		int			keyint;
+		int			numframes;
+		Vector3DF	bmin, bmax;			// position bounds
+		float		vmax;				// velocity bound, per component
+		int			pad;
+		uint64		index;				// file offset of the frame index
+	};
+	struct PointSeqEntry {
+		int			frame;
+		int			key;
+		uint64		offset;
+	};
+
+	class PointSeqWriter {
+	public:
+		PointSeqWriter ();
+		~PointSeqWriter ()		{ Close (); }
+
+		bool	Open ( std::string fname, Vector3DF bmin, Vector3DF bmax, float vmax, int keyint = 32 );
+		bool	Write ( int frame, int num, Vector3DF* pos, Vector3DF* vel, uint* clr );
+		void	Close ();					// writes the frame index
+		bool	isOpen ()				{ return mFP != 0x0; }
+		uint64	getBytes ()				{ return mOffset; }
+
+	private:
+		FILE*						mFP;
+		PointSeqHeader				mHdr;
+		std::vector<PointSeqEntry>	mIndex;
+		uint64						mOffset;
+		int							mSinceKey;
+		std::vector<ushort>			mQ0, mQ1;		// quantized pos+vel of the two previous frames
+		std::vector<uint>			mClr;
+	};
+
+	class PointSeqReader {
+	public:
+		struct Frame {
+			int						ndx, frame, num;
+			std::vector<Vector3DF>	pos, vel;
+			std::vector<uint>		clr;
+		};
+
+		PointSeqReader ();
+		~PointSeqReader ()		{ Close (); }
+
+		bool	Open ( std::string fname, int depth = 4 );		// depth: frames decoded ahead
+		void	Close ();
+		bool	isOpen ()				{ return mFP != 0x0; }
+		int		getNumFrames ()			{ return (int) mIndex.size(); }
+
+		// Blocks until `frame` is decoded. Valid until the next call; null if the frame is
+		// not in the sequence or the file is damaged.
+		const Frame* Acquire ( int frame );
+
+	private:
+		void	Worker ();
+		bool	Decode ( int ndx, Frame& f );
+
+		FILE*						mFP;
+		PointSeqHeader				mHdr;
+		std::vector<PointSeqEntry>	mIndex;
+		int							mDepth;
+		Frame						mCurrent;
+
+		// Decoder state, worker thread only
+		std::vector<ushort>			mQ0, mQ1;
+		std::vector<uint>			mClr;
+
+		// Shared with the worker
+		std::mutex					mMutex;
+		std::condition_variable		mWake, mReady;
+		std::deque<Frame>			mQueue;			// decoded, in order
+		int							mNext;			// next frame index to decode
+		int							mSkipTo;		// frames before this are decoded but not queued
+		int							mSeek;			// requested frame index, -1 if none
+		uint64						mGen;			// bumped by seeks, stale decodes are dropped
+		bool						mFailed, mQuit;
+		int							mFailedNdx;		// frame index that failed to decode, if mFailed
+		std::thread					mWorker;
+	};
+
+#endif
@@ -9,6 +9,12 @@
 #include <algorithm> // For min/max
 
 #include "gvdb_export_nanovdb.h"
+#include "gvdb_generate.h"
+#include "gvdb_parallel.h"
+
+#include <unordered_map>
+
+#include <nanovdb/util/IO.h>
 
 namespace nvdb {
 	using namespace nanovdb;
@@ -371,56 +377,29 @@ print('};')
 #endif
 	}
 
-	CUdeviceptr ExportToNanoVDB(VolumeGVDB& gvdb, uchar channel, void* backgroundPtr,
-		const char gridName[nanovdb::GridData::MaxNameSize], nanovdb::GridClass gridClass, size_t* outTotalSize)
-	{
-		// Validate input
-		if (backgroundPtr == nullptr) {
-			gprintf("Error in ExportToNanoVDB: backgroundPtr was nullptr!\n");
-			return GVDB_EXPORT_NANOVDB_NULL;
-		}
-		if (outTotalSize == nullptr) {
-			gprintf("Error in ExportToNanoVDB: outTotalSize was nullptr!\n");
-			return GVDB_EXPORT_NANOVDB_NULL;
-		}
-
-		// This function works by splitting its work between the GPU and CPU. While the GPU exports
-		// leaves and internal nodes, the CPU fills in the grid data. The CPU then receives the
-		// level-2 nodes, sorts them, and then copies its data to the GPU. However, note that the
-		// GPU is fully capable of doing this work on its own, using e.g. Thrust's parallel sorting
-		// algorithms.
-
-		// In order for this function to be efficient, we output a NanoVDB tree whose lower levels
-		// match the GVDB tree. In NanoVDB, these are different templated types, so how do we
-		// handle all of the possibilities (since we have to generate all our code in advance)?
-		// Well, a NanoVDB volume is essentially a single block of memory, storing data and offsets
-		// into this memory. In memory, it can be viewed like this:
-		//   GridData
-		//   number of GridBlindMetaData objects (contains offsets to contents)
-		//   TreeData (contains pointers to root, internal nodes, and leaves)
-		//   root
-		//     (number of level-2 nodes) Tiles
-		//   level-2 nodes
-		//   level-1 nodes
-		//   leaves
-		//   contents of GridBlindMetaData
-		//
-		// If we're careful, we can break down writing each of these sections into handling a
-		// relatively small number of types, and instantiate all of the functions we need.
-		// Also, in this function, we ignore GridBlindMetaData.
-		//
-		// To sum this all up, this function works like this:
-		// - Compute region sizes.
-		// - Allocate memory.
-		// - Start exporting leaves and nodes on the GPU.
-		// - On the CPU, fill in most of the grid, tree, and root structures.
-		// - Wait for the GPu to finish, and retrieve the level-2 nodes from the GPU. Sort them,
-		// then populate the remaining root and GridData fields.
-		// - Copy the grid, tree, root, and tiles to the GPU. 
-		// - Clean up.
+	// Denotes the different regions of a NanoVDB file/memory representation.
+	enum Region {
+		R_GRID,
+		R_TREE,
+		R_ROOT,
+		R_NODE2,
+		R_NODE1,
+		R_LEAF,
+		R_COUNT
+	};
 
-		ValueUnion backgroundUnion = *reinterpret_cast<ValueUnion*>(backgroundPtr);
+	// Node counts and region offsets of the NanoVDB buffer for a GVDB volume. Shared by the
+	// device and host exporters.
+	struct ExportLayout {
+		uchar gvdbType;
+		int log2Dim[3];					// per level, leaves first
+		int numNodes[3];				// per level, leaves first
+		size_t offsets[R_COUNT + 1];	// byte offset of each region; the last is the total size
+	};
 
+	// Checks that the volume and channel can be exported, and computes the layout.
+	static bool PlanExport(VolumeGVDB& gvdb, uchar channel, ExportLayout& layout)
+	{
 		// Get template parameters from GVDB
 		int brickLog2Dim = gvdb.getLD(0);
 		int node1Log2Dim = gvdb.getLD(1);
@@ -431,19 +410,19 @@ print('};')
 			gprintf("Error in ExportToNanoVDB: The brick log2dim (%d) was outside of the range [1,8]. "
 				"Consider using a different tree structure or adding this case to the supported types.\n",
 				brickLog2Dim);
-			return GVDB_EXPORT_NANOVDB_NULL;
+			return false;
 		}
 		if (node1Log2Dim < 1 || node1Log2Dim > 8) {
 			gprintf("Error in ExportToNanoVDB: The level-1 node log2dim (%d) was outside of the range [1,8]. "
 				"Consider using a different tree structure or adding this case to the supported types.\n",
 				node1Log2Dim);
-			return GVDB_EXPORT_NANOVDB_NULL;
+			return false;
 		}
 		if (node2Log2Dim < 1 || node2Log2Dim > 8) {
 			gprintf("Error in ExportToNanoVDB: The level-2 node log2dim (%d) was outside of the range [1,8]. "
 				"Consider using a different tree structure or adding this case to the supported types.\n",
 				node2Log2Dim);
-			return GVDB_EXPORT_NANOVDB_NULL;
+			return false;
 		}
 		// Make sure that the gvdbType is a type that can be converted to a NanoVDB volume.
 		switch (gvdbType) {
@@ -455,31 +434,20 @@ print('};')
 			gprintf("Error in ExportToNanoVDB:  The type of GVDB channel %u was %u, which is not "
 				"supported for NanoVDB export.",
 				static_cast<unsigned int>(channel), static_cast<unsigned int>(gvdbType));
-			return GVDB_EXPORT_NANOVDB_NULL;
+			return false;
 		}
 
-		// Denotes the different regions of a NanoVDB file/memory representation.
-		enum Region {
-			R_GRID,
-			R_TREE,
-			R_ROOT,
-			R_NODE2,
-			R_NODE1,
-			R_LEAF,
-			R_COUNT
-		};
-
 		// Count the number of nodes at each level. At the moment, limit the number of nodes of each
 		// type to INT_MAX (2^31-1).
 		int numNode2s, numNode1s, numLeaves;
 		if (!ExportToNanoVDB_GetNumNodes(gvdb, 2, numNode2s)) {
-			return GVDB_EXPORT_NANOVDB_NULL;
+			return false;
 		}
 		if (!ExportToNanoVDB_GetNumNodes(gvdb, 1, numNode1s)) {
-			return GVDB_EXPORT_NANOVDB_NULL;
+			return false;
 		}
 		if (!ExportToNanoVDB_GetNumNodes(gvdb, 0, numLeaves)) {
-			return GVDB_EXPORT_NANOVDB_NULL;
+			return false;
 		}
 
 		// Compute the size of each region.
@@ -495,11 +463,172 @@ print('};')
 		// Compute offsets into memory using an exclusive prefix sum; the last element in this array
 		// will hold the size of all of the memory we need to allocate.
 		// (e.g. this turns {3, 5, 2, 5} into {0, 3, 8, 10, 15}.)
-		size_t dataOffsetsBytes[R_COUNT + 1];
-		dataOffsetsBytes[0] = 0;
+		layout.offsets[0] = 0;
 		for (int i = 1; i <= R_COUNT; i++) {
-			dataOffsetsBytes[i] = dataOffsetsBytes[i - 1] + dataSizes[i - 1];
+			layout.offsets[i] = layout.offsets[i - 1] + dataSizes[i - 1];
+		}
+
+		layout.gvdbType = gvdbType;
+		layout.log2Dim[0] = brickLog2Dim;
+		layout.log2Dim[1] = node1Log2Dim;
+		layout.log2Dim[2] = node2Log2Dim;
+		layout.numNodes[0] = numLeaves;
+		layout.numNodes[1] = numNode1s;
+		layout.numNodes[2] = numNode2s;
+		return true;
+	}
+
+	// Fills in the grid and tree structures, which don't depend on the node contents.
+	static void FillGridAndTree(VolumeGVDB& gvdb, uint8_t* buffer, const ExportLayout& layout,
+		const char gridName[nanovdb::GridData::MaxNameSize], nanovdb::GridClass gridClass)
+	{
+		const size_t* dataOffsetsBytes = layout.offsets;
+		const uchar gvdbType = layout.gvdbType;
+
+		//---------------------------------------------------------------------------------------------
+		// Grid (CPU)
+		nanovdb::GridData* gridData = reinterpret_cast<nanovdb::GridData*>(buffer);
+		{
+			gridData->mMagic = NANOVDB_MAGIC_NUMBER;
+
+			memcpy(gridData->mGridName, gridName, nanovdb::GridData::MaxNameSize);
+
+			// Get the GVDB index-to-world transform and copy it to a format Map can read
+			Matrix4F xform = gvdb.getTransform(); // Make a copy (note that once this is integrated
+			// into the main library, we can access the inverse directly):
+			{
+				float indexToWorld[4][4];
+				for (int row = 0; row < 4; row++) {
+					for (int col = 0; col < 4; col++) {
+						indexToWorld[row][col] = xform(row, col);
+					}
+				}
+				float worldToIndex[4][4];
+				xform.InvertTRS();
+				for (int row = 0; row < 4; row++) {
+					for (int col = 0; col < 4; col++) {
+						worldToIndex[row][col] = xform(row, col);
+					}
+				}
+				gridData->mMap.set(indexToWorld, worldToIndex, 1.0); // mTaper seems to be unused
+			}
+
+			// Skip over the world bounding box for now - we'll fill it in later.
+
+			// GridData would like a uniform scale, but that's not really possible to provide, since
+			// GVDB supports arbitrary voxel transforms (e.g. think of skewed voxels).
+			// For now, we use the approach GridBuilder uses, which is scale_i = ||map(e_i) - map((0,0,0))||.
+			// However, for a different approximation, we could use something like sqrt(tr(A*A)/3),
+			// where A is the upper-left 3x3 block of xform; if A is normal, this gives the root mean
+			// square of the singular values of A.
+			const nanovdb::Vec3d mapAt0 = gridData->applyMap(nanovdb::Vec3d(0, 0, 0));
+			gridData->mVoxelSize = Vec3R(
+				(gridData->applyMap(nanovdb::Vec3d(1, 0, 0)) - mapAt0).length(),
+				(gridData->applyMap(nanovdb::Vec3d(0, 1, 0)) - mapAt0).length(),
+				(gridData->applyMap(nanovdb::Vec3d(0, 0, 1)) - mapAt0).length()
+			);
+
+			gridData->mGridClass = gridClass;
+
+			switch (gvdbType) {
+			case T_FLOAT:
+				gridData->mGridType = nanovdb::GridType::Float;
+				break;
+			case T_FLOAT3:
+				gridData->mGridType = nanovdb::GridType::Vec3f;
+				break;
+			case T_INT:
+				gridData->mGridType = nanovdb::GridType::Int32;
+			}
+
+			gridData->mBlindMetadataCount = 0;
+			gridData->mBlindMetadataOffset = 0;
+		}
+		assert(sizeof(nanovdb::GridData) == dataOffsetsBytes[R_TREE]); // Consistency check
+
+		//---------------------------------------------------------------------------------------------
+		// Tree (CPU)
+		using TreeDataT = TreeData<TREE_DEPTH>; // The root is always at level 3 in NanoVDB
+		TreeDataT* treeData = reinterpret_cast<TreeDataT*>(buffer + dataOffsetsBytes[R_TREE]);
+		{
+			// Filling in the tree is much simpler; we simply give the offsets from treePtr to each of
+			// the regions, and the number of nodes in each region. Note that the indices of mBytes
+			// and mCount refer to the level of the nodes.
+			treeData->mBytes[0] = dataOffsetsBytes[R_LEAF] - dataOffsetsBytes[R_TREE];
+			treeData->mBytes[1] = dataOffsetsBytes[R_NODE1] - dataOffsetsBytes[R_TREE];
+			treeData->mBytes[2] = dataOffsetsBytes[R_NODE2] - dataOffsetsBytes[R_TREE];
+			treeData->mBytes[3] = dataOffsetsBytes[R_ROOT] - dataOffsetsBytes[R_TREE];
+
+			treeData->mCount[0] = layout.numNodes[0];
+			treeData->mCount[1] = layout.numNodes[1];
+			treeData->mCount[2] = layout.numNodes[2];
+			treeData->mCount[3] = 1; // There's only one root
+		}
+	}
+
+	CUdeviceptr ExportToNanoVDB(VolumeGVDB& gvdb, uchar channel, void* backgroundPtr,
+		const char gridName[nanovdb::GridData::MaxNameSize], nanovdb::GridClass gridClass, size_t* outTotalSize)
+	{
+		// Validate input
+		if (backgroundPtr == nullptr) {
+			gprintf("Error in ExportToNanoVDB: backgroundPtr was nullptr!\n");
+			return GVDB_EXPORT_NANOVDB_NULL;
+		}
+		if (outTotalSize == nullptr) {
+			gprintf("Error in ExportToNanoVDB: outTotalSize was nullptr!\n");
+			return GVDB_EXPORT_NANOVDB_NULL;
+		}
+
+		// This function works by splitting its work between the GPU and CPU. While the GPU exports
+		// leaves and internal nodes, the CPU fills in the grid data. The CPU then receives the
+		// level-2 nodes, sorts them, and then copies its data to the GPU. However, note that the
+		// GPU is fully capable of doing this work on its own, using e.g. Thrust's parallel sorting
+		// algorithms.
+
+		// In order for this function to be efficient, we output a NanoVDB tree whose lower levels
+		// match the GVDB tree. In NanoVDB, these are different templated types, so how do we
+		// handle all of the possibilities (since we have to generate all our code in advance)?
+		// Well, a NanoVDB volume is essentially a single block of memory, storing data and offsets
+		// into this memory. In memory, it can be viewed like this:
+		//   GridData
+		//   number of GridBlindMetaData objects (contains offsets to contents)
+		//   TreeData (contains pointers to root, internal nodes, and leaves)
+		//   root
+		//     (number of level-2 nodes) Tiles
+		//   level-2 nodes
+		//   level-1 nodes
+		//   leaves
+		//   contents of GridBlindMetaData
+		//
+		// If we're careful, we can break down writing each of these sections into handling a
+		// relatively small number of types, and instantiate all of the functions we need.
+		// Also, in this function, we ignore GridBlindMetaData.
+		//
+		// To sum this all up, this function works like this:
+		// - Compute region sizes.
+		// - Allocate memory.
+		// - Start exporting leaves and nodes on the GPU.
+		// - On the CPU, fill in most of the grid, tree, and root structures.
+		// - Wait for the GPu to finish, and retrieve the level-2 nodes from the GPU. Sort them,
+		// then populate the remaining root and GridData fields.
+		// - Copy the grid, tree, root, and tiles to the GPU. 
+		// - Clean up.
+
+		ValueUnion backgroundUnion = *reinterpret_cast<ValueUnion*>(backgroundPtr);
+
+		// Validate the tree and type, and compute region sizes and offsets
+		ExportLayout layout;
+		if (!PlanExport(gvdb, channel, layout)) {
+			return GVDB_EXPORT_NANOVDB_NULL;
 		}
+		const size_t* dataOffsetsBytes = layout.offsets;
+		const uchar gvdbType = layout.gvdbType;
+		const int brickLog2Dim = layout.log2Dim[0];
+		const int node1Log2Dim = layout.log2Dim[1];
+		const int node2Log2Dim = layout.log2Dim[2];
+		int numLeaves = layout.numNodes[0];
+		int numNode1s = layout.numNodes[1];
+		int numNode2s = layout.numNodes[2];
 
 		// Switch to GVDB's context
 		const CUcontext gvdbContext = gvdb.getContext();
@@ -594,90 +723,15 @@ print('};')
 		}
 
 		//---------------------------------------------------------------------------------------------
-		// Grid (CPU)
+		// Grid and tree (CPU)
 		nanovdb::GridData* gridData = reinterpret_cast<nanovdb::GridData*>(bufferCPU);
-		{
-			gridData->mMagic = NANOVDB_MAGIC_NUMBER;
-
-			memcpy(gridData->mGridName, gridName, nanovdb::GridData::MaxNameSize);
-
-			// Get the GVDB index-to-world transform and copy it to a format Map can read
-			Matrix4F xform = gvdb.getTransform(); // Make a copy (note that once this is integrated
-			// into the main library, we can access the inverse directly):
-			{
-				float indexToWorld[4][4];
-				for (int row = 0; row < 4; row++) {
-					for (int col = 0; col < 4; col++) {
-						indexToWorld[row][col] = xform(row, col);
-					}
-				}
-				float worldToIndex[4][4];
-				xform.InvertTRS();
-				for (int row = 0; row < 4; row++) {
-					for (int col = 0; col < 4; col++) {
-						worldToIndex[row][col] = xform(row, col);
-					}
-				}
-				gridData->mMap.set(indexToWorld, worldToIndex, 1.0); // mTaper seems to be unused
-			}
-
-			// Skip over the world bounding box for now - we'll fill it in later.
-
-			// GridData would like a uniform scale, but that's not really possible to provide, since
-			// GVDB supports arbitrary voxel transforms (e.g. think of skewed voxels).
-			// For now, we use the approach GridBuilder uses, which is scale_i = ||map(e_i) - map((0,0,0))||.
-			// However, for a different approximation, we could use something like sqrt(tr(A*A)/3),
-			// where A is the upper-left 3x3 block of xform; if A is normal, this gives the root mean
-			// square of the singular values of A.
-			const nanovdb::Vec3d mapAt0 = gridData->applyMap(nanovdb::Vec3d(0, 0, 0));
-			gridData->mVoxelSize = Vec3R(
-				(gridData->applyMap(nanovdb::Vec3d(1, 0, 0)) - mapAt0).length(),
-				(gridData->applyMap(nanovdb::Vec3d(0, 1, 0)) - mapAt0).length(),
-				(gridData->applyMap(nanovdb::Vec3d(0, 0, 1)) - mapAt0).length()
-			);
-
-			gridData->mGridClass = gridClass;
-
-			switch (gvdbType) {
-			case T_FLOAT:
-				gridData->mGridType = nanovdb::GridType::Float;
-				break;
-			case T_FLOAT3:
-				gridData->mGridType = nanovdb::GridType::Vec3f;
-				break;
-			case T_INT:
-				gridData->mGridType = nanovdb::GridType::Int32;
-			}
-
-			gridData->mBlindMetadataCount = 0;
-			gridData->mBlindMetadataOffset = 0;
-		}
-		assert(sizeof(nanovdb::GridData) == dataSizes[R_GRID]); // Consistency check
-
-		//---------------------------------------------------------------------------------------------
-		// Tree (CPU)
-		using TreeDataT = TreeData<TREE_DEPTH>; // The root is always at level 3 in NanoVDB
-		TreeDataT* treeData = reinterpret_cast<TreeDataT*>(bufferCPU + dataOffsetsBytes[R_TREE]);
-		{
-			// Filling in the tree is much simpler; we simply give the offsets from treePtr to each of
-			// the regions, and the number of nodes in each region. Note that the indices of mBytes
-			// and mCount refer to the level of the nodes.
-			treeData->mBytes[0] = dataOffsetsBytes[R_LEAF] - dataOffsetsBytes[R_TREE];
-			treeData->mBytes[1] = dataOffsetsBytes[R_NODE1] - dataOffsetsBytes[R_TREE];
-			treeData->mBytes[2] = dataOffsetsBytes[R_NODE2] - dataOffsetsBytes[R_TREE];
-			treeData->mBytes[3] = dataOffsetsBytes[R_ROOT] - dataOffsetsBytes[R_TREE];
-
-			treeData->mCount[0] = numLeaves;
-			treeData->mCount[1] = numNode1s;
-			treeData->mCount[2] = numNode2s;
-			treeData->mCount[3] = 1; // There's only one root
-		}
+		FillGridAndTree(gvdb, bufferCPU, layout, gridName, gridClass);
 
 		// Now, wait for the GPU to finish by issuing a synchronizing operation to copy its level-2
 		// nodes to the CPU:
 		cudaCheck(cuMemcpyDtoH(bufferCPU + dataOffsetsBytes[R_NODE2], // CPU pointer
 			bufferGPU + dataOffsetsBytes[R_NODE2], // GPU pointer
-			dataSizes[R_NODE2]), // Data size
+			dataOffsetsBytes[R_NODE1] - dataOffsetsBytes[R_NODE2]), // Data size
 			"nvdb", "ExportToNanoVDB", "cuMemcpyDtoH", "Level-2 Nodes", DEBUG_EXPORT_NANOVDB);
 
 		//---------------------------------------------------------------------------------------------
@@ -721,6 +775,432 @@ print('};')
 		return bufferGPU;
 	}
 
+	//---------------------------------------------------------------------------------------------
+	// Host export. This follows the device kernels in cuda_export_nanovdb.cu, but runs over the
+	// GVDB pools on the CPU, with one thread per range of nodes. Only the atlas is read back from
+	// the GPU, a batch of atlas layers at a time.
+
+	// Fills in the leaves in `leaves` from a slab of the atlas starting at layer slice `slabZ`, and
+	// records their extents in `ranges` (indexed by leaf).
+	template<class ValueT, int LOG2DIM>
+	void HostProcessLeaves(VolumeGVDB& gvdb, uint8_t* leafStart, const std::vector<int>& leaves,
+		const uint8_t* slab, int slabZ, Vector3DI atlasRes, int elemBytes, NodeRangeData* ranges)
+	{
+		using LeafT = LeafNode<ValueT, Coord, Mask, LOG2DIM>;
+		const int brickres = 1 << LOG2DIM;
+
+		ParallelChunks(leaves.size(), 0, [&](int, uint64 s, uint64 e) {
+			for (uint64 i = s; i < e; i++) {
+				const int leafIdx = leaves[i];
+				nvdb::Node* gvdbNode = gvdb.getNodeAtLevel(leafIdx, 0);
+				LeafT* node = reinterpret_cast<LeafT*>(leafStart) + leafIdx;
+				typename LeafT::DataType& nodeData = *reinterpret_cast<typename LeafT::DataType*>(node);
+
+				// All values in a brick are active in GVDB
+				nodeData.mValueMask.set(true);
+
+				ValueT minValue = ExportToNanoVDB_MaximumValue<ValueT>();
+				ValueT maxValue = -minValue;
+
+				// Read the slab in row order, and write the brick in the order ((x * T) + y) * T + z.
+				const Vector3DI brickValue = gvdbNode->mValue;
+				for (int z = 0; z < brickres; z++) {
+					for (int y = 0; y < brickres; y++) {
+						const uint8_t* row = slab + ((uint64(brickValue.z + z - slabZ) * atlasRes.y
+							+ (brickValue.y + y)) * atlasRes.x + brickValue.x) * elemBytes;
+						for (int x = 0; x < brickres; x++) {
+							ValueT value;
+							memcpy(&value, row + x * elemBytes, sizeof(ValueT));
+							nodeData.mValues[(x * brickres + y) * brickres + z] = value;
+							minValue = ExportToNanoVDB_Min(minValue, value);
+							maxValue = ExportToNanoVDB_Max(maxValue, value);
+						}
+					}
+				}
+
+				nodeData.mMinimum = minValue;
+				nodeData.mMaximum = maxValue;
+				nodeData.mBBoxMin = { gvdbNode->mPos.x, gvdbNode->mPos.y, gvdbNode->mPos.z };
+				nodeData.mBBoxDif[0] = brickres;
+				nodeData.mBBoxDif[1] = brickres;
+				nodeData.mBBoxDif[2] = brickres;
+
+				*getValueUnion<ValueT>(ranges[leafIdx].valueMin) = node->valueMin();
+				*getValueUnion<ValueT>(ranges[leafIdx].valueMax) = node->valueMax();
+				ranges[leafIdx].aabb = node->bbox();
+			}
+		});
+	}
+
+	using HostLeafFunc = void(*)(VolumeGVDB&, uint8_t*, const std::vector<int>&, const uint8_t*, int,
+		Vector3DI, int, NodeRangeData*);
+
+	// Table of instantiations of HostProcessLeaves, [value type][leaf log2dim - 2].
+	static const HostLeafFunc hostLeafFuncs[3][6] = {
+	{HostProcessLeaves<float, 2>, HostProcessLeaves<float, 3>, HostProcessLeaves<float, 4>, HostProcessLeaves<float, 5>, HostProcessLeaves<float, 6>, HostProcessLeaves<float, 7>},
+	{HostProcessLeaves<Vec3f, 2>, HostProcessLeaves<Vec3f, 3>, HostProcessLeaves<Vec3f, 4>, HostProcessLeaves<Vec3f, 5>, HostProcessLeaves<Vec3f, 6>, HostProcessLeaves<Vec3f, 7>},
+	{HostProcessLeaves<int, 2>, HostProcessLeaves<int, 3>, HostProcessLeaves<int, 4>, HostProcessLeaves<int, 5>, HostProcessLeaves<int, 6>, HostProcessLeaves<int, 7>}
+	};
+
+	// Fills in the internal nodes of one level from the extents of their children, and records
+	// their own extents in `ranges`. LOG2DIM is the log2dim of the internal node.
+	template<class ValueT, int LOG2DIM>
+	void HostProcessInternalNodes(VolumeGVDB& gvdb, uint8_t* nodeStart, int numNodes, int level,
+		const NodeRangeData* childRanges, ValueUnion backgroundUnion, NodeRangeData* ranges)
+	{
+		// As in GetNode2Range, the leaf type doesn't matter here
+		using NodeT = InternalNode<LeafNode<ValueT>, LOG2DIM>;
+		using DataT = typename NodeT::DataType;
+		const uint32_t res = 1 << LOG2DIM;
+		const uint32_t numChildren = res * res * res;
+		const uint32_t resMask = res - 1;
+		const uint32_t resSquared = res * res;
+		const uint32_t middleMask = res * resMask;
+
+		ParallelChunks(numNodes, 0, [&](int, uint64 s, uint64 e) {
+			for (uint64 nodeIdx = s; nodeIdx < e; nodeIdx++) {
+				nvdb::Node* gvdbNode = gvdb.getNodeAtLevel(static_cast<int>(nodeIdx), level);
+
+				// Skip nodes with no children; all of their fields stay 0.
+				if (gvdbNode->mChildList == ID_UNDEFL) continue;
+
+				DataT* nodeData = reinterpret_cast<DataT*>(nodeStart) + nodeIdx;
+				nodeData->mValueMask.setOff();
+				nodeData->mChildMask.setOff();
+				nodeData->mOffset = numNodes - static_cast<int>(nodeIdx);
+
+				ValueT valueMin = ExportToNanoVDB_MaximumValue<ValueT>();
+				ValueT valueMax = -valueMin;
+				nanovdb::Coord aabbMin = { INT_MAX, INT_MAX, INT_MAX };
+				nanovdb::Coord aabbMax = { -INT_MAX, -INT_MAX, -INT_MAX };
+
+				for (uint32_t gvdbChildIdx = 0; gvdbChildIdx < numChildren; gvdbChildIdx++) {
+					// GVDB children are in (z*T+y)*T+x order, NanoVDB children in (x*T+y)*T+z order.
+					const uint32_t nanoVDBChildIdx =
+						(gvdbChildIdx / resSquared)
+						+ (gvdbChildIdx & middleMask)
+						+ (gvdbChildIdx & resMask) * resSquared;
+
+					const uint64 childReference = gvdb.getChildRefAtBit(gvdbNode, gvdbChildIdx);
+					if (childReference == ID_UNDEF64) {
+						nodeData->mTable[nanoVDBChildIdx].value = *getValueUnion<ValueT>(backgroundUnion);
+						continue;
+					}
+
+					const uint32_t childID = static_cast<uint32_t>(ElemNdx(childReference));
+					nodeData->mChildMask.setOn(nanoVDBChildIdx);
+					nodeData->mTable[nanoVDBChildIdx].childID = childID;
+
+					NodeRangeData rangeData = childRanges[childID];
+					valueMin = ExportToNanoVDB_Min(valueMin, *getValueUnion<ValueT>(rangeData.valueMin));
+					valueMax = ExportToNanoVDB_Max(valueMax, *getValueUnion<ValueT>(rangeData.valueMax));
+					for (int c = 0; c < 3; c++) {
+						aabbMin[c] = std::min(aabbMin[c], rangeData.aabb.min()[c]);
+						aabbMax[c] = std::max(aabbMax[c], rangeData.aabb.max()[c]);
+					}
+				}
+
+				nodeData->mMinimum = valueMin;
+				nodeData->mMaximum = valueMax;
+				nodeData->mBBox.min() = aabbMin;
+				nodeData->mBBox.max() = aabbMax;
+
+				const NodeT* node = reinterpret_cast<const NodeT*>(nodeData);
+				*getValueUnion<ValueT>(ranges[nodeIdx].valueMin) = node->valueMin();
+				*getValueUnion<ValueT>(ranges[nodeIdx].valueMax) = node->valueMax();
+				ranges[nodeIdx].aabb = node->bbox();
+			}
+		});
+	}
+
+	using HostInternalFunc = void(*)(VolumeGVDB&, uint8_t*, int, int, const NodeRangeData*, ValueUnion,
+		NodeRangeData*);
+
+	// Table of instantiations of HostProcessInternalNodes, [value type][node log2dim - 2].
+	static const HostInternalFunc hostInternalFuncs[3][6] = {
+	{HostProcessInternalNodes<float, 2>, HostProcessInternalNodes<float, 3>, HostProcessInternalNodes<float, 4>, HostProcessInternalNodes<float, 5>, HostProcessInternalNodes<float, 6>, HostProcessInternalNodes<float, 7>},
+	{HostProcessInternalNodes<Vec3f, 2>, HostProcessInternalNodes<Vec3f, 3>, HostProcessInternalNodes<Vec3f, 4>, HostProcessInternalNodes<Vec3f, 5>, HostProcessInternalNodes<Vec3f, 6>, HostProcessInternalNodes<Vec3f, 7>},
+	{HostProcessInternalNodes<int, 2>, HostProcessInternalNodes<int, 3>, HostProcessInternalNodes<int, 4>, HostProcessInternalNodes<int, 5>, HostProcessInternalNodes<int, 6>, HostProcessInternalNodes<int, 7>}
+	};
+
+	bool ExportToNanoVDBHost(VolumeGVDB& gvdb, uchar channel, void* backgroundPtr,
+		const char gridName[nanovdb::GridData::MaxNameSize], nanovdb::GridClass gridClass,
+		std::vector<uint8_t>& outGrid)
+	{
+		if (backgroundPtr == nullptr) {
+			gprintf("Error in ExportToNanoVDBHost: backgroundPtr was nullptr!\n");
+			return false;
+		}
+
+		ExportLayout layout;
+		if (!PlanExport(gvdb, channel, layout)) {
+			return false;
+		}
+		if (layout.numNodes[2] == 0) {
+			gprintf("Error in ExportToNanoVDBHost: The volume has no nodes.\n");
+			return false;
+		}
+		for (int level = 0; level < TREE_DEPTH; level++) {
+			if (layout.log2Dim[level] < 2 || layout.log2Dim[level] > 7) {
+				gprintf("Error in ExportToNanoVDBHost: The level-%d log2dim (%d) was outside of the "
+					"range [2,7].\n", level, layout.log2Dim[level]);
+				return false;
+			}
+		}
+		const size_t* dataOffsetsBytes = layout.offsets;
+		const int typeTableIndex = TypeTableIndex(layout.gvdbType);
+		const ValueUnion backgroundUnion = *reinterpret_cast<ValueUnion*>(backgroundPtr);
+
+		PERF_PUSH("ExportToNanoVDBHost");
+		outGrid.assign(dataOffsetsBytes[R_COUNT], 0);
+		uint8_t* buffer = outGrid.data();
+
+		// Extents of the nodes of the level below the one being processed
+		std::vector<NodeRangeData> childRanges(layout.numNodes[0]);
+		std::vector<NodeRangeData> ranges;
+
+		//---------------------------------------------------------------------------------------------
+		// Leaves (GVDB bricks)
+		// Bucket the leaves by atlas layer, then read back batches of layers and fill in the leaves
+		// that live in them. T_FLOAT3 atlases are stored with 4 channels on the GPU.
+		const int brickres = gvdb.mPool->getAtlasBrickres(channel);
+		const Vector3DI atlasRes = gvdb.mPool->getAtlasRes(channel);
+		const int elemBytes = gvdb.mPool->getAtlasVoxelBytes(channel);
+
+		std::vector<std::vector<uint64>> layers;
+		const int batch = gvdb.GetLeafLayers(channel, Vector3DI(INT_MIN, INT_MIN, INT_MIN),
+			Vector3DI(INT_MAX, INT_MAX, INT_MAX), layers);
+		std::vector<uint8_t> slab;
+		std::vector<int> leaves;
+		uint8_t* leafStart = buffer + dataOffsetsBytes[R_LEAF];
+
+		for (int l0 = 0; l0 < static_cast<int>(layers.size()); l0 += batch) {
+			const int l1 = std::min(static_cast<int>(layers.size()), l0 + batch);
+			leaves.clear();
+			for (int l = l0; l < l1; l++) {
+				for (uint64 leafRef : layers[l]) leaves.push_back(static_cast<int>(ElemNdx(leafRef)));
+			}
+			if (leaves.empty()) continue;
+			gvdb.ReadAtlasLayers(channel, l0, l1, slab);
+
+			hostLeafFuncs[typeTableIndex][layout.log2Dim[0] - 2](gvdb, leafStart, leaves,
+				slab.data(), l0 * brickres, atlasRes, elemBytes, childRanges.data());
+		}
+		gvdb.EndAtlasLayers(slab);
+
+		//---------------------------------------------------------------------------------------------
+		// Level-1 and level-2 nodes
+		const Region nodeRegions[TREE_DEPTH] = { R_LEAF, R_NODE1, R_NODE2 };
+		for (int level = 1; level < TREE_DEPTH; level++) {
+			ranges.assign(layout.numNodes[level], NodeRangeData());
+			hostInternalFuncs[typeTableIndex][layout.log2Dim[level] - 2](gvdb,
+				buffer + dataOffsetsBytes[nodeRegions[level]], layout.numNodes[level], level,
+				childRanges.data(), backgroundUnion, ranges.data());
+			childRanges.swap(ranges);
+		}
+
+		//---------------------------------------------------------------------------------------------
+		// Grid, tree, root and grid extents
+		FillGridAndTree(gvdb, buffer, layout, gridName, gridClass);
+
+		nanovdb::GridData* gridData = reinterpret_cast<nanovdb::GridData*>(buffer);
+		uint8_t* rootDataPtr = buffer + dataOffsetsBytes[R_ROOT];
+		uint8_t* node2Start = buffer + dataOffsetsBytes[R_NODE2];
+		const uint64_t activeVoxelCount = layout.numNodes[0] * gvdb.getVoxCnt(0);
+		const int totalLog2Dim = layout.log2Dim[0] + layout.log2Dim[1] + layout.log2Dim[2];
+		switch (layout.gvdbType) {
+		case T_FLOAT:
+			ProcessGridExtents<float>(gridData, rootDataPtr, node2Start,
+				activeVoxelCount, backgroundPtr, layout.numNodes[2], layout.log2Dim[2], totalLog2Dim);
+			break;
+		case T_FLOAT3:
+			ProcessGridExtents<Vec3f>(gridData, rootDataPtr, node2Start,
+				activeVoxelCount, backgroundPtr, layout.numNodes[2], layout.log2Dim[2], totalLog2Dim);
+			break;
+		case T_INT:
+			ProcessGridExtents<int>(gridData, rootDataPtr, node2Start,
+				activeVoxelCount, backgroundPtr, layout.numNodes[2], layout.log2Dim[2], totalLog2Dim);
+			break;
+		}
+
+		PERF_POP();
+		return true;
+	}
+
+	bool SaveNanoVDB(const std::string& filename, const std::vector<uint8_t>& grid)
+	{
+		if (grid.empty()) {
+			gprintf("Error in SaveNanoVDB: The grid was empty.\n");
+			return false;
+		}
+
+		HostBuffer buffer = HostBuffer::create(grid.size());
+		memcpy(buffer.data(), grid.data(), grid.size());
+		GridHandle<HostBuffer> handle(std::move(buffer));
+
+		try {
+			io::writeGrid(filename, handle);
+		}
+		catch (const std::exception& e) {
+			gprintf("Error in SaveNanoVDB: Could not write %s: %s\n", filename.c_str(), e.what());
+			return false;
+		}
+		return true;
+	}
+
+	//---------------------------------------------------------------------------------------------
+	// Import. NanoVDB leaves map one-to-one onto GVDB bricks when the lowest three log2dims match,
+	// so the topology is rebuilt from the flat leaf array and the leaf values are copied into the
+	// atlas in bulk, without going through OpenVDB.
+
+	// Packs the brick coordinates of a position into a map key, 21 bits per axis.
+	static uint64 ImportBrickKey(Vector3DI pos, int log2Dim) {
+		return (uint64(pos.x >> log2Dim) & 0x1FFFFF)
+			| ((uint64(pos.y >> log2Dim) & 0x1FFFFF) << 21)
+			| ((uint64(pos.z >> log2Dim) & 0x1FFFFF) << 42);
+	}
+
+	// Activates a brick for each leaf and fills the atlas from the leaf values. `offset` is
+	// subtracted from NanoVDB index coordinates to get GVDB coordinates.
+	template<int LOG2DIM>
+	void ImportLeaves(VolumeGVDB& gvdb, uchar channel, const uint8_t* leafStart, int numLeaves,
+		Vector3DI offset, float background)
+	{
+		using LeafT = LeafNode<float, Coord, Mask, LOG2DIM>;
+		using DataT = typename LeafT::DataType;
+		const int brickres = 1 << LOG2DIM;
+		const DataT* leaves = reinterpret_cast<const DataT*>(leafStart);
+
+		// The leaf origin is its active bounding box minimum, rounded down to the leaf grid.
+		std::vector<Vector3DI> bricks(numLeaves);
+		ParallelFor(numLeaves, [&](uint64 n) {
+			const Coord& bboxMin = leaves[n].mBBoxMin;
+			bricks[n] = Vector3DI(bboxMin[0] & ~(brickres - 1), bboxMin[1] & ~(brickres - 1),
+				bboxMin[2] & ~(brickres - 1)) - offset;
+		});
+
+		std::unordered_map<uint64, int> leafOfBrick;
+		leafOfBrick.reserve(numLeaves);
+		for (int n = 0; n < numLeaves; n++) {
+			leafOfBrick[ImportBrickKey(bricks[n], LOG2DIM)] = n;
+		}
+
+		ActivateBricks(&gvdb, bricks);
+
+		// NanoVDB leaves are in ((x * T) + y) * T + z order, GVDB bricks in ((z * T) + y) * T + x.
+		FillBricks(&gvdb, channel, background, [&](nvdb::Node* node, float* dst) {
+			auto it = leafOfBrick.find(ImportBrickKey(node->mPos, LOG2DIM));
+			if (it == leafOfBrick.end()) return;
+			const float* src = leaves[it->second].mValues;
+			for (int z = 0; z < brickres; z++) {
+				for (int y = 0; y < brickres; y++) {
+					for (int x = 0; x < brickres; x++) {
+						*dst++ = src[(x * brickres + y) * brickres + z];
+					}
+				}
+			}
+		});
+	}
+
+	using ImportLeavesFunc = void(*)(VolumeGVDB&, uchar, const uint8_t*, int, Vector3DI, float);
+
+	// Table of instantiations of ImportLeaves, [leaf log2dim - 2].
+	static const ImportLeavesFunc importLeavesFuncs[6] = {
+		ImportLeaves<2>, ImportLeaves<3>, ImportLeaves<4>, ImportLeaves<5>, ImportLeaves<6>, ImportLeaves<7>
+	};
+
+	bool LoadNanoVDB(VolumeGVDB& gvdb, uchar channel, const uint8_t* grid, size_t size)
+	{
+		if (grid == nullptr || size < sizeof(GridData) + sizeof(TreeData<TREE_DEPTH>)) {
+			gprintf("Error in LoadNanoVDB: The buffer is too small to hold a NanoVDB grid.\n");
+			return false;
+		}
+		const GridData* gridData = reinterpret_cast<const GridData*>(grid);
+		if (gridData->mMagic != NANOVDB_MAGIC_NUMBER) {
+			gprintf("Error in LoadNanoVDB: The buffer does not start with a NanoVDB grid.\n");
+			return false;
+		}
+		if (gridData->mGridType != GridType::Float) {
+			gprintf("Error in LoadNanoVDB: Only float grids can be loaded.\n");
+			return false;
+		}
+		if (gvdb.mPool == nullptr || channel >= gvdb.mPool->getNumAtlas()
+			|| gvdb.mPool->getAtlas(channel).type != T_FLOAT) {
+			gprintf("Error in LoadNanoVDB: Channel %u must exist and be T_FLOAT.\n",
+				static_cast<unsigned int>(channel));
+			return false;
+		}
+
+		// The file doesn't store its branching factors, so check that the region sizes agree with
+		// the GVDB configuration instead.
+		const int brickLog2Dim = gvdb.getLD(0);
+		const int node1Log2Dim = gvdb.getLD(1);
+		const int node2Log2Dim = gvdb.getLD(2);
+		for (int level = 0; level < TREE_DEPTH; level++) {
+			if (gvdb.getLD(level) < 2 || gvdb.getLD(level) > 7) {
+				gprintf("Error in LoadNanoVDB: The level-%d log2dim (%d) was outside of the range [2,7].\n",
+					level, gvdb.getLD(level));
+				return false;
+			}
+		}
+		const uint8_t* treeStart = grid + sizeof(GridData);
+		const TreeData<TREE_DEPTH>* treeData = reinterpret_cast<const TreeData<TREE_DEPTH>*>(treeStart);
+		const NanoVDBTypeSizes typeSizes = ComputeTypeSizes(T_FLOAT, brickLog2Dim, node1Log2Dim, node2Log2Dim);
+		const uint64_t numLeaves = treeData->mCount[0];
+		if (treeData->mBytes[1] - treeData->mBytes[2] != treeData->mCount[2] * typeSizes.node2
+			|| treeData->mBytes[0] - treeData->mBytes[1] != treeData->mCount[1] * typeSizes.node1
+			|| sizeof(GridData) + treeData->mBytes[0] + numLeaves * typeSizes.leaf > size) {
+			gprintf("Error in LoadNanoVDB: The grid's node layout does not match the GVDB log2dims "
+				"(%d, %d, %d).\n", node2Log2Dim, node1Log2Dim, brickLog2Dim);
+			return false;
+		}
+		if (numLeaves == 0 || numLeaves > INT_MAX) {
+			gprintf("Error in LoadNanoVDB: Unsupported number of leaves (%llu).\n",
+				static_cast<unsigned long long>(numLeaves));
+			return false;
+		}
+
+		PERF_PUSH("LoadNanoVDB");
+		const RootDataPrototype<float>* rootData =
+			reinterpret_cast<const RootDataPrototype<float>*>(treeStart + treeData->mBytes[3]);
+		const float background = rootData->mBackground;
+
+		// GVDB expects positive coordinates, so shift the volume by whole level-2 nodes (keeping the
+		// same node boundaries) and move the shift into the transform: the pretranslation adds `offset`
+		// back, so GVDB and NanoVDB agree on world positions. Rotations in the NanoVDB map are not
+		// carried over.
+		const int totalLog2Dim = brickLog2Dim + node1Log2Dim + node2Log2Dim;
+		const CoordBBox& indexAABB = rootData->mBBox;
+		const Vector3DI offset((indexAABB.min()[0] >> totalLog2Dim) << totalLog2Dim,
+			(indexAABB.min()[1] >> totalLog2Dim) << totalLog2Dim,
+			(indexAABB.min()[2] >> totalLog2Dim) << totalLog2Dim);
+		const Vec3R voxelSize = gridData->mVoxelSize;
+		const Vec3R origin = gridData->applyMap(Vec3R(0, 0, 0));
+
+		gvdb.Clear();
+		gvdb.SetTransform(Vector3DF(float(offset.x), float(offset.y), float(offset.z)),
+			Vector3DF(float(voxelSize[0]), float(voxelSize[1]), float(voxelSize[2])),
+			Vector3DF(0, 0, 0), Vector3DF(float(origin[0]), float(origin[1]), float(origin[2])));
+
+		importLeavesFuncs[brickLog2Dim - 2](gvdb, channel, treeStart + treeData->mBytes[0],
+			static_cast<int>(numLeaves), offset, background);
+		PERF_POP();
+		return true;
+	}
+
+	bool LoadNanoVDB(VolumeGVDB& gvdb, uchar channel, const std::string& filename)
+	{
+		GridHandle<HostBuffer> handle;
+		try {
+			handle = io::readGrid(filename);
+		}
+		catch (const std::exception& e) {
+			gprintf("Error in LoadNanoVDB: Could not read %s: %s\n", filename.c_str(), e.what());
+			return false;
+		}
+		return LoadNanoVDB(gvdb, channel, handle.data(), handle.size());
+	}
+
 	void RenderNanoVDB(CUcontext context, CUdeviceptr nanoVDB, Camera3D* camera,
 		uint width, uint height, uchar* outImage)
 	{
@@ -18,9 +18,8 @@
 #define NOMINMAX
 #include "gvdb.h"
 
-#ifdef USE_BITMASKS
-#error As of this writing, GVDB-to-NanoVDB conversion requires not using bitmasks.
-#endif // #ifdef USE_BITMASKS
+#include <string>
+#include <vector>
 
 #ifdef NDEBUG
 static const bool DEBUG_EXPORT_NANOVDB = false;
@@ -77,6 +76,23 @@ namespace nvdb {
 	CUdeviceptr ExportToNanoVDB(VolumeGVDB& gvdb, uchar channel, void* backgroundPtr,
 		const char gridName[nanovdb::GridData::MaxNameSize], nanovdb::GridClass gridClass, size_t* outTotalSize);
 
+	// Same as ExportToNanoVDB, but builds the NanoVDB grid in host memory: the node pools are
+	// walked on the CPU in parallel, and only the atlas is read back from the GPU. On success,
+	// outGrid holds the grid (with the same layout and type mapping as above) and true is returned.
+	bool ExportToNanoVDBHost(VolumeGVDB& gvdb, uchar channel, void* backgroundPtr,
+		const char gridName[nanovdb::GridData::MaxNameSize], nanovdb::GridClass gridClass,
+		std::vector<uint8_t>& outGrid);
+
+	// Writes a grid returned by ExportToNanoVDBHost to a .nvdb file. Returns false on failure.
+	bool SaveNanoVDB(const std::string& filename, const std::vector<uint8_t>& grid);
+
+	// Replaces the contents of the GVDB volume with a NanoVDB float grid, read from memory or from
+	// a .nvdb file. The grid's leaf, level-1 and level-2 log2dims must match gvdb.getLD(0..2), and
+	// `channel` must be an existing T_FLOAT channel. Leaves become bricks, and their values are
+	// copied into the atlas in parallel; tiles are not imported. Does not require OpenVDB.
+	bool LoadNanoVDB(VolumeGVDB& gvdb, uchar channel, const uint8_t* grid, size_t size);
+	bool LoadNanoVDB(VolumeGVDB& gvdb, uchar channel, const std::string& filename);
+
 	// Renders a level set of a NanoGridCustom<float, 5, 4, 3> on the GPU. Switches to the given
 	// CUDA context before rendering.
 	void RenderNanoVDB(CUcontext context, CUdeviceptr nanoVDB, Camera3D* camera,
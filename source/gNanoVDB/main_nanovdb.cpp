@@ -7,6 +7,8 @@
 //----------------------------------------------------------------------------------
 
 #include <algorithm> // for min/max
+#include <atomic>
+#include <cmath>
 
 // GVDB export to NanoVDB
 #include "gvdb_export_nanovdb.h"
@@ -14,6 +16,9 @@
 // Sample utilities
 #include "file_png.h"
 
+// For the import round-trip check
+#include <nanovdb/util/Primitives.h>
+
 VolumeGVDB gvdb;
 
 int main(int argc, char* argv) {
@@ -59,6 +64,15 @@ int main(int argc, char* argv) {
 	CUdeviceptr deviceGrid = ExportToNanoVDB(gvdb, 0, &background, gridName, nanovdb::GridClass::LevelSet, &gridSize);
 	gprintf("Finished converting to a NanoVDB volume in %f ms.\n", gvdb.TimerStop());
 
+	// The same volume can also be exported into host memory, and saved as a .nvdb file.
+	gvdb.TimerStart();
+	std::vector<uint8_t> hostGrid;
+	if (ExportToNanoVDBHost(gvdb, 0, &background, gridName, nanovdb::GridClass::LevelSet, hostGrid)
+		&& SaveNanoVDB("explosion.nvdb", hostGrid)) {
+		gprintf("Saved explosion.nvdb (%llu bytes) in %f ms.\n",
+			static_cast<unsigned long long>(hostGrid.size()), gvdb.TimerStop());
+	}
+
 	// Render the volume using the render kernel in cuda_export_nanovdb.cu.
 	gprintf("Rendering...\n");
 	gvdb.TimerStart();
@@ -91,5 +105,42 @@ int main(int argc, char* argv) {
 	CUcontext tempContext;
 	cudaCheck(cuCtxPopCurrent(&tempContext), "", "main", "cuCtxPopCurrent", "tempContext", DEBUG_EXPORT_NANOVDB);
 
+	// Round-trip check for LoadNanoVDB: build a level set sphere whose index coordinates are all
+	// negative, load it into GVDB, and compare each GVDB voxel with the NanoVDB value at the same
+	// world position.
+	gprintf("Loading a NanoVDB sphere with negative coordinates.\n");
+	auto sphereHandle = nanovdb::createLevelSetSphere<float>(20.0f, { -70.0f, -50.0f, -40.0f }, 0.5f);
+	const nanovdb::NanoGrid<float>* sphereGrid = sphereHandle.grid<float>();
+	gvdb.Configure(5, 5, 5, 4, 3);	// same node sizes as nanovdb::NanoGrid<float>
+	gvdb.DestroyChannels();
+	gvdb.AddChannel(0, T_FLOAT, 1);
+	if (sphereGrid == nullptr
+		|| !LoadNanoVDB(gvdb, 0, static_cast<const uint8_t*>(sphereHandle.data()), sphereHandle.size())) {
+		gprintf("Could not load the sphere.\n");
+		exit(-1);
+	}
+	std::atomic<uint64_t> numChecked(0), numMismatched(0);
+	const Matrix4F& xform = gvdb.getTransform();
+	gvdb.ForEachLeaf(0, [&](int chunk, const BrickView& brick) {
+		auto acc = sphereGrid->getAccessor();
+		uint64_t checked = 0, mismatched = 0;
+		for (VoxelIterator v(brick); v; ++v) {
+			const Vector3DF world = xform.TransformPoint(Vector3DF(v.pos()));
+			const nanovdb::Vec3d index = sphereGrid->worldToIndex(nanovdb::Vec3d(world.x, world.y, world.z));
+			const nanovdb::Coord ijk(int(std::floor(index[0] + 0.5)), int(std::floor(index[1] + 0.5)),
+				int(std::floor(index[2] + 0.5)));
+			if (acc.getValue(ijk) != v.value<float>()) mismatched++;
+			checked++;
+		}
+		numChecked += checked;
+		numMismatched += mismatched;
+	});
+	gprintf("Round trip: %llu of %llu voxels differ between NanoVDB and GVDB.\n",
+		static_cast<unsigned long long>(numMismatched.load()), static_cast<unsigned long long>(numChecked.load()));
+	if (numChecked == 0 || numMismatched != 0) {
+		gprintf("Round-trip check failed.\n");
+		exit(-1);
+	}
+
 	printf("Done!\n");
 }
\ No newline at end of file
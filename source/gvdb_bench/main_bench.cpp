@@ -0,0 +1,540 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+// gvdb_bench: host-side microbenchmarks for the core GVDB paths.
+//
+// Usage: gvdb_bench [size] [repeats] [output.json] [model.obj] [--hostmem=<policy>]
+//   size     Bricks per axis of the test domain (default 16, i.e. 16^3 bricks).
+//   repeats  Number of timed runs per benchmark; min and median are reported (default 3).
+//   output   JSON output file. If omitted, JSON is written to stdout.
+//   model    OBJ model for parse/voxelize benchmarks (default lucy.obj from shared_assets).
+//   policy   Host memory policy for pools and atlas, comma separated:
+//            default|thp|hugetlb [,interleave] [,firsttouch]   (e.g. --hostmem=thp,firsttouch)
+//            Run once with and once without to compare.
+
+#include "gvdb.h"
+using namespace nvdb;
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct BenchResult {
+	std::string	name;
+	double		ms_min;
+	double		ms_median;
+	uint64		items;				// work items per run (nodes, queries, triangles..)
+	uint64		bytes;				// bytes moved per run, 0 if not meaningful
+};
+
+static std::vector<BenchResult>	g_results;
+static int						g_repeats = 3;
+static std::string				g_hostmem = "default";
+
+static double msElapsed ( std::chrono::high_resolution_clock::time_point t0 )
+{
+	return std::chrono::duration<double, std::milli> ( std::chrono::high_resolution_clock::now() - t0 ).count();
+}
+
+// Runs `setup` (untimed) then `body` (timed) g_repeats times. `body` returns item count.
+static void RunBench ( const char* name, std::function<void()> setup, std::function<uint64()> body, uint64 bytes = 0 )
+{
+	std::vector<double> times;
+	uint64 items = 0;
+	for (int r = 0; r < g_repeats; r++) {
+		if ( setup ) setup ();
+		auto t0 = std::chrono::high_resolution_clock::now ();
+		items = body ();
+		times.push_back ( msElapsed ( t0 ) );
+	}
+	std::sort ( times.begin(), times.end() );
+	BenchResult res;
+	res.name = name;
+	res.ms_min = times.front();
+	res.ms_median = times[ times.size()/2 ];
+	res.items = items;
+	res.bytes = bytes;
+	g_results.push_back ( res );
+	fprintf ( stderr, "%-20s %10.3f ms  (%llu items)\n", name, res.ms_median, (unsigned long long) items );
+}
+
+static void WriteJSON ( FILE* fp, int size, const Counters& cnt, const std::vector<MemUsage>& mem, const MemUsage& memtotal )
+{
+	fprintf ( fp, "{\n  \"size\": %d,\n  \"repeats\": %d,\n  \"hostmem\": \"%s\",\n  \"simd\": \"%s\",\n  \"xform_avx2\": %s,\n  \"benchmarks\": [\n", size, g_repeats, g_hostmem.c_str(), getVecSimd(), hasTransformAVX2() ? "true" : "false" );
+	for (size_t n = 0; n < g_results.size(); n++) {
+		const BenchResult& r = g_results[n];
+		double sec = r.ms_median / 1000.0;
+		fprintf ( fp, "    { \"name\": \"%s\", \"ms_min\": %.4f, \"ms_median\": %.4f, \"items\": %llu, \"items_per_sec\": %.1f",
+			r.name.c_str(), r.ms_min, r.ms_median, (unsigned long long) r.items, (sec > 0) ? r.items / sec : 0.0 );
+		if ( r.bytes > 0 )
+			fprintf ( fp, ", \"bytes\": %llu, \"mb_per_sec\": %.2f", (unsigned long long) r.bytes, (sec > 0) ? (r.bytes / (1024.0*1024.0)) / sec : 0.0 );
+		fprintf ( fp, " }%s\n", (n+1 < g_results.size()) ? "," : "" );
+	}
+	fprintf ( fp, "  ],\n  \"counters\": {\n" );
+	fprintf ( fp, "    \"pool_grow\": %llu, \"pool_grow_bytes\": %llu,\n", (unsigned long long) cnt.poolGrow, (unsigned long long) cnt.poolGrowBytes );
+	fprintf ( fp, "    \"brick_activate\": %llu, \"brick_deactivate\": %llu, \"atlas_resize\": %llu,\n", (unsigned long long) cnt.brickActivate, (unsigned long long) cnt.brickDeactivate, (unsigned long long) cnt.atlasResize );
+	fprintf ( fp, "    \"commit_bytes\": %llu, \"retrieve_bytes\": %llu,\n", (unsigned long long) cnt.commitBytes, (unsigned long long) cnt.retrieveBytes );
+	fprintf ( fp, "    \"vbx_read_bytes\": %llu, \"vbx_write_bytes\": %llu,\n", (unsigned long long) cnt.vbxReadBytes, (unsigned long long) cnt.vbxWriteBytes );
+	fprintf ( fp, "    \"arena_hit\": %llu, \"arena_miss\": %llu\n", (unsigned long long) cnt.arenaHit, (unsigned long long) cnt.arenaMiss );
+	fprintf ( fp, "  },\n  \"memory\": [\n" );
+	for (size_t n = 0; n <= mem.size(); n++) {
+		const MemUsage& m = (n < mem.size()) ? mem[n] : memtotal;
+		fprintf ( fp, "    { \"category\": \"%s\", \"id\": %d, \"cpu\": %llu, \"gpu\": %llu, \"cpu_peak\": %llu, \"gpu_peak\": %llu }%s\n",
+			Allocator::getMemCategoryName ( m.category ), m.id, (unsigned long long) m.cpu, (unsigned long long) m.gpu,
+			(unsigned long long) m.cpuPeak, (unsigned long long) m.gpuPeak, (n < mem.size()) ? "," : "" );
+	}
+	fprintf ( fp, "  ]\n}\n" );
+}
+
+// Conservative triangle/box overlap used by the CPU voxelizer: bounding box test
+// followed by a separating-plane test against the triangle plane.
+static bool TriangleTouchesBox ( Vector3DF v0, Vector3DF v1, Vector3DF v2, Vector3DF bmin, Vector3DF bmax )
+{
+	Vector3DF c = bmin; c += bmax; c *= 0.5f;
+	Vector3DF h = bmax; h -= bmin; h *= 0.5f;
+	Vector3DF e0 = v1; e0 -= v0;
+	Vector3DF e1 = v2; e1 -= v0;
+	Vector3DF nrm = e0; nrm.Cross ( e1 );
+	Vector3DF d = c; d -= v0;
+	float dist = fabs ( nrm.Dot ( d ) );
+	float rad = h.x*fabs(nrm.x) + h.y*fabs(nrm.y) + h.z*fabs(nrm.z);
+	return dist <= rad;
+}
+
+// Scalar references for the vector math benchmarks (the pre-SIMD implementations).
+static void ScalarMul4 ( const float* orig, const float* op, float* out )
+{
+	for (int c = 0; c < 4; c++)
+		for (int r = 0; r < 4; r++)
+			out[4*c+r] = op[4*c]*orig[r] + op[4*c+1]*orig[4+r] + op[4*c+2]*orig[8+r] + op[4*c+3]*orig[12+r];
+}
+static Vector3DF ScalarXform ( const float* m, const Vector3DF& p )
+{
+	return Vector3DF ( m[0]*p.x + m[4]*p.y + m[8]*p.z + m[12], m[1]*p.x + m[5]*p.y + m[9]*p.z + m[13], m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14] );
+}
+
+// Matrix4F / Vector4DF microbenchmarks, scalar reference vs. the library (SIMD) paths.
+static void RunMathBench ()
+{
+	const int cnt = 1 << 16;
+	std::mt19937 rng ( 777 );
+	std::uniform_real_distribution<float> u ( -2.0f, 2.0f );
+	std::vector<Matrix4FA> mats ( cnt );
+	std::vector<Vector3DF> pnts ( cnt );
+	for (int n = 0; n < cnt; n++) {
+		for (int i = 0; i < 16; i++) mats[n].data[i] = u(rng);
+		pnts[n].Set ( u(rng), u(rng), u(rng) );
+	}
+	Matrix4FA acc;
+	volatile float sink = 0;
+
+	RunBench ( "mat4_mul_scalar", 0x0, [&]() -> uint64 {
+		float a[16], t[16];
+		memcpy ( a, acc.data, sizeof(a) );
+		for (int n = 0; n < cnt; n++) { ScalarMul4 ( a, mats[n].data, t ); memcpy ( a, t, sizeof(a) ); a[15] = 1.0f; }
+		sink = a[0];
+		return cnt; } );
+	RunBench ( "mat4_mul", 0x0, [&]() -> uint64 {
+		Matrix4FA a = acc;
+		for (int n = 0; n < cnt; n++) { a *= mats[n]; a.data[15] = 1.0f; }
+		sink = a.data[0];
+		return cnt; } );
+	RunBench ( "mat4_xform_scalar", 0x0, [&]() -> uint64 {
+		Vector3DF s ( 0, 0, 0 );
+		for (int r = 0; r < 16; r++)
+			for (int n = 0; n < cnt; n++) s += ScalarXform ( mats[r].data, pnts[n] );
+		sink = s.x;
+		return (uint64) cnt * 16; } );
+	RunBench ( "mat4_xform", 0x0, [&]() -> uint64 {
+		Vector3DF s ( 0, 0, 0 );
+		for (int r = 0; r < 16; r++)
+			for (int n = 0; n < cnt; n++) s += mats[r].TransformPoint ( pnts[n] );
+		sink = s.x;
+		return (uint64) cnt * 16; } );
+	// Batched transforms of a packed xyz array, against one TransformPoint per point.
+	const uint64 npts = uint64(1) << 22;
+	std::vector<float> aos ( npts * 3 ), soa ( npts * 3 ), outp ( npts * 3 );
+	for (uint64 n = 0; n < npts * 3; n++) aos[n] = soa[n] = u(rng);
+	Matrix4F xf = mats[0];
+	RunBench ( "xform_points_scalar", 0x0, [&]() -> uint64 {
+		const Vector3DF* src = (const Vector3DF*) aos.data();
+		Vector3DF* dst = (Vector3DF*) outp.data();
+		for (uint64 n = 0; n < npts; n++) dst[n] = xf.TransformPoint ( src[n] );
+		return npts; }, npts * 24 );
+	RunBench ( "xform_points", 0x0, [&]() -> uint64 {
+		TransformPoints ( xf, aos.data(), outp.data(), npts, 3 );
+		return npts; }, npts * 24 );
+	RunBench ( "xform_points_soa", 0x0, [&]() -> uint64 {
+		float* s = soa.data(); float* o = outp.data();
+		TransformPointsSoA ( xf, s, s + npts, s + 2*npts, o, o + npts, o + 2*npts, npts );
+		return npts; }, npts * 24 );
+	RunBench ( "xform_bounds", 0x0, [&]() -> uint64 {
+		Vector3DF bmin, bmax;
+		TransformPointsBounds ( xf, aos.data(), 0x0, npts, 3, bmin, bmax );
+		sink = bmin.x;
+		return npts; }, npts * 12 );
+
+	RunBench ( "mat4_invert_trs", 0x0, [&]() -> uint64 {
+		float s = 0;
+		for (int n = 0; n < cnt; n++) { Matrix4FA m = mats[n]; m.InvertTRS (); s += m.data[0]; }
+		sink = s;
+		return cnt; } );
+	RunBench ( "mat4_invert_fast", 0x0, [&]() -> uint64 {
+		float s = 0;
+		for (int n = 0; n < cnt; n++) { Matrix4FA m = mats[n]; m.InvertFast (); s += m.data[0]; }
+		sink = s;
+		return cnt; } );
+}
+
+// Parses "thp,interleave,firsttouch" style policy strings. Returns false on unknown tokens.
+static bool ParseHostMem ( std::string str, HostMemPolicy& p )
+{
+	size_t s = 0;
+	while ( s <= str.size() ) {
+		size_t e = str.find ( ',', s );
+		if ( e == std::string::npos ) e = str.size();
+		std::string tok = str.substr ( s, e-s );
+		if ( tok == "default" )			p.pages = HOST_PAGES_DEFAULT;
+		else if ( tok == "thp" )		p.pages = HOST_PAGES_THP;
+		else if ( tok == "hugetlb" )	p.pages = HOST_PAGES_HUGETLB;
+		else if ( tok == "interleave" ) p.numa = HOST_NUMA_INTERLEAVE;
+		else if ( tok == "firsttouch" ) p.firstTouch = true;
+		else if ( !tok.empty() )		return false;
+		s = e + 1;
+	}
+	return true;
+}
+
+int main ( int argc, char** argv )
+{
+	int size = 16;
+	const char* outname = 0x0;
+	std::string modelname = "lucy.obj";
+	HostMemPolicy policy;
+	int pos = 0;
+	for (int a = 1; a < argc; a++) {
+		std::string arg = argv[a];
+		if ( arg.compare ( 0, 10, "--hostmem=" ) == 0 ) {
+			g_hostmem = arg.substr ( 10 );
+			if ( !ParseHostMem ( g_hostmem, policy ) ) { fprintf ( stderr, "Unknown host memory policy: %s\n", g_hostmem.c_str() ); exit(-1); }
+			continue;
+		}
+		switch ( pos++ ) {
+		case 0: size = atoi ( argv[a] );		break;
+		case 1: g_repeats = atoi ( argv[a] );	break;
+		case 2: outname = argv[a];				break;
+		case 3: modelname = argv[a];			break;
+		}
+	}
+	if ( size < 1 ) size = 1;
+	if ( g_repeats < 1 ) g_repeats = 1;
+
+	VolumeGVDB gvdb;
+	gvdb.SetVerbose ( false );
+	gvdb.SetCudaDevice ( GVDB_DEV_FIRST );
+	gvdb.Initialize ();
+	gvdb.mPool->SetHostMemPolicy ( policy );
+	gvdb.AddPath ( "../source/shared_assets/" );
+	gvdb.AddPath ( "../shared_assets/" );
+	gvdb.AddPath ( ASSET_PATH );
+	gvdb.ResetCounters ();
+
+	const int brickres = 8;											// Configure(3,3,3,3,3) => 8^3 bricks
+	const int domain = size * brickres;
+	const uint64 numBricks = (uint64) size * size * size;
+
+	// Brick centers in shuffled order, so activation does not walk the tree coherently.
+	std::mt19937 rng ( 12345 );
+	std::vector<Vector3DF> centers;
+	centers.reserve ( numBricks );
+	for (int z = 0; z < size; z++)
+		for (int y = 0; y < size; y++)
+			for (int x = 0; x < size; x++)
+				centers.push_back ( Vector3DF( x*brickres + brickres/2, y*brickres + brickres/2, z*brickres + brickres/2 ) );
+	std::shuffle ( centers.begin(), centers.end(), rng );
+
+	// Random query points, roughly half inside the activated domain (1.26^3 ~ 2).
+	const int numQuery = 1 << 20;
+	std::vector<Vector3DF> queries ( numQuery );
+	std::uniform_real_distribution<float> uq ( 0.0f, domain * 1.26f );
+	for (int n = 0; n < numQuery; n++)
+		queries[n].Set ( uq(rng), uq(rng), uq(rng) );
+
+	RunMathBench ();
+
+	// PoolAlloc growth: the default configuration starts with tiny pools, so this
+	// measures repeated pool growth while allocating one leaf per brick.
+	RunBench ( "pool_alloc",
+		[&]() { gvdb.Configure ( 3, 3, 3, 3, 3 ); },
+		[&]() -> uint64 {
+			for (uint64 n = 0; n < numBricks; n++) gvdb.AllocateNode ( 0 );
+			return numBricks;
+		} );
+
+	// ActivateSpace, one root-to-leaf descent per brick.
+	RunBench ( "activate_single",
+		[&]() { gvdb.Configure ( 3, 3, 3, 3, 3 ); },
+		[&]() -> uint64 {
+			for (uint64 n = 0; n < numBricks; n++) gvdb.ActivateSpace ( centers[n] );
+			return numBricks;
+		} );
+
+	// Bulk activation of the same domain through ActivateRegion.
+	RunBench ( "activate_bulk",
+		[&]() { gvdb.Configure ( 3, 3, 3, 3, 3 ); gvdb.ActivateSpace ( Vector3DF(0,0,0) ); },
+		[&]() -> uint64 {
+			Extents e = gvdb.ComputeExtents ( 1, Vector3DF(0,0,0), Vector3DF(domain, domain, domain) );
+			return gvdb.ActivateRegion ( 0, e );
+		} );
+
+	// Build the reference topology for the remaining benchmarks.
+	gvdb.Configure ( 3, 3, 3, 3, 3 );
+	gvdb.AddChannel ( 0, T_FLOAT, 1 );
+	for (uint64 n = 0; n < numBricks; n++) gvdb.ActivateSpace ( centers[n] );
+	gvdb.FinishTopology ();
+
+	RunBench ( "update_atlas", 0x0,
+		[&]() -> uint64 { gvdb.UpdateAtlas (); return gvdb.getNumUsedNodes ( 0 ); } );
+
+	RunBench ( "update_neighbors", 0x0,
+		[&]() -> uint64 { gvdb.UpdateNeighbors (); return gvdb.getNumUsedNodes ( 0 ); } );
+
+	// Per-frame aux buffer churn: point counts vary frame to frame as in a streaming loop.
+	RunBench ( "aux_prepare_cycle", 0x0,
+		[&]() -> uint64 {
+			const int frames = 256;
+			for (int f = 0; f < frames; f++) {
+				int cnt = (1 << 20) + ((f * 7919) % 1024) * 512;
+				gvdb.PrepareAux ( AUX_PNODE, cnt, sizeof(int), false );
+				gvdb.PrepareAux ( AUX_PNDX, cnt, sizeof(int), false );
+				gvdb.PrepareAux ( AUX_GRIDCNT, cnt / 64, sizeof(int), true, true );
+				gvdb.CleanAux ( AUX_PNODE );
+				gvdb.CleanAux ( AUX_PNDX );
+			}
+			return frames;
+		} );
+
+	RunBench ( "query_isActive", 0x0,
+		[&]() -> uint64 {
+			for (int n = 0; n < numQuery; n++)
+				gvdb.isActive ( Vector3DI(queries[n]) );
+			return numQuery;
+		} );
+
+	// Same queries on the runtime descent, for comparison with the specialized tree shape.
+	gvdb.SetTreeSpecialize ( false );
+	RunBench ( "query_isActive_runtime", 0x0,
+		[&]() -> uint64 {
+			for (int n = 0; n < numQuery; n++)
+				gvdb.isActive ( Vector3DI(queries[n]) );
+			return numQuery;
+		} );
+	gvdb.SetTreeSpecialize ( true );
+
+	// Frustum cull to leaves from a camera at the domain corner looking at its center (partial view).
+	Camera3D cam;
+	cam.setFov ( 50.0f );
+	cam.setNearFar ( 1.0f, domain * 4.0f );
+	cam.setPos ( -domain * 0.25f, domain * 0.5f, -domain * 0.25f );
+	cam.setToPos ( domain * 0.5f, domain * 0.5f, domain * 0.5f );
+	RunBench ( "cull_nodes", 0x0,
+		[&]() -> uint64 { return gvdb.CullNodes ( cam, 0 ).size(); } );
+
+	// Stream every visible brick through the prefetcher from a synthetic loader.
+	RunBench ( "prefetch_stream", 0x0,
+		[&]() -> uint64 {
+			BrickPrefetcher pf ( &gvdb, 0, []( uint64, Vector3DI pos, char* dst, uint64 bytes ) -> bool {
+				float* v = (float*) dst;
+				for (uint64 i = 0; i < bytes / sizeof(float); i++) v[i] = float(pos.x);
+				return true;
+			} );
+			pf.Prioritize ( cam );
+			while ( !pf.isIdle() )
+				if ( pf.Update() == 0 ) std::this_thread::yield ();
+			return pf.getNumResident ();
+		} );
+
+	// getValue reads from a host copy of the atlas; contents are irrelevant for timing.
+	Vector3DI ares = gvdb.mPool->getAtlasRes ( 0 );
+	uint64 atlasBytes = (uint64) ares.x * ares.y * ares.z * sizeof(float);
+	float* hostAtlas = (float*) gvdb.mPool->HostAlloc ( atlasBytes, true );
+	RunBench ( "query_getValue", 0x0,
+		[&]() -> uint64 {
+			slong root = gvdb.getRootID ();
+			volatile float sum = 0;
+			for (int n = 0; n < numQuery; n++)
+				sum += gvdb.getValue ( root, queries[n], hostAtlas );
+			return numQuery;
+		} );
+	gvdb.SetTreeSpecialize ( false );
+	RunBench ( "query_getValue_runtime", 0x0,
+		[&]() -> uint64 {
+			slong root = gvdb.getRootID ();
+			volatile float sum = 0;
+			for (int n = 0; n < numQuery; n++)
+				sum += gvdb.getValue ( root, queries[n], hostAtlas );
+			return numQuery;
+		} );
+	gvdb.SetTreeSpecialize ( true );
+	gvdb.mPool->HostFree ( (char*) hostAtlas );
+
+	// Sum every active voxel on the host, one partial sum per chunk (a cache line apart).
+	RunBench ( "foreach_voxel", 0x0,
+		[&]() -> uint64 {
+			std::vector<double> part ( getNumThreads() * 8, 0.0 );
+			std::vector<uint64> cnt ( getNumThreads() * 8, 0 );
+			gvdb.ForEachActiveVoxel<float> ( 0, Vector3DI(INT_MIN, INT_MIN, INT_MIN), Vector3DI(INT_MAX, INT_MAX, INT_MAX),
+				[&]( int c, const Vector3DI&, float v ) { part[c*8] += v; cnt[c*8]++; } );
+			uint64 total = 0;
+			for (size_t c = 0; c < cnt.size(); c += 8) total += cnt[c];
+			return total;
+		} );
+
+	// Host allocation under the selected policy: allocate, zero (first touch) and
+	// stream over a large buffer, as a pool or atlas growth would.
+	const uint64 hostBytes = uint64(256) << 20;
+	RunBench ( "host_alloc_touch", 0x0,
+		[&]() -> uint64 {
+			char* buf = gvdb.mPool->HostAlloc ( hostBytes, true );
+			volatile uint64 sum = 0;
+			for (uint64 i = 0; i < hostBytes; i += 4096) sum += buf[i];
+			gvdb.mPool->HostFree ( buf );
+			return hostBytes / 4096;
+		}, hostBytes );
+
+	// VBX save/load throughput.
+	std::string vbxname = "gvdb_bench_tmp.vbx";
+	gvdb.SaveVBX ( vbxname );
+	FILE* fp = fopen ( vbxname.c_str(), "rb" );
+	uint64 vbxbytes = 0;
+	if ( fp != 0x0 ) { fseek ( fp, 0, SEEK_END ); vbxbytes = ftell ( fp ); fclose ( fp ); }
+
+	RunBench ( "vbx_save", 0x0,
+		[&]() -> uint64 { gvdb.SaveVBX ( vbxname ); return gvdb.getNumUsedNodes ( 0 ); }, vbxbytes );
+
+	RunBench ( "vbx_load", 0x0,
+		[&]() -> uint64 { gvdb.LoadVBX ( vbxname ); return gvdb.getNumUsedNodes ( 0 ); }, vbxbytes );
+	remove ( vbxname.c_str() );
+
+	// OBJ parse and CPU voxelize.
+	char modelpath[1024];
+	if ( gvdb.FindFile ( modelname, modelpath ) ) {
+		uint64 objbytes = 0;
+		fp = fopen ( modelpath, "rb" );
+		if ( fp != 0x0 ) { fseek ( fp, 0, SEEK_END ); objbytes = ftell ( fp ); fclose ( fp ); }
+
+		Model* m = 0x0;
+		RunBench ( "obj_parse",
+			[&]() { delete m; m = new Model; },
+			[&]() -> uint64 { gvdb.getScene()->LoadModel ( m, modelpath, 1.0f, 0, 0, 0 ); return m->getNumElem(); }, objbytes );
+
+		// Fit the model into the benchmark domain.
+		Vector3DF vmin( 1e30f, 1e30f, 1e30f), vmax(-1e30f,-1e30f,-1e30f);
+		for (int n = 0; n < m->getNumVert(); n++) {
+			Vector3DF p = m->getVert(n)->pos;
+			vmin.x = std::min(vmin.x, p.x); vmin.y = std::min(vmin.y, p.y); vmin.z = std::min(vmin.z, p.z);
+			vmax.x = std::max(vmax.x, p.x); vmax.y = std::max(vmax.y, p.y); vmax.z = std::max(vmax.z, p.z);
+		}
+		Vector3DF ext = vmax; ext -= vmin;
+		float s = (domain - 1) / std::max( ext.x, std::max( ext.y, ext.z ) );
+
+		// Conservative surface voxelization at brick granularity: every brick touched
+		// by a triangle is activated.
+		RunBench ( "cpu_voxelize",
+			[&]() { gvdb.Configure ( 3, 3, 3, 3, 3 ); },
+			[&]() -> uint64 {
+				for (int f = 0; f < m->getNumElem(); f++) {
+					Vector3DI vi = m->getFace(f)->vert;
+					Vector3DF v[3] = { m->getVert(vi.x)->pos, m->getVert(vi.y)->pos, m->getVert(vi.z)->pos };
+					Vector3DF tmin ( 1e30f, 1e30f, 1e30f), tmax(-1e30f,-1e30f,-1e30f);
+					for (int k = 0; k < 3; k++) {
+						v[k] -= vmin; v[k] *= s;
+						tmin.x = std::min(tmin.x, v[k].x); tmin.y = std::min(tmin.y, v[k].y); tmin.z = std::min(tmin.z, v[k].z);
+						tmax.x = std::max(tmax.x, v[k].x); tmax.y = std::max(tmax.y, v[k].y); tmax.z = std::max(tmax.z, v[k].z);
+					}
+					Vector3DI bmin ( int(tmin.x) / brickres, int(tmin.y) / brickres, int(tmin.z) / brickres );
+					Vector3DI bmax ( int(tmax.x) / brickres, int(tmax.y) / brickres, int(tmax.z) / brickres );
+					for (int z = bmin.z; z <= bmax.z; z++)
+						for (int y = bmin.y; y <= bmax.y; y++)
+							for (int x = bmin.x; x <= bmax.x; x++) {
+								Vector3DF lo ( x*brickres, y*brickres, z*brickres );
+								Vector3DF hi = lo; hi += Vector3DF(brickres, brickres, brickres);
+								if ( TriangleTouchesBox ( v[0], v[1], v[2], lo, hi ) ) {
+									lo += Vector3DF(brickres/2, brickres/2, brickres/2);
+									gvdb.ActivateSpace ( lo );
+								}
+							}
+				}
+				return m->getNumElem();
+			} );
+		delete m;
+	} else {
+		fprintf ( stderr, "Cannot find model %s, skipping obj_parse and cpu_voxelize.\n", modelname.c_str() );
+	}
+
+	// Synthetic generators (parallel brick search + atlas fill)
+	VolumeGenerator gen ( &gvdb, 1 );
+	RunBench ( "gen_sphere",
+		[&]() { gvdb.Configure ( 3, 3, 3, 3, 3 ); gvdb.AddChannel ( 0, T_FLOAT, 1 ); },
+		[&]() -> uint64 { float r = domain*0.4f; return gen.Sphere ( 0, Vector3DF(r+8, r+8, r+8), r ) * brickres*brickres*brickres; } );
+
+	RunBench ( "gen_noise_cloud",
+		[&]() { gvdb.Configure ( 3, 3, 3, 3, 3 ); gvdb.AddChannel ( 0, T_FLOAT, 1 ); },
+		[&]() -> uint64 { return gen.NoiseCloud ( 0, Vector3DF(0,0,0), Vector3DF(domain, domain, domain), 0.3f ) * brickres*brickres*brickres; } );
+
+	// ForEachActiveVoxel on a T_FLOAT3 channel, whose atlas stores 16 bytes per voxel. Each voxel
+	// holds its own index-space position, so a misaddressed read is caught.
+	gvdb.Configure ( 3, 3, 3, 3, 3 );
+	gvdb.AddChannel ( 0, T_FLOAT3, 1 );
+	for (uint64 n = 0; n < numBricks; n++) gvdb.ActivateSpace ( centers[n] );
+	gvdb.FinishTopology ();
+	gvdb.UpdateAtlas ();
+	{
+		Vector3DI ares = gvdb.mPool->getAtlasRes ( 0 );
+		std::vector<Vector4DF> vec ( (uint64) ares.x * ares.y * ares.z, Vector4DF(0, 0, 0, 0) );
+		for (LeafIterator it ( gvdb ); it; ++it) {
+			Vector3DI a = it.node()->mValue;
+			for (int z = 0; z < brickres; z++)
+				for (int y = 0; y < brickres; y++)
+					for (int x = 0; x < brickres; x++)
+						vec[ (uint64(a.z+z)*ares.y + (a.y+y))*ares.x + (a.x+x) ].Set ( float(it.pos().x+x), float(it.pos().y+y), float(it.pos().z+z), 0 );
+		}
+		gvdb.mPool->AtlasWriteSlices ( 0, 0, ares.z, (const uchar*) vec.data() );
+	}
+	std::atomic<uint64> float3Bad ( 0 );
+	RunBench ( "foreach_voxel_float3", 0x0,
+		[&]() -> uint64 {
+			std::vector<uint64> cnt ( getNumThreads() * 8, 0 ), bad ( getNumThreads() * 8, 0 );
+			gvdb.ForEachActiveVoxel<Vector3DF> ( 0, Vector3DI(INT_MIN, INT_MIN, INT_MIN), Vector3DI(INT_MAX, INT_MAX, INT_MAX),
+				[&]( int c, const Vector3DI& p, const Vector3DF& v ) {
+					cnt[c*8]++;
+					if ( v.x != p.x || v.y != p.y || v.z != p.z ) bad[c*8]++;
+				} );
+			uint64 total = 0;
+			for (size_t c = 0; c < cnt.size(); c += 8) { total += cnt[c]; float3Bad += bad[c]; }
+			return total;
+		} );
+	if ( float3Bad > 0 ) fprintf ( stderr, "ERROR: foreach_voxel_float3 read %llu wrong values.\n", (unsigned long long) float3Bad.load() );
+
+	// Output
+	FILE* out = stdout;
+	if ( outname != 0x0 ) {
+		out = fopen ( outname, "w" );
+		if ( out == 0x0 ) { fprintf ( stderr, "Cannot open %s for writing.\n", outname ); exit(-1); }
+	}
+	WriteJSON ( out, size, gvdb.getCounters(), gvdb.getMemUsage(), gvdb.getMemTotal() );
+	if ( out != stdout ) fclose ( out );
+
+	return 0;
+}
@@ -19,18 +19,36 @@
 #define ID_UNDEFL	0xFFFFFFFF
 #define ID_UNDEF64	0xFFFFFFFFFFFFFFFF
 #define CHAN_UNDEF	255
+#define ELEM_TILE	0xFE		// child list entry holding a constant-value tile (see gvdb_allocator.h)
 #define MAX_CHANNEL  32
 
+// Stored node references (see noderef in gvdb_types.h)
+#ifdef USE_COMPACT_NODES
+	typedef uint	noderef;		// pool index only
+	#define ID_UNDEFREF	ID_UNDEFL
+#else
+	typedef uint64	noderef;		// full pool reference
+	#define ID_UNDEFREF	ID_UNDEF64
+#endif
+
 struct ALIGN(16) VDBNode {
 	uchar		mLev;			// Level		Max = 255			1 byte
 	uchar		mFlags;
 	uchar		mPriority;
+#ifdef USE_COMPACT_NODES
+	uchar		mListCls;		// Child list level/class in group 1
+	int3		mPos;			// Pos			Max = +/- 4 mil (linear space/range)	12 bytes
+	int3		mValue;			// Value		Max = +8 mil		4 bytes
+	noderef		mParent;		// Parent index						4 bytes
+	noderef		mChildList;		// Child List index					4 bytes
+#else
 	uchar		pad;
 	int3		mPos;			// Pos			Max = +/- 4 mil (linear space/range)	12 bytes
 	int3		mValue;			// Value		Max = +8 mil		4 bytes
 	float3		mVRange;
-	uint64		mParent;		// Parent ID						8 bytes
-	uint64		mChildList;		// Child List						8 bytes
+	noderef		mParent;		// Parent ID						8 bytes
+	noderef		mChildList;		// Child List						8 bytes
+#endif
 	uint64		mMask;			// Bitmask starts - Must keep here, even if not USE_BITMASKS
 };
 
@@ -46,9 +64,9 @@ struct ALIGN(16) VDBInfo {
 	int3		noderange[10]; // How many voxels on a side a node of each level covers
 	int			nodecnt[10]; // Total number of allocated nodes per level
 	int			nodewid[10]; // Size of a node at each level in bytes
-	int			childwid[10]; // Size of the child list per node at each level in bytes
+	int			childwid[10]; // Size of a child list in bytes, per level (per capacity class with USE_BITMASKS)
 	char*		nodelist[10]; // Pointer to each level's pool group 0 (nodes)
-	char*		childlist[10]; // Pointer to each level's pool group 1 (child lists)
+	char*		childlist[10]; // Pointer to each pool in group 1 (child lists), indexed like childwid
 	VDBAtlasNode*  atlas_map; // Pointer to the atlas map (which maps from atlas to world space)
 	int3		atlas_cnt; // Number of bricks on each axis of the atlas
 	int3		atlas_res; // Total resolution in voxels of the atlas
@@ -76,51 +94,62 @@ __device__ float								cxform[16];
 #endif
 
 #ifdef USE_BITMASKS
-inline __device__ uint64 numBitsOn ( uint64 v)
+// Number of bits on in the node mask below bit n
+inline __device__ int countOn ( VDBNode* node, int n )
 {
-	v = v - ((v >> 1) & uint64(0x5555555555555555LLU));
-	v = (v & uint64(0x3333333333333333LLU)) + ((v >> 2) & uint64(0x3333333333333333LLU));
-	return ((v + (v >> 4) & uint64(0xF0F0F0F0F0F0F0FLLU)) * uint64(0x101010101010101LLU)) >> 56;
+	int sum = 0;
+	uint64* w = (uint64*) (&node->mMask);
+	for (int k = 0; k < (n >> 6); k++) sum += __popcll ( w[k] );
+	return sum + __popcll ( w[n >> 6] & ((uint64(1) << (n & 63))-1) );
 }
-inline __device__ int countOn ( VDBNode* node, int n )
+#endif
+
+// Group 1 level (capacity class with USE_BITMASKS) and index of a node's child list
+inline __device__ uchar getChildListLev ( VDBNode* node )
 {
-	uint64 sum = 0;
-	uint64* w1 = (uint64*) (&node->mMask);
-	uint64* we = w1 + (n >> 6);
-	for (; w1 != we; ) sum += numBitsOn (*w1++ );
-	uint64 w2 = *w1;
-	w2 = *w1 & (( uint64(1) << (n & 63))-1);
-	sum += numBitsOn ( w2 );
-	return sum;
+#ifdef USE_COMPACT_NODES
+	return node->mListCls;
+#else
+	return uchar( (node->mChildList >> 8) & 0xFF );
+#endif
 }
-inline __device__ bool isBitOn ( VDBNode* node, int b )
+inline __device__ uint64 getChildListNdx ( VDBNode* node )
 {
-	return ( (&node->mMask)[ b >> 6 ] & (uint64(1) << (b & 63))) != 0;
+#ifdef USE_COMPACT_NODES
+	return node->mChildList;
+#else
+	return node->mChildList >> 16;
+#endif
 }
 
-inline __device__ int getChild ( VDBNode* node, int b )
-{	
-	int n = countOn ( node, b );
-	uint64 listid = node->mChildList;
-	if (listid == ID_UNDEFL) return ID_UNDEF64;
-	uchar clev = uchar( (listid >> 8) & 0xFF );
-	int cndx = listid >> 16;
-	uint64* clist = (uint64*) (gvdb.childlist[clev] + cndx*gvdb.childwid[clev]);
-	int c = (*(clist + n)) >> 16;
-	return c;
+// Child list of a node, or 0x0 if it has none
+inline __device__ noderef* getChildList ( VDBInfo* gvdb, VDBNode* node )
+{
+	if (node->mChildList == ID_UNDEFL) return 0x0;
+	uchar clev = getChildListLev ( node );
+	return (noderef*) (gvdb->childlist[clev] + getChildListNdx(node)*gvdb->childwid[clev]);
 }
 
-#else 
-
+// Child at bit b. With bitmasks, lists narrower than a full list are packed in bit order.
 inline __device__ int getChild ( VDBInfo* gvdb, VDBNode* node, int b )
 {	
-	uint64 listid = node->mChildList;
-	if (listid == ID_UNDEFL) return ID_UNDEF64;
-	uchar clev = uchar( (listid >> 8) & 0xFF );
-	int cndx = listid >> 16;
-	uint64* clist = (uint64*) (gvdb->childlist[clev] + cndx*gvdb->childwid[clev]);
-	int c = (*(clist + b)) >> 16;
+	noderef* clist = getChildList ( gvdb, node );
+	if (clist == 0x0) return ID_UNDEF64;
+#ifdef USE_BITMASKS
+	int res = gvdb->res[node->mLev];
+	if ( gvdb->childwid[getChildListLev(node)] < res*res*res*sizeof(noderef) ) {
+		if ( ((&node->mMask)[ b >> 6 ] & (uint64(1) << (b & 63))) == 0 ) return ID_UNDEF64;
+		b = countOn ( node, b );
+	}
+#endif
+	noderef entry = *(clist + b);
+#ifdef USE_COMPACT_NODES
+	return entry;			// entries are indices; ID_UNDEFREF reads back as ID_UNDEF64 in an int
+#else
+	if ((entry & 0xFF) == ELEM_TILE) return ID_UNDEF64;		// tiles are not children
+	int c = entry >> 16;
 	return c;
+#endif
 }
 
 inline __device__ bool isBitOn ( VDBInfo* gvdb, VDBNode* node, int b )
@@ -128,7 +157,20 @@ inline __device__ bool isBitOn ( VDBInfo* gvdb, VDBNode* node, int b )
 	return getChild(gvdb, node, b) != ID_UNDEF64;
 }
 
+// Returns true and the tile value if child slot `b` holds a constant-value tile
+inline __device__ bool getTile ( VDBInfo* gvdb, VDBNode* node, int b, float& v )
+{
+#if defined(USE_BITMASKS) || defined(USE_COMPACT_NODES)
+	return false;			// tiles need dense child lists of full references
+#else
+	noderef* clist = getChildList ( gvdb, node );
+	if (clist == 0x0) return false;
+	uint64 entry = *(clist + b);
+	if ((entry & 0xFF) != ELEM_TILE) return false;
+	v = __uint_as_float( uint(entry >> 32) );
+	return true;
 #endif
+}
 
 inline __device__ VDBAtlasNode* getAtlasNode ( VDBInfo* gvdb, float3 brickpos )
 {
@@ -321,17 +363,6 @@ inline __device__ uint64 getPosParent( VDBInfo* gvdb, int3 pos, int stopLev)
 		posInNode.z /= range.z;
 		bitMaskPos = (posInNode.z*res + posInNode.y)*res + posInNode.x;
 		//bitMaskPos = ((pos.z - nd->mPos.z)*gvdb->res[l]/gvdb->noderange[l].z*gvdb->res[l] + (pos.y - nd->mPos.y)*gvdb->res[l]/gvdb->noderange[l].y)*gvdb->res[l] + (pos.x - nd->mPos.x)*gvdb->res[l]/gvdb->noderange[l].x;
-#ifdef USE_BITMASKS
-		uint64 p = nd->countOn ( bitMaskPos );
-
-		l--;
-
-		uint64* clist = mPool->PoolData64(nd->mChildList);
-		if (l == lev) return clist[p];
-
-		nd = getNode(clist[p]);
-#else
-		
 		childId = getChild( gvdb, nd, bitMaskPos);
 
 		l--;
@@ -341,7 +372,6 @@ inline __device__ uint64 getPosParent( VDBInfo* gvdb, int3 pos, int stopLev)
 		if(l == stopLev) return childId;
 
 		nd = (VDBNode*) (gvdb->nodelist[l] + childId*gvdb->nodewid[l]);//getNode(l, childId);
-#endif
 	}
 
 	return ID_UNDEFL;
@@ -371,16 +401,6 @@ inline __device__ uint64 getParent( VDBInfo* gvdb, int stopLev, int3 pos)
 		posInNode.z /= range.z;
 		bitMaskPos = (posInNode.z*res + posInNode.y)*res + posInNode.x;
 
-#ifdef USE_BITMASKS
-		uint64 p = nd->countOn ( bitMaskPos );
-
-		l--;
-
-		uint64* clist = mPool->PoolData64(nd->mChildList);
-		if (l == lev) return clist[p];
-
-		nd = getNode( gvdb, clist[p] );
-#else
 		l--;
 
 		childId = getChild( gvdb, nd, bitMaskPos);
@@ -390,7 +410,6 @@ inline __device__ uint64 getParent( VDBInfo* gvdb, int stopLev, int3 pos)
 		if(l == stopLev) return childId;
 
 		nd = getNode( gvdb, l, childId);
-#endif
 	}
 
 	return ID_UNDEFL;
@@ -406,7 +425,7 @@ extern "C" __global__ void gvdbDelinkLeafBricks ( VDBInfo* gvdb )
 	VDBNode* node = getNode ( gvdb, 0, i);
 
 	if (node->mFlags) return;					// in use brick
-	if (node->mParent == ID_UNDEF64) return;	// deactivated brick
+	if (node->mParent == ID_UNDEFREF) return;	// deactivated brick
 
 	uint64 pnodeId = getParent( gvdb, 1, node->mPos);
 	VDBNode* pnode = getNode ( gvdb, 1, pnodeId);
@@ -421,11 +440,10 @@ extern "C" __global__ void gvdbDelinkLeafBricks ( VDBInfo* gvdb )
 	posInNode.z /= range.z;
 	int bitMaskPos = (posInNode.z*res + posInNode.y)*res+ posInNode.x;
 	
-	node->mParent = ID_UNDEF64;					// no parent = deactivated
-	uint64 listid = pnode->mChildList;
-	int cndx = listid >> 16;
-	uint64* clist = (uint64*) (gvdb->childlist[1] + cndx*gvdb->childwid[1]);
-	*(clist + bitMaskPos) = ID_UNDEF64;
+	node->mParent = ID_UNDEFREF;				// no parent = deactivated
+	noderef* clist = getChildList ( gvdb, pnode );
+	if (clist == 0x0) return;
+	*(clist + bitMaskPos) = ID_UNDEFREF;
 }
 
 extern "C" __global__ void gvdbDelinkBricks ( VDBInfo* gvdb, int lev )
@@ -435,12 +453,19 @@ extern "C" __global__ void gvdbDelinkBricks ( VDBInfo* gvdb, int lev )
 
 	VDBNode* node = getNode ( gvdb, lev, i);
 
-	if (node->mParent == ID_UNDEF64) { node->mFlags = false; return;	}// deactivated brick
+	if (node->mParent == ID_UNDEFREF) { node->mFlags = false; return;	}// deactivated brick
 
-	for (int ci = 0; ci < gvdb->res[lev]*gvdb->res[lev]*gvdb->res[lev]; ci++)
-	{
-		uint64* clist = (uint64*) (gvdb->childlist[lev] + i*gvdb->childwid[lev]);
-		if (*(clist + ci) != ID_UNDEF64) { node->mFlags = true; return; }
+	noderef* nlist = getChildList ( gvdb, node );
+	if (nlist != 0x0) {
+		for (int ci = 0; ci < gvdb->res[lev]*gvdb->res[lev]*gvdb->res[lev]; ci++)
+		{
+			noderef ch = *(nlist + ci);
+#ifdef USE_COMPACT_NODES
+			if (ch != ID_UNDEFREF) { node->mFlags = true; return; }
+#else
+			if (ch != ID_UNDEFREF && (ch & 0xFF) != ELEM_TILE) { node->mFlags = true; return; }		// tiles keep no node alive
+#endif
+		}
 	}
 
 	node->mFlags = false;
@@ -459,11 +484,10 @@ extern "C" __global__ void gvdbDelinkBricks ( VDBInfo* gvdb, int lev )
 	posInNode.z /= range.z;
 	int bitMaskPos = (posInNode.z*res + posInNode.y)*res+ posInNode.x;
 	
-	node->mParent = ID_UNDEF64;					// no parent = deactivated
-	uint64 listid = pnode->mChildList;
-	int cndx = listid >> 16;
-	uint64* clist = (uint64*) (gvdb->childlist[lev+1] + cndx*gvdb->childwid[lev+1]);
-	*(clist + bitMaskPos) = ID_UNDEF64;
+	node->mParent = ID_UNDEFREF;				// no parent = deactivated
+	noderef* clist = getChildList ( gvdb, pnode );
+	if (clist == 0x0) return;
+	*(clist + bitMaskPos) = ID_UNDEFREF;
 }
 
 // link node
@@ -493,14 +517,23 @@ extern "C" __global__ void gvdbLinkBricks ( VDBInfo* gvdb, int lev)
 	if (posInNode.x > res || posInNode.x < 0 || posInNode.y > res || posInNode.y < 0 || posInNode.z > res || posInNode.z < 0) return;
 
 	// set mParent in node
+#ifdef USE_COMPACT_NODES
+	node->mParent = noderef(pnodeId);					// set parent of child
+#else
 	node->mParent = ((pnodeId << 16) | ((lev+1) << 8));	// set parent of child
+#endif
 
-	uint64 listid = pnode->mChildList;
-	uint64 cndx = listid >> 16;
-	if (cndx >= gvdb->nodecnt[ lev+1 ]) return;
-	uint64* clist = (uint64*) (gvdb->childlist[lev+1] + cndx*gvdb->childwid[lev+1]);
+	if (pnode->mChildList == ID_UNDEFL) return;
+#ifndef USE_BITMASKS
+	if (getChildListNdx(pnode) >= gvdb->nodecnt[ lev+1 ]) return;
+#endif
+	noderef* clist = getChildList ( gvdb, pnode );
 
+#ifdef USE_COMPACT_NODES
+	*(clist + bitMaskPos) = noderef(i);
+#else
 	*(clist + bitMaskPos) = ((uint64(i) << 16) | (uint64(lev) << 8));
+#endif
 
 }
 
@@ -114,7 +114,7 @@ extern "C" __global__ void gvdbSetFlagSubcell(VDBInfo* gvdb, int num_sc, int* sc
 
 	VDBNode* node = getNode(gvdb, 0, i);
 
-	sc_flag[i] = (node->mParent == ID_UNDEF64) ? 0 : 1;
+	sc_flag[i] = (node->mParent == ID_UNDEFREF) ? 0 : 1;
 }
 
 extern "C" __global__ void gvdbConvAndTransform ( int num_pnts, char* psrc, char psrcbits, char* pdest, char pdestbits,
@@ -663,7 +663,7 @@ extern "C" __global__ void gvdbMapExtraGVDB (VDBInfo* gvdb, int numBricks, int s
 	if ( i >= numBricks) return;
 
 	VDBNode* pnode = getNode ( gvdb, 0, i );
-	if (pnode->mParent == ID_UNDEF64) return;
+	if (pnode->mParent == ID_UNDEFREF) return;
 	int3 pos = pnode->mPos;
 
 	int obs_nid = getPosLeafParent(obs, pos);
@@ -681,7 +681,7 @@ extern "C" __global__ void gvdbCalcSubcellPos (VDBInfo* gvdb, int* sc_nid, int3*
 	//if (sc_mapping[i] < 0) return;
 
 	VDBNode* pnode = getNode ( gvdb, 0, i );
-	if (pnode->mParent == ID_UNDEF64) return;
+	if (pnode->mParent == ID_UNDEFREF) return;
 	int3 pos = pnode->mPos;
 
 	for (int sc = 0; sc < sc_per_brick; sc++)
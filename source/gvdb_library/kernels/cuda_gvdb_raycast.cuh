@@ -534,10 +534,76 @@ __device__ void rayDeepBrick ( VDBInfo* gvdb, uchar chan, int nodeid, float3 t,
 
 
 
+// Traces a constant-value tile: a child slot whose whole region holds the value `v`.
+// Behaves as `brickFunc` would on a brick filled with `v`, without sampling the atlas.
+// Inputs:
+//   `gvdb`: The volume's `VDBInfo` object
+//   `v`: The tile value
+//   `bmin`, `bsize`: Index-space corner and size of the tile
+//   `t`: Entry (t.x) and exit (t.y) parameters of the ray in the tile
+//   `pos`: The origin of the ray
+//   `dir`: The direction of the ray
+//   `brickFunc`: The brick function of the current render mode
+// Outputs are the same as for `brickFunc`.
+__device__ void rayTile ( VDBInfo* gvdb, float v, float3 bmin, float3 bsize, float3 t, float3 pos, float3 dir, float3& hit, float3& norm, float4& clr, gvdbBrickFunc_t brickFunc )
+{
+	if ( brickFunc == rayDeepBrick ) {
+		if ( v < SCN_MINVAL ) return;
+		t.x = SCN_DIRECTSTEP * ceilf( t.x / SCN_DIRECTSTEP );	// Start on sampling wavefront
+		const float dt = length(SCN_DIRECTSTEP*dir);
+		const float tDepthIntersection = getRayDepthBufferMax(dir);
+		if (hit.x == 0) hit.x = t.x;
+
+		// Every sample has the same value, so the samples integrate in closed form:
+		// n layers of transmittance e give e^n, and scatter (1 - e^n) of the incoming light.
+		const float n = fmaxf( ceilf( (fminf(t.y, tDepthIntersection) - t.x) / dt ), 0.0f );
+		const float4 val = transfer(gvdb, v);
+		const float en = exp(SCN_EXTINCT * val.w * SCN_DIRECTSTEP * n);
+		clr.x += val.x * clr.w * (1 - en) * SCN_ALBEDO;
+		clr.y += val.y * clr.w * (1 - en) * SCN_ALBEDO;
+		clr.z += val.z * clr.w * (1 - en) * SCN_ALBEDO;
+		clr.w *= en;
+		hit.y = t.x + n * dt;
+		if (t.y > tDepthIntersection) hit.z = 1;
+		clr = make_float4(fmin(clr.x, 1.f), fmin(clr.y, 1.f), fmin(clr.z, 1.f), fmax(clr.w, 0.f));
+		return;
+	}
+	if ( brickFunc == rayShadowBrick ) {
+		// Shadow gain depends on the distance travelled, so step as rayShadowBrick does
+		const float density = transfer(gvdb, v).w;
+		float ts = t.x + gvdb->epsilon;
+		for (float tp = ts; clr.w < 1 && tp < t.y; tp += SCN_DIRECTSTEP) {
+			float val = exp ( SCN_EXTINCT * density * SCN_SHADOWSTEP/(1.0 + ts * 0.4) );
+			clr.w = 1.0 - (1.0-clr.w) * val;
+			ts += SCN_SHADOWSTEP;
+		}
+		return;
+	}
+	if ( brickFunc == rayEmptySkipBrick ) {
+		hit = pos + t.x * dir;
+		return;
+	}
+
+	// Surfaces: a tile is either entirely inside or entirely outside, so it is hit where the ray enters.
+	// Level sets are inside below the threshold; the other surface modes above it.
+	const bool inside = ( brickFunc == rayLevelSetBrick ) ? (v < SCN_THRESH) : (v >= SCN_THRESH);
+	if ( !inside ) return;
+	hit = getRayPoint ( pos, dir, t.x );
+
+	// Normal of the tile face at the hit point
+	float3 fromCenter = (hit - bmin) / bsize - 0.5f;
+	fromCenter -= 0.01 * dir;
+	const float maxCoordinate = fmaxf(fmaxf(fabsf(fromCenter.x), fabsf(fromCenter.y)), fabsf(fromCenter.z));
+	norm.x = (fabsf(fromCenter.x) == maxCoordinate ? copysignf(1.0f, fromCenter.x) : 0.0f);
+	norm.y = (fabsf(fromCenter.y) == maxCoordinate ? copysignf(1.0f, fromCenter.y) : 0.0f);
+	norm.z = (fabsf(fromCenter.z) == maxCoordinate ? copysignf(1.0f, fromCenter.z) : 0.0f);
+}
+
 //----------------------------- MASTER RAYCAST FUNCTION
 // 1. Performs empty skipping of GVDB hiearchy
 // 2. Checks input depth buffer [if set]
 // 3. Calls the specified 'brickFunc' when a brick is hit, for custom behavior
+//    (constant-value tiles go to rayTile, which mimics 'brickFunc')
 // 4. Returns a color and/or surface hit and normal
 //
 __device__ void rayCast ( VDBInfo* gvdb, uchar chan, float3 pos, float3 dir, float3& hit, float3& norm, float4& clr, gvdbBrickFunc_t brickFunc )
@@ -597,6 +663,16 @@ __device__ void rayCast ( VDBInfo* gvdb, uchar chan, float3 pos, float3 dir, flo
 				dda.Prepare(vmin, gvdb->vdel[lev]);						// start dda at next level down
 			}
 		} else {
+			// constant-value tile, trace it in place
+			float tile;
+			if ( getTile ( gvdb, node, b, tile ) ) {
+				rayTile ( gvdb, tile, vmin + make_float3(dda.p) * gvdb->vdel[lev], gvdb->vdel[lev], dda.t, pos, dir, hit, norm, clr, brickFunc );
+				if ( clr.w <= 0) {
+					clr.w = 0;
+					return;
+				}
+				if (hit.z != NOHIT) return;
+			}
 			// empty voxel, step DDA
 			dda.Step();
 		}
@@ -40,6 +40,14 @@ features for CPU and GPU profiling:
 #include <fcntl.h>	
 #include <cstdlib>
 
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <math.h>
+
 extern void				gprintf(const char * fmt, ...);
 #define PERF_PRINTF		gprintf
 
@@ -53,9 +61,6 @@ bool				g_perfInit = false;			// Is perf started? Checks for DLL
 	char*				g_nvtxPop = 0x0;
 #endif
 
-int					g_perfLevel = 0;			// Current level of push/pop
-sjtime				g_perfStack[1024];			// Stack of recorded CPU timings
-char				g_perfMsg[1024][256];			// Stack of recorded messages
 FILE*				g_perfCons = 0x0;			// On-screen console to output CPU timing
 int					g_perfPrintLev = 2;			// Maximum level to print. Set with PERF_SET
 bool				g_perfCPU = false;			// Do CPU timing? Set with PERF_SET
@@ -63,18 +68,161 @@ bool				g_perfGPU = false;			// Do GPU timing? Set with PERF_SET
 bool				g_perfConsOut = true;
 std::string			g_perfFName = "";			// File name for CPU output. Set with PERF_SET
 FILE*				g_perfFile = 0x0;			// File handle for output
+sjtime				g_perfEpoch = 0;			// Time of PERF_INIT. Trace timestamps are relative to this
+
+//---------------- PER-THREAD MARKER STACKS
+// Each thread owns its own marker stack and its own aggregate table, so
+// PERF_PUSH/PERF_POP from worker threads never share state. When a thread
+// exits, its aggregates are merged into a retired table and its record is
+// returned to a free list for the next new thread, keeping its trace id.
+// Short-lived workers (ParallelChunks) therefore reuse a bounded set of records.
+
+#define PERF_MAXLEV			256				// Maximum nesting depth per thread
+#define PERF_NAMELEN		40				// Marker name length stored in events (multiple of 8)
+#define PERF_EVENTS			65536			// Ring buffer size (power of two)
+#define PERF_HIST_BINS		192				// Log-scale histogram bins (4 per octave, starting at 1 ns)
+
+struct PerfStat {
+	PerfStat() : count(0), total(0), tmin(0), tmax(0) { memset ( hist, 0, sizeof(hist) ); }
+	uint64			count;
+	double			total, tmin, tmax;		// milliseconds
+	uint32			hist[PERF_HIST_BINS];
+};
+
+struct PerfThread {
+	PerfThread() : level(0), startLevel(0), tid(0) {}
+	int				level;					// Current level of push/pop
+	sjtime			stack[PERF_MAXLEV];		// Stack of recorded CPU timings
+	std::string		msg[PERF_MAXLEV];		// Stack of recorded messages
+	int				startLevel;				// Separate stack for PERF_START/PERF_STOP
+	sjtime			startStack[PERF_MAXLEV];
+	uint32			tid;
+	std::mutex		lock;					// Uncontended except while reporting
+	std::map<std::string, PerfStat>	stats;
+};
+
+static std::mutex					g_perfThreadLock;
+static std::vector<PerfThread*>		g_perfThreads;		// records of live threads
+static std::vector<PerfThread*>		g_perfFree;			// records of exited threads, for reuse
+static std::map<std::string, PerfStat>	g_perfRetired;	// aggregates of exited threads
+
+static void mergeStat ( PerfStat& dst, const PerfStat& src )
+{
+	if ( dst.count == 0 || src.tmin < dst.tmin ) dst.tmin = src.tmin;
+	if ( dst.count == 0 || src.tmax > dst.tmax ) dst.tmax = src.tmax;
+	dst.count += src.count;
+	dst.total += src.total;
+	for (int b = 0; b < PERF_HIST_BINS; b++) dst.hist[b] += src.hist[b];
+}
+
+// Owns the calling thread's record and retires it at thread exit
+struct PerfThreadSlot {
+	PerfThreadSlot() : pt(0x0) {}
+	~PerfThreadSlot() {
+		if ( pt == 0x0 ) return;
+		std::lock_guard<std::mutex> guard ( g_perfThreadLock );
+		{
+			std::lock_guard<std::mutex> tguard ( pt->lock );
+			for (std::map<std::string, PerfStat>::iterator it = pt->stats.begin(); it != pt->stats.end(); it++)
+				mergeStat ( g_perfRetired[ it->first ], it->second );
+			pt->stats.clear ();
+		}
+		pt->level = 0;
+		pt->startLevel = 0;
+		g_perfThreads.erase ( std::find ( g_perfThreads.begin(), g_perfThreads.end(), pt ) );
+		g_perfFree.push_back ( pt );
+	}
+	PerfThread*		pt;
+};
+static thread_local PerfThreadSlot	t_perf;
+static uint32						g_perfNextTid = 0;
+
+static PerfThread* getPerfThread ()
+{
+	if ( t_perf.pt == 0x0 ) {
+		std::lock_guard<std::mutex> guard ( g_perfThreadLock );
+		if ( !g_perfFree.empty() ) {
+			t_perf.pt = g_perfFree.back ();
+			g_perfFree.pop_back ();
+		} else {
+			t_perf.pt = new PerfThread;
+			t_perf.pt->tid = g_perfNextTid++;
+		}
+		g_perfThreads.push_back ( t_perf.pt );
+	}
+	return t_perf.pt;
+}
+
+//---------------- EVENT RING BUFFER
+// Begin/end events are written lock-free, as a seqlock per slot. A writer 
+// claims a slot with an atomic increment, marks it unpublished, fills it, 
+// then publishes it by storing the slot sequence. The payload is atomic 
+// too (relaxed), so a reader racing a writer sees torn data at worst, which
+// the sequence check after reading rejects. Oldest events are lost on wraparound.
+
+#define PERF_NAMEWORDS		(PERF_NAMELEN/8)
+
+struct PerfEvent {
+	std::atomic<uint64>	seq;				// index+1 when published, 0 while writing
+	std::atomic<sjtime>	time;
+	std::atomic<uint32>	tid;
+	std::atomic<short>	depth;
+	std::atomic<char>	type;				// 'B' or 'E'
+	std::atomic<uint64>	name[PERF_NAMEWORDS];	// packed, not terminated
+};
+
+static PerfEvent				g_perfEvents[PERF_EVENTS];
+static std::atomic<uint64>		g_perfEventWrite ( 0 );
+
+static void recordEvent ( char type, const char* name, sjtime t, uint32 tid, int depth )
+{
+	char packed[PERF_NAMELEN];
+	strncpy ( packed, name, PERF_NAMELEN );
+	uint64 idx = g_perfEventWrite.fetch_add ( 1, std::memory_order_relaxed );
+	PerfEvent& e = g_perfEvents[ idx & (PERF_EVENTS-1) ];
+	e.seq.store ( 0, std::memory_order_relaxed );
+	std::atomic_thread_fence ( std::memory_order_release );
+	e.time.store ( t, std::memory_order_relaxed );
+	e.tid.store ( tid, std::memory_order_relaxed );
+	e.depth.store ( (short) depth, std::memory_order_relaxed );
+	e.type.store ( type, std::memory_order_relaxed );
+	for (int w = 0; w < PERF_NAMEWORDS; w++) {
+		uint64 v;
+		memcpy ( &v, packed + w*8, 8 );
+		e.name[w].store ( v, std::memory_order_relaxed );
+	}
+	e.seq.store ( idx+1, std::memory_order_release );
+}
+
+static void recordStat ( PerfThread* pt, const char* name, double ms )
+{
+	double ns = ms * 1000000.0;
+	int bin = (ns <= 1.0) ? 0 : int( log2(ns) * 4.0 );
+	if ( bin >= PERF_HIST_BINS ) bin = PERF_HIST_BINS-1;
+
+	std::lock_guard<std::mutex> guard ( pt->lock );
+	PerfStat& s = pt->stats[ name ];
+	if ( s.count == 0 || ms < s.tmin ) s.tmin = ms;
+	if ( s.count == 0 || ms > s.tmax ) s.tmax = ms;
+	s.count++;
+	s.total += ms;
+	s.hist[bin]++;
+}
 
 void PERF_START ()
 {
-	g_perfStack [ g_perfLevel ] = TimeX::GetSystemNSec ();
-	g_perfLevel++;
+	PerfThread* pt = getPerfThread ();
+	if ( pt->startLevel >= PERF_MAXLEV ) { pt->startLevel++; return; }
+	pt->startStack [ pt->startLevel++ ] = TimeX::GetSystemNSec ();
 }
 
 float PERF_STOP ()
 {
-	g_perfLevel--;
+	PerfThread* pt = getPerfThread ();
+	if ( pt->startLevel <= 0 ) return 0;
+	if ( --pt->startLevel >= PERF_MAXLEV ) return 0;
 	sjtime curr = TimeX::GetSystemNSec ();
-	curr -= g_perfStack [ g_perfLevel ];
+	curr -= pt->startStack [ pt->startLevel ];
 	return ((float) curr) / MSEC_SCALAR;
 }
 
@@ -85,11 +233,15 @@ void PERF_PUSH ( const char* msg )
 		if ( g_perfGPU ) (*g_nvtxPush) (msg);	
 	#endif
 	if ( g_perfCPU ) {
-		if ( ++g_perfLevel < g_perfPrintLev ) {
-			strncpy ( (char*) g_perfMsg[ g_perfLevel ], msg, 256 );
-			g_perfStack [ g_perfLevel ] = TimeX::GetSystemNSec ();				
-			if ( g_perfConsOut ) PERF_PRINTF ( "%*s%s\n", g_perfLevel <<1, "", msg );
-			if ( g_perfFile != 0x0 ) fprintf ( g_perfFile, "%*s%s\n", g_perfLevel <<1, "", msg );
+		PerfThread* pt = getPerfThread ();
+		int lev = ++pt->level;
+		if ( lev >= PERF_MAXLEV ) return;
+		pt->msg[ lev ] = msg;
+		pt->stack [ lev ] = TimeX::GetSystemNSec ();
+		recordEvent ( 'B', msg, pt->stack[lev], pt->tid, lev );
+		if ( lev < g_perfPrintLev ) {
+			if ( g_perfConsOut ) PERF_PRINTF ( "%*s%s\n", lev <<1, "", msg );
+			if ( g_perfFile != 0x0 ) fprintf ( g_perfFile, "%*s%s\n", lev <<1, "", msg );
 		}		
 	}
 }
@@ -99,19 +251,142 @@ float PERF_POP ()
 		if ( g_perfGPU ) (*g_nvtxPop) ();
 	#endif
 	if ( g_perfCPU ) {
-		if ( g_perfLevel < g_perfPrintLev) {
-			sjtime curr = TimeX::GetSystemNSec ();
-			curr -= g_perfStack [ g_perfLevel ];		
-			if ( g_perfConsOut ) PERF_PRINTF ( "%*s%s: %f ms\n", g_perfLevel <<1, "", g_perfMsg[g_perfLevel], ((float) curr)/MSEC_SCALAR );		
-			if ( g_perfFile != 0x0 ) fprintf ( g_perfFile, "%*s%s: %f ms\n", g_perfLevel <<1, "", g_perfMsg[g_perfLevel], ((float) curr)/MSEC_SCALAR );
-			g_perfLevel--;
-			return ((float) curr) / MSEC_SCALAR;
-		}	
-		g_perfLevel--;
+		PerfThread* pt = getPerfThread ();
+		int lev = pt->level;
+		if ( lev <= 0 ) return 0;				// unbalanced pop
+		pt->level--;
+		if ( lev >= PERF_MAXLEV ) return 0;
+		sjtime end = TimeX::GetSystemNSec ();
+		float ms = ((float) (end - pt->stack [ lev ])) / MSEC_SCALAR;
+		const char* msg = pt->msg[lev].c_str();
+		recordEvent ( 'E', msg, end, pt->tid, lev );
+		recordStat ( pt, msg, ms );
+		if ( lev < g_perfPrintLev) {
+			if ( g_perfConsOut ) PERF_PRINTF ( "%*s%s: %f ms\n", lev <<1, "", msg, ms );		
+			if ( g_perfFile != 0x0 ) fprintf ( g_perfFile, "%*s%s: %f ms\n", lev <<1, "", msg, ms );
+		}
+		return ms;
 	}
 	return 0;
 }
 
+//---------------- AGGREGATES AND EXPORT
+
+// Estimate a percentile from the merged log-scale histogram (milliseconds)
+static double histPercentile ( const PerfStat& s, double pct )
+{
+	if ( s.count == 0 ) return 0;
+	uint64 target = (uint64) ceil ( pct * s.count );
+	if ( target < 1 ) target = 1;
+	uint64 cnt = 0;
+	for (int b = 0; b < PERF_HIST_BINS; b++) {
+		cnt += s.hist[b];
+		if ( cnt >= target ) {
+			double ms = pow ( 2.0, (b + 0.5) / 4.0 ) / 1000000.0;		// geometric center of bin
+			if ( ms < s.tmin ) ms = s.tmin;
+			if ( ms > s.tmax ) ms = s.tmax;
+			return ms;
+		}
+	}
+	return s.tmax;
+}
+
+// Merge the per-thread tables, and those of exited threads, into a single table keyed by marker name
+static void mergeStats ( std::map<std::string, PerfStat>& out )
+{
+	std::lock_guard<std::mutex> guard ( g_perfThreadLock );
+	out = g_perfRetired;
+	for (size_t t = 0; t < g_perfThreads.size(); t++) {
+		PerfThread* pt = g_perfThreads[t];
+		std::lock_guard<std::mutex> tguard ( pt->lock );
+		for (std::map<std::string, PerfStat>::iterator it = pt->stats.begin(); it != pt->stats.end(); it++)
+			mergeStat ( out[ it->first ], it->second );
+	}
+}
+
+void PERF_RESET ()
+{
+	{
+		std::lock_guard<std::mutex> guard ( g_perfThreadLock );
+		for (size_t t = 0; t < g_perfThreads.size(); t++) {
+			std::lock_guard<std::mutex> tguard ( g_perfThreads[t]->lock );
+			g_perfThreads[t]->stats.clear ();
+		}
+		g_perfRetired.clear ();
+	}
+	for (int n = 0; n < PERF_EVENTS; n++) g_perfEvents[n].seq.store ( 0, std::memory_order_relaxed );
+	g_perfEventWrite.store ( 0 );
+	g_perfEpoch = TimeX::GetSystemNSec ();
+}
+
+void PERF_REPORT ()
+{
+	std::map<std::string, PerfStat> stats;
+	mergeStats ( stats );
+	PERF_PRINTF ( "%-32s %8s %12s %10s %10s %10s %10s\n", "marker", "count", "total ms", "min ms", "max ms", "p50 ms", "p99 ms" );
+	for (std::map<std::string, PerfStat>::iterator it = stats.begin(); it != stats.end(); it++) {
+		const PerfStat& s = it->second;
+		PERF_PRINTF ( "%-32s %8llu %12.3f %10.3f %10.3f %10.3f %10.3f\n", it->first.c_str(), (unsigned long long) s.count, 
+			s.total, s.tmin, s.tmax, histPercentile(s, 0.50), histPercentile(s, 0.99) );
+	}
+}
+
+bool PERF_EXPORT_CSV ( const char* fname )
+{
+	FILE* fp = fopen ( fname, "wt" );
+	if ( fp == 0x0 ) {
+		PERF_PRINTF ( "ERROR: PERF_EXPORT_CSV cannot open %s\n", fname );
+		return false;
+	}
+	std::map<std::string, PerfStat> stats;
+	mergeStats ( stats );
+	fprintf ( fp, "name,count,total_ms,min_ms,max_ms,avg_ms,p50_ms,p99_ms\n" );
+	for (std::map<std::string, PerfStat>::iterator it = stats.begin(); it != stats.end(); it++) {
+		const PerfStat& s = it->second;
+		std::string name = it->first;
+		for (size_t c = 0; c < name.length(); c++) if ( name[c]=='"' ) name[c] = '\'';
+		fprintf ( fp, "\"%s\",%llu,%f,%f,%f,%f,%f,%f\n", name.c_str(), (unsigned long long) s.count, s.total, s.tmin, s.tmax,
+			(s.count > 0) ? s.total / s.count : 0.0, histPercentile(s, 0.50), histPercentile(s, 0.99) );
+	}
+	fclose ( fp );
+	return true;
+}
+
+// Write the ring buffer as Chrome trace JSON (open with chrome://tracing or Perfetto)
+bool PERF_EXPORT_TRACE ( const char* fname )
+{
+	FILE* fp = fopen ( fname, "wt" );
+	if ( fp == 0x0 ) {
+		PERF_PRINTF ( "ERROR: PERF_EXPORT_TRACE cannot open %s\n", fname );
+		return false;
+	}
+	uint64 last = g_perfEventWrite.load ( std::memory_order_acquire );
+	uint64 first = (last > PERF_EVENTS) ? last - PERF_EVENTS : 0;
+	bool bFirst = true;
+	char name[PERF_NAMELEN+1];
+	fprintf ( fp, "{\"traceEvents\":[\n" );
+	for (uint64 i = first; i < last; i++) {
+		PerfEvent& src = g_perfEvents[ i & (PERF_EVENTS-1) ];
+		if ( src.seq.load ( std::memory_order_acquire ) != i+1 ) continue;		// not published
+		sjtime time = src.time.load ( std::memory_order_relaxed );
+		uint32 tid = src.tid.load ( std::memory_order_relaxed );
+		char type = src.type.load ( std::memory_order_relaxed );
+		for (int w = 0; w < PERF_NAMEWORDS; w++) {
+			uint64 v = src.name[w].load ( std::memory_order_relaxed );
+			memcpy ( name + w*8, &v, 8 );
+		}
+		std::atomic_thread_fence ( std::memory_order_acquire );
+		if ( src.seq.load ( std::memory_order_relaxed ) != i+1 ) continue;		// overwritten while reading
+		name[PERF_NAMELEN] = '\0';
+		for (char* c = name; *c != '\0'; c++) if ( *c=='"' || *c=='\\' || *c < ' ' ) *c = ' ';
+		fprintf ( fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":0,\"tid\":%u}", bFirst ? "" : ",\n",
+			name, type, double(time - g_perfEpoch) / 1000.0, tid );
+		bFirst = false;
+	}
+	fprintf ( fp, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+	fclose ( fp );
+	return true;
+}
 
 void PERF_SET ( bool cons, int lev )
 {
@@ -128,7 +403,7 @@ void PERF_INIT ( int buildbits, bool cpu, bool gpu, bool cons, int lev, const ch
 	if ( lev == 0 ) lev = 32767;
 	g_perfPrintLev = lev;
 	g_perfInit = true;
-	g_perfLevel = 0;	
+	getPerfThread()->level = 0;
 	g_perfFile = 0x0;
 	g_perfFName = fname;	
 	if ( g_perfFName.length() > 0 ) {
@@ -196,6 +471,7 @@ void PERF_INIT ( int buildbits, bool cpu, bool gpu, bool cons, int lev, const ch
 	#endif
 
 	TimeX start;		// create Time obj to initialize system timer
+	g_perfEpoch = TimeX::GetSystemNSec ();
 }
 
 
@@ -224,6 +500,7 @@ const int TimeX::m_DaysInMonth[13] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31,
 bool TimeX::m_Started = false;
 sjtime			m_BaseTime;
 sjtime			m_BaseTicks;
+sjtime			m_BaseNSec;
 
 void start_timing ( sjtime base )
 {	
@@ -237,6 +514,9 @@ void start_timing ( sjtime base )
 		struct timeval tv;
 		gettimeofday(&tv, NULL);
 		m_BaseTicks = ((sjtime) tv.tv_sec * 1000000LL) + (sjtime) tv.tv_usec;		
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		m_BaseNSec = ((sjtime) ts.tv_sec * SEC_SCALAR) + (sjtime) ts.tv_nsec;
 	#endif
 }
 
@@ -259,7 +539,10 @@ sjtime TimeX::GetSystemNSec ()
 		QueryPerformanceCounter ( &currCount );
 		return m_BaseTime + sjtime( (double(currCount.QuadPart-m_BaseCount.QuadPart) / m_BaseFreq.QuadPart) * SEC_SCALAR);
 	#else
-		printf ( "ERROR: GetSystemNSec not implemented. QueryPerformanceCounter not available.\n" );
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);				// monotonic, nanosecond resolution
+		sjtime t = ((sjtime) ts.tv_sec * SEC_SCALAR) + (sjtime) ts.tv_nsec;
+		return m_BaseTime + ( t - m_BaseNSec );
 	#endif	
 }
 
@@ -25,6 +25,11 @@ features for CPU and GPU profiling:
 11. CPU Level specifies maximum printf level for markers. Useful when
     your markers are inside an inner loop. You can keep them in code, but hide their output.
 12. GPU markers use NVIDIA's Perfmarkers for viewing in NVIDIA NSIGHT
+13. Markers are thread-safe. Each thread keeps its own marker stack.
+14. Every marker is aggregated by name (count, total, min, max, p50, p99).
+    Print with PERF_REPORT, or write with PERF_EXPORT_CSV.
+15. Begin/end events are kept in a ring buffer (most recent 64k events),
+    and can be written as Chrome trace JSON with PERF_EXPORT_TRACE.
 */
 
 #ifndef APP_PERF
@@ -51,6 +56,10 @@ features for CPU and GPU profiling:
 	extern "C" GVDB_API void PERF_INIT ( int buildbits, bool cpu, bool gpu, bool cons, int lev, const char* fname );
 	extern "C" GVDB_API void PERF_SET ( bool cons, int lev );
 	extern "C" GVDB_API void PERF_PRINTF ( char* format, ... );
+	extern "C" GVDB_API void PERF_RESET ();									// Clear aggregates and trace events
+	extern "C" GVDB_API void PERF_REPORT ();								// Print aggregates per marker name
+	extern "C" GVDB_API bool PERF_EXPORT_CSV ( const char* fname );			// Write aggregates as CSV
+	extern "C" GVDB_API bool PERF_EXPORT_TRACE ( const char* fname );		// Write events as Chrome trace JSON
 
 
 	// Time Class
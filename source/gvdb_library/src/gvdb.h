@@ -17,6 +17,9 @@
 	#include "gvdb_model.h"
 	#include "gvdb_volume_3D.h"
 	#include "gvdb_volume_gvdb.h"
+	#include "gvdb_generate.h"
+	#include "gvdb_prefetch.h"
+	#include "gvdb_transform.h"
 	#include "app_perf.h"
 
 #endif
@@ -17,21 +17,38 @@
 #endif
 
 #include <cstdlib>
+#include <cstdio>
 #include <cuda_runtime.h>
 #include <cuda.h>
 
+#include "gvdb_parallel.h"
+
+#if defined(__linux__)
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
 using namespace nvdb;
 
 
 DataPtr::DataPtr() {
 	type=T_UCHAR; usedNum=0; lastEle=0; max=0; size=0; stride=0; cpu=0; glid=0; grsc=0; gpu=0; 
 	filter = 0; border = 0;
+	memtag = MemTag(MEM_OTHER, 0); memcpu = 0; memgpu = 0;
+	capcpu = 0; capgpu = 0;
 }		
 
 Allocator::Allocator ()
 {
 	mbDebug = false;
 	mVFBO[0] = -1;
+	ResetCounters ();
+	memset ( &mMemTotal, 0, sizeof(MemUsage) );
+	mMemTotal.category = -1;
+	mArenaGPUBytes = 0;
+	mArenaCPUBytes = 0;
+	mArenaLimit = uint64(1) << 30;
 
 	cudaCheck ( cuModuleLoad ( &cuAllocatorModule, CUDA_GVDB_COPYDATA_PTX ), "Allocator", "Allocator", "cuModuleLoad", CUDA_GVDB_COPYDATA_PTX, mbDebug);
 		
@@ -47,6 +64,7 @@ Allocator::Allocator ()
 Allocator::~Allocator() {
 	AtlasReleaseAll();
 	PoolReleaseAll();
+	ArenaTrim ( 0 );
 
 	cudaCheck(cuModuleUnload(cuAllocatorModule), "Allocator", "~Allocator", "cuModuleUnload", "cuAllocatorModule", false);
 }
@@ -71,21 +89,24 @@ void Allocator::PoolCreate ( uchar grp, uchar lev, uint64 width, uint64 initmax,
 	p.stride = width;		
 	p.cpu = 0x0;
 	p.gpu = 0x0;
+	p.memtag = MemTag ( MEM_POOL, (int(grp) << 8) | lev );
 	
 	if ( p.size == 0 ) return;		// placeholder pool, do not allocate
 
 	// cpu allocate
-	p.cpu = (char*) calloc ( p.size, 1 );
+	p.cpu = HostAlloc ( p.size, true );
 	if ( p.cpu == 0x0 ) {
 		gprintf ( "ERROR: Unable to malloc %lld for pool lev %d\n", p.size, lev );
 		gerror ();
 	}	
+	MemTrackData ( p, false, p.size );
 
 	// gpu allocate
 	if ( bGPU ) {
 		size_t sz = p.size;
 		cudaCheck ( cuMemAlloc ( &p.gpu, sz ), "Allocator", "PoolCreate", "cuMemAlloc", "", mbDebug );
 		cudaCheck ( cuMemsetD8 ( p.gpu, 0, sz ), "Allocator", "PoolCreate", "cuMemsetD8", "", mbDebug );
+		MemTrackData ( p, true, p.size );
 	}
 	mPool[grp].push_back ( p );
 }
@@ -113,6 +134,7 @@ void Allocator::PoolCommit ( int grp, int lev )
 	DataPtr* p = &mPool[grp][lev];
 	//std::cout << grp << " " << lev << " " << p->gpu << " " << p->lastEle * p->stride << std::endl;
 	cudaCheck ( cuMemcpyHtoD ( p->gpu, p->cpu, p->lastEle * p->stride ), "Allocator", "PoolCommit", "cuMemcpyHtoD", "", mbDebug );	
+	Count ( CNT_POOL_COMMIT_BYTES, p->lastEle * p->stride );
 }
 
 
@@ -128,6 +150,7 @@ void Allocator::PoolFetch(int grp, int lev )
 {
 	DataPtr* p = &mPool[grp][lev];
 	cudaCheck ( cuMemcpyDtoH ( p->cpu,  p->gpu, p->lastEle * p->stride ), "Allocator", "PoolFetch", "cuMemcpyDtoH", "", mbDebug);	
+	Count ( CNT_POOL_FETCH_BYTES, p->lastEle * p->stride );
 }
 
 void Allocator::PoolCommitAtlasMap ()
@@ -137,6 +160,7 @@ void Allocator::PoolCommitAtlasMap ()
 		if ( mAtlasMap[n].cpu != 0x0 ) {
 			p = &mAtlasMap[n];
 			cudaCheck ( cuMemcpyHtoD ( p->gpu, p->cpu, p->lastEle * p->stride ), "Allocator", "PoolCommitAtlasMap", "cuMemcpyHtoD", "", mbDebug);
+			Count ( CNT_POOL_COMMIT_BYTES, p->lastEle * p->stride );
 		}
 	}	
 }
@@ -147,16 +171,21 @@ void Allocator::PoolReleaseAll ()
 	for (int grp=0; grp < MAX_POOL; grp++) 
 		for (int lev=0; lev < mPool[grp].size(); lev++ )  {
 			if ( mPool[grp][lev].cpu != 0x0 ) 
-				free ( mPool[grp][lev].cpu );
+				HostFree ( mPool[grp][lev].cpu );
 
 			if ( mPool[grp][lev].gpu != 0x0 )
 				cudaCheck ( cuMemFree ( mPool[grp][lev].gpu ), "Allocator", "PoolReleaseAll", "cuMemFree", "", mbDebug);
+
+			MemTrackData ( mPool[grp][lev], false, 0 );
+			MemTrackData ( mPool[grp][lev], true, 0 );
 		}
 
 
 	// release pool structure	
-	for (int grp=0; grp < MAX_POOL; grp++) 
+	for (int grp=0; grp < MAX_POOL; grp++) {
 		mPool[grp].clear ();
+		mPoolFree[grp].clear ();
+	}
 }
 
 
@@ -164,16 +193,30 @@ uint64 Allocator::PoolAlloc ( uchar grp, uchar lev, bool bGPU )
 {
 	if ( lev >= mPool[grp].size() ) return ID_UNDEFL;
 	DataPtr* p = &mPool[grp][lev];
+
+	// Reuse a freed element
+	if ( lev < mPoolFree[grp].size() && !mPoolFree[grp][lev].empty() ) {
+		uint64 ndx = mPoolFree[grp][lev].back ();
+		mPoolFree[grp][lev].pop_back ();
+		if ( grp == 0 ) Count ( CNT_NODE_ALLOC + lev );
+		p->usedNum++;
+		return Elem(grp, lev, ndx);
+	}
 	
 	if ( p->lastEle >= p->max ) {
 		// Expand pool
+		Count ( CNT_POOL_GROW );
 		p->max *= 2;
 		p->size = p->stride * p->max;
 		if ( p->cpu != 0x0 ) {
-			char* new_cpu = (char*) calloc ( p->size, 1 );
-			memcpy ( new_cpu, p->cpu, p->stride*p->lastEle );
-			free ( p->cpu );
+			char* new_cpu = HostAlloc ( p->size, true );
+			MemTrack ( p->memtag, false, p->size );			// old and new coexist during the copy
+			HostCopy ( new_cpu, p->cpu, p->stride*p->lastEle );
+			Count ( CNT_POOL_GROW_BYTES, p->stride*p->lastEle );
+			HostFree ( p->cpu );
 			p->cpu = new_cpu;
+			MemTrack ( p->memtag, false, -sint64(p->size) );
+			MemTrackData ( *p, false, p->size );
 		}
 		if ( p->gpu != 0x0 ) {
 			size_t sz = p->size;	
@@ -181,11 +224,16 @@ uint64 Allocator::PoolAlloc ( uchar grp, uchar lev, bool bGPU )
 			cudaCheck ( cuMemAlloc ( &new_gpu, sz ), "Allocator", "PoolAlloc", "cuMemAlloc", "", mbDebug);
 			cudaCheck ( cuMemsetD8 ( new_gpu, 0, sz ), "Allocator", "PoolAlloc", "cuMemsetD8", "", mbDebug);
 			cudaCheck ( cuMemcpy ( new_gpu, p->gpu, p->stride*p->lastEle), "Allocator", "PoolAlloc", "cuMemcpy", "", mbDebug);
+			Count ( CNT_POOL_GROW_BYTES, p->stride*p->lastEle );
+			MemTrack ( p->memtag, true, sz );
 			cudaCheck ( cuMemFree ( p->gpu ), "Allocator", "PoolAlloc", "cuMemFree", "", mbDebug );
 			p->gpu = new_gpu;
+			MemTrack ( p->memtag, true, -sint64(sz) );
+			MemTrackData ( *p, true, sz );
 		}
 	}
 	// Return new element
+	if ( grp == 0 ) Count ( CNT_NODE_ALLOC + lev );
 	p->lastEle++;	
 	p->usedNum++;
 	return Elem(grp,lev, (p->lastEle-1) );
@@ -200,6 +248,8 @@ void Allocator::PoolEmptyAll ()
 			mPool[grp][lev].usedNum = 0;	
 			mPool[grp][lev].lastEle = 0;	
 		}
+	for (int grp=0; grp < MAX_POOL; grp++) 
+		mPoolFree[grp].clear ();
 }
 
 uint64 Allocator::getPoolMem ()
@@ -229,8 +279,15 @@ uint64* Allocator::PoolData64 ( uint64 elem )
 	return (uint64*) PoolData ( elem );
 }
 
-void PoolFree ( int elem )
+// Return an element to its pool. Freed elements are reused by PoolAlloc before the pool is extended.
+void Allocator::PoolFree ( uint64 elem )
 {
+	uchar g = ElemGrp(elem);
+	uchar l = ElemLev(elem);
+	if ( g >= MAX_POOL || l >= mPool[g].size() ) return;
+	if ( mPoolFree[g].size() <= l ) mPoolFree[g].resize ( l+1 );
+	mPoolFree[g][l].push_back ( ElemNdx(elem) );
+	mPool[g][l].usedNum--;
 }
 
 
@@ -279,12 +336,15 @@ void Allocator::CreateMemLinear ( DataPtr& p, char* dat, int stride, uint64 cnt,
 				cudaCheck ( cuMemAllocHost ( (void**)&p.cpu, sizeof(float) * 3 ), "Allocator", "CreateMemLinear", "cuMemAllocHost", "", mbDebug);
 			else 
 				p.cpu = (char*) malloc ( p.size );		// create on cpu 
+			MemTrackData ( p, false, bAllocHost ? sizeof(float)*3 : p.size );
 		}
 	} else {
 		p.cpu = dat;							// get from user
+		MemTrackData ( p, false, 0 );			// not owned
 	}
 	if ( p.gpu != 0x0 ) cudaCheck ( cuMemFree (p.gpu), "Allocator", "CreateMemLinear", "cuMemFree", "", mbDebug);
 	cudaCheck ( cuMemAlloc ( &p.gpu, p.size ), "Allocator", "CreateMemLinear", "cuMemAlloc", "", mbDebug);
+	MemTrackData ( p, true, p.size );
 
 	if ( dat!=0x0 ) CommitMem ( p );			// transfer from user
 }
@@ -295,21 +355,225 @@ void Allocator::FreeMemLinear ( DataPtr& p )
 	if ( p.gpu != 0x0 ) cudaCheck ( cuMemFree (p.gpu), "Allocator", "FreeMemLinear", "cuMemFree", "", mbDebug);
 	p.cpu = 0x0;
 	p.gpu = 0x0;
+	MemTrackData ( p, false, 0 );
+	MemTrackData ( p, true, 0 );
+}
+
+DataBuffer Allocator::CreateBuffer ( int stride, uint64 cnt, bool bCPU, int memtag )
+{
+	DataPtr p;
+	p.memtag = memtag;
+	CreateMemLinear ( p, 0x0, stride, cnt, bCPU );
+	return DataBuffer ( p );
+}
+
+DataBuffer::DataBuffer ( DataBuffer&& src ) : mPtr ( src.mPtr )
+{
+	src.mPtr = DataPtr();
+}
+
+DataBuffer& DataBuffer::operator= ( DataBuffer&& src )
+{
+	if ( this != &src ) {
+		reset ();
+		mPtr = src.mPtr;
+		src.mPtr = DataPtr();
+	}
+	return *this;
+}
+
+void DataBuffer::reset ()
+{
+	if ( mPtr.alloc != 0x0 ) {
+		mPtr.alloc->ArenaRelease ( mPtr );		// arena blocks go back to the cache
+		mPtr.alloc->FreeMemLinear ( mPtr );
+	}
+	mPtr = DataPtr();
+}
+
+DataPtr DataBuffer::release ()
+{
+	DataPtr p = mPtr;
+	mPtr = DataPtr();
+	return p;
+}
+
+DataPtr DataBuffer::view () const
+{
+	return view ( 0, mPtr.usedNum );
+}
+
+DataPtr DataBuffer::view ( uint64 first, uint64 cnt ) const
+{
+	DataPtr v = mPtr;
+	uint64 offs = first * mPtr.stride;
+	if ( v.cpu != 0x0 ) v.cpu += offs;
+	if ( v.gpu != 0x0 ) v.gpu += offs;
+	v.lastEle = cnt;
+	v.usedNum = cnt;
+	v.max = cnt;
+	v.size = cnt * mPtr.stride;
+	v.memcpu = 0; v.memgpu = 0;					// views own nothing
+	v.capcpu = 0; v.capgpu = 0;
+	return v;
+}
+
+// Block size for an arena request: 256 bytes minimum, then four classes per
+// power of two (4,5,6,7 x 2^k), so a block wastes at most 25%.
+uint64 Allocator::ArenaClassSize ( uint64 bytes )
+{
+	if ( bytes <= 256 ) return 256;
+	uint64 step = 64;
+	while ( (step << 3) < bytes ) step <<= 1;
+	return ((bytes + step - 1) / step) * step;
+}
+
+void Allocator::ArenaAcquire ( DataPtr& p, int stride, uint64 cnt, bool bCPU )
+{
+	uint64 sz = (uint64) stride * cnt;
+	uint64 had = std::max ( p.size, p.max * p.stride );	// extent of a buffer not from the arena
+	p.alloc = this;
+	p.lastEle = cnt;
+	p.usedNum = cnt;
+	p.max = cnt;
+	p.stride = stride;
+	p.size = sz;
+	p.subdim = Vector3DI(0,0,0);
+
+	// Blocks not from the arena are kept while large enough. Otherwise they are freed if
+	// GVDB accounts for them (CreateMemLinear), or only dropped if they belong to the user.
+	if ( p.gpu != 0x0 && p.capgpu == 0 && (p.memgpu != 0 ? p.memgpu : had) < sz ) {
+		if ( p.memgpu != 0 ) {
+			cudaCheck ( cuMemFree ( p.gpu ), "Allocator", "ArenaAcquire", "cuMemFree", "", mbDebug );
+			MemTrackData ( p, true, 0 );
+		}
+		p.gpu = 0x0;
+	}
+	if ( p.cpu != 0x0 && p.capcpu == 0 && (p.memcpu != 0 ? p.memcpu : had) < sz ) {
+		if ( p.memcpu != 0 ) {
+			free ( p.cpu );
+			MemTrackData ( p, false, 0 );
+		}
+		p.cpu = 0x0;
+	}
+
+	// Device block from the arena, grow-only
+	if ( p.gpu == 0x0 || (p.capgpu != 0 && p.capgpu < sz) ) {
+		ArenaRelease ( p );
+		uint64 cap = ArenaClassSize ( sz );
+		std::multimap<uint64, CUdeviceptr>::iterator it = mArenaGPU.lower_bound ( cap );
+		if ( it != mArenaGPU.end() && it->first <= 2*cap ) {		// reuse a cached block
+			cap = it->first;
+			p.gpu = it->second;
+			mArenaGPU.erase ( it );
+			mArenaGPUBytes -= cap;
+			MemTrack ( MemTag(MEM_ARENA, 0), true, -(sint64) cap );
+			Count ( CNT_ARENA_HIT );
+		} else {
+			CUresult res = cuMemAlloc ( &p.gpu, cap );
+			if ( res == CUDA_ERROR_OUT_OF_MEMORY ) {			// memory pressure, drop the cache and retry
+				ArenaTrim ( 0 );
+				res = cuMemAlloc ( &p.gpu, cap );
+			}
+			cudaCheck ( res, "Allocator", "ArenaAcquire", "cuMemAlloc", "", mbDebug );
+			Count ( CNT_ARENA_MISS );
+		}
+		p.capgpu = cap;
+		MemTrackData ( p, true, cap );
+	}
+
+	// Host block from the arena, grow-only. A host copy that is not requested is kept if it is large enough.
+	if ( p.cpu != 0x0 && p.capcpu != 0 && p.capcpu < sz ) {
+		mArenaCPU.insert ( std::make_pair ( p.capcpu, p.cpu ) );
+		mArenaCPUBytes += p.capcpu;
+		MemTrack ( MemTag(MEM_ARENA, 0), false, (sint64) p.capcpu );
+		MemTrackData ( p, false, 0 );
+		p.cpu = 0x0;
+		p.capcpu = 0;
+	}
+	if ( bCPU && p.cpu == 0x0 ) {
+		uint64 cap = ArenaClassSize ( sz );
+		std::multimap<uint64, char*>::iterator it = mArenaCPU.lower_bound ( cap );
+		if ( it != mArenaCPU.end() && it->first <= 2*cap ) {
+			cap = it->first;
+			p.cpu = it->second;
+			mArenaCPU.erase ( it );
+			mArenaCPUBytes -= cap;
+			MemTrack ( MemTag(MEM_ARENA, 0), false, -(sint64) cap );
+			Count ( CNT_ARENA_HIT );
+		} else {
+			p.cpu = HostAlloc ( cap, false );
+			Count ( CNT_ARENA_MISS );
+		}
+		p.capcpu = cap;
+		MemTrackData ( p, false, cap );
+	}
+}
+
+void Allocator::ArenaRelease ( DataPtr& p )
+{
+	if ( p.gpu != 0x0 && p.capgpu != 0 ) {
+		mArenaGPU.insert ( std::make_pair ( p.capgpu, p.gpu ) );
+		mArenaGPUBytes += p.capgpu;
+		MemTrack ( MemTag(MEM_ARENA, 0), true, (sint64) p.capgpu );
+		MemTrackData ( p, true, 0 );
+		p.gpu = 0x0;
+		p.capgpu = 0;
+	}
+	if ( p.cpu != 0x0 && p.capcpu != 0 ) {
+		mArenaCPU.insert ( std::make_pair ( p.capcpu, p.cpu ) );
+		mArenaCPUBytes += p.capcpu;
+		MemTrack ( MemTag(MEM_ARENA, 0), false, (sint64) p.capcpu );
+		MemTrackData ( p, false, 0 );
+		p.cpu = 0x0;
+		p.capcpu = 0;
+	}
+	if ( mArenaGPUBytes > mArenaLimit || mArenaCPUBytes > mArenaLimit )
+		ArenaTrim ( mArenaLimit );
+}
+
+// Frees cached blocks, largest first, until at most keep_bytes remain on each side.
+uint64 Allocator::ArenaTrim ( uint64 keep_bytes )
+{
+	uint64 freed = 0;
+	while ( mArenaGPUBytes > keep_bytes && !mArenaGPU.empty() ) {
+		std::multimap<uint64, CUdeviceptr>::iterator it = --mArenaGPU.end();
+		cudaCheck ( cuMemFree ( it->second ), "Allocator", "ArenaTrim", "cuMemFree", "", mbDebug );
+		mArenaGPUBytes -= it->first;
+		MemTrack ( MemTag(MEM_ARENA, 0), true, -(sint64) it->first );
+		freed += it->first;
+		mArenaGPU.erase ( it );
+	}
+	while ( mArenaCPUBytes > keep_bytes && !mArenaCPU.empty() ) {
+		std::multimap<uint64, char*>::iterator it = --mArenaCPU.end();
+		HostFree ( it->second );
+		mArenaCPUBytes -= it->first;
+		MemTrack ( MemTag(MEM_ARENA, 0), false, -(sint64) it->first );
+		freed += it->first;
+		mArenaCPU.erase ( it );
+	}
+	return freed;
 }
 
 void Allocator::RetrieveMem ( DataPtr& p)
 {
 	cudaCheck ( cuMemcpyDtoH ( p.cpu, p.gpu, p.size), "Allocator", "RetrieveMem", "cuMemcpyDtoH", "", mbDebug);
+	Count ( CNT_RETRIEVE_BYTES, p.size );
 }
 
 void Allocator::CommitMem ( DataPtr& p)
 {
 	cudaCheck ( cuMemcpyHtoD ( p.gpu, p.cpu, p.size), "Allocator", "CommitMem", "cuMemcpyHtoD", "", mbDebug);
+	Count ( CNT_COMMIT_BYTES, p.size );
 }
 
 
 void Allocator::AllocateTextureGPU ( DataPtr& p, uchar dtype, Vector3DI res, bool bGL, uint64 preserve )
 {	
+	// Device bytes of the new texture (float3 is stored as 4 channels)
+	uint64 gpu_sz = uint64(res.x) * uint64(res.y) * uint64(res.z) * ((dtype==T_FLOAT3) ? 4*sizeof(float) : getSize(dtype));
+	if ( res.x <= 0 || res.y <= 0 || res.z <= 0 ) gpu_sz = 0;
+
 	// GPU allocate	
 	if ( bGL ) {
 		// OpenGL 3D texture
@@ -347,10 +611,13 @@ void Allocator::AllocateTextureGPU ( DataPtr& p, uchar dtype, Vector3DI res, boo
 				const Vector3DI src (res.x, res.y, static_cast<int>(preserve / bytesPerPlane));	 // src amount to copy 				
 				glCopyImageSubData ( old_glid, GL_TEXTURE_3D, 0, 0,0,0, p.glid, GL_TEXTURE_3D, 0, 0,0,0, src.x, src.y, src.z );
 			}
+			MemTrack ( p.memtag, true, gpu_sz );			// old and new coexist during the copy
 			if ( old_glid != -1 ) {
 				GLuint id = old_glid;
 				glDeleteTextures ( 1, &id );
 			}
+			MemTrack ( p.memtag, true, -sint64(gpu_sz) );
+			MemTrackData ( p, true, gpu_sz );
 
 			// CUDA-GL interop for CUarray
 			if ( p.grsc != 0 ) cudaCheck ( cuGraphicsUnregisterResource ( p.grsc ), "Allocator", "AllocateTextureGPU", "cuGraphicsUnregisterResource", "", mbDebug);
@@ -444,14 +711,17 @@ void Allocator::AllocateTextureGPU ( DataPtr& p, uchar dtype, Vector3DI res, boo
 				cp.WidthInBytes = res.x * getSize(dtype);
 				cp.Height = res.y;
 				cp.Depth = preserve / (res.x*res.y*getSize(dtype));	  // amount to copy (preserve)
-				if ( cp.Depth < desc.Depth )
+				if ( cp.Depth <= desc.Depth )
 				   cudaCheck ( cuMemcpy3D ( &cp ), "Allocator", "AllocateTextureGPU", "cuMemcpy3D", "preserve", mbDebug);
 			}
 
 		} else {
 			p.garray = 0;
 		}
+		MemTrack ( p.memtag, true, gpu_sz );			// old and new coexist during the copy
 		if ( old_array != 0 ) cudaCheck ( cuArrayDestroy ( old_array ), "Allocator", "AllocateTextureGPU", "cuArrayDestroy", "", mbDebug);
+		MemTrack ( p.memtag, true, -sint64(gpu_sz) );
+		MemTrackData ( p, true, gpu_sz );
 	}	
 }
 
@@ -460,11 +730,14 @@ void Allocator::AllocateTextureCPU ( DataPtr& p, uint64 sz, bool bCPU, uint64 pr
 {
 	if ( bCPU ) {
 		char* old_cpu = p.cpu;
-		p.cpu = (char*) malloc ( p.size );		
+		p.cpu = HostAlloc ( p.size, false );		
+		MemTrack ( p.memtag, false, p.size );		// old and new coexist during the copy
 		if ( preserve > 0 && old_cpu != 0x0 ) {
-			memcpy ( p.cpu, old_cpu, preserve );
+			HostCopy ( p.cpu, old_cpu, preserve );
 		}
-		if ( old_cpu != 0x0 ) free ( old_cpu );	
+		if ( old_cpu != 0x0 ) HostFree ( old_cpu );	
+		MemTrack ( p.memtag, false, -sint64(p.size) );
+		MemTrackData ( p, false, p.size );
 	}
 }
 
@@ -485,12 +758,15 @@ void Allocator::AllocateAtlasMap ( int stride, Vector3DI axiscnt )
 	q.lastEle = q.max;
 	q.stride = stride;
 	q.size = stride * q.max;					// list of mapping structs			
+	q.memtag = MemTag ( MEM_ATLAS_MAP, 0 );
 	if ( q.cpu != 0x0 ) free ( q.cpu );
 	q.cpu = (char*) malloc ( q.size );			// cpu allocate		
+	MemTrackData ( q, false, q.size );
 			
 	size_t sz = q.size;							// gpu allocate
 	if ( q.gpu != 0x0 ) cudaCheck ( cuMemFree ( q.gpu ), "Allocator", "AllocateAtlasMap", "cuMemFree", "", mbDebug);
 	cudaCheck ( cuMemAlloc ( &q.gpu, q.size ), "Allocator", "AllocateAtlasMap", "cuMemAlloc", "", mbDebug );
+	MemTrackData ( q, true, q.size );
 
 	mAtlasMap[0] = q;
 }
@@ -548,6 +824,7 @@ bool Allocator::AtlasCreate ( uchar chan, uchar dtype, Vector3DI leafdim, Vector
 	p.glid = -1;
 	p.grsc = 0x0;
 	p.garray = 0x0;
+	p.memtag = MemTag ( MEM_ATLAS, chan );
 
 	// Atlas
 	AllocateTextureGPU ( p, dtype, axisres, bGL, 0 );		// GPU allocate	
@@ -588,6 +865,7 @@ bool Allocator::AtlasResize ( uchar chan, int cx, int cy, int cz )
 	p.subdim = axiscnt;
 
 	// Atlas		
+	Count ( CNT_ATLAS_RESIZE );
 	AllocateTextureGPU ( p, p.type, axisres, (p.glid!=-1), 0 );
 	AllocateTextureCPU ( p, p.size, (p.cpu!=0x0), 0 );
 	mAtlas[chan] = p;
@@ -627,7 +905,7 @@ bool Allocator::AtlasResize ( uchar chan, uint64 max_leaf )
 	Vector3DI axiscnt = p.subdim;	// number of bricks on each axis	
 	uint64 preserve = p.size;		// previous size of atlas (# bytes to preserve)
 
-	// Expand Z-axis of atlas
+	// Expand (or shrink) Z-axis of atlas
 	axiscnt.z = int(ceil ( max_leaf / float(axiscnt.x*axiscnt.y) ));		// expand number of bricks along Z-axis
 
 	// If atlas will have the same dimensions, do not reallocate
@@ -637,11 +915,13 @@ bool Allocator::AtlasResize ( uchar chan, uint64 max_leaf )
 	// Compute axis res
 	axisres = axiscnt * int(leafdim + p.apron * 2);		// new atlas resolution
 	uint64 atlas_sz = uint64(getSize(p.type)) * axisres.x * uint64(axisres.y) * axisres.z;	// new atlas size
+	preserve = std::min ( preserve, atlas_sz );			// when shrinking, keep the leading layers
 	p.max = axiscnt.x * axiscnt.y * axiscnt.z;			// max leaves supported
 	p.size = atlas_sz;				// new total # bytes
 	p.subdim = axiscnt;				// new number of bricks on each axis
 
 	// Atlas		
+	Count ( CNT_ATLAS_RESIZE );
 	AllocateTextureGPU ( p, p.type, axisres, (p.glid!=-1), preserve );
 	AllocateTextureCPU ( p, p.size, (p.cpu!=0x0), preserve );
 	mAtlas[chan] = p;
@@ -658,12 +938,15 @@ void Allocator::AllocateNeighbors( uint64 cnt )
 	mNeighbors.max = brks;
 	mNeighbors.stride = sizeof(int) * 8;
 	mNeighbors.size = mNeighbors.max * mNeighbors.stride;
+	mNeighbors.memtag = MemTag ( MEM_NEIGHBORS, 0 );
 
 	if (mNeighbors.cpu != 0x0) free(mNeighbors.cpu);
 	mNeighbors.cpu = (char*) malloc(mNeighbors.size);
+	MemTrackData ( mNeighbors, false, mNeighbors.size );
 
 	if ( mNeighbors.gpu != 0x0) cudaCheck(cuMemFree(mNeighbors.gpu), "Allocator", "AllocateNeighbors", "cuMemFree", "", mbDebug);
 	cudaCheck(cuMemAlloc(&mNeighbors.gpu, mNeighbors.size), "Allocator", "AllocateNeighbors", "cuMemAlloc", "", mbDebug);
+	MemTrackData ( mNeighbors, true, mNeighbors.size );
 }
 
 void Allocator::CommitNeighbors()
@@ -808,6 +1091,7 @@ void Allocator::AtlasCommitFromCPU ( uchar chan, uchar* src )
 	cp.Depth = res.z;
 	
 	cudaCheck ( cuMemcpy3D ( &cp ), "Allocator", "AtlasCommitFromCPU", "cuMemcpy3D", "", mbDebug);
+	Count ( CNT_ATLAS_COMMIT_BYTES, uint64(cp.WidthInBytes) * cp.Height * cp.Depth );
 }
 
 void Allocator::AtlasFill ( uchar chan )
@@ -821,6 +1105,30 @@ void Allocator::AtlasFill ( uchar chan )
 	cudaCheck ( cuLaunchKernel ( cuFillTex, grid.x, grid.y, grid.z, block.x, block.y, block.z, 0, mStream, args, NULL ), "Allocator", "AtlasCommitFromCPU", "cuLaunch", "cuFillTex", mbDebug);
 }
 
+void Allocator::AtlasCopyBrick ( uchar chan, Vector3DI src, Vector3DI dst )
+{
+	// src and dst are brick positions in the atlas (excluding apron), as given by AtlasAlloc
+	int apr = mAtlas[chan].apron;
+	int br = static_cast<int>(mAtlas[chan].stride) + apr*2;
+	int esize = (mAtlas[chan].type == T_FLOAT3) ? 4*sizeof(float) : getSize( mAtlas[chan].type );
+
+	CUDA_MEMCPY3D cp = {0};
+	cp.srcMemoryType = CU_MEMORYTYPE_ARRAY;
+	cp.srcArray = mAtlas[chan].garray;
+	cp.srcXInBytes = size_t(src.x - apr) * esize;
+	cp.srcY = src.y - apr;
+	cp.srcZ = src.z - apr;
+	cp.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+	cp.dstArray = mAtlas[chan].garray;
+	cp.dstXInBytes = size_t(dst.x - apr) * esize;
+	cp.dstY = dst.y - apr;
+	cp.dstZ = dst.z - apr;
+	cp.WidthInBytes = size_t(br) * esize;
+	cp.Height = br;
+	cp.Depth = br;
+	cudaCheck ( cuMemcpy3D ( &cp ), "Allocator", "AtlasCopyBrick", "cuMemcpy3D", "", mbDebug);
+}
+
 void Allocator::AtlasRetrieveSlice ( uchar chan, int slice, int sz, CUdeviceptr gpu_buf, uchar* cpu_dest )
 {
 	// transfer a 3D texture slice into gpu buffer
@@ -838,6 +1146,25 @@ void Allocator::AtlasRetrieveSlice ( uchar chan, int slice, int sz, CUdeviceptr
 	cp.Height = atlasres.y;
 	cp.Depth = 1;
 	cudaCheck ( cuMemcpy3D ( &cp ), "Allocator", "AtlasRetrieveSlice", "cuMemcpy3D", "", mbDebug);
+	Count ( CNT_ATLAS_RETRIEVE_BYTES, uint64(cp.WidthInBytes) * cp.Height );
+}
+
+// Transfer voxel slices [z0, z0+cnt) of an atlas to host memory in one copy
+void Allocator::AtlasRetrieveSlices ( uchar chan, int z0, int cnt, uchar* dest )
+{
+	Vector3DI atlasres = getAtlasRes(chan);
+
+	CUDA_MEMCPY3D cp = {0};
+	cp.srcMemoryType = CU_MEMORYTYPE_ARRAY;
+	cp.srcArray = mAtlas[chan].garray;
+	cp.srcZ = z0;
+	cp.dstMemoryType = CU_MEMORYTYPE_HOST;
+	cp.dstHost = dest;
+	cp.WidthInBytes = atlasres.x * getAtlasVoxelBytes ( chan );
+	cp.Height = atlasres.y;
+	cp.Depth = cnt;
+	cudaCheck ( cuMemcpy3D ( &cp ), "Allocator", "AtlasRetrieveSlices", "cuMemcpy3D", "", mbDebug);
+	Count ( CNT_ATLAS_RETRIEVE_BYTES, uint64(cp.WidthInBytes) * cp.Height * cp.Depth );
 }
 
 void Allocator::AtlasWriteSlice ( uchar chan, int slice, int sz, CUdeviceptr gpu_buf, uchar* cpu_src )
@@ -857,7 +1184,26 @@ void Allocator::AtlasWriteSlice ( uchar chan, int slice, int sz, CUdeviceptr gpu
 	cp.Height = atlasres.y;
 	cp.Depth = 1;
 	cudaCheck ( cuMemcpy3D ( &cp ), "Allocator", "AtlasWriteSlice", "cuMemcpy3D", "", mbDebug);
+	Count ( CNT_ATLAS_COMMIT_BYTES, uint64(cp.WidthInBytes) * cp.Height );
+
+}
 
+// Transfer voxel slices [z0, z0+cnt) from host memory to an atlas in one copy
+void Allocator::AtlasWriteSlices ( uchar chan, int z0, int cnt, const uchar* src )
+{
+	Vector3DI atlasres = getAtlasRes(chan);
+
+	CUDA_MEMCPY3D cp = {0};
+	cp.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+	cp.dstArray = mAtlas[chan].garray;
+	cp.dstZ = z0;
+	cp.srcMemoryType = CU_MEMORYTYPE_HOST;
+	cp.srcHost = src;
+	cp.WidthInBytes = atlasres.x * getAtlasVoxelBytes ( chan );
+	cp.Height = atlasres.y;
+	cp.Depth = cnt;
+	cudaCheck ( cuMemcpy3D ( &cp ), "Allocator", "AtlasWriteSlices", "cuMemcpy3D", "", mbDebug);
+	Count ( CNT_ATLAS_COMMIT_BYTES, uint64(cp.WidthInBytes) * cp.Height * cp.Depth );
 }
 
 void Allocator::AtlasRetrieveGL ( uchar chan, char* dest )
@@ -897,7 +1243,7 @@ void Allocator::AtlasReleaseAll ()
 
 		// Free cpu memory
 		if ( mAtlas[n].cpu != 0x0 ) {
-			free ( mAtlas[n].cpu );
+			HostFree ( mAtlas[n].cpu );
 			mAtlas[n].cpu = 0x0;
 		}
 
@@ -930,6 +1276,8 @@ void Allocator::AtlasReleaseAll ()
 				mAtlas[n].glid = -1;
 			}
 		#endif
+		MemTrackData ( mAtlas[n], false, 0 );
+		MemTrackData ( mAtlas[n], true, 0 );
 	}
 
 	mAtlas.clear ();
@@ -945,6 +1293,8 @@ void Allocator::AtlasReleaseAll ()
 				cudaCheck ( cuMemFree ( mAtlasMap[n].gpu ), "Allocator", "AtlasReleaseAll", "cuMemFree", "AtlasMap", mbDebug);
 				mAtlasMap[n].gpu = 0x0;
 		}
+		MemTrackData ( mAtlasMap[n], false, 0 );
+		MemTrackData ( mAtlasMap[n], true, 0 );
 	}
 	mAtlasMap.clear ();
 }
@@ -965,6 +1315,10 @@ int Allocator::getAtlasBrickres ( uchar chan )
 {
 	return static_cast<int>(mAtlas[chan].stride + (mAtlas[chan].apron<<1));
 }
+int Allocator::getAtlasVoxelBytes ( uchar chan )
+{
+	return (mAtlas[chan].type == T_FLOAT3) ? 4*sizeof(float) : getSize ( mAtlas[chan].type );
+}
 // Res of single brick, without apron
 int Allocator::getAtlasBrickwid (uchar chan)
 {
@@ -982,14 +1336,30 @@ void Allocator::PoolWrite ( FILE* fp, uchar grp, uchar lev )
 {
 	fwrite ( getPoolCPU(grp, lev), getPoolWidth(grp, lev), getPoolTotalCnt(grp, lev), fp );
 }
+// Read `cnt` elements of `wid` bytes each. Elements of a different width than the pool are
+// truncated or zero padded to the pool width, e.g. node records saved with or without bitmasks.
 void Allocator::PoolRead ( FILE* fp, uchar grp, uchar lev, int cnt, int wid )
 {
-	char* dat = getPoolCPU (grp,lev );
-	fread ( dat, wid, cnt, fp );
-
-	mPool[grp][lev].usedNum = cnt;
-	mPool[grp][lev].lastEle = cnt;
-	mPool[grp][lev].stride = wid;
+	DataPtr* p = &mPool[grp][lev];
+	if ( uint64(cnt) > p->max ) {
+		gprintf ( "ERROR: PoolRead, %d elements exceed pool %d,%d capacity of %llu.\n", cnt, grp, lev, (unsigned long long) p->max );
+		gerror ();
+		return;
+	}
+	if ( p->stride == uint64(wid) ) {
+		fread ( p->cpu, wid, cnt, fp );
+	} else {
+		std::vector<char> row ( wid );
+		uint64 keep = std::min ( p->stride, uint64(wid) );
+		for (int n = 0; n < cnt; n++) {
+			char* dst = p->cpu + p->stride * n;
+			fread ( row.data(), wid, 1, fp );
+			memcpy ( dst, row.data(), keep );
+			if ( keep < p->stride ) memset ( dst + keep, 0, p->stride - keep );
+		}
+	}
+	p->usedNum = cnt;
+	p->lastEle = cnt;
 }
 
 void Allocator::AtlasWrite ( FILE* fp, uchar chan )
@@ -1129,6 +1499,214 @@ Vector3DF cudaGetMemUsage ()
 }
 
 
+void Allocator::ResetCounters ()
+{
+	for (int n=0; n < CNT_MAX; n++ )
+		mCounters[n].store ( 0, std::memory_order_relaxed );
+}
+
+Counters Allocator::getCounters ()
+{
+	Counters c;
+	for (int n=0; n < MAX_POOL; n++ )
+		c.nodeAlloc[n] = mCounters[CNT_NODE_ALLOC + n].load ( std::memory_order_relaxed );
+	c.poolGrow				= mCounters[CNT_POOL_GROW].load ( std::memory_order_relaxed );
+	c.poolGrowBytes			= mCounters[CNT_POOL_GROW_BYTES].load ( std::memory_order_relaxed );
+	c.brickActivate			= mCounters[CNT_BRICK_ACTIVATE].load ( std::memory_order_relaxed );
+	c.brickDeactivate		= mCounters[CNT_BRICK_DEACTIVATE].load ( std::memory_order_relaxed );
+	c.atlasResize			= mCounters[CNT_ATLAS_RESIZE].load ( std::memory_order_relaxed );
+	c.commitBytes			= mCounters[CNT_COMMIT_BYTES].load ( std::memory_order_relaxed );
+	c.retrieveBytes			= mCounters[CNT_RETRIEVE_BYTES].load ( std::memory_order_relaxed );
+	c.poolCommitBytes		= mCounters[CNT_POOL_COMMIT_BYTES].load ( std::memory_order_relaxed );
+	c.poolFetchBytes		= mCounters[CNT_POOL_FETCH_BYTES].load ( std::memory_order_relaxed );
+	c.atlasCommitBytes		= mCounters[CNT_ATLAS_COMMIT_BYTES].load ( std::memory_order_relaxed );
+	c.atlasRetrieveBytes	= mCounters[CNT_ATLAS_RETRIEVE_BYTES].load ( std::memory_order_relaxed );
+	c.vbxReadBytes			= mCounters[CNT_VBX_READ_BYTES].load ( std::memory_order_relaxed );
+	c.vbxWriteBytes			= mCounters[CNT_VBX_WRITE_BYTES].load ( std::memory_order_relaxed );
+	c.arenaHit				= mCounters[CNT_ARENA_HIT].load ( std::memory_order_relaxed );
+	c.arenaMiss				= mCounters[CNT_ARENA_MISS].load ( std::memory_order_relaxed );
+	return c;
+}
+
+#if defined(__linux__)
+// Bitmask of online NUMA nodes (first 64), from sysfs, e.g. "0-1" or "0,2-3"
+static unsigned long hostNumaNodes ()
+{
+	unsigned long mask = 0;
+	FILE* fp = fopen ( "/sys/devices/system/node/online", "r" );
+	if ( fp == 0x0 ) return 0;
+	int a, b; char sep;
+	while ( fscanf ( fp, "%d", &a ) == 1 ) {
+		b = a;
+		if ( fscanf ( fp, "%c", &sep ) == 1 && sep == '-' ) {
+			if ( fscanf ( fp, "%d", &b ) != 1 ) break;
+			if ( fscanf ( fp, "%c", &sep ) != 1 ) sep = 0;
+		}
+		for (int n = a; n <= b && n < 64; n++ ) mask |= (1UL << n);
+		if ( sep != ',' ) break;
+	}
+	fclose ( fp );
+	return mask;
+}
+#endif
+
+char* Allocator::HostAlloc ( uint64 sz, bool bZero )
+{
+	if ( sz == 0 ) return 0x0;
+	bool bLarge = ( sz >= mHostPolicy.minBytes );
+	char* ptr = 0x0;
+
+#if defined(__linux__)
+	if ( bLarge && (mHostPolicy.pages != HOST_PAGES_DEFAULT || mHostPolicy.numa != HOST_NUMA_DEFAULT) ) {
+		const uint64 huge = uint64(2) << 20;
+		uint64 len = (sz + huge-1) & ~(huge-1);
+		void* m = MAP_FAILED;
+		if ( mHostPolicy.pages == HOST_PAGES_HUGETLB )
+			m = mmap ( 0x0, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0 );
+		if ( m == MAP_FAILED ) {
+			m = mmap ( 0x0, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+			if ( m != MAP_FAILED && mHostPolicy.pages != HOST_PAGES_DEFAULT )
+				madvise ( m, len, MADV_HUGEPAGE );
+		}
+		if ( m != MAP_FAILED ) {
+			ptr = (char*) m;
+			#ifdef SYS_mbind
+			if ( mHostPolicy.numa == HOST_NUMA_INTERLEAVE ) {
+				static unsigned long nodes = hostNumaNodes ();
+				if ( (nodes & (nodes-1)) != 0 )			// more than one node
+					syscall ( SYS_mbind, ptr, len, 3 /* MPOL_INTERLEAVE */, &nodes, sizeof(nodes)*8, 0 );
+			}
+			#endif
+			std::lock_guard<std::mutex> lock ( mHostMutex );
+			mHostMapped[ptr] = len;
+		}
+	}
+#endif
+
+	bool bTouch = bLarge && mHostPolicy.firstTouch;
+	if ( ptr == 0x0 ) {
+		// calloc zeroes on this thread; with first touch, zero below on all threads instead
+		ptr = (char*) ( (bZero && !bTouch) ? calloc ( sz, 1 ) : malloc ( sz ) );
+		if ( ptr == 0x0 ) return 0x0;
+	}
+	if ( !bTouch ) return ptr;							// mmap'd pages are already zero
+
+	// First touch: fault pages in from all threads in page-aligned chunks
+	const uint64 page = 4096;
+	uint64 pages = (sz + page-1) / page;
+	ParallelChunks ( pages, 0, [&]( int, uint64 s, uint64 e ) {
+		uint64 a = s*page, b = std::min ( e*page, sz );
+		memset ( ptr + a, 0, b - a );
+	} );
+	return ptr;
+}
+
+void Allocator::HostFree ( char* ptr )
+{
+	if ( ptr == 0x0 ) return;
+#if defined(__linux__)
+	{
+		std::lock_guard<std::mutex> lock ( mHostMutex );
+		std::map<char*, uint64>::iterator it = mHostMapped.find ( ptr );
+		if ( it != mHostMapped.end() ) {
+			munmap ( ptr, it->second );
+			mHostMapped.erase ( it );
+			return;
+		}
+	}
+#endif
+	free ( ptr );
+}
+
+void Allocator::HostCopy ( char* dst, const char* src, uint64 sz )
+{
+	if ( sz < mHostPolicy.minBytes || !mHostPolicy.firstTouch ) {
+		memcpy ( dst, src, sz );
+		return;
+	}
+	const uint64 page = 4096;
+	uint64 pages = (sz + page-1) / page;
+	ParallelChunks ( pages, 0, [&]( int, uint64 s, uint64 e ) {
+		uint64 a = s*page, b = std::min ( e*page, sz );
+		memcpy ( dst + a, src + a, b - a );
+	} );
+}
+
+void Allocator::MemTrack ( int tag, bool bGPU, sint64 delta )
+{
+	if ( delta == 0 ) return;
+	std::lock_guard<std::mutex> lock ( mMemMutex );
+	std::map<int, MemUsage>::iterator it = mMem.find ( tag );
+	if ( it == mMem.end() ) {
+		MemUsage m;
+		memset ( &m, 0, sizeof(MemUsage) );
+		m.category = tag >> 16;
+		m.id = tag & 0xFFFF;
+		it = mMem.insert ( std::make_pair ( tag, m ) ).first;
+	}
+	MemUsage& m = it->second;
+	uint64& curr = bGPU ? m.gpu : m.cpu;
+	uint64& peak = bGPU ? m.gpuPeak : m.cpuPeak;
+	uint64& tcurr = bGPU ? mMemTotal.gpu : mMemTotal.cpu;
+	uint64& tpeak = bGPU ? mMemTotal.gpuPeak : mMemTotal.cpuPeak;
+
+	// Releasing more than is tracked means a buffer was released twice
+	assert ( delta > 0 || uint64(-delta) <= curr );
+	curr += delta;
+	tcurr += delta;
+	if ( curr > peak ) peak = curr;
+	if ( tcurr > tpeak ) tpeak = tcurr;
+}
+
+void Allocator::MemTrackData ( DataPtr& p, bool bGPU, uint64 bytes )
+{
+	uint64& owned = bGPU ? p.memgpu : p.memcpu;
+	MemTrack ( p.memtag, bGPU, sint64(bytes) - sint64(owned) );
+	owned = bytes;
+}
+
+void Allocator::ResetMemPeaks ()
+{
+	std::lock_guard<std::mutex> lock ( mMemMutex );
+	for (std::map<int, MemUsage>::iterator it = mMem.begin(); it != mMem.end(); it++ ) {
+		it->second.cpuPeak = it->second.cpu;
+		it->second.gpuPeak = it->second.gpu;
+	}
+	mMemTotal.cpuPeak = mMemTotal.cpu;
+	mMemTotal.gpuPeak = mMemTotal.gpu;
+}
+
+std::vector<MemUsage> Allocator::getMemUsage ()
+{
+	std::lock_guard<std::mutex> lock ( mMemMutex );
+	std::vector<MemUsage> list;
+	for (std::map<int, MemUsage>::iterator it = mMem.begin(); it != mMem.end(); it++ )
+		list.push_back ( it->second );
+	return list;
+}
+
+MemUsage Allocator::getMemTotal ()
+{
+	std::lock_guard<std::mutex> lock ( mMemMutex );
+	return mMemTotal;
+}
+
+const char* Allocator::getMemCategoryName ( int cat )
+{
+	switch ( cat ) {
+	case MEM_POOL:		return "pool";
+	case MEM_ATLAS:		return "atlas";
+	case MEM_ATLAS_MAP:	return "atlas_map";
+	case MEM_NEIGHBORS:	return "neighbors";
+	case MEM_AUX:		return "aux";
+	case MEM_DATA:		return "data";
+	case MEM_STAGING:	return "staging";
+	case MEM_ARENA:		return "arena";
+	case MEM_OTHER:		return "other";
+	}
+	return "total";
+}
+
 DataPtr* Allocator::getPool(uchar grp, uchar lev)
 {
 	return &mPool[grp][lev];
@@ -13,7 +13,11 @@
 	#include "gvdb_types.h"		
 	#include "gvdb_vec.h"
 	#include <vector>
+	#include <atomic>
+	#include <map>
+	#include <mutex>
 	#include <cuda.h>
+	#include <cstring>
 	using namespace nvdb;
 
 	// Maximum number of GVDB Pool levels
@@ -52,8 +56,136 @@
 		CUdeviceptr	gpu;				// gpu pointer (cuda)	
 		CUtexObject tex_obj;			// gpu texture object
 		CUsurfObject surf_obj;			// gpu surface object
+		int			memtag;				// memory accounting category, see MemTag
+		uint64		memcpu;				// host bytes accounted to this pointer
+		uint64		memgpu;				// device bytes accounted to this pointer
+		uint64		capcpu;				// host block size from the recycling arena, 0 if not arena-owned
+		uint64		capgpu;				// device block size from the recycling arena, 0 if not arena-owned
+	};
+
+	// Owning buffer
+	// Move-only wrapper that owns the memory of a DataPtr and releases it through its
+	// Allocator when destroyed or reset. view() returns a non-owning DataPtr for the
+	// DataPtr-based APIs; views must not outlive the buffer. Destroy while the CUDA
+	// context that allocated the buffer is current.
+	class GVDB_API DataBuffer {
+	public:
+		DataBuffer ()							{}
+		explicit DataBuffer ( const DataPtr& p ) : mPtr(p) {}	// adopt memory from CreateMemLinear/AllocData
+		DataBuffer ( DataBuffer&& src );
+		DataBuffer& operator= ( DataBuffer&& src );
+		DataBuffer ( const DataBuffer& ) = delete;
+		DataBuffer& operator= ( const DataBuffer& ) = delete;
+		~DataBuffer ()							{ reset (); }
+
+		void		reset ();								// free the memory, buffer becomes empty
+		DataPtr		release ();								// give up ownership without freeing
+		DataPtr		view () const;							// non-owning view of the whole buffer
+		DataPtr		view ( uint64 first, uint64 cnt ) const;	// non-owning view of elements [first, first+cnt)
+		DataPtr&	ptr ()								{ return mPtr; }
+
+		bool		empty () const						{ return mPtr.cpu == 0x0 && mPtr.gpu == 0x0; }
+		uint64		count () const						{ return mPtr.usedNum; }
+		uint64		stride () const						{ return mPtr.stride; }
+		uint64		bytes () const						{ return mPtr.size; }
+		char*		cpu () const						{ return mPtr.cpu; }
+		CUdeviceptr	gpu () const						{ return mPtr.gpu; }
+		template<typename T> T* cpuAs () const			{ return (T*) mPtr.cpu; }
+
+	private:
+		DataPtr		mPtr;
 	};	
+
+	// Memory accounting
+	// Every host and device allocation made through the Allocator is attributed to a
+	// category and id (pool level, channel, aux id..), with current and peak bytes.
+	enum MemCategory {
+		MEM_POOL = 0,				// topology pools, id = (grp << 8) | lev
+		MEM_ATLAS,					// atlas channels, id = channel
+		MEM_ATLAS_MAP,				// atlas mapping table
+		MEM_NEIGHBORS,				// neighbor table
+		MEM_AUX,					// auxiliary buffers, id = aux id
+		MEM_DATA,					// user buffers from AllocData
+		MEM_STAGING,				// temporary I/O staging buffers
+		MEM_ARENA,					// free blocks cached by the recycling arena
+		MEM_OTHER,					// anything else (transfer func, ..)
+		MEM_CAT_MAX
+	};
+	inline int MemTag ( int cat, int id )		{ return (cat << 16) | (id & 0xFFFF); }
+
+	struct GVDB_API MemUsage {
+		int			category;			// MemCategory, or -1 for the total
+		int			id;					// pool level, channel or aux id
+		uint64		cpu;				// current host bytes
+		uint64		gpu;				// current device bytes
+		uint64		cpuPeak;			// peak host bytes
+		uint64		gpuPeak;			// peak device bytes
+	};
 	
+	// Performance counters
+	// Always-on counters of allocation and transfer work. Incremented with
+	// relaxed atomics, so they are cheap enough to leave enabled in production.
+	enum CounterId {
+		CNT_POOL_GROW = 0,			// pool expansions in PoolAlloc
+		CNT_POOL_GROW_BYTES,		// bytes copied by pool expansions (cpu + gpu)
+		CNT_BRICK_ACTIVATE,			// leaf bricks activated
+		CNT_BRICK_DEACTIVATE,		// leaf bricks deactivated
+		CNT_ATLAS_RESIZE,			// atlas channel reallocations
+		CNT_COMMIT_BYTES,			// HtoD bytes, CommitData (CommitMem)
+		CNT_RETRIEVE_BYTES,			// DtoH bytes, RetrieveData (RetrieveMem)
+		CNT_POOL_COMMIT_BYTES,		// HtoD bytes, PoolCommit and atlas map
+		CNT_POOL_FETCH_BYTES,		// DtoH bytes, PoolFetch
+		CNT_ATLAS_COMMIT_BYTES,		// HtoD bytes, AtlasCommit and atlas slice writes
+		CNT_ATLAS_RETRIEVE_BYTES,	// DtoH bytes, atlas slice reads
+		CNT_VBX_READ_BYTES,			// bytes read by LoadVBX
+		CNT_VBX_WRITE_BYTES,		// bytes written by SaveVBX
+		CNT_ARENA_HIT,				// arena requests served from cached blocks
+		CNT_ARENA_MISS,				// arena requests that allocated a new block
+		CNT_NODE_ALLOC,				// nodes allocated per level (MAX_POOL entries)
+		CNT_MAX = CNT_NODE_ALLOC + MAX_POOL
+	};
+
+	// Snapshot of the performance counters. See VolumeGVDB::getCounters
+	struct GVDB_API Counters {
+		uint64		nodeAlloc[MAX_POOL];	// nodes allocated per level
+		uint64		poolGrow;				// pool expansions
+		uint64		poolGrowBytes;			// bytes copied by pool expansions
+		uint64		brickActivate;			// bricks activated
+		uint64		brickDeactivate;		// bricks deactivated
+		uint64		atlasResize;			// atlas reallocations
+		uint64		commitBytes;			// host-to-device, CommitData
+		uint64		retrieveBytes;			// device-to-host, RetrieveData
+		uint64		poolCommitBytes;		// host-to-device, PoolCommit
+		uint64		poolFetchBytes;			// device-to-host, PoolFetch
+		uint64		atlasCommitBytes;		// host-to-device, AtlasCommit
+		uint64		atlasRetrieveBytes;		// device-to-host, atlas readback
+		uint64		vbxReadBytes;			// VBX bytes read
+		uint64		vbxWriteBytes;			// VBX bytes written
+		uint64		arenaHit;				// arena blocks reused
+		uint64		arenaMiss;				// arena blocks allocated
+	};
+	
+	// Host memory policy
+	// Controls how large host buffers (node pools, atlas CPU copies) are allocated.
+	// Buffers smaller than minBytes always use malloc/calloc. Linux only; elsewhere
+	// the default policy is used.
+	enum HostPageMode {
+		HOST_PAGES_DEFAULT = 0,		// malloc/calloc
+		HOST_PAGES_THP,				// mmap + madvise(MADV_HUGEPAGE), transparent 2MB pages
+		HOST_PAGES_HUGETLB			// mmap with MAP_HUGETLB (reserved pages), falls back to THP
+	};
+	enum HostNumaMode {
+		HOST_NUMA_DEFAULT = 0,		// OS default, pages land on the node of the first touching thread
+		HOST_NUMA_INTERLEAVE		// pages interleaved across all online nodes
+	};
+	struct GVDB_API HostMemPolicy {
+		HostMemPolicy() : pages(HOST_PAGES_DEFAULT), numa(HOST_NUMA_DEFAULT), firstTouch(false), minBytes(uint64(4) << 20) {}
+		int			pages;				// HostPageMode
+		int			numa;				// HostNumaMode
+		bool		firstTouch;			// zero/copy new buffers on all threads, so pages spread over their nodes
+		uint64		minBytes;			// smaller buffers use plain malloc
+	};
+
 	// Element conversions
 	// Used to pack/unpack the group, level, and index from a pool reference
 	inline uint64 Elem ( uchar grp, uchar lev, uint64 ndx )	{ return uint64(grp) | (uint64(lev) << 8) | (uint64(ndx) << 16); }
@@ -61,6 +193,29 @@
 	inline uchar ElemLev ( uint64 id )						{ return uchar((id>>8) & 0xFF); }
 	inline uint64 ElemNdx ( uint64 id )						{ return id >> 16; }	
 
+	// Stored node references (noderef) to and from pool references
+	#ifdef USE_COMPACT_NODES
+		inline noderef ElemRef ( uint64 id )					{ return ( id == ID_UNDEF64 || id == ID_UNDEFL ) ? ID_UNDEFREF : noderef(ElemNdx(id)); }
+		inline uint64 RefElem ( noderef r, uchar grp, uchar lev )	{ return ( r == ID_UNDEFREF ) ? ID_UNDEF64 : Elem(grp, lev, r); }
+	#else
+		inline noderef ElemRef ( uint64 id )					{ return id; }
+		inline uint64 RefElem ( noderef r, uchar, uchar )		{ return r; }
+	#endif
+
+	// Constant-value tiles
+	// A child list entry may hold a tile in place of a child reference: a single value for the
+	// whole region the child would cover. Tiles use group ELEM_TILE, which is never a pool group,
+	// and keep the value's bits in the upper 32 bits.
+	#define ELEM_TILE		0xFE
+	// Tiles need dense child lists of full 64-bit references, so packed (USE_BITMASKS) and
+	// compact (USE_COMPACT_NODES) builds leave them out.
+	#if !defined(USE_BITMASKS) && !defined(USE_COMPACT_NODES)
+		#define GVDB_TILES
+	#endif
+	inline uint64 ElemTile ( float v )						{ uint32 b; memcpy ( &b, &v, sizeof(b) ); return uint64(ELEM_TILE) | (uint64(b) << 32); }
+	inline bool isElemTile ( uint64 id )					{ return (id & 0xFF) == ELEM_TILE; }
+	inline float ElemTileValue ( uint64 id )				{ uint32 b = uint32(id >> 32); float v; memcpy ( &v, &b, sizeof(v) ); return v; }
+
 	// Allocator
 	// Primary memory handler for GVDB
 	class Allocator {
@@ -80,7 +235,7 @@
 		void	PoolFetch(int grp, int lev );
 
 		uint64	PoolAlloc ( uchar grp, uchar lev, bool bGPU );		// allocate on pool
-		void	PoolFree ( uint64 id );								// free from pool		
+		void	PoolFree ( uint64 id );								// free from pool, reused by PoolAlloc
 		char*	PoolData ( uint64 id );								// get data ptr
 		char*	PoolData ( uchar grp, uchar lev, uint64 ndx );
 		uint64* PoolData64 ( uint64 id );		
@@ -91,6 +246,7 @@
 		uint64  getPoolSize ( uchar grp, uchar lev ) { return mPool[grp][lev].size; }
 		CUdeviceptr	getPoolGPU ( uchar grp, uchar lev )	{ return mPool[grp][lev].gpu; }
 		uint64	getPoolWidth ( uchar grp, uchar lev );					// get pool width		
+		int		getNumPools ( uchar grp )	{ return (int) mPool[grp].size(); }
 		uint64	getPoolMem ();
 		void	PoolWrite ( FILE* fp, uchar grp, uchar lev );
 		void	PoolRead ( FILE* fp, uchar grp, uchar lev, int cnt, int wid );
@@ -118,8 +274,11 @@
 		void	AtlasCopyTex ( uchar chan, Vector3DI val, const DataPtr& src );		// device-to-device copy 3D sub-vol into 3D 
 		void	AtlasCopyTexZYX ( uchar chan, Vector3DI val, const DataPtr& src );	// device-to-device copy 3D sub-vol into 3D, ZYX order 		
 		void	AtlasCopyLinear ( uchar chan, Vector3DI offset, CUdeviceptr gpu_buf );
+		void	AtlasCopyBrick ( uchar chan, Vector3DI src, Vector3DI dst );		// device-to-device copy of one brick (apron included) within the atlas
 		void	AtlasRetrieveSlice ( uchar chan, int y, int sz, CUdeviceptr tempmem, uchar* dest );
+		void	AtlasRetrieveSlices ( uchar chan, int z0, int cnt, uchar* dest );	// cnt voxel slices, getAtlasVoxelBytes per voxel
 		void	AtlasWriteSlice ( uchar chan, int slice, int sz, CUdeviceptr gpu_buf, uchar* cpu_src );
+		void	AtlasWriteSlices ( uchar chan, int z0, int cnt, const uchar* src );		// cnt voxel slices, getAtlasVoxelBytes per voxel
 		void	AtlasRetrieveTexXYZ ( uchar chan, Vector3DI val, DataPtr& buf );		
 		uint64	getAtlasMem (); // Returns the number of megabytes of memory used by the atlas.
 		void	AtlasWrite ( FILE* fp, uchar chan );		
@@ -129,6 +288,7 @@
 		void	CreateMemLinear ( DataPtr& p, char* dat, int sz );
 		void	CreateMemLinear ( DataPtr& p, char* dat, int stride, uint64 cnt, bool bCPU, bool bAllocHost = false  );
 		void    FreeMemLinear ( DataPtr& p );
+		DataBuffer CreateBuffer ( int stride, uint64 cnt, bool bCPU, int memtag = MemTag(MEM_DATA, 0) );
 		void    RetrieveMem ( DataPtr& p);
 		void    CommitMem ( DataPtr& p);
 
@@ -158,6 +318,7 @@
 		Vector3DI getAtlasPackres(uchar chan);
 		Vector3DI getAtlasCnt(uchar chan)		{ return mAtlas[chan].subdim; }		
 		int		getAtlasBrickres ( uchar chan);				
+		int		getAtlasVoxelBytes ( uchar chan );			// bytes per voxel on the device (T_FLOAT3 is stored as 4 floats)
 		int		getAtlasBrickwid ( uchar chan);
 		int		getNumLevels ()		{ return (int) mPool[0].size(); }
 		DataPtr* getPool(uchar grp, uchar lev);
@@ -168,13 +329,57 @@
 		CUstream getStream() { return mStream; }
 		void SetDebug(bool b) { mbDebug = b; }
 
+		// Performance counters
+		void	Count ( int id, uint64 n = 1 )	{ mCounters[id].fetch_add ( n, std::memory_order_relaxed ); }
+		void	ResetCounters ();
+		Counters getCounters ();
+
+		// Host memory policy
+		void	SetHostMemPolicy ( const HostMemPolicy& p )	{ mHostPolicy = p; }
+		HostMemPolicy getHostMemPolicy ()					{ return mHostPolicy; }
+		char*	HostAlloc ( uint64 sz, bool bZero );			// allocate per policy
+		void	HostFree ( char* ptr );							// release memory from HostAlloc (or malloc)
+		void	HostCopy ( char* dst, const char* src, uint64 sz );	// copy, in parallel under firstTouch
+
+		// Recycling arena
+		// Grow-only linear buffers backed by size-classed blocks. Released blocks are cached
+		// rather than freed, so per-frame buffers stop hitting cuMemAlloc/malloc. The cache is
+		// trimmed by ArenaTrim, when it exceeds the arena limit, and when a device allocation fails.
+		void	ArenaAcquire ( DataPtr& p, int stride, uint64 cnt, bool bCPU );	// size p, keeping its blocks if large enough
+		void	ArenaRelease ( DataPtr& p );								// return p's blocks to the cache
+		uint64	ArenaTrim ( uint64 keep_bytes = 0 );						// free cached blocks down to keep_bytes (host and device each)
+		void	SetArenaLimit ( uint64 max_bytes )	{ mArenaLimit = max_bytes; }
+		uint64	getArenaCached ( bool bGPU )		{ return bGPU ? mArenaGPUBytes : mArenaCPUBytes; }
+		static uint64 ArenaClassSize ( uint64 bytes );						// block size used for a request
+
+		// Memory accounting
+		void	MemTrack ( int tag, bool bGPU, sint64 delta );			// adjust bytes of a category
+		void	MemTrackData ( DataPtr& p, bool bGPU, uint64 bytes );	// set bytes currently owned by p
+		void	ResetMemPeaks ();										// peaks = current usage
+		std::vector<MemUsage> getMemUsage ();							// per category and id
+		MemUsage getMemTotal ();										// totals over all categories
+		static const char* getMemCategoryName ( int cat );
+
 	private:
 
 		std::vector< DataPtr >		mPool[ MAX_POOL ];
+		std::vector< std::vector<uint64> >	mPoolFree[ MAX_POOL ];	// freed element indices per pool
 		std::vector< DataPtr >		mAtlas;
 		std::vector< DataPtr >		mAtlasMap;
 		DataPtr						mNeighbors;
 		bool						mbDebug;
+		std::atomic<uint64>			mCounters[CNT_MAX];
+		std::map<int, MemUsage>		mMem;
+		MemUsage					mMemTotal;
+		std::mutex					mMemMutex;
+		HostMemPolicy				mHostPolicy;
+		std::map<char*, uint64>		mHostMapped;		// mmap'd host blocks and their lengths
+		std::mutex					mHostMutex;
+		std::multimap<uint64, CUdeviceptr>	mArenaGPU;	// cached device blocks by size
+		std::multimap<uint64, char*>		mArenaCPU;	// cached host blocks by size
+		uint64						mArenaGPUBytes;
+		uint64						mArenaCPUBytes;
+		uint64						mArenaLimit;
 
 		int							mVFBO[2];
 
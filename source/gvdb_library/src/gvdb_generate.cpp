@@ -0,0 +1,449 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+#include "gvdb_generate.h"
+#include "gvdb_volume_gvdb.h"
+#include "gvdb_parallel.h"
+#include "app_perf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+using namespace nvdb;
+
+//-------------------------------------------------------- Helpers
+
+// 64-bit integer mix (splitmix64 finalizer)
+static inline uint64 mix64 ( uint64 h )
+{
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+	return h ^ (h >> 31);
+}
+
+// Hash of a lattice point to [0,1)
+static inline float latticeValue ( int x, int y, int z, uint64 seed )
+{
+	uint64 h = mix64 ( seed ^ (uint64(uint32(x)) * 0x9E3779B97F4A7C15ULL) );
+	h = mix64 ( h ^ (uint64(uint32(y)) * 0xC2B2AE3D27D4EB4FULL) );
+	h = mix64 ( h ^ (uint64(uint32(z)) * 0x165667B19E3779F9ULL) );
+	return float(h >> 40) / float(1 << 24);
+}
+
+// Smooth trilinear value noise in [0,1)
+static float valueNoise ( Vector3DF p, uint64 seed )
+{
+	float fx = floorf(p.x), fy = floorf(p.y), fz = floorf(p.z);
+	int ix = int(fx), iy = int(fy), iz = int(fz);
+	float tx = p.x - fx, ty = p.y - fy, tz = p.z - fz;
+	tx = tx*tx*(3-2*tx);	ty = ty*ty*(3-2*ty);	tz = tz*tz*(3-2*tz);
+
+	float c[2][2];
+	for (int k = 0; k < 2; k++)
+		for (int j = 0; j < 2; j++) {
+			float v0 = latticeValue ( ix, iy+j, iz+k, seed );
+			float v1 = latticeValue ( ix+1, iy+j, iz+k, seed );
+			c[k][j] = v0 + (v1-v0)*tx;
+		}
+	float c0 = c[0][0] + (c[0][1]-c[0][0])*ty;
+	float c1 = c[1][0] + (c[1][1]-c[1][0])*ty;
+	return c0 + (c1-c0)*tz;
+}
+
+// Bricks below zero are outside index space; bounds of shapes crossing the origin start at 0.
+static Vector3DI clampBrick ( Vector3DI b )
+{
+	return Vector3DI ( std::max ( b.x, 0 ), std::max ( b.y, 0 ), std::max ( b.z, 0 ) );
+}
+
+// Collects brick positions (voxel coords) in the brick-index box [bmin, bmax] for which
+// test(brick_center) holds. Chunks are concatenated in order, so the list is deterministic.
+template<typename T> static void collectBricks ( Vector3DI bmin, Vector3DI bmax, int bw, T test, std::vector<Vector3DI>& out )
+{
+	out.clear ();
+	bmin = clampBrick ( bmin );
+	if ( bmax.x < bmin.x || bmax.y < bmin.y || bmax.z < bmin.z ) return;
+	uint64 rx = bmax.x - bmin.x + 1, ry = bmax.y - bmin.y + 1, rz = bmax.z - bmin.z + 1;
+	uint64 total = rx * ry * rz;
+	int chunks = getNumThreads ();
+	std::vector< std::vector<Vector3DI> > found ( chunks );
+
+	ParallelChunks ( total, chunks, [&]( int c, uint64 s, uint64 e ) {
+		Vector3DF half ( bw*0.5f, bw*0.5f, bw*0.5f );
+		for (uint64 i = s; i < e; i++) {
+			Vector3DI pos ( int(bmin.x + i % rx), int(bmin.y + (i / rx) % ry), int(bmin.z + i / (rx*ry)) );
+			pos *= bw;
+			Vector3DF ctr ( pos ); ctr += half;
+			if ( test ( ctr ) ) found[c].push_back ( pos );
+		}
+	} );
+	for (int c = 0; c < chunks; c++)
+		out.insert ( out.end(), found[c].begin(), found[c].end() );
+}
+
+static Vector3DI brickFloor ( Vector3DF p, int bw )
+{
+	return Vector3DI ( int(floorf(p.x / bw)), int(floorf(p.y / bw)), int(floorf(p.z / bw)) );
+}
+
+//-------------------------------------------------------- Host brick helpers
+
+uint64 nvdb::ActivateBricks ( VolumeGVDB* gvdb, const std::vector<Vector3DI>& bricks )
+{
+	PERF_PUSH ( "Activate" );
+	Vector3DF half = gvdb->getCover(0) * 0.5f;
+	for (size_t n = 0; n < bricks.size(); n++) {
+		Vector3DF p ( bricks[n] ); p += half;
+		gvdb->ActivateSpace ( p );
+	}
+	PERF_POP ();
+
+	gvdb->FinishTopology ();
+	gvdb->UpdateAtlas ();
+	return bricks.size();
+}
+
+// Atlas layers are filled in parallel in bounded batches and uploaded slice by slice.
+void nvdb::FillBricks ( VolumeGVDB* gvdb, uchar chan, float bg, const BrickFill& fill )
+{
+	gvdb->UnshareBricks ();
+	Allocator* pool = gvdb->mPool;
+	int bw = pool->getAtlasBrickwid ( chan );
+	int br = pool->getAtlasBrickres ( chan );
+	int apron = (br - bw) / 2;
+	Vector3DI ares = pool->getAtlasRes ( chan );
+	Vector3DI acnt = pool->getAtlasCnt ( chan );
+	uint64 slice = uint64(ares.x) * ares.y;
+	if ( acnt.z <= 0 || slice == 0 ) return;
+
+	// Bucket leaves by atlas layer
+	std::vector< std::vector<uint64> > layers ( acnt.z );
+	uint64 total = pool->getPoolTotalCnt ( 0, 0 );
+	for (uint64 n = 0; n < total; n++) {
+		Node* node = gvdb->getNode ( 0, 0, n );
+		if ( !node->mFlags ) continue;
+		int l = (node->mValue.z - apron) / br;
+		if ( l >= 0 && l < acnt.z ) layers[l].push_back ( n );
+	}
+
+	// Batch as many layers as fit in ~64 MB of staging. The staging buffer comes from
+	// the host memory policy, and is filled by the workers that write it (first touch).
+	int batch = (int) std::max<uint64> ( 1, (uint64(64) << 20) / (slice * br) );
+	std::vector<uint64> leaves;
+
+	uint64 staging = slice * br * std::min ( batch, acnt.z ) * sizeof(float);
+	float* buf = (float*) pool->HostAlloc ( staging, false );
+	if ( buf == 0x0 ) { gprintf ( "ERROR: Unable to allocate %llu bytes of brick staging.\n", staging ); return; }
+	pool->MemTrack ( MemTag(MEM_STAGING, 0), false, staging );
+
+	CUcontext pctx;
+	cuCtxPushCurrent ( gvdb->getContext() );
+	for (int l0 = 0; l0 < acnt.z; l0 += batch) {
+		int l1 = std::min ( acnt.z, l0 + batch );
+		ParallelChunks ( slice * br * (l1-l0), 0, [&]( int, uint64 s, uint64 e ) {
+			std::fill ( buf + s, buf + e, bg );
+		} );
+		leaves.clear ();
+		for (int l = l0; l < l1; l++) leaves.insert ( leaves.end(), layers[l].begin(), layers[l].end() );
+
+		ParallelChunks ( leaves.size(), 0, [&]( int, uint64 s, uint64 e ) {
+			std::vector<float> brick ( bw*bw*bw );
+			for (uint64 i = s; i < e; i++) {
+				Node* node = gvdb->getNode ( 0, 0, leaves[i] );
+				std::fill ( brick.begin(), brick.end(), bg );
+				fill ( node, brick.data() );
+				Vector3DI a = node->mValue;
+				a.z -= l0 * br;
+				for (int z = 0; z < bw; z++)
+					for (int y = 0; y < bw; y++)
+						memcpy ( &buf[ (uint64(a.z+z)*ares.y + (a.y+y)) * ares.x + a.x ], &brick[ (z*bw + y)*bw ], bw*sizeof(float) );
+			}
+		} );
+		for (int z = 0; z < (l1-l0)*br; z++)
+			pool->AtlasWriteSlice ( chan, l0*br + z, 0, 0, (uchar*) &buf[ z*slice ] );
+	}
+	cuCtxPopCurrent ( &pctx );
+	pool->MemTrack ( MemTag(MEM_STAGING, 0), false, -sint64(staging) );
+	pool->HostFree ( (char*) buf );
+
+	gvdb->UpdateApron ( chan, bg );
+}
+
+// Fills bricks from a per-voxel function of the voxel center position.
+template<typename F> static void fillAnalytic ( VolumeGVDB* gvdb, uchar chan, float bg, F func )
+{
+	int bw = gvdb->mPool->getAtlasBrickwid ( chan );
+	FillBricks ( gvdb, chan, bg, [&]( Node* node, float* dst ) {
+		Vector3DF p;
+		for (int z = 0; z < bw; z++)
+			for (int y = 0; y < bw; y++)
+				for (int x = 0; x < bw; x++) {
+					p.Set ( node->mPos.x + x + 0.5f, node->mPos.y + y + 0.5f, node->mPos.z + z + 0.5f );
+					*dst++ = func ( p );
+				}
+	} );
+}
+
+//-------------------------------------------------------- VolumeGenerator
+
+VolumeGenerator::VolumeGenerator ( VolumeGVDB* gvdb, uint64 seed )
+{
+	mGVDB = gvdb;
+	mSeed = seed;
+}
+
+float VolumeGenerator::Noise ( Vector3DF p, int octaves )
+{
+	float sum = 0, amp = 0.5f, norm = 0;
+	for (int o = 0; o < std::max(octaves, 1); o++) {
+		sum += amp * valueNoise ( p, mSeed + o );
+		norm += amp;
+		p *= 2.0f;
+		amp *= 0.5f;
+	}
+	return sum / norm;
+}
+
+bool VolumeGenerator::CheckChannel ( uchar chan )
+{
+	if ( mGVDB == 0x0 || mGVDB->mPool == 0x0 || chan >= mGVDB->mPool->getNumAtlas() ) {
+		gprintf ( "ERROR: VolumeGenerator: channel %d does not exist. Call Configure and AddChannel first.\n", chan );
+		return false;
+	}
+	if ( mGVDB->mPool->getAtlas(chan).type != T_FLOAT ) {
+		gprintf ( "ERROR: VolumeGenerator: channel %d must be T_FLOAT.\n", chan );
+		return false;
+	}
+	return true;
+}
+
+uint64 VolumeGenerator::Sphere ( uchar chan, Vector3DF center, float radius, float band )
+{
+	if ( !CheckChannel(chan) ) return 0;
+	PERF_PUSH ( "Generate Sphere" );
+	int bw = mGVDB->getRes ( 0 );
+	float reach = radius + band + bw;
+	float tol = band + bw * 0.8660254f;				// band + half brick diagonal
+	Vector3DF r ( reach, reach, reach );
+
+	std::vector<Vector3DI> bricks;
+	collectBricks ( brickFloor(center - r, bw), brickFloor(center + r, bw), bw, [&]( Vector3DF p ) {
+		p -= center;
+		return fabs ( float(p.Length()) - radius ) <= tol;
+	}, bricks );
+	uint64 cnt = ActivateBricks ( mGVDB, bricks );
+
+	fillAnalytic ( mGVDB, chan, band, [&]( Vector3DF p ) {
+		p -= center;
+		float d = float(p.Length()) - radius;
+		return std::max ( -band, std::min ( band, d ) );
+	} );
+	PERF_POP ();
+	return cnt;
+}
+
+uint64 VolumeGenerator::Torus ( uchar chan, Vector3DF center, float major_radius, float minor_radius, float band )
+{
+	if ( !CheckChannel(chan) ) return 0;
+	PERF_PUSH ( "Generate Torus" );
+	int bw = mGVDB->getRes ( 0 );
+	float tol = band + bw * 0.8660254f;
+	Vector3DF r ( major_radius + minor_radius + band + bw, minor_radius + band + bw, major_radius + minor_radius + band + bw );
+
+	// Torus around the Y axis
+	auto sdf = [=]( Vector3DF p ) -> float {
+		p -= center;
+		float q = sqrtf ( p.x*p.x + p.z*p.z ) - major_radius;
+		return sqrtf ( q*q + p.y*p.y ) - minor_radius;
+	};
+	std::vector<Vector3DI> bricks;
+	collectBricks ( brickFloor(center - r, bw), brickFloor(center + r, bw), bw, [&]( Vector3DF p ) {
+		return fabs ( sdf(p) ) <= tol;
+	}, bricks );
+	uint64 cnt = ActivateBricks ( mGVDB, bricks );
+
+	fillAnalytic ( mGVDB, chan, band, [&]( Vector3DF p ) {
+		return std::max ( -band, std::min ( band, sdf(p) ) );
+	} );
+	PERF_POP ();
+	return cnt;
+}
+
+uint64 VolumeGenerator::NoiseCloud ( uchar chan, Vector3DF vmin, Vector3DF vmax, float occupancy, float scale, int octaves )
+{
+	if ( !CheckChannel(chan) ) return 0;
+	if ( occupancy <= 0 ) return 0;
+	PERF_PUSH ( "Generate NoiseCloud" );
+	occupancy = std::min ( occupancy, 1.0f );
+	int bw = mGVDB->getRes ( 0 );
+	float inv = 1.0f / std::max ( scale, 1.0f );
+
+	// Sample noise once per brick, then pick the threshold that gives the requested occupancy.
+	std::vector<Vector3DI> cand;
+	collectBricks ( brickFloor(vmin, bw), brickFloor(vmax - Vector3DF(0.001f, 0.001f, 0.001f), bw), bw, []( Vector3DF ) { return true; }, cand );
+	std::vector<float> val ( cand.size() );
+	Vector3DF half ( bw*0.5f, bw*0.5f, bw*0.5f );
+	ParallelFor ( cand.size(), [&]( uint64 i ) {
+		Vector3DF p ( cand[i] ); p += half; p *= inv;
+		val[i] = Noise ( p, octaves );
+	} );
+	float thresh = 0;
+	if ( !val.empty() ) {
+		std::vector<float> sorted ( val );
+		size_t k = std::min ( sorted.size()-1, size_t( (1.0 - occupancy) * sorted.size() ) );
+		std::nth_element ( sorted.begin(), sorted.begin() + k, sorted.end() );
+		thresh = sorted[k];
+	}
+	std::vector<Vector3DI> bricks;
+	for (size_t i = 0; i < cand.size(); i++)
+		if ( val[i] >= thresh ) bricks.push_back ( cand[i] );
+	uint64 cnt = ActivateBricks ( mGVDB, bricks );
+
+	// Density rises from 0 at the threshold to 1 at the noise maximum
+	float norm = 1.0f / std::max ( 1.0f - thresh, 1e-6f );
+	fillAnalytic ( mGVDB, chan, 0.0f, [&]( Vector3DF p ) {
+		p *= inv;
+		return std::max ( 0.0f, Noise ( p, octaves ) - thresh ) * norm;
+	} );
+	PERF_POP ();
+	return cnt;
+}
+
+uint64 VolumeGenerator::GaussianPoints ( uchar chan, Vector3DF center, Vector3DF sigma, uint64 num_pnts, std::vector<Vector3DF>* pnts )
+{
+	if ( !CheckChannel(chan) ) return 0;
+	PERF_PUSH ( "Generate GaussianPoints" );
+	int bw = mGVDB->getRes ( 0 );
+	std::vector<Vector3DF> local;
+	std::vector<Vector3DF>& pts = (pnts != 0x0) ? *pnts : local;
+	pts.resize ( num_pnts );
+
+	// Fixed-size chunks, each with its own RNG stream, so output does not depend on thread count.
+	const uint64 chunk = 65536;
+	uint64 seed = mSeed;
+	ParallelFor ( (num_pnts + chunk-1) / chunk, [&]( uint64 c ) {
+		std::mt19937_64 rng ( mix64 ( seed ) + c );
+		std::normal_distribution<float> nd ( 0.0f, 1.0f );
+		uint64 e = std::min ( num_pnts, (c+1)*chunk );
+		for (uint64 i = c*chunk; i < e; i++) {
+			float x = nd(rng), y = nd(rng), z = nd(rng);
+			pts[i].Set ( center.x + sigma.x*x, center.y + sigma.y*y, center.z + sigma.z*z );
+		}
+	} );
+
+	// Bricks covered by +/- 6 sigma; points outside are ignored.
+	Vector3DF ext = sigma * 6.0f;
+	Vector3DI bmin = clampBrick ( brickFloor ( center - ext, bw ) );
+	Vector3DI bmax = brickFloor ( center + ext, bw );
+	if ( bmax.x < bmin.x || bmax.y < bmin.y || bmax.z < bmin.z ) { PERF_POP (); return 0; }
+	uint64 rx = bmax.x - bmin.x + 1, ry = bmax.y - bmin.y + 1;
+	int nslab = bmax.z - bmin.z + 1;
+	const uint64 NONE = uint64(-1);
+
+	// Counting sort of point indices by brick z-slab, then sort each slab by brick key.
+	int nth = getNumThreads ();
+	std::vector<uint64> keys ( num_pnts );
+	std::vector< std::vector<uint64> > hist ( nth, std::vector<uint64>( nslab, 0 ) );
+	ParallelChunks ( num_pnts, nth, [&]( int c, uint64 s, uint64 e ) {
+		for (uint64 i = s; i < e; i++) {
+			Vector3DI b = brickFloor ( pts[i], bw );
+			if ( b.x < bmin.x || b.y < bmin.y || b.z < bmin.z || b.x > bmax.x || b.y > bmax.y || b.z > bmax.z ) { keys[i] = NONE; continue; }
+			keys[i] = (uint64(b.z - bmin.z) * ry + uint64(b.y - bmin.y)) * rx + uint64(b.x - bmin.x);
+			hist[c][ b.z - bmin.z ]++;
+		}
+	} );
+	std::vector<uint64> slabStart ( nslab+1, 0 );
+	uint64 off = 0;
+	for (int s = 0; s < nslab; s++) {
+		slabStart[s] = off;
+		for (int c = 0; c < nth; c++) { uint64 h = hist[c][s]; hist[c][s] = off; off += h; }
+	}
+	slabStart[nslab] = off;
+	std::vector<uint64> order ( off );
+	ParallelChunks ( num_pnts, nth, [&]( int c, uint64 s, uint64 e ) {
+		for (uint64 i = s; i < e; i++)
+			if ( keys[i] != NONE ) order[ hist[c][ keys[i] / (rx*ry) ]++ ] = i;
+	} );
+
+	std::vector< std::vector<uint64> > slabBricks ( nslab );
+	ParallelFor ( nslab, [&]( uint64 s ) {
+		std::sort ( order.begin() + slabStart[s], order.begin() + slabStart[s+1], [&]( uint64 a, uint64 b ) {
+			return (keys[a] != keys[b]) ? keys[a] < keys[b] : a < b;
+		} );
+		for (uint64 j = slabStart[s]; j < slabStart[s+1]; j++)
+			if ( j == slabStart[s] || keys[order[j]] != keys[order[j-1]] ) slabBricks[s].push_back ( j );
+	} );
+
+	// Unique bricks in key order, with the start of each brick's run in `order`
+	std::vector<uint64> brickKey, brickStart;
+	std::vector<Vector3DI> bricks;
+	for (int s = 0; s < nslab; s++)
+		for (size_t k = 0; k < slabBricks[s].size(); k++) {
+			uint64 j = slabBricks[s][k];
+			uint64 key = keys[ order[j] ];
+			brickKey.push_back ( key );
+			brickStart.push_back ( j );
+			bricks.push_back ( Vector3DI( int(bmin.x + key % rx), int(bmin.y + (key / rx) % ry), int(bmin.z + key / (rx*ry)) ) * bw );
+		}
+	brickStart.push_back ( order.size() );
+	uint64 cnt = ActivateBricks ( mGVDB, bricks );
+
+	// Each brick splats only its own points, so bricks can be filled concurrently.
+	FillBricks ( mGVDB, chan, 0.0f, [&]( Node* node, float* dst ) {
+		Vector3DI b = node->mPos / bw;
+		if ( b.x < bmin.x || b.y < bmin.y || b.z < bmin.z || b.x > bmax.x || b.y > bmax.y || b.z > bmax.z ) return;
+		uint64 key = (uint64(b.z - bmin.z) * ry + uint64(b.y - bmin.y)) * rx + uint64(b.x - bmin.x);
+		std::vector<uint64>::iterator it = std::lower_bound ( brickKey.begin(), brickKey.end(), key );
+		if ( it == brickKey.end() || *it != key ) return;
+		size_t k = it - brickKey.begin();
+		for (uint64 j = brickStart[k]; j < brickStart[k+1]; j++) {
+			const Vector3DF& p = pts[ order[j] ];
+			int lx = std::min ( bw-1, std::max ( 0, int(floorf(p.x)) - node->mPos.x ) );
+			int ly = std::min ( bw-1, std::max ( 0, int(floorf(p.y)) - node->mPos.y ) );
+			int lz = std::min ( bw-1, std::max ( 0, int(floorf(p.z)) - node->mPos.z ) );
+			dst[ (lz*bw + ly)*bw + lx ] += 1.0f;
+		}
+	} );
+	PERF_POP ();
+	return cnt;
+}
+
+uint64 VolumeGenerator::ThinShell ( uchar chan, Vector3DF center, float radius, float thickness, float amplitude )
+{
+	if ( !CheckChannel(chan) ) return 0;
+	PERF_PUSH ( "Generate ThinShell" );
+	int bw = mGVDB->getRes ( 0 );
+	float halft = std::max ( thickness * 0.5f, 0.5f );
+	float inv = 1.0f / std::max ( radius * 0.25f, 1.0f );		// displacement feature size
+	float reach = radius + fabs(amplitude) + halft + bw;
+	Vector3DF r ( reach, reach, reach );
+
+	auto dist = [&]( Vector3DF p ) -> float {
+		p -= center;
+		float rs = radius;
+		if ( amplitude != 0 ) {
+			Vector3DF q = p; q *= inv;
+			rs += amplitude * (2.0f * Noise ( q, 3 ) - 1.0f);
+		}
+		return float(p.Length()) - rs;
+	};
+	// Displacement varies within a brick, so allow one extra half-diagonal when displaced.
+	float tol = halft + bw * 0.8660254f * ((amplitude != 0) ? 2.0f : 1.0f);
+
+	std::vector<Vector3DI> bricks;
+	collectBricks ( brickFloor(center - r, bw), brickFloor(center + r, bw), bw, [&]( Vector3DF p ) {
+		return fabs ( dist(p) ) <= tol;
+	}, bricks );
+	uint64 cnt = ActivateBricks ( mGVDB, bricks );
+
+	fillAnalytic ( mGVDB, chan, 0.0f, [&]( Vector3DF p ) {
+		return std::max ( 0.0f, 1.0f - fabs ( dist(p) ) / halft );
+	} );
+	PERF_POP ();
+	return cnt;
+}
@@ -0,0 +1,80 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+// Synthetic sparse volumes for benchmarking and soak tests.
+//
+// Each generator finds the bricks it touches in parallel on the host, activates them
+// through ActivateSpace, rebuilds topology and atlas (FinishTopology, UpdateAtlas), then
+// fills the float channel `chan` brick by brick in parallel and updates the aprons.
+// Positions and sizes are in voxel (index-space) units. Output depends only on the
+// arguments and seed, not on the number of threads. Index space starts at 0: parts of a
+// shape at negative coordinates are clipped.
+//
+// Note: UpdateAtlas reassigns every brick, so values previously stored in the volume
+// are not preserved. Generate into a freshly configured volume.
+
+#ifndef DEF_GVDB_GENERATE
+	#define DEF_GVDB_GENERATE
+
+	#include "gvdb_types.h"
+	#include "gvdb_vec.h"
+	#include <functional>
+	#include <vector>
+
+	namespace nvdb {
+
+	class VolumeGVDB;
+	struct Node;
+
+	class GVDB_API VolumeGenerator {
+	public:
+		VolumeGenerator ( VolumeGVDB* gvdb, uint64 seed = 1 );
+
+		void	SetSeed ( uint64 seed )		{ mSeed = seed; }
+		uint64	getSeed ()					{ return mSeed; }
+
+		// Narrow-band level sets. Values are signed distance clamped to [-band, band]
+		// (negative inside). Returns the number of active bricks.
+		uint64	Sphere ( uchar chan, Vector3DF center, float radius, float band = 3.0f );
+		uint64	Torus ( uchar chan, Vector3DF center, float major_radius, float minor_radius, float band = 3.0f );
+
+		// Fractal noise density inside [vmin, vmax). `occupancy` in (0,1] is the fraction of
+		// bricks in the box that become active; `scale` is the feature size in voxels.
+		uint64	NoiseCloud ( uchar chan, Vector3DF vmin, Vector3DF vmax, float occupancy, float scale = 64.0f, int octaves = 4 );
+
+		// Normally distributed points; each voxel stores the number of points it contains.
+		// If `pnts` is given it receives the generated points.
+		uint64	GaussianPoints ( uchar chan, Vector3DF center, Vector3DF sigma, uint64 num_pnts, std::vector<Vector3DF>* pnts = 0x0 );
+
+		// Spherical shell of the given thickness, optionally displaced by noise of amplitude
+		// `amplitude`. Values are 1 at the mid-surface, falling to 0 at the shell faces.
+		uint64	ThinShell ( uchar chan, Vector3DF center, float radius, float thickness, float amplitude = 0.0f );
+
+		// Fractal value noise in [0,1), deterministic by seed.
+		float	Noise ( Vector3DF p, int octaves );
+
+	private:
+		bool	CheckChannel ( uchar chan );
+
+		VolumeGVDB*		mGVDB;
+		uint64			mSeed;
+	};
+
+	// Host brick helpers used by the generators, also usable by other host-side producers.
+	//
+	// ActivateBricks activates the leaves with the given lower corners (voxel coords), then
+	// rebuilds topology and atlas. Returns the number of bricks.
+	GVDB_API uint64 ActivateBricks ( VolumeGVDB* gvdb, const std::vector<Vector3DI>& bricks );
+
+	// FillBricks writes every atlas voxel of float channel `chan`. fill(node, dst) writes the
+	// bw^3 voxels of one active leaf (x fastest) into `dst`, pre-set to `bg`, and is called from
+	// several threads. Unused atlas space is set to `bg`. Aprons are updated.
+	typedef std::function<void ( Node* node, float* dst )> BrickFill;
+	GVDB_API void FillBricks ( VolumeGVDB* gvdb, uchar chan, float bg, const BrickFill& fill );
+
+	}
+
+#endif
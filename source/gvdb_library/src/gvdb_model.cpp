@@ -8,6 +8,7 @@
 //-----------------------------------------------------------------------------
 
 #include "gvdb_model.h"
+#include "gvdb_transform.h"
 
 #include "loader_OBJReader.h"
 
@@ -25,15 +26,11 @@ void Model::Transform ( Vector3DF move, Vector3DF scale )
 {
 	float* pos = (float*) ( (char*) vertBuffer + vertOffset);	
 
-	// Scale object
-	for (int n=0; n < vertCount; n++ ) {
-		*(pos)	 = *(pos) * scale.x + move.x;
-		*(pos+1) = *(pos+1) * scale.y + move.y;
-		*(pos+2) = *(pos+2) * scale.z + move.z;
-		pos += vertStride/sizeof(float);
-	}		
-	Matrix4F ident;
-	ComputeBounds ( ident, 0 );	
+	// Scale and move object, computing the new bounds in the same pass
+	Matrix4F xform;
+	xform.data[0] = scale.x; xform.data[5] = scale.y; xform.data[10] = scale.z;
+	xform.data[12] = move.x; xform.data[13] = move.y; xform.data[14] = move.z;
+	TransformPointsBounds ( xform, pos, pos, vertCount, vertStride/sizeof(float), objMin, objMax );
 }
 
 void Model::ComputeBounds ( Matrix4F& xform, float margin )
@@ -46,21 +43,9 @@ void Model::ComputeBounds ( Matrix4F& xform, float margin )
 	}
 
 	// Compute polygon bounds
-	Vector3DF pnt;
 	float* pos = (float*) ( (char*) vertBuffer + vertOffset);	
-	pnt = *(Vector3DF*) pos; pnt *= xform;
-	objMin = pnt;
-	objMax = pnt;
-	for (int n=0; n < vertCount; n++ ) {
-		pnt = *(Vector3DF*) pos; pnt *= xform;
-		if ( pnt.x < objMin.x ) objMin.x = pnt.x;
-		if ( pnt.y < objMin.y ) objMin.y = pnt.y;
-		if ( pnt.z < objMin.z ) objMin.z = pnt.z;
-		if ( pnt.x > objMax.x ) objMax.x = pnt.x;
-		if ( pnt.y > objMax.y ) objMax.y = pnt.y;
-		if ( pnt.z > objMax.z ) objMax.z = pnt.z;
-		pos += vertStride/sizeof(float);
-	}
+	TransformPointsBounds ( xform, pos, 0x0, vertCount, vertStride/sizeof(float), objMin, objMax );
+
 	// Add margin
 	Vector3DF m = objMax; m -= objMin; m *= margin;
 	objMin -= m;
@@ -29,14 +29,24 @@
 		uchar		mLev;			// Tree Level			1 byte	Max = 0 to 255
 		uchar		mFlags;			// Flags				1 byte	true - used, false - discard
 		uchar		mPriority;		// Priority				1 byte
+#ifdef USE_COMPACT_NODES
+		uchar		mListCls;		// Child List pool		1 byte	Pool1 level (capacity class with USE_BITMASKS)
+		Vector3DI	mPos;			// Pos in Index-space	12 byte
+		Vector3DI	mValue;			// Value in Atlas		12 byte
+		noderef		mParent;		// Parent index			4 byte	Pool0 index at level mLev+1
+		noderef		mChildList;		// Child List index		4 byte	Pool1 index at level mListCls
+		uint64		mMask;			// Start of BITMASK.	8 byte
+									// HEADER TOTAL			48 bytes
+#else
 		uchar		pad;			//						1 byte
 		Vector3DI	mPos;			// Pos in Index-space	12 byte
 		Vector3DI	mValue;			// Value in Atlas		12 byte
 		Vector3DF	mVRange;		// Value min, max, ave	12 byte
-		uint64		mParent;		// Parent ID			8 byte	Pool0 reference
-		uint64		mChildList;		// Child List			8 byte	Pool1 reference									?#ifdef USE_BITMASKS
+		noderef		mParent;		// Parent ID			8 byte	Pool0 reference
+		noderef		mChildList;		// Child List			8 byte	Pool1 reference
 		uint64		mMask;			// Start of BITMASK.	8 byte  
 									// HEADER TOTAL			64 bytes
+#endif
 	};
 
 	};
@@ -0,0 +1,54 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+// Minimal host-side threading helpers shared by the CPU paths of GVDB.
+// Work is split into contiguous chunks with a fixed assignment, so results that
+// are gathered per chunk and concatenated in chunk order are deterministic.
+
+#ifndef DEF_GVDB_PARALLEL
+	#define DEF_GVDB_PARALLEL
+
+	#include "gvdb_types.h"
+	#include <algorithm>
+	#include <thread>
+	#include <vector>
+
+	namespace nvdb {
+
+	// Number of worker threads used by ParallelChunks (at least 1).
+	inline int getNumThreads ()
+	{
+		int n = (int) std::thread::hardware_concurrency ();
+		return (n < 1) ? 1 : n;
+	}
+
+	// Splits [0, n) into `chunks` contiguous ranges and calls func(chunk, start, end) for each.
+	// Chunk 0 runs on the calling thread. If chunks <= 0, one chunk per hardware thread is used.
+	template<typename F> void ParallelChunks ( uint64 n, int chunks, F func )
+	{
+		if ( chunks <= 0 ) chunks = getNumThreads ();
+		if ( (uint64) chunks > n ) chunks = (int) std::max<uint64> ( n, 1 );
+		if ( chunks == 1 ) { func ( 0, (uint64) 0, n ); return; }
+
+		std::vector<std::thread> workers;
+		workers.reserve ( chunks-1 );
+		for (int c = 1; c < chunks; c++) {
+			uint64 s = n * c / chunks, e = n * (c+1) / chunks;
+			workers.push_back ( std::thread ( [&func, c, s, e]() { func ( c, s, e ); } ) );
+		}
+		func ( 0, (uint64) 0, n / chunks );
+		for (size_t i = 0; i < workers.size(); i++) workers[i].join ();
+	}
+
+	// Calls func(i) for every i in [0, n), split across all hardware threads.
+	template<typename F> void ParallelFor ( uint64 n, F func )
+	{
+		ParallelChunks ( n, 0, [&func]( int, uint64 s, uint64 e ) { for (uint64 i = s; i < e; i++) func ( i ); } );
+	}
+
+	}
+
+#endif
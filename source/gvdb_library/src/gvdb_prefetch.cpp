@@ -0,0 +1,240 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+#include "gvdb_prefetch.h"
+#include "gvdb_volume_gvdb.h"
+#include "gvdb_camera.h"
+#include "app_perf.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace nvdb;
+
+BrickPrefetcher::BrickPrefetcher ( VolumeGVDB* gvdb, uchar chan, Loader loader, int threads )
+{
+	mGVDB = gvdb;
+	mChan = chan;
+	mLoader = loader;
+	uint64 br = mGVDB->mPool->getAtlas(chan).stride;
+	mBrickBytes = br * br * br * mGVDB->mPool->getSize ( mGVDB->mPool->getAtlas(chan).type );
+	mBudgetUpdate = uint64(64) << 20;
+	mBudgetPending = uint64(256) << 20;
+	mLookahead = 8.0f;
+	mMaxDist = 0.0f;
+	mHasPrev = false;
+	mNumResident = 0;
+	mNumFailed = 0;
+	mStaging.ptr().memtag = MemTag ( MEM_STAGING, 0 );
+	mPendingBytes = 0;
+	mGeneration = 0;
+	mQuit = false;
+
+	if ( threads < 1 ) threads = 1;
+	for (int n = 0; n < threads; n++)
+		mWorkers.push_back ( std::thread ( &BrickPrefetcher::Worker, this ) );
+}
+
+BrickPrefetcher::~BrickPrefetcher ()
+{
+	{
+		std::lock_guard<std::mutex> lock ( mMutex );
+		mQuit = true;
+	}
+	mWake.notify_all ();
+	for (size_t n = 0; n < mWorkers.size(); n++) mWorkers[n].join ();
+
+	CUcontext pctx;
+	cuCtxPushCurrent ( mGVDB->getContext() );
+	mStaging.reset ();
+	cuCtxPopCurrent ( &pctx );
+}
+
+void BrickPrefetcher::SetBudget ( uint64 bytes_per_update, uint64 max_pending )
+{
+	{
+		std::lock_guard<std::mutex> lock ( mMutex );
+		mBudgetUpdate = bytes_per_update;
+		mBudgetPending = std::max ( max_pending, mBrickBytes );		// at least one brick
+	}
+	mWake.notify_all ();
+}
+
+uchar& BrickPrefetcher::State ( uint64 nodeid )
+{
+	uint64 n = ElemNdx ( nodeid );
+	if ( n >= mState.size() ) mState.resize ( n+1, ST_NONE );
+	return mState[n];
+}
+
+bool BrickPrefetcher::isResident ( uint64 nodeid )
+{
+	return State ( nodeid ) == ST_RESIDENT;
+}
+
+uint64 BrickPrefetcher::getNumQueued ()
+{
+	std::lock_guard<std::mutex> lock ( mMutex );
+	return mQueue.size();
+}
+
+bool BrickPrefetcher::isIdle ()
+{
+	std::lock_guard<std::mutex> lock ( mMutex );
+	return mQueue.empty() && mPendingBytes == 0;
+}
+
+void BrickPrefetcher::Invalidate ()
+{
+	std::lock_guard<std::mutex> lock ( mMutex );
+	mQueue.clear ();
+	for (size_t n = 0; n < mDone.size(); n++) mPendingBytes -= mBrickBytes;
+	mDone.clear ();
+	mGeneration++;
+	mState.clear ();
+	mScored.clear ();			// nodes may no longer exist, so mPriority is not reset
+	mNumResident = 0;
+	mHasPrev = false;
+}
+
+// Scores leaves visible from `cam` into [lo, hi] by distance, keeping the max per leaf.
+void BrickPrefetcher::ScoreView ( Camera3D& cam, int lo, int hi )
+{
+	std::vector<uint64> ids = mGVDB->CullNodes ( cam, 0 );
+	float maxdist = (mMaxDist > 0) ? mMaxDist : cam.getFar();
+	Matrix4F& xform = mGVDB->getTransform ();
+	Vector3DF half = mGVDB->getCover(0) * 0.5f;
+
+	for (size_t i = 0; i < ids.size(); i++) {
+		Node* node = mGVDB->getNode ( ids[i] );
+		if ( node->mValue.x < 0 ) continue;				// no atlas slot
+		Vector3DF ctr = xform.TransformPoint ( Vector3DF(node->mPos) + half );
+		int p = lo + hi - int( cam.calculateLOD ( ctr, float(lo), float(hi), maxdist ) );
+		if ( node->mPriority == 0 ) mScored.push_back ( ids[i] );
+		if ( p > node->mPriority ) node->mPriority = uchar(p);
+	}
+}
+
+void BrickPrefetcher::Prioritize ( Camera3D& cam )
+{
+	PERF_PUSH ( "Prefetch prioritize" );
+
+	for (size_t i = 0; i < mScored.size(); i++) mGVDB->getNode ( mScored[i] )->mPriority = 0;
+	mScored.clear ();
+
+	// Current view first, then the pose extrapolated from the last camera motion
+	ScoreView ( cam, 128, 255 );
+	Vector3DF pos = cam.getPos(), to = cam.getToPos();
+	if ( mHasPrev && mLookahead > 0 ) {
+		Vector3DF dpos = (pos - mPrevPos) * mLookahead;
+		Vector3DF dto = (to - mPrevTo) * mLookahead;
+		if ( dpos.LengthSq() > 0 || dto.LengthSq() > 0 ) {
+			Camera3D pred;
+			pred.Copy ( cam );
+			pred.setPos ( pos.x + dpos.x, pos.y + dpos.y, pos.z + dpos.z );
+			pred.setToPos ( to.x + dto.x, to.y + dto.y, to.z + dto.z );
+			ScoreView ( pred, 1, 127 );
+		}
+	}
+	mPrevPos = pos;
+	mPrevTo = to;
+	mHasPrev = true;
+
+	// Replace requests not yet started; loads in flight finish regardless
+	{
+		std::lock_guard<std::mutex> lock ( mMutex );
+		for (size_t i = 0; i < mQueue.size(); i++) State ( mQueue[i].nodeid ) = ST_NONE;
+		mQueue.clear ();
+		for (size_t i = 0; i < mScored.size(); i++) {
+			uchar& st = State ( mScored[i] );
+			if ( st != ST_NONE ) continue;
+			Node* node = mGVDB->getNode ( mScored[i] );
+			Request r;
+			r.nodeid = mScored[i];
+			r.pos = node->mPos;
+			r.priority = node->mPriority;
+			r.gen = mGeneration;
+			mQueue.push_back ( r );
+			st = ST_QUEUED;
+		}
+		std::stable_sort ( mQueue.begin(), mQueue.end(), []( const Request& a, const Request& b ) { return a.priority < b.priority; } );
+	}
+	mWake.notify_all ();
+
+	PERF_POP ();
+}
+
+void BrickPrefetcher::Worker ()
+{
+	std::unique_lock<std::mutex> lock ( mMutex );
+	for (;;) {
+		mWake.wait ( lock, [this]() { return mQuit || ( !mQueue.empty() && mPendingBytes + mBrickBytes <= mBudgetPending ); } );
+		if ( mQuit ) return;
+		Request r = mQueue.back ();
+		mQueue.pop_back ();
+		mPendingBytes += mBrickBytes;
+		lock.unlock ();
+
+		Loaded ld;
+		ld.nodeid = r.nodeid;
+		ld.gen = r.gen;
+		ld.data.resize ( mBrickBytes );
+		ld.ok = mLoader ( r.nodeid, r.pos, ld.data.data(), mBrickBytes );
+
+		lock.lock ();
+		if ( r.gen == mGeneration )
+			mDone.push_back ( std::move(ld) );
+		else
+			mPendingBytes -= mBrickBytes;
+	}
+}
+
+int BrickPrefetcher::Update ()
+{
+	// Take finished loads within the bandwidth budget (at least one brick)
+	std::vector<Loaded> done;
+	{
+		std::lock_guard<std::mutex> lock ( mMutex );
+		size_t n = std::min<size_t> ( mDone.size(), std::max<uint64> ( 1, mBudgetUpdate / mBrickBytes ) );
+		for (size_t i = 0; i < n; i++) done.push_back ( std::move(mDone[i]) );
+		mDone.erase ( mDone.begin(), mDone.begin() + n );
+	}
+	if ( done.empty() ) return 0;
+
+	PERF_PUSH ( "Prefetch upload" );
+
+	// Pack into one staging buffer, one host-to-device copy, then scatter to atlas slots
+	std::vector<uint64> ok;
+	for (size_t i = 0; i < done.size(); i++) {
+		if ( done[i].ok ) { ok.push_back ( i ); continue; }
+		State ( done[i].nodeid ) = ST_NONE;
+		mNumFailed++;
+	}
+	if ( !ok.empty() ) {
+		CUcontext pctx;
+		cuCtxPushCurrent ( mGVDB->getContext() );
+		mGVDB->mPool->ArenaAcquire ( mStaging.ptr(), (int) mBrickBytes, ok.size(), true );
+		for (size_t i = 0; i < ok.size(); i++)
+			memcpy ( mStaging.cpu() + i * mBrickBytes, done[ ok[i] ].data.data(), mBrickBytes );
+		mGVDB->mPool->CommitMem ( mStaging.ptr() );
+		for (size_t i = 0; i < ok.size(); i++) {
+			Node* node = mGVDB->getNode ( done[ ok[i] ].nodeid );
+			mGVDB->mPool->AtlasCopyLinear ( mChan, node->mValue, mStaging.gpu() + i * mBrickBytes );
+			State ( done[ ok[i] ].nodeid ) = ST_RESIDENT;
+		}
+		cuCtxPopCurrent ( &pctx );
+		mNumResident += ok.size();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock ( mMutex );
+		mPendingBytes -= done.size() * mBrickBytes;
+	}
+	mWake.notify_all ();
+
+	PERF_POP ();
+	return (int) ok.size();
+}
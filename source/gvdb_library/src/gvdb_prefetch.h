@@ -0,0 +1,119 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+// View-driven brick streaming for out-of-core and remote volumes.
+//
+// The topology (and atlas slots, from UpdateAtlas) is built up front; brick voxel data
+// arrives later through a user loader. Each frame:
+//   Prioritize ( cam )	scores the leaves visible from the camera and from a camera pose
+//						predicted from recent motion, stores the score in Node::mPriority,
+//						and queues non-resident bricks for loading, best first.
+//   Update ()			uploads loaded bricks to the atlas within the per-update bandwidth
+//						budget. Call UpdateApron on the channel after bricks arrive if
+//						the renderer samples across brick borders.
+//
+// Loads run on worker threads. Bricks that are queued but not yet started are dropped
+// when a later Prioritize no longer selects them. The memory budget caps host bytes held
+// by loads in flight or waiting for upload.
+//
+// mPriority: 0 = not needed, otherwise 1..255, higher loads sooner. Bricks visible now
+// rank above bricks only visible from the predicted pose.
+
+#ifndef DEF_GVDB_PREFETCH
+	#define DEF_GVDB_PREFETCH
+
+	#include "gvdb_types.h"
+	#include "gvdb_vec.h"
+	#include "gvdb_allocator.h"
+	#include <condition_variable>
+	#include <functional>
+	#include <mutex>
+	#include <thread>
+	#include <vector>
+
+	namespace nvdb {
+
+	class VolumeGVDB;
+	class Camera3D;
+
+	class GVDB_API BrickPrefetcher {
+	public:
+		// Fills `dst` (bytes = brick res^3 * channel type size, x fastest) with the voxels of the
+		// leaf `nodeid` whose lower corner is `pos` (voxel units). Called on worker threads;
+		// returns false if the brick could not be loaded.
+		typedef std::function<bool ( uint64 nodeid, Vector3DI pos, char* dst, uint64 bytes )> Loader;
+
+		BrickPrefetcher ( VolumeGVDB* gvdb, uchar chan, Loader loader, int threads = 2 );
+		~BrickPrefetcher ();
+
+		// bytes_per_update: max bytes uploaded by one Update. max_pending: max host bytes of
+		// loads in flight or waiting for upload.
+		void	SetBudget ( uint64 bytes_per_update, uint64 max_pending );
+		void	SetLookahead ( float frames )		{ mLookahead = frames; }		// pose prediction, in Prioritize calls
+		void	SetMaxDist ( float dist )			{ mMaxDist = dist; }			// world distance of lowest priority (0 = camera far)
+
+		void	Prioritize ( Camera3D& cam );
+		int		Update ();													// returns bricks uploaded
+		void	Invalidate ();												// forget residency, e.g. after topology rebuild
+
+		bool	isResident ( uint64 nodeid );
+		uint64	getNumResident ()					{ return mNumResident; }
+		uint64	getNumQueued ();
+		bool	isIdle ();												// nothing queued, loading or waiting for upload
+		uint64	getNumFailed ()						{ return mNumFailed; }
+		uint64	getBrickBytes ()					{ return mBrickBytes; }
+
+	private:
+		enum { ST_NONE = 0, ST_QUEUED, ST_RESIDENT };		// per-leaf residency; queued covers in flight
+
+		struct Request {
+			uint64		nodeid;
+			Vector3DI	pos;
+			uchar		priority;
+			uint64		gen;
+		};
+		struct Loaded {
+			uint64		nodeid;
+			uint64		gen;
+			bool		ok;
+			std::vector<char> data;
+		};
+
+		void	Worker ();
+		void	ScoreView ( Camera3D& cam, int lo, int hi );
+		uchar&	State ( uint64 nodeid );
+
+		VolumeGVDB*		mGVDB;
+		uchar			mChan;
+		Loader			mLoader;
+		uint64			mBrickBytes;
+		uint64			mBudgetUpdate, mBudgetPending;
+		float			mLookahead, mMaxDist;
+
+		// Camera history for pose prediction
+		bool			mHasPrev;
+		Vector3DF		mPrevPos, mPrevTo;
+
+		// Main thread state, indexed by leaf pool index
+		std::vector<uchar>	mState;
+		std::vector<uint64>	mScored;			// leaves with mPriority set by the last Prioritize
+		uint64			mNumResident, mNumFailed;
+		DataBuffer		mStaging;			// upload staging, host and device
+
+		// Shared with workers
+		std::mutex					mMutex;
+		std::condition_variable		mWake;
+		std::vector<Request>		mQueue;			// sorted, best last
+		std::vector<Loaded>			mDone;
+		uint64						mPendingBytes;
+		uint64						mGeneration;	// bumped by Invalidate, stale loads are dropped
+		bool						mQuit;
+		std::vector<std::thread>	mWorkers;
+	};
+
+	}
+
+#endif
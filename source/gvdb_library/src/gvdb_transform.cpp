@@ -0,0 +1,249 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+#include "gvdb_transform.h"
+#include "gvdb_parallel.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+// The AVX2 path is compiled with a per-function target, so the library itself needs no
+// -mavx2 flag; it is only called after a run-time CPU check.
+#if defined(__x86_64__) || defined(_M_X64)
+	#define GVDB_XFORM_X86
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+		#define GVDB_TARGET_AVX2
+	#else
+		#define GVDB_TARGET_AVX2	__attribute__((target("avx2,fma")))
+	#endif
+#endif
+
+using namespace nvdb;
+
+namespace {
+
+struct XformJob {
+	const float*	m;					// column-major 4x4
+	const float*	in;					// AoS input, or 0x0 for SoA
+	float*			out;
+	uint64			stride;
+	const float*	x;					// SoA input
+	const float*	y;
+	const float*	z;
+	float*			ox;
+	float*			oy;
+	float*			oz;
+	bool			bounds;
+};
+
+bool detectAVX2 ()
+{
+#if defined(GVDB_XFORM_X86)
+	#if defined(_MSC_VER)
+		int r[4];
+		__cpuid ( r, 0 );
+		if ( r[0] < 7 ) return false;
+		__cpuid ( r, 1 );
+		bool osxsave = (r[2] & (1 << 27)) != 0, avx = (r[2] & (1 << 28)) != 0, fma = (r[2] & (1 << 12)) != 0;
+		if ( !osxsave || !avx || !fma ) return false;
+		if ( (_xgetbv ( 0 ) & 6) != 6 ) return false;		// OS saves ymm state
+		__cpuidex ( r, 7, 0 );
+		return (r[1] & (1 << 5)) != 0;
+	#else
+		__builtin_cpu_init ();
+		return __builtin_cpu_supports ( "avx2" ) && __builtin_cpu_supports ( "fma" );
+	#endif
+#else
+	return false;
+#endif
+}
+
+// Points [s, e), one at a time. Same arithmetic as Matrix4F::TransformPoint.
+void xformScalar ( const XformJob& j, uint64 s, uint64 e, float* bmin, float* bmax )
+{
+	const float* m = j.m;
+	for (uint64 i = s; i < e; i++) {
+		float px, py, pz;
+		if ( j.in ) { const float* p = j.in + i * j.stride; px = p[0]; py = p[1]; pz = p[2]; }
+		else		{ px = j.x[i]; py = j.y[i]; pz = j.z[i]; }
+		float rx = m[0] * px + m[4] * py + m[ 8] * pz + m[12];
+		float ry = m[1] * px + m[5] * py + m[ 9] * pz + m[13];
+		float rz = m[2] * px + m[6] * py + m[10] * pz + m[14];
+		if ( j.in ) {
+			if ( j.out ) { float* o = j.out + i * j.stride; o[0] = rx; o[1] = ry; o[2] = rz; }
+		} else if ( j.ox ) {
+			j.ox[i] = rx; j.oy[i] = ry; j.oz[i] = rz;
+		}
+		if ( j.bounds ) {
+			bmin[0] = std::min ( bmin[0], rx );
+			bmin[1] = std::min ( bmin[1], ry );
+			bmin[2] = std::min ( bmin[2], rz );
+			bmax[0] = std::max ( bmax[0], rx );
+			bmax[1] = std::max ( bmax[1], ry );
+			bmax[2] = std::max ( bmax[2], rz );
+		}
+	}
+}
+
+#if defined(GVDB_XFORM_X86)
+// Packed xyz (stride 3): 8 points in 24 floats <-> x, y, z registers, by in-lane shuffles.
+GVDB_TARGET_AVX2 inline void loadXYZ8 ( const float* p, __m256& x, __m256& y, __m256& z )
+{
+	__m256 m03 = _mm256_insertf128_ps ( _mm256_castps128_ps256 ( _mm_loadu_ps ( p ) ),    _mm_loadu_ps ( p + 12 ), 1 );
+	__m256 m14 = _mm256_insertf128_ps ( _mm256_castps128_ps256 ( _mm_loadu_ps ( p + 4 ) ), _mm_loadu_ps ( p + 16 ), 1 );
+	__m256 m25 = _mm256_insertf128_ps ( _mm256_castps128_ps256 ( _mm_loadu_ps ( p + 8 ) ), _mm_loadu_ps ( p + 20 ), 1 );
+	__m256 xy = _mm256_shuffle_ps ( m14, m25, _MM_SHUFFLE ( 2, 1, 3, 2 ) );
+	__m256 yz = _mm256_shuffle_ps ( m03, m14, _MM_SHUFFLE ( 1, 0, 2, 1 ) );
+	x = _mm256_shuffle_ps ( m03, xy, _MM_SHUFFLE ( 2, 0, 3, 0 ) );
+	y = _mm256_shuffle_ps ( yz, xy, _MM_SHUFFLE ( 3, 1, 2, 0 ) );
+	z = _mm256_shuffle_ps ( yz, m25, _MM_SHUFFLE ( 3, 0, 3, 1 ) );
+}
+GVDB_TARGET_AVX2 inline void storeXYZ8 ( float* p, __m256 x, __m256 y, __m256 z )
+{
+	__m256 rxy = _mm256_shuffle_ps ( x, y, _MM_SHUFFLE ( 2, 0, 2, 0 ) );
+	__m256 ryz = _mm256_shuffle_ps ( y, z, _MM_SHUFFLE ( 3, 1, 3, 1 ) );
+	__m256 rzx = _mm256_shuffle_ps ( z, x, _MM_SHUFFLE ( 3, 1, 2, 0 ) );
+	__m256 r03 = _mm256_shuffle_ps ( rxy, rzx, _MM_SHUFFLE ( 2, 0, 2, 0 ) );
+	__m256 r14 = _mm256_shuffle_ps ( ryz, rxy, _MM_SHUFFLE ( 3, 1, 2, 0 ) );
+	__m256 r25 = _mm256_shuffle_ps ( rzx, ryz, _MM_SHUFFLE ( 3, 1, 3, 1 ) );
+	_mm_storeu_ps ( p,      _mm256_castps256_ps128 ( r03 ) );
+	_mm_storeu_ps ( p + 4,  _mm256_castps256_ps128 ( r14 ) );
+	_mm_storeu_ps ( p + 8,  _mm256_castps256_ps128 ( r25 ) );
+	_mm_storeu_ps ( p + 12, _mm256_extractf128_ps ( r03, 1 ) );
+	_mm_storeu_ps ( p + 16, _mm256_extractf128_ps ( r14, 1 ) );
+	_mm_storeu_ps ( p + 20, _mm256_extractf128_ps ( r25, 1 ) );
+}
+
+// Points [s, e), 8 at a time. Packed AoS is shuffled, other strides are gathered;
+// the remainder is done by xformScalar.
+GVDB_TARGET_AVX2 void xformAVX2 ( const XformJob& j, uint64 s, uint64 e, float* bmin, float* bmax )
+{
+	const float* m = j.m;
+	__m256 m0 = _mm256_set1_ps ( m[0] ), m1 = _mm256_set1_ps ( m[1] ), m2 = _mm256_set1_ps ( m[2] );
+	__m256 m4 = _mm256_set1_ps ( m[4] ), m5 = _mm256_set1_ps ( m[5] ), m6 = _mm256_set1_ps ( m[6] );
+	__m256 m8 = _mm256_set1_ps ( m[8] ), m9 = _mm256_set1_ps ( m[9] ), m10 = _mm256_set1_ps ( m[10] );
+	__m256 m12 = _mm256_set1_ps ( m[12] ), m13 = _mm256_set1_ps ( m[13] ), m14 = _mm256_set1_ps ( m[14] );
+	__m256 vmin[3], vmax[3];
+	for (int k = 0; k < 3; k++) { vmin[k] = _mm256_set1_ps ( bmin[k] ); vmax[k] = _mm256_set1_ps ( bmax[k] ); }
+	__m256i gidx = _mm256_mullo_epi32 ( _mm256_setr_epi32 ( 0, 1, 2, 3, 4, 5, 6, 7 ), _mm256_set1_epi32 ( (int) j.stride ) );
+	float tmp[3][8];
+
+	uint64 i = s;
+	for (; i + 8 <= e; i += 8) {
+		__m256 px, py, pz;
+		if ( j.in && j.stride == 3 ) {
+			loadXYZ8 ( j.in + i * 3, px, py, pz );
+		} else if ( j.in ) {
+			const float* p = j.in + i * j.stride;
+			px = _mm256_i32gather_ps ( p, gidx, 4 );
+			py = _mm256_i32gather_ps ( p + 1, gidx, 4 );
+			pz = _mm256_i32gather_ps ( p + 2, gidx, 4 );
+		} else {
+			px = _mm256_loadu_ps ( j.x + i );
+			py = _mm256_loadu_ps ( j.y + i );
+			pz = _mm256_loadu_ps ( j.z + i );
+		}
+		__m256 rx = _mm256_fmadd_ps ( m0, px, _mm256_fmadd_ps ( m4, py, _mm256_fmadd_ps ( m8, pz, m12 ) ) );
+		__m256 ry = _mm256_fmadd_ps ( m1, px, _mm256_fmadd_ps ( m5, py, _mm256_fmadd_ps ( m9, pz, m13 ) ) );
+		__m256 rz = _mm256_fmadd_ps ( m2, px, _mm256_fmadd_ps ( m6, py, _mm256_fmadd_ps ( m10, pz, m14 ) ) );
+		if ( j.in ) {
+			if ( j.out && j.stride == 3 ) {
+				storeXYZ8 ( j.out + i * 3, rx, ry, rz );
+			} else if ( j.out ) {
+				_mm256_storeu_ps ( tmp[0], rx ); _mm256_storeu_ps ( tmp[1], ry ); _mm256_storeu_ps ( tmp[2], rz );
+				float* o = j.out + i * j.stride;
+				for (int l = 0; l < 8; l++, o += j.stride) { o[0] = tmp[0][l]; o[1] = tmp[1][l]; o[2] = tmp[2][l]; }
+			}
+		} else if ( j.ox ) {
+			_mm256_storeu_ps ( j.ox + i, rx ); _mm256_storeu_ps ( j.oy + i, ry ); _mm256_storeu_ps ( j.oz + i, rz );
+		}
+		if ( j.bounds ) {
+			vmin[0] = _mm256_min_ps ( vmin[0], rx ); vmax[0] = _mm256_max_ps ( vmax[0], rx );
+			vmin[1] = _mm256_min_ps ( vmin[1], ry ); vmax[1] = _mm256_max_ps ( vmax[1], ry );
+			vmin[2] = _mm256_min_ps ( vmin[2], rz ); vmax[2] = _mm256_max_ps ( vmax[2], rz );
+		}
+	}
+	if ( j.bounds ) {
+		float lo[8], hi[8];
+		for (int k = 0; k < 3; k++) {
+			_mm256_storeu_ps ( lo, vmin[k] ); _mm256_storeu_ps ( hi, vmax[k] );
+			for (int l = 0; l < 8; l++) {
+				if ( lo[l] < bmin[k] ) bmin[k] = lo[l];
+				if ( hi[l] > bmax[k] ) bmax[k] = hi[l];
+			}
+		}
+	}
+	xformScalar ( j, i, e, bmin, bmax );
+}
+#endif
+
+void xformRun ( const XformJob& j, uint64 n, Vector3DF* bmin, Vector3DF* bmax )
+{
+	static const bool bAVX2 = detectAVX2 ();
+	int chunks = ( n >= XFORM_PARALLEL_MIN ) ? getNumThreads () : 1;
+	std::vector<float> lo ( chunks * 3, FLT_MAX ), hi ( chunks * 3, -FLT_MAX );
+
+	ParallelChunks ( n, chunks, [&]( int c, uint64 s, uint64 e ) {
+#if defined(GVDB_XFORM_X86)
+		if ( bAVX2 ) { xformAVX2 ( j, s, e, &lo[c*3], &hi[c*3] ); return; }
+#endif
+		xformScalar ( j, s, e, &lo[c*3], &hi[c*3] );
+	} );
+
+	if ( j.bounds && n > 0 ) {
+		float rmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, rmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (int c = 0; c < chunks; c++)
+			for (int k = 0; k < 3; k++) {
+				if ( lo[c*3+k] < rmin[k] ) rmin[k] = lo[c*3+k];
+				if ( hi[c*3+k] > rmax[k] ) rmax[k] = hi[c*3+k];
+			}
+		bmin->Set ( rmin[0], rmin[1], rmin[2] );
+		bmax->Set ( rmax[0], rmax[1], rmax[2] );
+	}
+}
+
+XformJob aosJob ( const Matrix4F& xform, const float* in, float* out, uint64 stride, bool bounds )
+{
+	XformJob j = { xform.data, in, out, stride, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, bounds };
+	return j;
+}
+
+XformJob soaJob ( const Matrix4F& xform, const float* x, const float* y, const float* z, float* ox, float* oy, float* oz, bool bounds )
+{
+	XformJob j = { xform.data, 0x0, 0x0, 0, x, y, z, ox, oy, oz, bounds };
+	return j;
+}
+
+}
+
+void nvdb::TransformPoints ( const Matrix4F& xform, const float* in, float* out, uint64 n, uint64 stride )
+{
+	xformRun ( aosJob ( xform, in, out, stride, false ), n, 0x0, 0x0 );
+}
+
+void nvdb::TransformPointsSoA ( const Matrix4F& xform, const float* x, const float* y, const float* z, float* ox, float* oy, float* oz, uint64 n )
+{
+	xformRun ( soaJob ( xform, x, y, z, ox, oy, oz, false ), n, 0x0, 0x0 );
+}
+
+void nvdb::TransformPointsBounds ( const Matrix4F& xform, const float* in, float* out, uint64 n, uint64 stride, Vector3DF& bmin, Vector3DF& bmax )
+{
+	xformRun ( aosJob ( xform, in, out, stride, true ), n, &bmin, &bmax );
+}
+
+void nvdb::TransformPointsBoundsSoA ( const Matrix4F& xform, const float* x, const float* y, const float* z, float* ox, float* oy, float* oz, uint64 n, Vector3DF& bmin, Vector3DF& bmax )
+{
+	xformRun ( soaJob ( xform, x, y, z, ox, oy, oz, true ), n, &bmin, &bmax );
+}
+
+bool nvdb::hasTransformAVX2 ()
+{
+	static const bool bAVX2 = detectAVX2 ();
+	return bAVX2;
+}
@@ -0,0 +1,45 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+// Batched point transforms.
+//
+// Transforms arrays of points by a Matrix4F (column-major, w = 1), optionally computing the
+// bounds of the transformed points in the same pass. AoS arrays hold xyz at the start of each
+// element, `stride` floats apart (3 for packed points, more for interleaved vertex data). Only
+// xyz of each output element is written, so `out` may equal `in`. SoA arrays are separate
+// x, y, z arrays, and outputs may equal inputs.
+//
+// On x86-64 CPUs with AVX2 and FMA (detected at run time) 8 points are processed at a time.
+// Arrays of at least XFORM_PARALLEL_MIN points are split across threads. Results match
+// Matrix4F::TransformPoint to float tolerance (FMA rounds once per multiply-add).
+
+#ifndef DEF_GVDB_TRANSFORM
+	#define DEF_GVDB_TRANSFORM
+
+	#include "gvdb_types.h"
+	#include "gvdb_vec.h"
+
+	namespace nvdb {
+
+	const uint64 XFORM_PARALLEL_MIN = 1 << 16;		// points per call before threads are used
+
+	GVDB_API void TransformPoints ( const Matrix4F& xform, const float* in, float* out, uint64 n, uint64 stride = 3 );
+	GVDB_API void TransformPointsSoA ( const Matrix4F& xform, const float* x, const float* y, const float* z,
+									   float* ox, float* oy, float* oz, uint64 n );
+
+	// Fused transform and bounds. `out` (or ox, oy, oz) may be 0x0 to compute only the bounds.
+	// If n is 0, bmin and bmax are left unchanged.
+	GVDB_API void TransformPointsBounds ( const Matrix4F& xform, const float* in, float* out, uint64 n, uint64 stride,
+										  Vector3DF& bmin, Vector3DF& bmax );
+	GVDB_API void TransformPointsBoundsSoA ( const Matrix4F& xform, const float* x, const float* y, const float* z,
+											 float* ox, float* oy, float* oz, uint64 n, Vector3DF& bmin, Vector3DF& bmax );
+
+	// True if the AVX2/FMA path is used on this CPU.
+	GVDB_API bool hasTransformAVX2 ();
+
+	}
+
+#endif
@@ -0,0 +1,89 @@
+//-----------------------------------------------------------------------------
+// NVIDIA(R) GVDB VOXELS
+// Copyright 2017 NVIDIA Corporation
+// SPDX-License-Identifier: Apache-2.0
+//-----------------------------------------------------------------------------
+
+// Compile-time tree configurations.
+// The tree shape is normally only known at run time (VolumeGVDB::mLogDim), so every host-side
+// descent recomputes resolutions, ranges and bit positions per level. TreeConfig fixes the shape
+// as template arguments instead, so those all become constants and shifts. VolumeGVDB matches
+// its configuration against the shapes listed in TreeConfigID when configured, and dispatches
+// host queries to the specialized descent once per query.
+
+#ifndef DEF_GVDB_TREE_CONFIG
+	#define DEF_GVDB_TREE_CONFIG
+
+	#include "gvdb_types.h"
+	#include "gvdb_vec.h"
+
+	namespace nvdb {
+
+	// N-th value of a parameter pack
+	template<int N, int First, int... Rest> struct TreePick			{ static const int value = TreePick<N-1, Rest...>::value; };
+	template<int First, int... Rest> struct TreePick<0, First, Rest...>	{ static const int value = First; };
+
+	// Sum of the log2 resolutions of levels 0..L; LD is given top level first
+	template<int L, int... LD> struct TreeLogRange		{ static const int value = TreePick<sizeof...(LD)-1-L, LD...>::value + TreeLogRange<L-1, LD...>::value; };
+	template<int... LD> struct TreeLogRange<-1, LD...>	{ static const int value = 0; };
+
+	// Tree shape given as log2 resolution per level, top level first, in the same order as
+	// VolumeGVDB::Configure(q4,q3,q2,q1,q0). For example TreeConfig<3,3,3,3,4> has 16^3 bricks.
+	template<int... LD> struct TreeConfig {
+		static const int Levels = sizeof...(LD);
+
+		template<int L> struct Level {
+			static_assert ( L >= 0 && L < sizeof...(LD), "TreeConfig level out of range" );
+			static const int	LogDim = TreePick<sizeof...(LD)-1-L, LD...>::value;		// same as getLD(L)
+			static const int	Res = 1 << LogDim;										// same as getRes(L)
+			static const int	LogRange = TreeLogRange<L, LD...>::value;
+			static const int	Range = 1 << LogRange;									// same as getRange(L) per axis
+			static const int	LogChildRange = LogRange - LogDim;						// range of one child
+			static const uint64	VoxCnt = uint64(1) << (3*LogDim);						// same as getVoxCnt(L)
+
+			// Same as getBitPos(L, p), for a local child position p in [0, Res-1]^3
+			static inline uint32 BitPos ( const Vector3DI& p )		{ return (uint32(p.z) << (2*LogDim)) | (uint32(p.y) << LogDim) | uint32(p.x); }
+			// Same as getPosFromBit(L, b)
+			static inline Vector3DI PosFromBit ( uint32 b )			{ return Vector3DI ( int(b & (Res-1)), int((b >> LogDim) & (Res-1)), int(b >> (2*LogDim)) ); }
+			// Whether an index-space offset from the node corner is inside the node
+			static inline bool Inside ( const Vector3DI& p )		{ return uint32(p.x) < uint32(Range) && uint32(p.y) < uint32(Range) && uint32(p.z) < uint32(Range); }
+			// Bit of the child covering an offset from the node corner (offset must be inside)
+			static inline uint32 ChildBit ( const Vector3DI& p )	{ return BitPos ( Vector3DI ( p.x >> LogChildRange, p.y >> LogChildRange, p.z >> LogChildRange ) ); }
+		};
+
+		// Whether a runtime configuration (levels and log2 resolution per level, leaf first) has this shape
+		static bool Matches ( int levs, const int* logdim )
+		{
+			static const int ld[] = { LD... };
+			if ( levs != Levels ) return false;
+			for (int n = 0; n < Levels; n++)
+				if ( logdim[n] != ld[Levels-1-n] ) return false;
+			return true;
+		}
+	};
+
+	// Shapes with specialized host traversal. Add an entry here and in the dispatch in
+	// gvdb_volume_gvdb.cpp (TREE_DISPATCH) to specialize another one.
+	enum TreeConfigID {
+		TREE_CFG_RUNTIME = -1,			// any other shape: runtime path
+		TREE_CFG_33333 = 0,				// TreeConfig<3,3,3,3,3>
+		TREE_CFG_33334,					// TreeConfig<3,3,3,3,4>
+		TREE_CFG_33335,					// TreeConfig<3,3,3,3,5>
+		TREE_CFG_55543,					// TreeConfig<5,5,5,4,3>
+		TREE_CFG_54333,					// TreeConfig<5,4,3,3,3>
+	};
+
+	// Specialized shape matching a runtime configuration, or TREE_CFG_RUNTIME
+	inline int getTreeConfigID ( int levs, const int* logdim )
+	{
+		if ( TreeConfig<3,3,3,3,3>::Matches ( levs, logdim ) ) return TREE_CFG_33333;
+		if ( TreeConfig<3,3,3,3,4>::Matches ( levs, logdim ) ) return TREE_CFG_33334;
+		if ( TreeConfig<3,3,3,3,5>::Matches ( levs, logdim ) ) return TREE_CFG_33335;
+		if ( TreeConfig<5,5,5,4,3>::Matches ( levs, logdim ) ) return TREE_CFG_55543;
+		if ( TreeConfig<5,4,3,3,3>::Matches ( levs, logdim ) ) return TREE_CFG_54333;
+		return TREE_CFG_RUNTIME;
+	}
+
+	}
+
+#endif
@@ -49,11 +49,20 @@
 	typedef uint32_t			uint;	
 	typedef int64_t				slong;		// note: keyword 'ulong' cannot be used with NV_ARM
 
+	// Node reference as stored in nodes and child lists. By default a full pool reference (see Elem);
+	// with USE_COMPACT_NODES a 32-bit index whose group and level are implied by where it is stored.
+	#ifdef USE_COMPACT_NODES
+		typedef uint32_t		noderef;
+	#else
+		typedef uint64_t		noderef;
+	#endif
+
 	#define NOHIT			1.0e10f
 	#define	ID_UNDEFB		0xFF			// 1 byte
 	#define	ID_UNDEFS		0xFFFF			// 2 byte
 	#define	ID_UNDEFL		0xFFFFFFFF		// 4 byte
 	#define	ID_UNDEF64		0xFFFFFFFFFFFFFFFF		// 8 byte
+	#define	ID_UNDEFREF		noderef(ID_UNDEF64)		// noderef width
 	#define CHAN_UNDEF		255
 
 	#define DEGtoRAD		(3.141592f/180.0f)
@@ -10,25 +10,71 @@
 #include "gvdb_vec.h"
 using namespace nvdb;
 
+// SIMD paths. SSE2 is part of x86-64, so no extra compiler flags are needed. Products are
+// summed in the same order as the scalar code, so results are bit-identical to it
+// (InvertFast is the exception, see below). A 4x4 product is too small to gain from AVX.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define GVDB_SSE
+	#include <emmintrin.h>
+#endif
+
+const char* nvdb::getVecSimd ()
+{
+#if defined(GVDB_SSE)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+// out = a * b, column-major 4x4. Column c of out is sum_k a.col[k] * b[4c+k].
+// out must not alias a or b.
+static inline void MatMul4 ( const float* a, const float* b, float* out )
+{
+#if defined(GVDB_SSE)
+	__m128 a0 = _mm_loadu_ps ( a ), a1 = _mm_loadu_ps ( a+4 ), a2 = _mm_loadu_ps ( a+8 ), a3 = _mm_loadu_ps ( a+12 );
+	for (int c = 0; c < 4; c++) {
+		const float* bc = b + 4*c;
+		__m128 r = _mm_mul_ps ( a0, _mm_set1_ps ( bc[0] ) );
+		r = _mm_add_ps ( r, _mm_mul_ps ( a1, _mm_set1_ps ( bc[1] ) ) );
+		r = _mm_add_ps ( r, _mm_mul_ps ( a2, _mm_set1_ps ( bc[2] ) ) );
+		r = _mm_add_ps ( r, _mm_mul_ps ( a3, _mm_set1_ps ( bc[3] ) ) );
+		_mm_storeu_ps ( out + 4*c, r );
+	}
+#else
+	for (int c = 0; c < 4; c++)
+		for (int r = 0; r < 4; r++)
+			out[4*c+r] = a[r]*b[4*c] + a[4+r]*b[4*c+1] + a[8+r]*b[4*c+2] + a[12+r]*b[4*c+3];
+#endif
+}
+
+// out = m * (x,y,z,w), column-major. out may alias the inputs.
+static inline void MatVec4 ( const float* m, float x, float y, float z, float w, float* out )
+{
+#if defined(GVDB_SSE)
+	__m128 r = _mm_mul_ps ( _mm_loadu_ps ( m ), _mm_set1_ps ( x ) );
+	r = _mm_add_ps ( r, _mm_mul_ps ( _mm_loadu_ps ( m+4 ), _mm_set1_ps ( y ) ) );
+	r = _mm_add_ps ( r, _mm_mul_ps ( _mm_loadu_ps ( m+8 ), _mm_set1_ps ( z ) ) );
+	r = _mm_add_ps ( r, _mm_mul_ps ( _mm_loadu_ps ( m+12 ), _mm_set1_ps ( w ) ) );
+	_mm_storeu_ps ( out, r );
+#else
+	float xa = x * m[0] + y * m[4] + z * m[8] + w * m[12];
+	float ya = x * m[1] + y * m[5] + z * m[9] + w * m[13];
+	float za = x * m[2] + y * m[6] + z * m[10] + w * m[14];
+	float wa = x * m[3] + y * m[7] + z * m[11] + w * m[15];
+	out[0] = xa; out[1] = ya; out[2] = za; out[3] = wa;
+#endif
+}
+
 Vector4DF &Vector4DF::operator*= (const Matrix4F &op)
 {
-	float xa, ya, za, wa;
-	xa = x * op.data[0] + y * op.data[4] + z * op.data[8] + w * op.data[12];
-	ya = x * op.data[1] + y * op.data[5] + z * op.data[9] + w * op.data[13];
-	za = x * op.data[2] + y * op.data[6] + z * op.data[10] + w * op.data[14];
-	wa = x * op.data[3] + y * op.data[7] + z * op.data[11] + w * op.data[15];
-	x = xa; y = ya; z = za; w = wa;
+	MatVec4 ( op.data, x, y, z, w, &x );
 	return *this;
 }
 
 Vector4DF &Vector4DF::operator*= (const float* op)
 {
-	float xa, ya, za, wa;
-	xa = x * op[0] + y * op[4] + z * op[8] + w * op[12];
-	ya = x * op[1] + y * op[5] + z * op[9] + w * op[13];
-	za = x * op[2] + y * op[6] + z * op[10] + w * op[14];
-	wa = x * op[3] + y * op[7] + z * op[11] + w * op[15];
-	x = xa; y = ya; z = za; w = wa;
+	MatVec4 ( op, x, y, z, w, &x );
 	return *this;
 }
 
@@ -56,25 +102,49 @@ Vector4DF &Vector4DF::operator+= (const int op) {x+= (VTYPE) op; y+= (VTYPE) op;
 Vector4DF &Vector4DF::operator+= (const double op) {x+= (VTYPE) op; y+= (VTYPE) op; z+= (VTYPE) op; w += (VTYPE) op; return *this;}
 Vector4DF &Vector4DF::operator+= (const Vector3DI &op) {x+=(VTYPE) op.x; y+=(VTYPE) op.y; z+=(VTYPE) op.z; return *this;}
 Vector4DF &Vector4DF::operator+= (const Vector3DF &op) {x+=(VTYPE) op.x; y+=(VTYPE) op.y; z+=(VTYPE) op.z; return *this;}
-Vector4DF &Vector4DF::operator+= (const Vector4DF &op) {x+=(VTYPE) op.x; y+=(VTYPE) op.y; z+=(VTYPE) op.z; w+=(VTYPE) op.w; return *this;}	
+Vector4DF &Vector4DF::operator+= (const Vector4DF &op) {
+#ifdef GVDB_SSE
+	_mm_storeu_ps ( &x, _mm_add_ps ( _mm_loadu_ps ( &x ), _mm_loadu_ps ( &op.x ) ) ); return *this;
+#else
+	x+=(VTYPE) op.x; y+=(VTYPE) op.y; z+=(VTYPE) op.z; w+=(VTYPE) op.w; return *this;
+#endif
+}	
 
 Vector4DF &Vector4DF::operator-= (const int op) {x-= (VTYPE) op; y-= (VTYPE) op; z-= (VTYPE) op; w -= (VTYPE) op; return *this;}
 Vector4DF &Vector4DF::operator-= (const double op) {x-= (VTYPE) op; y-= (VTYPE) op; z-= (VTYPE) op; w -= (VTYPE) op; return *this;}
 Vector4DF &Vector4DF::operator-= (const Vector3DI &op) {x-=(VTYPE) op.x; y-=(VTYPE) op.y; z-=(VTYPE) op.z; return *this;}
 Vector4DF &Vector4DF::operator-= (const Vector3DF &op) {x-=(VTYPE) op.x; y-=(VTYPE) op.y; z-=(VTYPE) op.z; return *this;}
-Vector4DF &Vector4DF::operator-= (const Vector4DF &op) {x-=(VTYPE) op.x; y-=(VTYPE) op.y; z-=(VTYPE) op.z; w-=(VTYPE) op.w; return *this;}	
+Vector4DF &Vector4DF::operator-= (const Vector4DF &op) {
+#ifdef GVDB_SSE
+	_mm_storeu_ps ( &x, _mm_sub_ps ( _mm_loadu_ps ( &x ), _mm_loadu_ps ( &op.x ) ) ); return *this;
+#else
+	x-=(VTYPE) op.x; y-=(VTYPE) op.y; z-=(VTYPE) op.z; w-=(VTYPE) op.w; return *this;
+#endif
+}	
 
 Vector4DF &Vector4DF::operator*= (const int op) {x*= (VTYPE) op; y*= (VTYPE) op; z*= (VTYPE) op; w *= (VTYPE) op; return *this;}
 Vector4DF &Vector4DF::operator*= (const double op) {x*= (VTYPE) op; y*= (VTYPE) op; z*= (VTYPE) op; w *= (VTYPE) op; return *this;}
 Vector4DF &Vector4DF::operator*= (const Vector3DI &op) {x*=(VTYPE) op.x; y*=(VTYPE) op.y; z*=(VTYPE) op.z; return *this;}
 Vector4DF &Vector4DF::operator*= (const Vector3DF &op) {x*=(VTYPE) op.x; y*=(VTYPE) op.y; z*=(VTYPE) op.z; return *this;}
-Vector4DF &Vector4DF::operator*= (const Vector4DF &op) {x*=(VTYPE) op.x; y*=(VTYPE) op.y; z*=(VTYPE) op.z; w*=(VTYPE) op.w; return *this;}	
+Vector4DF &Vector4DF::operator*= (const Vector4DF &op) {
+#ifdef GVDB_SSE
+	_mm_storeu_ps ( &x, _mm_mul_ps ( _mm_loadu_ps ( &x ), _mm_loadu_ps ( &op.x ) ) ); return *this;
+#else
+	x*=(VTYPE) op.x; y*=(VTYPE) op.y; z*=(VTYPE) op.z; w*=(VTYPE) op.w; return *this;
+#endif
+}	
 
 Vector4DF &Vector4DF::operator/= (const int op) {x/= (VTYPE) op; y/= (VTYPE) op; z/= (VTYPE) op; w /= (VTYPE) op; return *this;}
 Vector4DF &Vector4DF::operator/= (const double op) {x/= (VTYPE) op; y/= (VTYPE) op; z/= (VTYPE) op; w /= (VTYPE) op; return *this;}
 Vector4DF &Vector4DF::operator/= (const Vector3DI &op) {x/=(VTYPE) op.x; y/=(VTYPE) op.y; z/=(VTYPE) op.z; return *this;}
 Vector4DF &Vector4DF::operator/= (const Vector3DF &op) {x/=(VTYPE) op.x; y/=(VTYPE) op.y; z/=(VTYPE) op.z; return *this;}
-Vector4DF &Vector4DF::operator/= (const Vector4DF &op) {x/=(VTYPE) op.x; y/=(VTYPE) op.y; z/=(VTYPE) op.z; w/=(VTYPE) op.w; return *this;}	
+Vector4DF &Vector4DF::operator/= (const Vector4DF &op) {
+#ifdef GVDB_SSE
+	_mm_storeu_ps ( &x, _mm_div_ps ( _mm_loadu_ps ( &x ), _mm_loadu_ps ( &op.x ) ) ); return *this;
+#else
+	x/=(VTYPE) op.x; y/=(VTYPE) op.y; z/=(VTYPE) op.z; w/=(VTYPE) op.w; return *this;
+#endif
+}	
 
 Vector4DF &Vector4DF::Cross (const Vector4DF &v) {double ax = x, ay = y, az = z, aw = w; x = (VTYPE) (ay * (double) v.z - az * (double) v.y); y = (VTYPE) (-ax * (double) v.z + az * (double) v.x); z = (VTYPE) (ax * (double) v.y - ay * (double) v.x); w = (VTYPE) 0; return *this;}
 		
@@ -126,11 +196,7 @@ Matrix4F Matrix4F::operator* (const float &op)
 }
 
 Vector3DF Matrix4F::operator* (const Vector3DF& op) {
-	Vector3DF result;
-	result.x = data[0] * op.x + data[4] * op.y + data[ 8] * op.z + data[12];
-	result.y = data[1] * op.x + data[5] * op.y + data[ 9] * op.z + data[13];
-	result.z = data[2] * op.x + data[6] * op.y + data[10] * op.z + data[14];
-	return result;
+	return TransformPoint ( op );
 }
 
 Matrix4F &Matrix4F::operator= (const unsigned char op)	{for ( int n=0; n<16; n++) data[n] = (VTYPE) op; return *this;}
@@ -162,33 +228,9 @@ Matrix4F &Matrix4F::operator= (const float* op)
 }
 
 Matrix4F &Matrix4F::operator*= (const float* op) {
-	register float orig[16];				// Temporary storage
+	float orig[16];							// Temporary storage
 	memcpy ( orig, data, 16*sizeof(float) );
-
-	// Calculate First Row
-	data[0] = op[0]*orig[0] + op[1]*orig[4] + op[2]*orig[8] + op[3]*orig[12];
-	data[1] = op[0]*orig[1] + op[1]*orig[5] + op[2]*orig[9] + op[3]*orig[13];
-	data[2] = op[0]*orig[2] + op[1]*orig[6] + op[2]*orig[10] + op[3]*orig[14];
-	data[3] = op[0]*orig[3] + op[1]*orig[7] + op[2]*orig[11] + op[3]*orig[15];
-
-	// Calculate Second Row
-	data[4] = op[4]*orig[0] + op[5]*orig[4] + op[6]*orig[8] + op[7]*orig[12];
-	data[5] = op[4]*orig[1] + op[5]*orig[5] + op[6]*orig[9] + op[7]*orig[13];
-	data[6] = op[4]*orig[2] + op[5]*orig[6] + op[6]*orig[10] + op[7]*orig[14];
-	data[7] = op[4]*orig[3] + op[5]*orig[7] + op[6]*orig[11] + op[7]*orig[15];
-	
-	// Calculate Third Row
-	data[8] = op[8]*orig[0] + op[9]*orig[4] + op[10]*orig[8] + op[11]*orig[12];
-	data[9] = op[8]*orig[1] + op[9]*orig[5] + op[10]*orig[9] + op[11]*orig[13];
-	data[10] = op[8]*orig[2] + op[9]*orig[6] + op[10]*orig[10] + op[11]*orig[14];
-	data[11] = op[8]*orig[3] + op[9]*orig[7] + op[10]*orig[11] + op[11]*orig[15];
-
-	// Calculate Four Row
-	data[12] = op[12]*orig[0] + op[13]*orig[4] + op[14]*orig[8] + op[15]*orig[12];
-	data[13] = op[12]*orig[1] + op[13]*orig[5] + op[14]*orig[9] + op[15]*orig[13];
-	data[14] = op[12]*orig[2] + op[13]*orig[6] + op[14]*orig[10] + op[15]*orig[14];
-	data[15] = op[12]*orig[3] + op[13]*orig[7] + op[14]*orig[11] + op[15]*orig[15];
-
+	MatMul4 ( orig, (op == data) ? orig : op, data );
 	return *this;
 }
 
@@ -464,6 +506,101 @@ Matrix4F &Matrix4F::InvertTRS ()
 	return *this;
 }
 
+// Single-precision general inverse. With SSE this is the cofactor method on 2x2 sub-determinants
+// (Intel AP-928), several times faster than InvertTRS, which works in double precision; results
+// agree with InvertTRS to float tolerance for well-conditioned matrices. If the determinant is 0,
+// does nothing.
+Matrix4F &Matrix4F::InvertFast ()
+{
+#if defined(GVDB_SSE)
+	float* src = data;
+	__m128 minor0, minor1, minor2, minor3;
+	__m128 row0, row1, row2, row3;
+	__m128 det, tmp1;
+
+	// Load the matrix transposed into row0..row3 (row1/row3 with halves swapped)
+	tmp1 = _mm_setzero_ps ();
+	row1 = _mm_setzero_ps ();
+	row3 = _mm_setzero_ps ();
+	tmp1 = _mm_loadh_pi ( _mm_loadl_pi ( tmp1, (__m64*)(src) ), (__m64*)(src+4) );
+	row1 = _mm_loadh_pi ( _mm_loadl_pi ( row1, (__m64*)(src+8) ), (__m64*)(src+12) );
+	row0 = _mm_shuffle_ps ( tmp1, row1, 0x88 );
+	row1 = _mm_shuffle_ps ( row1, tmp1, 0xDD );
+	tmp1 = _mm_loadh_pi ( _mm_loadl_pi ( tmp1, (__m64*)(src+2) ), (__m64*)(src+6) );
+	row3 = _mm_loadh_pi ( _mm_loadl_pi ( row3, (__m64*)(src+10) ), (__m64*)(src+14) );
+	row2 = _mm_shuffle_ps ( tmp1, row3, 0x88 );
+	row3 = _mm_shuffle_ps ( row3, tmp1, 0xDD );
+
+	// Cofactors
+	tmp1 = _mm_mul_ps ( row2, row3 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0xB1 );
+	minor0 = _mm_mul_ps ( row1, tmp1 );
+	minor1 = _mm_mul_ps ( row0, tmp1 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0x4E );
+	minor0 = _mm_sub_ps ( _mm_mul_ps ( row1, tmp1 ), minor0 );
+	minor1 = _mm_sub_ps ( _mm_mul_ps ( row0, tmp1 ), minor1 );
+	minor1 = _mm_shuffle_ps ( minor1, minor1, 0x4E );
+
+	tmp1 = _mm_mul_ps ( row1, row2 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0xB1 );
+	minor0 = _mm_add_ps ( _mm_mul_ps ( row3, tmp1 ), minor0 );
+	minor3 = _mm_mul_ps ( row0, tmp1 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0x4E );
+	minor0 = _mm_sub_ps ( minor0, _mm_mul_ps ( row3, tmp1 ) );
+	minor3 = _mm_sub_ps ( _mm_mul_ps ( row0, tmp1 ), minor3 );
+	minor3 = _mm_shuffle_ps ( minor3, minor3, 0x4E );
+
+	tmp1 = _mm_mul_ps ( _mm_shuffle_ps ( row1, row1, 0x4E ), row3 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0xB1 );
+	row2 = _mm_shuffle_ps ( row2, row2, 0x4E );
+	minor0 = _mm_add_ps ( _mm_mul_ps ( row2, tmp1 ), minor0 );
+	minor2 = _mm_mul_ps ( row0, tmp1 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0x4E );
+	minor0 = _mm_sub_ps ( minor0, _mm_mul_ps ( row2, tmp1 ) );
+	minor2 = _mm_sub_ps ( _mm_mul_ps ( row0, tmp1 ), minor2 );
+	minor2 = _mm_shuffle_ps ( minor2, minor2, 0x4E );
+
+	tmp1 = _mm_mul_ps ( row0, row1 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0xB1 );
+	minor2 = _mm_add_ps ( _mm_mul_ps ( row3, tmp1 ), minor2 );
+	minor3 = _mm_sub_ps ( _mm_mul_ps ( row2, tmp1 ), minor3 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0x4E );
+	minor2 = _mm_sub_ps ( _mm_mul_ps ( row3, tmp1 ), minor2 );
+	minor3 = _mm_sub_ps ( minor3, _mm_mul_ps ( row2, tmp1 ) );
+
+	tmp1 = _mm_mul_ps ( row0, row3 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0xB1 );
+	minor1 = _mm_sub_ps ( minor1, _mm_mul_ps ( row2, tmp1 ) );
+	minor2 = _mm_add_ps ( _mm_mul_ps ( row1, tmp1 ), minor2 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0x4E );
+	minor1 = _mm_add_ps ( _mm_mul_ps ( row2, tmp1 ), minor1 );
+	minor2 = _mm_sub_ps ( minor2, _mm_mul_ps ( row1, tmp1 ) );
+
+	tmp1 = _mm_mul_ps ( row0, row2 );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0xB1 );
+	minor1 = _mm_add_ps ( _mm_mul_ps ( row3, tmp1 ), minor1 );
+	minor3 = _mm_sub_ps ( minor3, _mm_mul_ps ( row1, tmp1 ) );
+	tmp1 = _mm_shuffle_ps ( tmp1, tmp1, 0x4E );
+	minor1 = _mm_sub_ps ( minor1, _mm_mul_ps ( row3, tmp1 ) );
+	minor3 = _mm_add_ps ( _mm_mul_ps ( row1, tmp1 ), minor3 );
+
+	// Determinant and scale
+	det = _mm_mul_ps ( row0, minor0 );
+	det = _mm_add_ps ( _mm_shuffle_ps ( det, det, 0x4E ), det );
+	det = _mm_add_ss ( _mm_shuffle_ps ( det, det, 0xB1 ), det );
+	if ( _mm_cvtss_f32 ( det ) == 0.0f ) return *this;
+	det = _mm_div_ss ( _mm_set_ss ( 1.0f ), det );
+	det = _mm_shuffle_ps ( det, det, 0x00 );
+	_mm_storeu_ps ( src,    _mm_mul_ps ( det, minor0 ) );
+	_mm_storeu_ps ( src+4,  _mm_mul_ps ( det, minor1 ) );
+	_mm_storeu_ps ( src+8,  _mm_mul_ps ( det, minor2 ) );
+	_mm_storeu_ps ( src+12, _mm_mul_ps ( det, minor3 ) );
+	return *this;
+#else
+	return InvertTRS ();
+#endif
+}
+
 Matrix4F &Matrix4F::operator= ( float* mat )
 {
 	for (int n=0; n < 16; n++) 
@@ -567,18 +704,11 @@ Matrix4F& Matrix4F::TranslateInPlace(const Vector3DF& translation) {
 }
 
 Matrix4F& Matrix4F::LeftMultiplyInPlace(const Matrix4F& mtx) {
-	// One can check that this compiles down to good code using something like Godbolt.
-	Matrix4F rightMtx(data); // Make a copy of this
 	// (AB)_(ik) = sum(A_(ij) B_(jk), j)
-	for (int k = 0; k < 4; k++) {
-		for (int i = 0; i < 4; i++) {
-			data[i + 4 * k]
-				= mtx(i, 0) * rightMtx(0, k)
-				+ mtx(i, 1) * rightMtx(1, k)
-				+ mtx(i, 2) * rightMtx(2, k)
-				+ mtx(i, 3) * rightMtx(3, k);
-		}
-	}
+	Matrix4F rightMtx(data); // Make a copy of this
+	float left[16];
+	memcpy(left, mtx.data, 16 * sizeof(float)); // mtx may be this
+	MatMul4(left, rightMtx.data, data);
 	return *this;
 }
 
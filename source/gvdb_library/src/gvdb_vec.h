@@ -485,6 +485,8 @@ namespace nvdb {
 		Matrix4F& Basis(const Vector3DF& c1, const Vector3DF& c2, const Vector3DF& c3);
 		// Inverts this matrix and returns itself. If the matrix has determinant 0, does nothing.
 		Matrix4F& InvertTRS();
+		// Like InvertTRS, but in single precision (SSE when available). Faster, within float tolerance.
+		Matrix4F& InvertFast();
 		// Sets this matrix to and returns the identity matrix.
 		Matrix4F& Identity();
 
@@ -493,6 +495,19 @@ namespace nvdb {
 
 		Matrix4F operator* (const float& op);
 		Vector3DF operator* (const Vector3DF& op);
+		// Transforms a point (w = 1) or a direction (w = 0); same result as operator*(Vector3DF) for points.
+		// Inline and scalar: packing one Vector3DF into SSE lanes costs more than it saves, and
+		// the compiler can vectorize loops over these.
+		Vector3DF TransformPoint(const Vector3DF& p) const {
+			return Vector3DF(data[0] * p.x + data[4] * p.y + data[ 8] * p.z + data[12],
+							 data[1] * p.x + data[5] * p.y + data[ 9] * p.z + data[13],
+							 data[2] * p.x + data[6] * p.y + data[10] * p.z + data[14]);
+		}
+		Vector3DF TransformDir(const Vector3DF& d) const {
+			return Vector3DF(data[0] * d.x + data[4] * d.y + data[ 8] * d.z,
+							 data[1] * d.x + data[5] * d.y + data[ 9] * d.z,
+							 data[2] * d.x + data[6] * d.y + data[10] * d.z);
+		}
 
 		// Scale-Rotate-Translate (compound matrix)
 		Matrix4F& TransSRT(const Vector3DF& c1, const Vector3DF& c2, const Vector3DF& c3, const Vector3DF& t, const Vector3DF& s);
@@ -544,6 +559,26 @@ namespace nvdb {
 	};
 #undef VTYPE
 
+	// 16-byte aligned variants, for arrays and members on hot paths. The SIMD code paths
+	// accept any alignment; aligned storage avoids loads that straddle cache lines.
+	class alignas(16) Vector4DFA : public Vector4DF {
+	public:
+		Vector4DFA() {}
+		Vector4DFA(const float xa, const float ya, const float za, const float wa) : Vector4DF(xa, ya, za, wa) {}
+		Vector4DFA(const Vector4DF& op) : Vector4DF(op) {}
+		Vector4DFA& operator= (const Vector4DF& op) { Vector4DF::operator=(op); return *this; }
+	};
+	class alignas(16) Matrix4FA : public Matrix4F {
+	public:
+		Matrix4FA() {}
+		Matrix4FA(const float* dat) : Matrix4F(dat) {}
+		Matrix4FA(const Matrix4F& op) : Matrix4F(op) {}
+		Matrix4FA& operator= (const Matrix4F& op) { Matrix4F::operator=(op); return *this; }
+	};
+
+	// Name of the SIMD path compiled into the vector math: "sse2" or "scalar".
+	GVDB_API const char* getVecSimd();
+
 	template<class VTYPE>
 	Vector3D<VTYPE>::Vector3D(const Vector4DF& op) { x = (VTYPE)op.x; y = (VTYPE)op.y; z = (VTYPE)op.z; }
 
@@ -23,6 +23,7 @@
 	class Scene;
 	class Model;
 	class Allocator;
+	class Camera3D;
 
 	class VolStats {
 		float		mem_used;			// in MB
@@ -12,15 +12,20 @@
 #include "gvdb_volume_gvdb.h"
 #include "gvdb_render.h"
 #include "gvdb_node.h"
+#include "gvdb_generate.h"
+#include "gvdb_parallel.h"
 #include "app_perf.h"
 #include "string_helper.h"
 
 #include "gvdb_cutils.cuh"
 
 #include <algorithm>
+#include <cstddef>
 #include <iostream>
 #include <float.h>
 #include <fstream>
+#include <mutex>
+#include <unordered_map>
 
 #if !defined(_WIN32)
 #	include <GL/glx.h>
@@ -29,7 +34,25 @@
 using namespace nvdb;
 
 #define MAJOR_VERSION		1
-#define MINOR_VERSION		11
+#define MINOR_VERSION		12
+
+// VBX node header size for a node reference width (see Node in gvdb_node.h)
+#define VBX_NODE_HDR(refbytes)	( (refbytes) == 4 ? 48 : 64 )
+static_assert ( sizeof(Node) == VBX_NODE_HDR(sizeof(noderef)), "Node layout does not match the VBX node header" );
+
+// Pool reference from a VBX node reference of `refbytes`: 8 = pool reference, 4 = index in
+// pool (grp, lev). Returns `undef` for an undefined reference of either width.
+static uint64 ReadFileRef ( const char* src, int refbytes, uchar grp, uchar lev, uint64 undef )
+{
+	if ( refbytes == 4 ) {
+		uint32 r;
+		memcpy ( &r, src, sizeof(r) );
+		return ( r == ID_UNDEFL ) ? undef : Elem ( grp, lev, r );
+	}
+	uint64 r;
+	memcpy ( &r, src, sizeof(r) );
+	return ( r == ID_UNDEFL || r == ID_UNDEF64 ) ? undef : r;
+}
 
 // Version history
 // GVDB 1.0  - First release. GTC'2017
@@ -77,7 +100,9 @@ VolumeGVDB::VolumeGVDB ()
 	SetTransform(Vector3DF(0, 0, 0), Vector3DF(1, 1, 1), Vector3DF(0, 0, 0), Vector3DF(0, 0, 0));
 
 	mRoot = ID_UNDEFL;
+	mTreeCfg = TREE_CFG_RUNTIME;
 	mbUseGLAtlas = false;
+	mNumSharedBricks = 0;
 
 	mVDBInfo.update = true;	
 	mVDBInfo.clr_chan = CHAN_UNDEF;
@@ -457,8 +482,8 @@ bool VolumeGVDB::ImportVTK ( std::string fname, std::string field, Vector3DI& re
 void VolumeGVDB::ConvertBitmaskToNonBitmask( int levs )
 {
 	Node* node;
-	uint64* clist;
-	uint64 childid;
+	noderef* clist;
+	noderef childid;
 //	uint32 cnt;
 	uint32 ndx;
 	uint64 ccnt, cmax, btchk;
@@ -480,10 +505,10 @@ void VolumeGVDB::ConvertBitmaskToNonBitmask( int levs )
 			// number of children
 			ccnt = getNumChild( node );
 			cmax = getVoxCnt( node->mLev );
-			clist = mPool->PoolData64( node->mChildList );
+			clist = getChildList( node );
 			
 			// pad remainder of child list with ID_UNDEFL			
-			memset(clist + ccnt, 0xFF, sizeof(uint64)*(cmax - ccnt));
+			memset(clist + ccnt, 0xFF, sizeof(noderef)*(cmax - ccnt));
 
 			// move children into index locations			
 			for (int64_t j = static_cast<int64_t>(ccnt-1); j >=0; j--) {
@@ -495,7 +520,7 @@ void VolumeGVDB::ConvertBitmaskToNonBitmask( int levs )
 				}
 				childid = *(clist + j);		// get child
 				*(clist + ndx) = childid;	// put child
-				*(clist + j) = ID_UNDEF64;
+				*(clist + j) = ID_UNDEFREF;
 			}			
 		}
 	}
@@ -584,6 +609,11 @@ bool VolumeGVDB::LoadVBX(const std::string fname, int force_maj, int force_min)
 		// GVDB 1.0 always uses bitmasks
 		read_masks = 1;
 	}
+	uchar refbytes = sizeof(uint64); // Width of node references in the VBX file
+	if (major == 1 && minor >= 12) {
+		// GVDB 1.12+ saves the node reference width
+		fread(&refbytes, sizeof(uchar), 1, fp);
+	}
 	
 	//--- grid offset table
 	for (int n=0; n < num_grids; n++ ) {
@@ -624,9 +654,9 @@ bool VolumeGVDB::LoadVBX(const std::string fname, int force_maj, int force_min)
 			fread(&cnt1[n], sizeof(int), 1, fp);
 			fread(&width1[n], sizeof(int), 1, fp);
 		}
-		if (width0[0] != sizeof(nvdb::Node)) {
+		if (width0[0] != VBX_NODE_HDR(refbytes)) {
 			gprintf("ERROR: VBX file contains nodes incompatible with current gvdb_library.\n");
-			gprintf("       Size in file: %d,  Size in library: %d\n", width0[0], sizeof(nvdb::Node));
+			gprintf("       Size in file: %d,  Size expected: %d\n", width0[0], VBX_NODE_HDR(refbytes));
 			gerror();
 		}
 
@@ -635,17 +665,29 @@ bool VolumeGVDB::LoadVBX(const std::string fname, int force_maj, int force_min)
 
 		mRoot = root;		// must be set after initialize
 
-		// Read topology
+		// Read topology, converting node references if the file uses the other width
+		const bool convert = (refbytes != sizeof(noderef));
 		for (int n=0; n < levels; n++ ) {
-			mPool->PoolRead(fp, 0, n, cnt0[n], width0[n]);
+			if (convert)	ReadNodes(fp, n, cnt0[n], width0[n], refbytes);
+			else			mPool->PoolRead(fp, 0, n, cnt0[n], width0[n]);
 		}
+#ifdef USE_BITMASKS
+		const bool rebuild = true;			// child list pools are per capacity class in memory
+#else
+		const bool rebuild = convert;
+#endif
 		for (int n = 0; n < levels; n++) {
-			mPool->PoolRead(fp, 1, n, cnt1[n], width1[n]);
+			if (rebuild)	ReadChildLists(fp, n, cnt1[n], width1[n], (read_masks==1), refbytes);
+			else			mPool->PoolRead(fp, 1, n, cnt1[n], width1[n]);
 		}
 
 		if (read_masks==1 && use_masks==0) {
-			// Convert bitmasks to non-bitmasks
-			ConvertBitmaskToNonBitmask( levels );
+			// Convert bitmasks to non-bitmasks (rebuilt lists are already dense)
+			if (rebuild) {
+				for (uint64 i = 0; i < getNumTotalNodes(0); i++) getNode(0, 0, i)->mFlags = 1;
+			} else {
+				ConvertBitmaskToNonBitmask( levels );
+			}
 		}
 
 		FinishTopology ();
@@ -664,6 +706,7 @@ bool VolumeGVDB::LoadVBX(const std::string fname, int force_maj, int force_min)
 			mPool->AtlasSetNum ( chan, cnt0[0] );		// assumes atlas contains all bricks (all are resident)
 
 			DataPtr slice;
+			slice.memtag = MemTag ( MEM_STAGING, 0 );
 			mPool->CreateMemLinear ( slice, 0x0, chan_stride, axisres.x*axisres.y, true );
 			for (int z = 0; z < axisres.z; z++ ) {
 				fread ( slice.cpu, slice.size, 1, fp );
@@ -674,6 +717,8 @@ bool VolumeGVDB::LoadVBX(const std::string fname, int force_maj, int force_min)
 		}
 		UpdateAtlas ();
 	}
+	mPool->Count ( CNT_VBX_READ_BYTES, uint64(ftell(fp)) );
+	fclose ( fp );
 
 	PERF_POP ();
 
@@ -965,9 +1010,6 @@ void VolumeGVDB::ActivateExtraBricksGPU(int pNumPnts, float pRadius, Vector3DF p
 	int extraLevPrefixSum = 0;
 	for (int lev = 0; lev < pRootLev; lev++)	
 	{
-		int r = getRes(lev); 
-		uint64 childlistLen = ((uint64) r*r*r);
-
 		Vector3DI brickRange = getRange(lev);
 		for (int n = extraLevPrefixSum; n < extraLevCnt[lev]+extraLevPrefixSum; n++)
 		{
@@ -976,16 +1018,11 @@ void VolumeGVDB::ActivateExtraBricksGPU(int pNumPnts, float pRadius, Vector3DF p
 				extraUniBricks[n * 4 + 1] * brickRange.y, 
 				extraUniBricks[n * 4 + 0] * brickRange.z));
 
-			if (lev > 0) 
-			{
-				Node* nd = getNode(nodeID);
-				nd->mChildList = mPool->PoolAlloc ( 1, lev, true );
-				uint64* clist = mPool->PoolData64 ( nd->mChildList );			
-				memset(clist, 0xFF, sizeof(uint64) * childlistLen);
-			}
+			if (lev > 0) CreateChildList ( getNode(nodeID) );
 		}
 		extraLevPrefixSum += extraLevCnt[lev];
 	}
+	ExpandChildLists ( pRootLev+1 );		// the link kernel addresses children by bit position
 	PERF_POP();
 
 	PERF_PUSH ( "Commit");
@@ -1010,6 +1047,12 @@ void VolumeGVDB::ActivateExtraBricksGPU(int pNumPnts, float pRadius, Vector3DF p
 	mPool->PoolFetchAll();
 	PERF_POP();
 
+#ifdef USE_BITMASKS
+	ConvertNonBitmaskToBitmask ( pRootLev+1 );
+	mPool->PoolCommitAll();
+	PrepareVDBPartially();
+#endif
+
 	POP_CTX
 
 	PERF_POP();
@@ -1079,17 +1122,21 @@ void VolumeGVDB::ActivateIncreBricksGPU(int pNumPnts, float pRadius, Vector3DF p
 		RetrieveData ( mAux[AUX_NODE_MARKER] );	
 
 		marker = (int*) mAux[AUX_NODE_MARKER].cpu;
+		uint64 activated = 0, deactivated = 0;
 		for (int ni = 0; ni < totalLeafNodeCnt; ni++) {
-			getNode(0,0,ni)->mFlags = *marker++;
+			Node* nd = getNode(0,0,ni);
+			if ( nd->mFlags && !*marker ) deactivated++;
+			if ( !nd->mFlags && *marker ) activated++;
+			nd->mFlags = *marker++;
 		}
+		mPool->Count ( CNT_BRICK_ACTIVATE, activated );
+		mPool->Count ( CNT_BRICK_DEACTIVATE, deactivated );
 	PERF_POP ();
 
 	PERF_PUSH ( "Allocate pool (CPU)");
 	int extraLevPrefixSum = 0;
 	for (int lev = 0; lev < pRootLev; lev++)	
 	{
-		int r = getRes(lev); 
-		uint64 childlistLen = ((uint64) r*r*r);
 		Vector3DI brickRange = getRange(lev);
 		for (int n = extraLevPrefixSum; n < extraLevCnt[lev]+extraLevPrefixSum; n++)
 		{
@@ -1099,16 +1146,11 @@ void VolumeGVDB::ActivateIncreBricksGPU(int pNumPnts, float pRadius, Vector3DF p
 			uint64 nodeID = mPool->PoolAlloc ( 0, lev, true );		
 			SetupNode ( nodeID, lev, Vector3DI( extraUniBricks[n * 4 + 2] * brickRange.x, extraUniBricks[n * 4 + 1] * brickRange.y, extraUniBricks[n * 4 + 0] * brickRange.z));
 	
-			if (lev > 0) // alloc childlist for nodes except leaf nodes
-			{
-				Node* nd = getNode(nodeID);
-				nd->mChildList = mPool->PoolAlloc ( 1, lev, true );
-				uint64* clist = mPool->PoolData64 ( nd->mChildList );			
-				memset(clist, 0xFF, sizeof(uint64) * childlistLen);
-			}
+			if (lev > 0) CreateChildList ( getNode(nodeID) );		// alloc childlist for nodes except leaf nodes
 		}
 		extraLevPrefixSum += extraLevCnt[lev];
 	}
+	ExpandChildLists ( pRootLev+1 );		// the link and delink kernels address children by bit position
 	PERF_POP ();
 
 	mPool->PoolCommitAll();
@@ -1141,6 +1183,12 @@ void VolumeGVDB::ActivateIncreBricksGPU(int pNumPnts, float pRadius, Vector3DF p
 
 	mPool->PoolFetchAll();
 
+#ifdef USE_BITMASKS
+	ConvertNonBitmaskToBitmask ( pRootLev+1 );
+	mPool->PoolCommitAll();
+	PrepareVDBPartially();
+#endif
+
 	PERF_PUSH ( "UpdateUsed");
 	uint64 usedNum = mPool->getPoolTotalCnt(0,0);
 	for (int ni = 0; ni < mPool->getPoolTotalCnt(0,0); ni++) if(!getNode(0,0,ni)->mFlags) usedNum--;
@@ -1288,15 +1336,10 @@ void VolumeGVDB::ActivateBricksGPU(int pNumPnts, float pRadius, Vector3DF pOrig,
 	PERF_PUSH("Create pool (CPU)");
 	{
 		mRoot = mPool->PoolAlloc ( 0, pRootLev, true );
-		uint64 childlistId = mPool->PoolAlloc ( 1, pRootLev, true );
 		SetupNode ( mRoot, pRootLev, pRootPos);
 		Node* rootnd = getNode(mRoot);
 		rootnd->mFlags = true;
-		rootnd->mChildList = childlistId;
-		uint64* clist = mPool->PoolData64 ( rootnd->mChildList );
-		int r = getRes(pRootLev); 
-		uint64 childlistLen = ((uint64) r*r*r);
-		memset(clist, 0xFF, sizeof(uint64) * childlistLen);
+		CreateChildList ( rootnd );
 	}
 	
 	int* levCnt = new int[pRootLev];
@@ -1308,9 +1351,6 @@ void VolumeGVDB::ActivateBricksGPU(int pNumPnts, float pRadius, Vector3DF pOrig,
 	int levPrefixSum = 0;
 	for (int lev = 0; lev < pRootLev; lev++)	
 	{
-		int r = getRes(lev); 
-		uint64 childlistLen = ((uint64) r*r*r);
-
 		Vector3DI brickRange = getRange(lev);
 		for (int n = levPrefixSum; n < levCnt[lev]+levPrefixSum; n++)
 		{
@@ -1319,13 +1359,7 @@ void VolumeGVDB::ActivateBricksGPU(int pNumPnts, float pRadius, Vector3DF pOrig,
 				uniBricks[n * 4 + 1] * brickRange.y, 
 				uniBricks[n * 4 + 0] * brickRange.z));
 
-			if (lev > 0) 
-			{
-				Node* nd = getNode(nodeID);
-				nd->mChildList = mPool->PoolAlloc ( 1, lev, true );
-				uint64* clist = mPool->PoolData64 ( nd->mChildList );			
-				memset(clist, 0xFF, sizeof(uint64) * childlistLen);
-			}
+			if (lev > 0) CreateChildList ( getNode(nodeID) );
 		}
 		levPrefixSum += levCnt[lev];
 	}
@@ -1359,26 +1393,10 @@ void VolumeGVDB::ActivateBricksGPU(int pNumPnts, float pRadius, Vector3DF pOrig,
 			posInNode.z = floor(posInNode.z);	
 			bitMaskPos = (posInNode.z*res.x + posInNode.y)*res.x+ posInNode.x;
 
-			// parent in node
-			nd->mParent = parentNodeID;	// set parent of child
-#ifdef USE_BITMASKS
-			// determine child bit position	
-			uint64 p = parentNd->countOn ( bitMaskPos );
-			uint64 cnum = parentNd->getNumChild();		// existing children count
-			parentNd->setOn ( bitMaskPos );
-
-			// insert into child list in parent node
-			uint64* clist = mPool->PoolData64 ( parentNd->mChildList );
-			if ( p < cnum ) {
-				memmove ( clist + p+1, clist + p, (cnum-p)*sizeof(uint64) );
-				*(clist + p) = nodeID;
-			} else {
-				*(clist + cnum) = nodeID;		
-			}
-#else
-			uint64* clist = mPool->PoolData64 ( parentNd->mChildList );
-			*(clist + bitMaskPos) = nodeID;	
-#endif
+			// parent in node (lists are dense until ConvertNonBitmaskToBitmask)
+			nd->mParent = ElemRef ( parentNodeID );	// set parent of child
+			noderef* clist = getChildList ( parentNd );
+			*(clist + bitMaskPos) = ElemRef ( nodeID );
 		}
 		mPool->PoolCommitAll();
 	}
@@ -1405,6 +1423,12 @@ void VolumeGVDB::ActivateBricksGPU(int pNumPnts, float pRadius, Vector3DF pOrig,
 	mPool->PoolFetchAll();
 	PERF_POP();
 #endif	
+
+#ifdef USE_BITMASKS
+	ConvertNonBitmaskToBitmask ( pRootLev+1 );		// repack the lists linked above
+	mPool->PoolCommitAll();
+	PrepareVDBPartially();
+#endif
 	
 	POP_CTX
 
@@ -1423,11 +1447,8 @@ void VolumeGVDB::FindActivBricks(int pLev,  int pRootlev,  int pNumPnts, Vector3
 	if (pLev == pRootlev)
 	{
 		mRoot = mPool->PoolAlloc ( 0, pLev, true );
-		uint64 childlistId = mPool->PoolAlloc ( 1, pLev, true );
 		SetupNode ( mRoot, pLev, pRootPos);
-
-		Node* rootnd = getNode(mRoot);
-		rootnd->mChildList = childlistId;
+		CreateChildList ( getNode(mRoot) );
 	}
 
 	//////////////////////////////////////////////////////////////////////////
@@ -1507,11 +1528,7 @@ void VolumeGVDB::FindActivBricks(int pLev,  int pRootlev,  int pNumPnts, Vector3
 		SetupNode ( nodeID, pLev - 1, Vector3DI( activatingBrickIdx[n] % dim * brickRange.x, 
 			activatingBrickIdx[n] / dim % dim * brickRange.y, 
 			activatingBrickIdx[n] / d2 % dim * brickRange.z));
-		if ((pLev - 1) > 0) 
-		{
-			Node* nd = getNode(nodeID);
-			nd->mChildList = mPool->PoolAlloc ( 1, pLev - 1, true );
-		}
+		if ((pLev - 1) > 0) CreateChildList ( getNode(nodeID) );
 	}
 	PERF_POP ();
 	//////////////////////////////////////////////////////////////////////////
@@ -1541,27 +1558,8 @@ void VolumeGVDB::FindActivBricks(int pLev,  int pRootlev,  int pNumPnts, Vector3
 		int posInNodeZ = int(floor(posInNode.z));
 		bitMaskPos = (posInNodeZ*res.x + posInNodeY)*res.x+ posInNodeX;
 
-		// parent in node
-		nd->mParent = parentNodeID;	// set parent of child
-
-		// determine child bit position	
-#ifdef USE_BITMASKS
-		uint64 p = parentNd->countOn ( bitMaskPos );
-		uint64 cnum = parentNd->getNumChild();		// existing children count
-		parentNd->setOn ( bitMaskPos );
-
-		// insert into child list in parent node
-		uint64* clist = mPool->PoolData64 ( parentNd->mChildList );
-		if ( p < cnum ) {
-			memmove ( clist + p+1, clist + p, (cnum-p)*sizeof(uint64) );
-			*(clist + p) = nodeID;
-		} else {
-			*(clist + cnum) = nodeID;		
-		}
-#else
-		uint64* clist = mPool->PoolData64 ( parentNd->mChildList );
-		*(clist + bitMaskPos) = nodeID;
-#endif
+		// insert into child list in parent node, also sets parent
+		InsertChild ( parentNodeID, nodeID, bitMaskPos );
 	}
 	PERF_POP ();
 	//////////////////////////////////////////////////////////////////////////
@@ -1595,6 +1593,7 @@ void VolumeGVDB::FinishTopology (bool pCommitPool, bool pComputeBounds)
 // Clear all channels
 void VolumeGVDB::ClearChannel (uchar chan)
 {
+	UnshareBricks ();
 	// This launches a kernel to clear the CUarray.
 	//   (there is no MemsetD8 for cuda arrays)
 	PUSH_CTX
@@ -1625,6 +1624,7 @@ void VolumeGVDB::ClearAllChannels ()
 // Save a VBX file
 void VolumeGVDB::SaveVBX ( const std::string fname )
 {
+	UnshareBricks ();			// VBX stores one brick per leaf
 	// See GVDB_FILESPEC.txt for the specification of the VBX file format.
 	PUSH_CTX
 	
@@ -1677,12 +1677,16 @@ void VolumeGVDB::SaveVBX ( const std::string fname )
 	
 	// bitmask info
 	uchar use_bitmask = 0;
-	#ifdef USE_BITMASK
+	#ifdef USE_BITMASKS
 		use_bitmask = 1;
 	#endif
 	if (major >= 2) {
 		fwrite( &use_bitmask, sizeof(uchar), 1, fp );		// bitmask usage (GVDB 2.0 or higher)
 	}
+	if (major == 1 && minor >= 12) {
+		const uchar refbytes = sizeof(noderef);
+		fwrite( &refbytes, sizeof(uchar), 1, fp );			// node reference width (GVDB 1.12 or higher)
+	}
 
 	//--- grid offset table
 	const long grid_table = ftell ( fp );					// position of grid table in file
@@ -1711,13 +1715,20 @@ void VolumeGVDB::SaveVBX ( const std::string fname )
 		//---- topology section
 		fwrite ( &levels, sizeof(int), 1, fp );				// num levels
 		fwrite ( &mRoot, sizeof(uint64), 1, fp );			// root id
+		// Child lists are written dense (the file has no bitmask flag), one row per node with
+		// children in node order. Lists freed to the pool's free list are not written.
+		std::vector<int> rows ( levels, 0 );
+		for (int n = 1; n < levels; n++) {
+			for (uint64 i = 0; i < mPool->getPoolTotalCnt(0, n); i++)
+				if ( getNode(0, n, i)->mChildList != ID_UNDEFL ) rows[n]++;
+		}
 		for (int n=0; n < levels; n++ ) {
 			const int res = getRes(n);
 			const Vector3DI range = getRange(n);
 			const int width0 = static_cast<int>(mPool->getPoolWidth(0, n));
-			const int width1 = static_cast<int>(mPool->getPoolWidth(1, n));
 			const int cnt0 = static_cast<int>(mPool->getPoolTotalCnt(0, n));
-			const int cnt1 = static_cast<int>(mPool->getPoolTotalCnt(1, n));
+			const int width1 = (n == 0) ? 0 : static_cast<int>(getVoxCnt(n) * sizeof(noderef));
+			const int cnt1 = rows[n];
 			fwrite ( &mLogDim[n], sizeof(int), 1, fp );
 			fwrite ( &res, sizeof(int), 1, fp );
 			fwrite ( &range.x, sizeof(int), 3, fp );
@@ -1728,11 +1739,37 @@ void VolumeGVDB::SaveVBX ( const std::string fname )
 		}
 
 		// Write topology
+#ifdef USE_BITMASKS
+		std::vector<uint32> bits;
+		std::vector<uint64> refs;
+#endif
+		std::vector<noderef> row;
+		std::vector<uchar> nodebuf;
 		for (int n = 0; n < levels; n++) {
-			mPool->PoolWrite(fp, 0, n); // write pool 0
+			uint64 width0 = mPool->getPoolWidth(0, n);
+			uint64 r = 0;
+			nodebuf.resize ( width0 );
+			Node* nd = (Node*) nodebuf.data();
+			for (uint64 i = 0; i < mPool->getPoolTotalCnt(0, n); i++) {		// write pool 0, child list = row
+				memcpy ( nd, getNode(0, n, i), width0 );
+				if ( nd->mChildList != ID_UNDEFL ) setChildListId ( nd, Elem(1, n, r++) );
+				fwrite ( nd, width0, 1, fp );
+			}
 		}
-		for (int n = 0; n < levels; n++) {
-			mPool->PoolWrite(fp, 1, n); // write pool 1
+		for (int n = 1; n < levels; n++) {
+			for (uint64 i = 0; i < mPool->getPoolTotalCnt(0, n); i++) {		// write pool 1, dense rows
+				Node* nd = getNode(0, n, i);
+				if ( nd->mChildList == ID_UNDEFL ) continue;
+#ifdef USE_BITMASKS
+				GatherChildList ( nd, bits, refs );
+				row.assign ( getVoxCnt(n), ID_UNDEFREF );
+				for (size_t k = 0; k < bits.size(); k++) row[ bits[k] ] = ElemRef ( refs[k] );
+#else
+				noderef* clist = getChildList ( nd );
+				row.assign ( clist, clist + getVoxCnt(n) );		// dense already, tiles included
+#endif
+				fwrite ( row.data(), sizeof(noderef), row.size(), fp );
+			}
 		}
 
 		//---- atlas section
@@ -1745,6 +1782,7 @@ void VolumeGVDB::SaveVBX ( const std::string fname )
 
 			fwrite ( &chan_type, sizeof(int), 1, fp );
 			fwrite ( &chan_stride, sizeof(int), 1, fp );
+			slice.memtag = MemTag ( MEM_STAGING, 0 );
 			mPool->CreateMemLinear ( slice, 0x0, chan_stride, axisres.x*axisres.y, true );
 
 			for (int z = 0; z < axisres.z; z++ ) {
@@ -1755,6 +1793,8 @@ void VolumeGVDB::SaveVBX ( const std::string fname )
 			mPool->FreeMemLinear ( slice );
 		}
 	}
+	mPool->Count ( CNT_VBX_WRITE_BYTES, uint64(ftell(fp)) );
+
 	// update grid offsets table
 	fseek(fp, grid_table, SEEK_SET);
 	fwrite(grid_offs.data(), sizeof(uint64), grid_offs.size(), fp); // grid offsets
@@ -1795,17 +1835,41 @@ void VolumeGVDB::ComputeBounds ()
 	Node* curr = getNode ( 0, 0, 0 );	
 	mVoxMin = curr->mPos;
 	mVoxMax = mVoxMin;
+	bool found = false;
+	auto expand = [&]( Vector3DI pos, Vector3DI r ) {
+		if ( !found ) { mVoxMin = pos; mVoxMax = mVoxMin; found = true; }
+		if ( pos.x < mVoxMin.x ) mVoxMin.x = static_cast<float>(pos.x);
+		if ( pos.y < mVoxMin.y ) mVoxMin.y = static_cast<float>(pos.y);
+		if ( pos.z < mVoxMin.z ) mVoxMin.z = static_cast<float>(pos.z);	
+		if ( pos.x + r.x > mVoxMax.x ) mVoxMax.x = static_cast<float>(pos.x + r.x);
+		if ( pos.y + r.y > mVoxMax.y ) mVoxMax.y = static_cast<float>(pos.y + r.y);
+		if ( pos.z + r.z > mVoxMax.z ) mVoxMax.z = static_cast<float>(pos.z + r.z);		
+	};
 	for (int n=0; n < mPool->getPoolTotalCnt(0,0); n++ ) {
 		curr = getNode ( 0, 0, n );
 		if (!curr->mFlags) continue;		// inactivated, skip
-		
-		if ( curr->mPos.x < mVoxMin.x ) mVoxMin.x = static_cast<float>(curr->mPos.x);
-		if ( curr->mPos.y < mVoxMin.y ) mVoxMin.y = static_cast<float>(curr->mPos.y);
-		if ( curr->mPos.z < mVoxMin.z ) mVoxMin.z = static_cast<float>(curr->mPos.z);	
-		if ( curr->mPos.x + range.x > mVoxMax.x ) mVoxMax.x = static_cast<float>(curr->mPos.x + range.x);
-		if ( curr->mPos.y + range.y > mVoxMax.y ) mVoxMax.y = static_cast<float>(curr->mPos.y + range.y);
-		if ( curr->mPos.z + range.z > mVoxMax.z ) mVoxMax.z = static_cast<float>(curr->mPos.z + range.z);		
+		expand ( curr->mPos, range );
+	}
+#ifdef GVDB_TILES
+	// Tiles cover the whole region of their child slot
+	for (int lev = 1; lev < mPool->getNumLevels(); lev++) {
+		int res = getRes ( lev );
+		uint64 vox = getVoxCnt ( lev );
+		Vector3DI crange = getRange ( lev-1 );
+		for (uint64 n = 0; n < mPool->getPoolTotalCnt(0, lev); n++) {
+			curr = getNode ( 0, lev, n );
+			if ( curr->mChildList == ID_UNDEFL ) continue;
+			noderef* clist = getChildList ( curr );
+			for (uint64 b = 0; b < vox; b++) {
+				if ( !isElemTile(clist[b]) ) continue;
+				Vector3DI p ( int(b % res), int((b / res) % res), int(b / (uint64(res)*res)) );
+				p *= crange;
+				p += curr->mPos;
+				expand ( p, crange );
+			}
+		}
 	}
+#endif
 	mObjMin = mVoxMin;
 	mObjMax = mVoxMax;
 	mVoxRes = mVoxMax;  mVoxRes -= mVoxMin;
@@ -1957,18 +2021,187 @@ bool VolumeGVDB::LoadBRK ( std::string fname )
 }
 
 
+// Replace uniform bricks with constant-value tiles, then rebuild the tree.
+// Tiles are collected as (slot level, slot corner, value) and promoted one level up while a
+// node's slots are all tiles within `tolerance`. The surviving bricks are refilled from the
+// values read back here.
+uint64 VolumeGVDB::CollapseTiles ( float tolerance )
+{
+#ifndef GVDB_TILES
+	(void) tolerance;
+	gprintf ( "ERROR: CollapseTiles requires dense child lists of full pool references.\n" );
+	return 0;
+#else
+	if ( mRoot == ID_UNDEFL || mPool->getNumLevels() < 2 ) return 0;
+	if ( mPool->getNumAtlas() != 1 || mPool->getAtlas(0).type != T_FLOAT ) {
+		gprintf ( "ERROR: CollapseTiles requires a single T_FLOAT channel.\n" );
+		return 0;
+	}
+	PERF_PUSH ( "Collapse tiles" );
+
+	struct Tile {
+		int			lev;		// level of the node holding the slot
+		Vector3DI	pos;		// corner of the slot
+		float		val;
+	};
+	std::vector<Tile> tiles;
+	const int levs = mPool->getNumLevels();
+
+	// Existing tiles, reachable from the root
+	std::vector<uint64> stack ( 1, mRoot );
+	while ( !stack.empty() ) {
+		Node* curr = getNode ( stack.back() );
+		stack.pop_back ();
+		if ( curr->mLev == 0 || curr->mChildList == ID_UNDEFL ) continue;
+		int res = getRes ( curr->mLev );
+		Vector3DI crange = getRange ( curr->mLev-1 );
+		noderef* clist = getChildList ( curr );
+		for (uint64 b = 0; b < getVoxCnt(curr->mLev); b++) {
+			if ( clist[b] == ID_UNDEFREF ) continue;
+			if ( !isElemTile(clist[b]) ) { stack.push_back ( clist[b] ); continue; }
+			Vector3DI p ( int(b % res), int((b / res) % res), int(b / (uint64(res)*res)) );
+			p *= crange;
+			p += curr->mPos;
+			tiles.push_back ( { curr->mLev, p, ElemTileValue(clist[b]) } );
+		}
+	}
+
+	// Read back the bricks a batch of atlas layers at a time. Uniform bricks become
+	// level-1 tiles, the rest keep their values for the refill.
+	const uint64 vox0 = getVoxCnt(0);
+	std::vector< std::vector<uint64> > layers;
+	const int batch = GetLeafLayers ( 0, Vector3DI(INT_MIN, INT_MIN, INT_MIN), Vector3DI(INT_MAX, INT_MAX, INT_MAX), layers );
+	uint64 leafcnt = 0;
+	for (size_t l = 0; l < layers.size(); l++) leafcnt += layers[l].size();
+
+	std::vector<Vector3DI> bricks;
+	std::vector<float> kept;
+	std::vector<uchar> buf;
+	std::vector<uint64> nodes;
+	std::vector<float> tileVal;
+	std::vector<char> uniform;
+
+	for (int l0 = 0; l0 < (int) layers.size(); l0 += batch) {
+		int l1 = std::min ( (int) layers.size(), l0 + batch );
+		nodes.clear ();
+		for (int l = l0; l < l1; l++) nodes.insert ( nodes.end(), layers[l].begin(), layers[l].end() );
+		if ( nodes.empty() ) continue;
+		ReadAtlasLayers ( 0, l0, l1, buf );
+
+		tileVal.assign ( nodes.size(), 0.0f );
+		uniform.assign ( nodes.size(), 0 );
+		ParallelChunks ( nodes.size(), 0, [&]( int, uint64 s, uint64 e ) {
+			for (uint64 i = s; i < e; i++) {
+				BrickView b = getBrickView ( 0, nodes[i], buf, l0 );
+				float vmin = b.at<float> ( 0, 0, 0 ), vmax = vmin;
+				for (VoxelIterator v ( b ); v; ++v) {
+					vmin = std::min ( vmin, v.value<float>() );
+					vmax = std::max ( vmax, v.value<float>() );
+				}
+				uniform[i] = ( vmax - vmin <= tolerance );
+				tileVal[i] = 0.5f * (vmin + vmax);
+			}
+		} );
+		for (uint64 i = 0; i < nodes.size(); i++) {
+			Node* node = getNode ( nodes[i] );
+			if ( uniform[i] ) {
+				tiles.push_back ( { 1, node->mPos, tileVal[i] } );
+				continue;
+			}
+			bricks.push_back ( node->mPos );
+			BrickView b = getBrickView ( 0, nodes[i], buf, l0 );
+			for (VoxelIterator v ( b ); v; ++v) kept.push_back ( v.value<float>() );
+		}
+	}
+	EndAtlasLayers ( buf );
+
+	if ( bricks.size() == leafcnt ) {
+		PERF_POP ();
+		return 0;
+	}
+
+	// Key of the node at `lev` containing `pos`, 21 bits per axis
+	auto nodeKey = [&]( int lev, Vector3DI pos ) {
+		Vector3DI r = getRange ( lev );
+		int64_t x = int64_t(floor(double(pos.x) / r.x)), y = int64_t(floor(double(pos.y) / r.y)), z = int64_t(floor(double(pos.z) / r.z));
+		return (uint64(x) & 0x1FFFFF) | ((uint64(y) & 0x1FFFFF) << 21) | ((uint64(z) & 0x1FFFFF) << 42);
+	};
+
+	// Promote nodes whose slots are all equal tiles
+	for (int lev = 1; lev < levs-1; lev++) {
+		std::unordered_map< uint64, std::vector<size_t> > byNode;
+		for (size_t t = 0; t < tiles.size(); t++)
+			if ( tiles[t].lev == lev ) byNode[ nodeKey(lev, tiles[t].pos) ].push_back ( t );
+		std::vector<char> drop ( tiles.size(), 0 );
+		std::vector<Tile> promoted;
+		for (auto& it : byNode) {
+			if ( it.second.size() != getVoxCnt(lev) ) continue;
+			float vmin = tiles[ it.second[0] ].val, vmax = vmin;
+			for (size_t t : it.second) {
+				vmin = std::min ( vmin, tiles[t].val );
+				vmax = std::max ( vmax, tiles[t].val );
+			}
+			if ( vmax - vmin > tolerance ) continue;
+			Vector3DI range;
+			promoted.push_back ( { lev+1, GetCoveringNode ( lev, tiles[ it.second[0] ].pos, range ), 0.5f * (vmin + vmax) } );
+			for (size_t t : it.second) drop[t] = 1;
+		}
+		if ( promoted.empty() ) continue;
+		size_t keep = 0;
+		for (size_t t = 0; t < tiles.size(); t++)
+			if ( !drop[t] ) tiles[keep++] = tiles[t];
+		tiles.resize ( keep );
+		tiles.insert ( tiles.end(), promoted.begin(), promoted.end() );
+	}
+
+	// Rebuild: nodes holding tiles first, then the surviving bricks
+	Clear ();
+	for (size_t t = 0; t < tiles.size(); t++) {
+		slong nodeid = ActivateSpaceAtLevel ( tiles[t].lev, tiles[t].pos );
+		uint32 b;
+		if ( nodeid == ID_UNDEFL || !getPosInNode ( nodeid, tiles[t].pos, b ) ) continue;
+		SetTile ( nodeid, b, tiles[t].val );
+	}
+	ActivateBricks ( this, bricks );
+
+	std::unordered_map<uint64, uint64> brickOf;
+	brickOf.reserve ( bricks.size() );
+	for (uint64 i = 0; i < bricks.size(); i++) brickOf[ nodeKey(0, bricks[i]) ] = i;
+	FillBricks ( this, 0, 0.0f, [&]( Node* node, float* dst ) {
+		auto it = brickOf.find ( nodeKey(0, node->mPos) );
+		if ( it != brickOf.end() ) memcpy ( dst, &kept[ it->second * vox0 ], vox0 * sizeof(float) );
+	} );
+
+	verbosef ( "  Collapsed %llu of %llu bricks, %llu tiles\n", (unsigned long long) (leafcnt - bricks.size()),
+		(unsigned long long) leafcnt, (unsigned long long) tiles.size() );
+	PERF_POP ();
+	return leafcnt - bricks.size();
+#endif
+}
+
 #ifdef BUILD_OPENVDB
+// Scalar value of a voxel as stored in the atlas: vector grids are loaded as their length.
+inline float vdbScalar ( float v )					{ return v; }
+inline float vdbScalar ( const openvdb::Vec3s& v )	{ return static_cast<float>(v.length()); }
+
+// Key of the brick containing index-space position `pos`, 21 bits per axis.
+inline uint64 vdbBrickKey ( Vector3DI pos, int ld )
+{
+	return (uint64(pos.x >> ld) & 0x1FFFFF) | ((uint64(pos.y >> ld) & 0x1FFFFF) << 21) | ((uint64(pos.z >> ld) & 0x1FFFFF) << 42);
+}
+
 template<class GridType>
 bool VolumeGVDB::LoadVDBInternal(openvdb::GridBase::Ptr& baseGrid) {
+	using LeafType = typename GridType::TreeType::LeafNodeType;
 	// isFloat is true iff the OpenVDB grid contains floating-point values. If it
 	// contains vector values instead, for instance, it will be false.
-	const bool isFloat = std::is_same<GridType::ValueType, float>::value;
+	const bool isFloat = std::is_same<typename GridType::ValueType, float>::value;
 	// Sanity check
 	if (!baseGrid->isType<GridType>()) {
 		gprintf("ERROR: Base grid type did not match template in LoadVDBInternal.\n");
 		return false;
 	}
-	GridType::Ptr grid = openvdb::gridPtrCast<GridType>(baseGrid);
+	typename GridType::Ptr grid = openvdb::gridPtrCast<GridType>(baseGrid);
 	const Vector3DF voxelsize = Vector3DF(
 		static_cast<float>(grid->voxelSize().x()),
 		static_cast<float>(grid->voxelSize().y()),
@@ -1979,152 +2212,113 @@ bool VolumeGVDB::LoadVDBInternal(openvdb::GridBase::Ptr& baseGrid) {
 	const float poolUsed = MeasurePools();
 	verbosef("   Topology Used: %6.2f MB\n", poolUsed);
 
-	int leaf_start = 0;
-	int leaf_max = 0;
 	Vector3DF vclipmin, vclipmax, voffset;
 	vclipmin = getScene()->mVClipMin;
 	vclipmax = getScene()->mVClipMax;
+	auto inClip = [&]( const Vector3DF& p ) {
+		return p.x > vclipmin.x && p.y > vclipmin.y && p.z > vclipmin.z && p.x < vclipmax.x && p.y < vclipmax.y && p.z < vclipmax.z;
+	};
 
-	// Determine volume bounds
+	// Gather the leaves. Walking the leaf iterator only visits the internal nodes of the tree;
+	// everything after this works on the flat list in parallel.
+	std::vector<const LeafType*> leaves;
+	for (typename GridType::TreeType::LeafCIter iter = grid->tree().cbeginLeaf(); iter; ++iter)
+		leaves.push_back ( iter.getLeaf() );
+	auto leafOrigin = [&]( uint64 n ) {
+		const openvdb::Coord& origin = leaves[n]->origin();
+		return Vector3DF( Vector3DI(origin.x(), origin.y(), origin.z()) );
+	};
+
+	// Determine volume bounds, per chunk
 	verbosef("   Compute volume bounds.\n");
-	GridType::TreeType::LeafCIter iterator;
-	vdbSkip<GridType>(grid, iterator, leaf_start);
-	for (leaf_max = 0; iterator.test(); ) {
-		openvdb::Coord origin;
-		iterator->getOrigin(origin);
-		Vector3DF p0 = Vector3DI(origin.x(), origin.y(), origin.z());
-		// Only accept origins within the vclip bounding box
-		if (p0.x > vclipmin.x && p0.y > vclipmin.y && p0.z > vclipmin.z && p0.x < vclipmax.x && p0.y < vclipmax.y && p0.z < vclipmax.z) {
-			if (leaf_max == 0) {
-				mVoxMin = p0; mVoxMax = p0;
-			}
-			else {
-				if (p0.x < mVoxMin.x) mVoxMin.x = p0.x;
-				if (p0.y < mVoxMin.y) mVoxMin.y = p0.y;
-				if (p0.z < mVoxMin.z) mVoxMin.z = p0.z;
-				if (p0.x > mVoxMax.x) mVoxMax.x = p0.x;
-				if (p0.y > mVoxMax.y) mVoxMax.y = p0.y;
-				if (p0.z > mVoxMax.z) mVoxMax.z = p0.z;
-			}
-			leaf_max++;
+	const int chunks = getNumThreads();
+	std::vector<Vector3DF> chunkMin ( chunks ), chunkMax ( chunks );
+	std::vector<char> chunkFound ( chunks, 0 );
+	ParallelChunks ( leaves.size(), chunks, [&]( int c, uint64 s, uint64 e ) {
+		for (uint64 n = s; n < e; n++) {
+			Vector3DF p0 = leafOrigin ( n );
+			// Only accept origins within the vclip bounding box
+			if ( !inClip(p0) ) continue;
+			if ( !chunkFound[c] ) { chunkMin[c] = p0; chunkMax[c] = p0; chunkFound[c] = 1; continue; }
+			chunkMin[c].x = std::min ( chunkMin[c].x, p0.x );	chunkMax[c].x = std::max ( chunkMax[c].x, p0.x );
+			chunkMin[c].y = std::min ( chunkMin[c].y, p0.y );	chunkMax[c].y = std::max ( chunkMax[c].y, p0.y );
+			chunkMin[c].z = std::min ( chunkMin[c].z, p0.z );	chunkMax[c].z = std::max ( chunkMax[c].z, p0.z );
 		}
-		iterator.next();
+	} );
+	bool found = false;
+	for (int c = 0; c < chunks; c++) {
+		if ( !chunkFound[c] ) continue;
+		if ( !found ) { mVoxMin = chunkMin[c]; mVoxMax = chunkMax[c]; found = true; continue; }
+		mVoxMin.x = std::min ( mVoxMin.x, chunkMin[c].x );	mVoxMax.x = std::max ( mVoxMax.x, chunkMax[c].x );
+		mVoxMin.y = std::min ( mVoxMin.y, chunkMin[c].y );	mVoxMax.y = std::max ( mVoxMax.y, chunkMax[c].y );
+		mVoxMin.z = std::min ( mVoxMin.z, chunkMin[c].z );	mVoxMax.z = std::max ( mVoxMax.z, chunkMax[c].z );
+	}
+	if ( !found ) {
+		gprintf("ERROR: No leaves of the .vdb grid are inside the clip volume.\n");
+		return false;
 	}
 	voffset = mVoxMin * -1;		// offset to positive space (hack)	
 
-
-	// Activate Space
-	PERF_PUSH("Activate");
-	verbosef("   Activating space.\n");
-
-	vdbSkip<GridType>(grid, iterator, leaf_start);
-	for (int n = leaf_max = 0; iterator.test(); n++) {
-
-		// Read leaf position
-		openvdb::Coord origin;
-		iterator->getOrigin(origin);
-		Vector3DF p0 = Vector3DI(origin.x(), origin.y(), origin.z());
-		p0 += voffset;
-
-		// only accept those in clip volume
-		if (p0.x > vclipmin.x && p0.y > vclipmin.y && p0.z > vclipmin.z && p0.x < vclipmax.x && p0.y < vclipmax.y && p0.z < vclipmax.z) {		// accept condition
-			
-			bool bnew = false;
-			slong leaf = ActivateSpace(mRoot, p0, bnew);
-			leaf_ptr.push_back(leaf);
-			leaf_pos.push_back(p0);
-			if (leaf_max == 0) {
-				mVoxMin = p0; mVoxMax = p0;
-				verbosef("   First leaf: %d  (%f %f %f)\n", leaf_start + n, p0.x, p0.y, p0.z);
-			}
-			leaf_max++;
+	// Select the leaves inside the clip volume after the offset, in file order
+	std::vector< std::vector<uint64> > chunkLeaves ( chunks );
+	ParallelChunks ( leaves.size(), chunks, [&]( int c, uint64 s, uint64 e ) {
+		for (uint64 n = s; n < e; n++) {
+			Vector3DF p0 = leafOrigin ( n );
+			p0 += voffset;
+			if ( inClip(p0) ) chunkLeaves[c].push_back ( n );
 		}
-		iterator.next();
+	} );
+	std::vector<uint64> accepted;
+	for (int c = 0; c < chunks; c++) accepted.insert ( accepted.end(), chunkLeaves[c].begin(), chunkLeaves[c].end() );
+
+	std::vector<Vector3DI> bricks ( accepted.size() );
+	const int ld0 = getLD(0);
+	std::unordered_map<uint64, uint64> leafOfBrick;
+	leafOfBrick.reserve ( accepted.size() );
+	for (uint64 i = 0; i < accepted.size(); i++) {
+		Vector3DF p0 = leafOrigin ( accepted[i] );
+		p0 += voffset;
+		bricks[i] = Vector3DI ( p0 );
+		leafOfBrick[ vdbBrickKey(bricks[i], ld0) ] = accepted[i];
 	}
+	verbosef("   Leaves: %llu of %llu\n", (unsigned long long) accepted.size(), (unsigned long long) leaves.size());
 
-	// Finish Topology
-	FinishTopology();
-
-	PERF_POP();
-
-	// Resize Atlas
-	//verbosef ( "   Create Atlas. Free before: %6.2f MB\n", cudaGetFreeMem() );
-	PERF_PUSH("Atlas");
+	// Activate space and create the atlas in one pass over the leaf origins
+	verbosef("   Activating space.\n");
 	DestroyChannels();
 	AddChannel(0, T_FLOAT, mApron, F_LINEAR);
-	UpdateAtlas();
-	PERF_POP();
-	//verbosef ( "   Create Atlas. Free after:  %6.2f MB, # Leaf: %d\n", cudaGetFreeMem(), leaf_max );
+	ActivateBricks ( this, bricks );
 
-	// Resize temp 3D texture to match leaf res
-	int res0 = getRes(0);
-	Vector3DI vres0(res0, res0, res0);		// leaf resolution
-	Vector3DF vrange0 = getRange(0);
-
-	Volume3D vtemp(mScene);
-	vtemp.Resize(T_FLOAT, vres0, 0x0, false);
-
-	// Read brick data
+	// Read brick data. Leaves are copied straight from their buffers into batches of atlas
+	// layers, which are uploaded slice by slice. OpenVDB leaves are in x-major order.
 	PERF_PUSH("Read bricks");
-
-	// Advance to starting leaf		
-	vdbSkip<GridType>(grid, iterator, leaf_start);
-
-	// Tempoary buffer for velocity fields
-	const int64_t res0_64 = static_cast<int64_t>(res0);
-	float* srcLengths = new float[res0_64 * res0_64 * res0_64];
-	float mValMin, mValMax;
-	mValMin = FLT_MAX; mValMax = FLT_MIN;
-
-	// Fill atlas from leaf data
-	int percentLast = 0, percent = 0;
 	verbosef("   Loading bricks.\n");
-	for (int leaf_cnt = 0; iterator.test(); ) {
-
-		// Read leaf position
-		openvdb::Coord origin;
-		iterator->getOrigin(origin);
-		Vector3DF p0 = Vector3DI(origin.x(), origin.y(), origin.z());
-		p0 += voffset;
-
-		// Only process nodes whose origins are within the bounding box
-		if (p0.x > vclipmin.x && p0.y > vclipmin.y && p0.z > vclipmin.z && p0.x < vclipmax.x && p0.y < vclipmax.y && p0.z < vclipmax.z) {
-			// get leaf	
-			GridType::TreeType::LeafNodeType::Buffer leafBuffer = iterator->buffer();
-			float* src;
-			if (isFloat) {
-				src = leafBuffer.data();
-			}
-			else {
-				src = ConvertToScalar(res0 * res0 * res0, (float*)leafBuffer.data(), srcLengths, mValMin, mValMax);
-			}
-
-			// Copy data from CPU into temporary 3D texture
-			vtemp.SetDomain(leaf_pos[leaf_cnt], leaf_pos[leaf_cnt] + vrange0);
-			vtemp.CommitFromCPU(src);
-
-			// Copy from 3D texture into Atlas brick
-			Node* node = getNode(leaf_ptr[leaf_cnt]);
-			mPool->AtlasCopyTexZYX(0, node->mValue, vtemp.getPtr());
-
-			// Progress percent
-			leaf_cnt++; percent = int(leaf_cnt * 100 / leaf_max);
-			if (percent != percentLast) {
-				verbosef("%d%%%% ", percent);
-				percentLast = percent;
-			}
+	const int res0 = getRes(0);
+	float mValMin = FLT_MAX, mValMax = -FLT_MAX;
+	std::mutex rangeMutex;
+	FillBricks ( this, 0, 0.0f, [&]( Node* node, float* dst ) {
+		auto it = leafOfBrick.find ( vdbBrickKey(node->mPos, ld0) );
+		if ( it == leafOfBrick.end() ) return;
+		const typename LeafType::ValueType* src = leaves[it->second]->buffer().data();
+		float vmin = FLT_MAX, vmax = -FLT_MAX;
+		for (int z = 0; z < res0; z++)
+			for (int y = 0; y < res0; y++)
+				for (int x = 0; x < res0; x++) {
+					float v = vdbScalar ( src[(x*res0 + y)*res0 + z] );
+					vmin = std::min ( vmin, v );
+					vmax = std::max ( vmax, v );
+					*dst++ = v;
+				}
+		if ( !isFloat ) {
+			std::lock_guard<std::mutex> lock ( rangeMutex );
+			mValMin = std::min ( mValMin, vmin );
+			mValMax = std::max ( mValMax, vmax );
 		}
-		iterator.next();
-	}
-
+	} );
 	PERF_POP();
-	if (mValMin != FLT_MAX || mValMax != FLT_MIN)
+	if (mValMin != FLT_MAX || mValMax != -FLT_MAX)
 		verbosef("\n    Value Range: %f %f\n", mValMin, mValMax);
 
-	UpdateApron();
-
-	delete[] srcLengths;
-
 	return true;
 }
 #endif // BUILD_OPENVDB
@@ -2173,7 +2367,7 @@ bool VolumeGVDB::LoadVDB ( std::string fname )
 	}
 	else if (baseGrid->isType<Vec3fGrid543>()) {
 		Configure(5, 5, 5, 4, 3);
-		success = LoadVDBInternal<FloatGrid543>(baseGrid);
+		success = LoadVDBInternal<Vec3fGrid543>(baseGrid);
 	}
 	else if (baseGrid->isType<FloatGrid34>()) {
 		Configure(3, 3, 3, 3, 4);
@@ -2181,7 +2375,7 @@ bool VolumeGVDB::LoadVDB ( std::string fname )
 	}
 	else if (baseGrid->isType<Vec3fGrid34>()) {
 		Configure(3, 3, 3, 3, 4);
-		success = LoadVDBInternal<FloatGrid34>(baseGrid);
+		success = LoadVDBInternal<Vec3fGrid34>(baseGrid);
 	}
 
 	vdbfile->close();
@@ -2212,41 +2406,52 @@ template<class TreeType>
 void VolumeGVDB::SaveVDBInternal(std::string& fname) {
 	// Raw pointer to tree
 	TreeType* treePtr = new TreeType(0.0);
-	TreeType::Ptr tree(treePtr);
+	typename TreeType::Ptr tree(treePtr);
 
 	// `typename` here doesn't change the type - it just lets the
 	// compiler know that these are types, and not values:
 	using GridType = typename openvdb::Grid<TreeType>;
 	using IterType = typename GridType::ValueAllIter;
-	using RootType = typename TreeType::RootNodeType;
 	using LeafType = typename TreeType::LeafNodeType;
 	using ValueType = typename LeafType::ValueType;
 
-	LeafType* leaf;
 	const int res = getRes(0);
-	const uint64 bytesPerLeaf = getVoxCnt(0) * sizeof(float); // = (res^3) floats
-
-	DataPtr p;
-	mPool->CreateMemLinear(p, 0x0, 1, bytesPerLeaf, true);
-
-	const uint64 leafcnt = mPool->getPoolTotalCnt(0, 0); // Leaf count
-	Node* node;
-	float minValue = FLT_MAX;
-	float maxValue = FLT_MIN;
-	for (uint64 n = 0; n < leafcnt; n++) {
-		node = getNode(0, 0, n);
-		Vector3DI pos = node->mPos;
-		// Get a pointer to this node
-		leaf = tree->touchLeaf(openvdb::Coord(pos.x, pos.y, pos.z));
-		leaf->setValuesOff();
-		ValueType* leafBuffer = leaf->buffer().data();
 
-		// Get the brick from the GPU
-		mPool->AtlasRetrieveTexXYZ(0, node->mValue, p);
-
-		// Set the leaf voxels
-		memcpy(leafBuffer, p.cpu, bytesPerLeaf);
+	// Read back batches of atlas layers, build the leaves from them in parallel,
+	// then hand them to the tree. OpenVDB leaves are in x-major order.
+	PERF_PUSH("Reading bricks");
+	std::vector< std::vector<uint64> > layers;
+	const int batch = GetLeafLayers ( 0, Vector3DI(INT_MIN, INT_MIN, INT_MIN), Vector3DI(INT_MAX, INT_MAX, INT_MAX), layers );
+	std::vector<uchar> buf;
+	std::vector<uint64> nodes;
+	std::vector<LeafType*> built;
+
+	for (int l0 = 0; l0 < (int) layers.size(); l0 += batch) {
+		int l1 = std::min ( (int) layers.size(), l0 + batch );
+		nodes.clear ();
+		for (int l = l0; l < l1; l++) nodes.insert ( nodes.end(), layers[l].begin(), layers[l].end() );
+		if ( nodes.empty() ) continue;
+		ReadAtlasLayers ( 0, l0, l1, buf );
+
+		built.assign ( nodes.size(), 0x0 );
+		ParallelChunks ( nodes.size(), 0, [&]( int, uint64 s, uint64 e ) {
+			for (uint64 i = s; i < e; i++) {
+				BrickView b = getBrickView ( 0, nodes[i], buf, l0 );
+				LeafType* leaf = new LeafType ( openvdb::Coord(b.origin.x, b.origin.y, b.origin.z), ValueType(0), false );
+				ValueType* leafBuffer = leaf->buffer().data();
+				for (int z = 0; z < res; z++)
+					for (int y = 0; y < res; y++) {
+						const float* row = b.row<float> ( y, z );
+						for (int x = 0; x < res; x++)
+							leafBuffer[(x*res + y)*res + z] = row[x];
+					}
+				built[i] = leaf;
+			}
+		} );
+		for (size_t i = 0; i < built.size(); i++) tree->addLeaf ( built[i] );		// tree takes ownership
 	}
+	EndAtlasLayers ( buf );
+	PERF_POP();
 	verbosef("  Leaf count: %d\n", tree->leafCount());
 
 	// Now, create the grid from the tree and activate it
@@ -2392,6 +2597,7 @@ void VolumeGVDB::Configure ( int levs, int* r, int* numcnt, bool use_masks )
 		mLogDim[n] = (r[n]==0) ? 1 : r[n];
 		maxcnt[n] = (numcnt[n]==0) ? 1 : numcnt[n];
 	}
+	mTreeCfg = getTreeConfigID ( levs, mLogDim );
 
 	mClrDim[0] = Vector3DF(0,0,1);		// blue
 	mClrDim[1] = Vector3DF(0,1,0);		// green
@@ -2421,9 +2627,18 @@ void VolumeGVDB::Configure ( int levs, int* r, int* numcnt, bool use_masks )
 	}
 
 	// child lists	
+#ifdef USE_BITMASKS
+	// one pool per capacity class, up to the class of the widest level
+	int classes = 0;
+	for (int n=1; n < levs; n++ )
+		classes = std::max ( classes, getChildClass ( getVoxCnt(n) ) + 1 );
+	for (int c=0; c < classes; c++ )
+		mPool->PoolCreate ( 1, c, sizeof(noderef)*getChildClassCap(c), maxcnt[1], true );
+#else
 	mPool->PoolCreate ( 1, 0, 0, 0, true );								
 	for (int n=1; n < levs; n++ ) 	
-		mPool->PoolCreate ( 1, n, sizeof(uint64)*getVoxCnt(n), maxcnt[n], true );
+		mPool->PoolCreate ( 1, n, sizeof(noderef)*getVoxCnt(n), maxcnt[n], true );
+#endif
 
 	mVoxResMax.Set ( 0, 0, 0 );
 
@@ -2455,6 +2670,7 @@ void VolumeGVDB::AddChannel ( uchar chan, int dt, int apron, int filter, int bor
 // Fill data channel
 void VolumeGVDB::FillChannel ( uchar chan, Vector4DF val )
 {
+	UnshareBricks ();
 	PUSH_CTX
 
 	if (val.x == 0 && val.y==0 && val.z==0 && val.w==0) {
@@ -2489,11 +2705,19 @@ void VolumeGVDB::Clear ()
 	PUSH_CTX
 
 	// Empty VDB data (keep pools)
+	if ( mPool->getNumLevels() > 0 ) {
+		uint64 deactivated = 0;		// only bricks still active, as in the marker update
+		for (uint64 n = 0; n < mPool->getPoolTotalCnt(0, 0); n++)
+			if ( getNode(0, 0, n)->mFlags ) deactivated++;
+		mPool->Count ( CNT_BRICK_DEACTIVATE, deactivated );
+	}
 	mPool->PoolEmptyAll ();		// does not free pool mem
 	mRoot = ID_UNDEFL;
 
 	// Empty atlas & atlas map
 	mPool->AtlasEmptyAll ();	// does not free atlas
+	mBrickOwner.clear ();
+	mNumSharedBricks = 0;
 	
 	mPnt.Set ( 0, 0, 0 );
 
@@ -2518,8 +2742,9 @@ void VolumeGVDB::SetupNode ( slong nodeid, int lev, Vector3DF pos, bool marker)
 	node->mParent = ID_UNDEFL;
 	node->mValue = Vector3DI(-1,-1,-1);
 	node->mFlags = marker;
+	if ( lev == 0 && marker ) mPool->Count ( CNT_BRICK_ACTIVATE );
 #ifdef USE_BITMASKS
-	if ( lev > 0 ) node->clearMask ();
+	if ( lev > 0 ) clearMask ( node );
 #endif
 }
 
@@ -2587,6 +2812,286 @@ void VolumeGVDB::AssignMapping ( Vector3DI brickpos, Vector3DI pos, int leafid )
 	an->mLeafNode = leafid;
 }
 
+// Hash of brick bytes, continued across channels. Two independent 64-bit states
+// are kept; bricks are considered identical when both match.
+static inline void brickHash ( uint64& h1, uint64& h2, const uchar* p, uint64 n )
+{
+	for (uint64 i = 0; i < n; i++) {
+		h1 = (h1 ^ p[i]) * 0x100000001B3ULL;				// FNV-1a
+		h2 = (h2 + p[i] + 1) * 0x9E3779B97F4A7C15ULL;
+		h2 ^= h2 >> 29;
+	}
+}
+
+// Deduplicate identical bricks
+// Bricks are hashed a batch of atlas layers at a time, equal hashes are confirmed by comparing
+// the bytes, then each channel is rewritten with only the unique bricks, packed from slot 0.
+// Voxels are handled at their atlas size, so T_FLOAT3 compares all four stored floats.
+uint64 VolumeGVDB::DedupBricks ()
+{
+	if ( mPool->getNumAtlas() == 0 || mPool->getNumLevels() == 0 ) return 0;
+	PUSH_CTX
+	PERF_PUSH ( "Dedup bricks" );
+
+	const int nchan = mPool->getNumAtlas();
+	const int br = mPool->getAtlasBrickres(0);
+	const int apron = mPool->getAtlas(0).apron;
+	const Vector3DI ares = mPool->getAtlasRes(0);
+	const Vector3DI acnt = mPool->getAtlasCnt(0);
+	const uint64 slice = uint64(ares.x) * ares.y;
+	const uint64 leafcnt = mPool->getPoolTotalCnt(0, 0);
+
+	// Bucket leaves by atlas layer, as leaf indices. All channels share the atlas layout.
+	std::vector< std::vector<uint64> > layers;
+	GetLeafLayers ( 0, Vector3DI(INT_MIN, INT_MIN, INT_MIN), Vector3DI(INT_MAX, INT_MAX, INT_MAX), layers );
+	std::vector<char> active ( leafcnt, 0 );
+	for (size_t l = 0; l < layers.size(); l++)
+		for (uint64& n : layers[l]) {
+			n = ElemNdx ( n );
+			active[n] = 1;
+		}
+	std::vector<uchar> buf;
+
+	// Hash every brick, apron included, over all channels
+	std::vector<uint64> h1 ( leafcnt, 0xCBF29CE484222325ULL ), h2 ( leafcnt, 0 );
+	std::vector<uint64> nodes;
+	for (int c = 0; c < nchan; c++) {
+		const int esize = mPool->getAtlasVoxelBytes ( c );		// as read by ReadAtlasLayers
+		const int batch = AtlasLayerBatch ( c );
+		for (int l0 = 0; l0 < acnt.z; l0 += batch) {
+			int l1 = std::min ( acnt.z, l0 + batch );
+			nodes.clear ();
+			for (int l = l0; l < l1; l++) nodes.insert ( nodes.end(), layers[l].begin(), layers[l].end() );
+			if ( nodes.empty() ) continue;
+			ReadAtlasLayers ( c, l0, l1, buf );
+			ParallelChunks ( nodes.size(), 0, [&]( int, uint64 s, uint64 e ) {
+				for (uint64 i = s; i < e; i++) {
+					uint64 n = nodes[i];
+					Vector3DI a = getNode ( 0, 0, n )->mValue;
+					a -= Vector3DI ( apron, apron, apron );
+					a.z -= l0 * br;
+					for (int z = 0; z < br; z++)
+						for (int y = 0; y < br; y++)
+							brickHash ( h1[n], h2[n], &buf[ ((uint64(a.z+z)*ares.y + (a.y+y)) * ares.x + a.x) * esize ], uint64(br) * esize );
+				}
+			} );
+		}
+	}
+
+	// Group bricks with equal hashes. Leaves are visited in layer order, so the owner of a group
+	// (the leaf that keeps its brick) never lies in a later layer than the leaves sharing it.
+	std::unordered_map< uint64, std::vector<uint64> > groups;
+	std::vector<uint64> owner ( leafcnt, ID_UNDEF64 );
+	std::vector<int> lastShare ( leafcnt, -1 );					// last layer sharing a leaf's brick
+	for (int l = 0; l < acnt.z; l++) {
+		for (uint64 n : layers[l]) {
+			std::vector<uint64>& g = groups[ h1[n] ];
+			uint64 o = ID_UNDEF64;
+			for (size_t j = 0; j < g.size() && o == ID_UNDEF64; j++)
+				if ( h2[ g[j] ] == h2[n] ) o = g[j];
+			if ( o == ID_UNDEF64 ) {
+				g.push_back ( n );
+			} else {
+				owner[n] = o;
+				lastShare[o] = l;
+			}
+		}
+	}
+	groups.clear ();
+
+	// Confirm each share by comparing brick bytes in every channel. Owners whose brick is still
+	// needed by a later batch are copied aside, up to the staging budget; a leaf whose owner's
+	// brick is not available, or differs, keeps its own brick.
+	const uint64 brickvox = uint64(br) * br * br;
+	auto copyBrick = [&]( uint64 n, int l0, int esize, uchar* dst ) {
+		Vector3DI a = getNode ( 0, 0, n )->mValue;
+		a -= Vector3DI ( apron, apron, apron );
+		a.z -= l0 * br;
+		for (int z = 0; z < br; z++)
+			for (int y = 0; y < br; y++, dst += size_t(br) * esize)
+				memcpy ( dst, &buf[ ((uint64(a.z+z)*ares.y + (a.y+y)) * ares.x + a.x) * esize ], size_t(br) * esize );
+	};
+	for (int c = 0; c < nchan; c++) {
+		const int esize = mPool->getAtlasVoxelBytes ( c );
+		const uint64 bytes = brickvox * esize;
+		const int batch = AtlasLayerBatch ( c );
+		std::unordered_map< uint64, std::vector<uchar> > saved;
+		uint64 savedBytes = 0;
+		for (int l0 = 0; l0 < acnt.z; l0 += batch) {
+			int l1 = std::min ( acnt.z, l0 + batch );
+			nodes.clear ();
+			for (int l = l0; l < l1; l++)
+				for (uint64 n : layers[l])
+					if ( owner[n] != ID_UNDEF64 || lastShare[n] >= l1 ) nodes.push_back ( n );
+			if ( nodes.empty() ) continue;
+			ReadAtlasLayers ( c, l0, l1, buf );
+			ParallelChunks ( nodes.size(), 0, [&]( int, uint64 s, uint64 e ) {
+				std::vector<uchar> mine ( bytes ), theirs ( bytes );
+				for (uint64 i = s; i < e; i++) {
+					uint64 n = nodes[i], o = owner[n];
+					if ( o == ID_UNDEF64 ) continue;
+					const uchar* ref;
+					int lo = (getNode ( 0, 0, o )->mValue.z - apron) / br;
+					if ( lo >= l0 ) {
+						copyBrick ( o, l0, esize, &theirs[0] );
+						ref = &theirs[0];
+					} else {
+						auto it = saved.find ( o );
+						if ( it == saved.end() ) { owner[n] = ID_UNDEF64; continue; }
+						ref = &it->second[0];
+					}
+					copyBrick ( n, l0, esize, &mine[0] );
+					if ( memcmp ( &mine[0], ref, bytes ) != 0 ) owner[n] = ID_UNDEF64;
+				}
+			} );
+			for (auto it = saved.begin(); it != saved.end(); ) {			// no longer needed
+				if ( lastShare[it->first] < l1 ) { savedBytes -= bytes; it = saved.erase ( it ); }
+				else it++;
+			}
+			for (uint64 n : nodes) {
+				if ( lastShare[n] < l1 || savedBytes + bytes > (uint64(64) << 20) ) continue;
+				std::vector<uchar>& v = saved[n];
+				v.resize ( bytes );
+				copyBrick ( n, l0, esize, &v[0] );
+				savedBytes += bytes;
+			}
+		}
+	}
+
+	// Bricks that are kept, in atlas slot order
+	std::vector<uint64> unique;
+	auto slotOf = [&]( uint64 n ) {
+		Vector3DI a = getNode ( 0, 0, n )->mValue;
+		a -= Vector3DI ( apron, apron, apron );
+		return (uint64(a.z / br) * acnt.y + a.y / br) * acnt.x + a.x / br;
+	};
+	for (int l = 0; l < acnt.z; l++)
+		for (uint64 n : layers[l])
+			if ( owner[n] == ID_UNDEF64 ) unique.push_back ( n );
+	std::sort ( unique.begin(), unique.end(), [&]( uint64 x, uint64 y ) { return slotOf(x) < slotOf(y); } );
+	const uint64 activecnt = std::count ( active.begin(), active.end(), 1 );
+	const uint64 shared = activecnt - unique.size();
+	if ( shared == 0 ) {
+		PERF_POP ();
+		POP_CTX
+		return 0;
+	}
+
+	// Compact each channel to the unique bricks, in place: the u-th kept brick moves to slot u,
+	// and since they are in slot order its source slot is never below u. Each batch of
+	// destination layers gathers its sources a batch of layers at a time, before it is written.
+	const uint64 a2 = uint64(acnt.x) * acnt.y;
+	const int nz = int( (unique.size() + a2 - 1) / a2 );
+	std::vector<uchar> packed;
+	for (int c = 0; c < nchan; c++) {
+		const int esize = mPool->getAtlasVoxelBytes ( c );
+		const uint64 plane = slice * esize;
+		const int batch = std::max ( 1, AtlasLayerBatch ( c ) / 2 );	// source and destination share the budget
+		for (int m0 = 0; m0 < nz; m0 += batch) {
+			int m1 = std::min ( nz, m0 + batch );
+			packed.assign ( plane * br * (m1-m0), 0 );
+			mPool->MemTrack ( MemTag(MEM_STAGING, 0), false, packed.size() );
+			uint64 u0 = uint64(m0) * a2, u1 = std::min<uint64> ( uint64(m1) * a2, unique.size() );
+			for (uint64 s0 = u0; s0 < u1; ) {
+				int l0 = int( slotOf ( unique[s0] ) / a2 ), l1 = std::min ( acnt.z, l0 + batch );
+				uint64 s1 = s0;
+				while ( s1 < u1 && slotOf ( unique[s1] ) < uint64(l1) * a2 ) s1++;
+				ReadAtlasLayers ( c, l0, l1, buf );
+				ParallelChunks ( s1 - s0, 0, [&]( int, uint64 s, uint64 e ) {
+					for (uint64 u = s0 + s; u < s0 + e; u++) {
+						Vector3DI a = getNode ( 0, 0, unique[u] )->mValue;
+						Vector3DI d = mPool->getAtlasPos ( c, u );
+						a -= Vector3DI ( apron, apron, apron );
+						d -= Vector3DI ( apron, apron, apron );
+						a.z -= l0 * br;
+						d.z -= m0 * br;
+						for (int z = 0; z < br; z++)
+							for (int y = 0; y < br; y++)
+								memcpy ( &packed[ ((uint64(d.z+z)*ares.y + (d.y+y)) * ares.x + d.x) * esize ],
+										 &buf[ ((uint64(a.z+z)*ares.y + (a.y+y)) * ares.x + a.x) * esize ], size_t(br) * esize );
+					}
+				} );
+				s0 = s1;
+			}
+			mPool->AtlasWriteSlices ( c, m0*br, (m1-m0)*br, &packed[0] );
+			mPool->MemTrack ( MemTag(MEM_STAGING, 0), false, -sint64(packed.size()) );
+		}
+		mPool->AtlasResize ( c, unique.size() );					// keeps the first nz layers
+		mPool->AtlasSetNum ( c, static_cast<int>(unique.size()) );
+	}
+	EndAtlasLayers ( buf );
+	SetupAtlasAccess ();
+
+	// Point leaves at their new slots, sharing leaves at their owner's
+	for (uint64 u = 0; u < unique.size(); u++)
+		getNode ( 0, 0, unique[u] )->mValue = mPool->getAtlasPos ( 0, u );
+	for (uint64 n = 0; n < leafcnt; n++)
+		if ( owner[n] != ID_UNDEF64 ) getNode ( 0, 0, n )->mValue = getNode ( 0, 0, owner[n] )->mValue;
+
+	// Atlas map holds the owners only
+	mPool->AllocateAtlasMap ( sizeof(AtlasNode), mPool->getAtlas(0).subdim );
+	ClearMapping ();
+	for (uint64 u = 0; u < unique.size(); u++) {
+		Node* node = getNode ( 0, 0, unique[u] );
+		AssignMapping ( node->mValue, node->mPos, static_cast<int>(unique[u]) );
+	}
+	mPool->PoolCommitAtlasMap ();
+	mPool->PoolCommit ( 0, 0 );
+	mVDBInfo.update = true;
+
+	mBrickOwner.swap ( owner );
+	mNumSharedBricks = shared;
+	verbosef ( "  Dedup: %llu of %llu bricks unique, atlas layers %d -> %d\n", (unsigned long long) unique.size(),
+		(unsigned long long) activecnt, acnt.z, nz );
+
+	PERF_POP ();
+	POP_CTX
+	return shared;
+}
+
+// Copy-on-write for shared bricks: give every sharing leaf its own slot and a copy of the brick
+void VolumeGVDB::UnshareBricks ()
+{
+	if ( mNumSharedBricks == 0 ) return;
+	PUSH_CTX
+	PERF_PUSH ( "Unshare bricks" );
+
+	uint64 need = mPool->getAtlas(0).lastEle + mNumSharedBricks;
+	for (int c = 0; c < mPool->getNumAtlas(); c++)
+		mPool->AtlasResize ( c, need );						// grows, preserving bricks
+	SetupAtlasAccess ();
+
+	Vector3DI pos;
+	for (uint64 n = 0; n < mBrickOwner.size(); n++) {
+		if ( mBrickOwner[n] == ID_UNDEF64 ) continue;
+		Node* node = getNode ( 0, 0, n );
+		mPool->AtlasAlloc ( 0, pos );
+		for (int c = 0; c < mPool->getNumAtlas(); c++)
+			mPool->AtlasCopyBrick ( c, node->mValue, pos );
+		node->mValue = pos;
+	}
+	for (int c = 1; c < mPool->getNumAtlas(); c++)
+		mPool->AtlasSetNum ( c, static_cast<int>(mPool->getAtlas(0).lastEle) );
+
+	// Rebuild the atlas map for all leaves
+	mPool->AllocateAtlasMap ( sizeof(AtlasNode), mPool->getAtlas(0).subdim );
+	ClearMapping ();
+	for (uint64 n = 0; n < mPool->getPoolTotalCnt(0, 0); n++) {
+		Node* node = getNode ( 0, 0, n );
+		if ( !node->mFlags ) continue;
+		AssignMapping ( node->mValue, node->mPos, static_cast<int>(n) );
+	}
+	mPool->PoolCommitAtlasMap ();
+	mPool->PoolCommit ( 0, 0 );
+	mVDBInfo.update = true;
+
+	mBrickOwner.clear ();
+	mNumSharedBricks = 0;
+
+	PERF_POP ();
+	POP_CTX
+}
+
 // Mandelbulb! (3D fractal)
 float Mandelbulb ( Vector3DF s )
 {
@@ -2618,6 +3123,7 @@ float Mandelbulb ( Vector3DF s )
 
 void VolumeGVDB::CopyChannel(int chanDst, int chanSrc)
 {
+	UnshareBricks ();
 	PUSH_CTX
 	mPool->CopyChannel(chanDst, chanSrc);
 	POP_CTX
@@ -2639,6 +3145,8 @@ void VolumeGVDB::UpdateAtlas ()
 	uint64 usedLeafcnt = mPool->getPoolUsedCnt(0,0);
 	
 	mPool->AtlasEmptyAll ();
+	mBrickOwner.clear ();			// every leaf gets its own brick
+	mNumSharedBricks = 0;
 
 	// Resize atlas
 	uint64 amax = mPool->getAtlas(0).max;
@@ -2759,9 +3267,84 @@ slong VolumeGVDB::Reparent(int lev, slong prevroot_id, Vector3DI pos, bool& bNew
 	// update root
 	mRoot = newroot_id;
 
-	return getNode(leaf_id)->mParent;			// return parent of the new pos
+	return getParentId ( getNode(leaf_id) );			// return parent of the new pos
 }
 
+// Host descents specialized for a compile-time tree shape (see gvdb_tree_config.h). They match the
+// runtime functions below, but all resolutions and ranges are constants. A walk may start at any
+// node: levels above the node's level just forward it down.
+template<class Cfg, int L> struct TreeWalk {
+	typedef typename Cfg::template Level<L> Lev;
+
+	static bool PosInNode ( Node* curr, const Vector3DI& pos, uint32& bit )
+	{
+		if ( curr->mLev < L ) return TreeWalk<Cfg, L-1>::PosInNode ( curr, pos, bit );
+		Vector3DI p = pos; p -= curr->mPos;
+		bit = Lev::Inside ( p ) ? Lev::ChildBit ( p ) : 0;
+		return Lev::Inside ( p );
+	}
+
+	static uint64 NodeAtPoint ( VolumeGVDB* g, uint64 nodeid, const Vector3DF& pos )
+	{
+		Node* curr = g->getNode ( nodeid );
+		if ( curr->mLev < L ) return TreeWalk<Cfg, L-1>::NodeAtPoint ( g, nodeid, pos );
+		Vector3DF p = pos; p -= curr->mPos;
+		if ( !(p.x >= 0 && p.y >= 0 && p.z >= 0 && p.x < Lev::Range && p.y < Lev::Range && p.z < Lev::Range) ) return ID_UNDEFL;
+		if ( L == 0 ) return nodeid;
+		uint64 childid = g->getChildRefAtBit ( curr, Lev::ChildBit ( Vector3DI(p) ) );
+		return ( childid == ID_UNDEF64 ) ? ID_UNDEFL : TreeWalk<Cfg, L-1>::NodeAtPoint ( g, childid, pos );
+	}
+
+	static bool IsActive ( VolumeGVDB* g, uint64 nodeid, const Vector3DI& pos )
+	{
+		Node* curr = g->getNode ( nodeid );
+		if ( curr->mLev < L ) return TreeWalk<Cfg, L-1>::IsActive ( g, nodeid, pos );
+		Vector3DI p = pos; p -= curr->mPos;
+		if ( !Lev::Inside ( p ) ) return false;
+		if ( L == 0 ) return true;
+		uint64 childid = g->getChildRefAtBit ( curr, Lev::ChildBit ( p ) );
+		return childid != ID_UNDEF64 && TreeWalk<Cfg, L-1>::IsActive ( g, childid, pos );
+	}
+
+	static float Value ( VolumeGVDB* g, uint64 nodeid, const Vector3DF& pos, float* atlas, const Vector3DI& atlasres )
+	{
+		Node* curr = g->getNode ( nodeid );
+		if ( curr->mLev < L ) return TreeWalk<Cfg, L-1>::Value ( g, nodeid, pos, atlas, atlasres );
+		Vector3DF p = pos; p -= curr->mPos;
+		if ( !(p.x >= 0 && p.y >= 0 && p.z >= 0 && p.x < Lev::Range && p.y < Lev::Range && p.z < Lev::Range) ) return 0.0;
+		if ( L == 0 ) {
+			Vector3DI v = Vector3DI(p) + curr->mValue;		// voxel in atlas
+			return atlas [ (v.z*atlasres.y + v.y)*atlasres.x + v.x ];
+		}
+		uint32 b = Lev::ChildBit ( Vector3DI(p) );
+		uint64 childid = g->getChildRefAtBit ( curr, b );
+		if ( childid != ID_UNDEF64 ) return TreeWalk<Cfg, L-1>::Value ( g, childid, pos, atlas, atlasres );
+		float tile;
+		if ( g->getTile ( curr, b, tile ) ) return tile;
+		return 0.0;
+	}
+};
+
+// Below the leaves; only referenced by the leaf level, never called
+template<class Cfg> struct TreeWalk<Cfg, -1> {
+	static bool PosInNode ( Node*, const Vector3DI&, uint32& )										{ return false; }
+	static uint64 NodeAtPoint ( VolumeGVDB*, uint64, const Vector3DF& )								{ return ID_UNDEFL; }
+	static bool IsActive ( VolumeGVDB*, uint64, const Vector3DI& )									{ return false; }
+	static float Value ( VolumeGVDB*, uint64, const Vector3DF&, float*, const Vector3DI& )			{ return 0.0; }
+};
+
+// Runs the statement(s) with Cfg set to the compile-time shape of this tree, if it has one and a
+// walk can start at level `lev`. Otherwise falls through to the runtime path that follows.
+#define TREE_DISPATCH(lev, ...)		\
+	switch ( mTreeCfg ) {			\
+	case TREE_CFG_33333:	{ typedef TreeConfig<3,3,3,3,3> Cfg;	if ( (lev) < Cfg::Levels ) { __VA_ARGS__; } }	break;	\
+	case TREE_CFG_33334:	{ typedef TreeConfig<3,3,3,3,4> Cfg;	if ( (lev) < Cfg::Levels ) { __VA_ARGS__; } }	break;	\
+	case TREE_CFG_33335:	{ typedef TreeConfig<3,3,3,3,5> Cfg;	if ( (lev) < Cfg::Levels ) { __VA_ARGS__; } }	break;	\
+	case TREE_CFG_55543:	{ typedef TreeConfig<5,5,5,4,3> Cfg;	if ( (lev) < Cfg::Levels ) { __VA_ARGS__; } }	break;	\
+	case TREE_CFG_54333:	{ typedef TreeConfig<5,4,3,3,3> Cfg;	if ( (lev) < Cfg::Levels ) { __VA_ARGS__; } }	break;	\
+	default: break;					\
+	}
+
 // Activate region of space at 3D position
 slong VolumeGVDB::ActivateSpace ( Vector3DF pos )
 {
@@ -2786,13 +3369,8 @@ slong VolumeGVDB::ActivateSpaceAtLevel ( int lev, Vector3DI pos )
 
 bool VolumeGVDB::isOn (slong nodeid, uint32 b )
 {
-	#ifdef USE_BITMASKS
-		Node* node = getNode(noideid);
-		return node->isOn( b );
-	#else
-		uint64 cid = getChildNode ( nodeid, b );
-		return (cid != ID_UNDEF64 );
-	#endif
+	uint64 cid = getChildNode ( nodeid, b );
+	return (cid != ID_UNDEF64 );
 }
 
 // Activate space
@@ -2844,7 +3422,7 @@ slong VolumeGVDB::ActivateSpace ( slong nodeid, Vector3DI pos, bool& bNew, slong
 		return ActivateSpace ( childid, pos, bNew, stopnode, stoplev );
 	} else {
 		// point is outside this node		
-		uint64 parent = curr->mParent;
+		uint64 parent = getParentId ( curr );
 		if ( parent == ID_UNDEFL ) {
 			parent = Reparent ( curr->mLev, nodeid, pos, bNew );	// make make new lev0 nodes
 			if ( parent == ID_UNDEFL ) return ID_UNDEFL;
@@ -2858,6 +3436,8 @@ slong VolumeGVDB::ActivateSpace ( slong nodeid, Vector3DI pos, bool& bNew, slong
 bool VolumeGVDB::getPosInNode ( slong curr_id, Vector3DI pos, uint32& bit )
 {
 	Node* curr = getNode ( curr_id );
+	TREE_DISPATCH ( curr->mLev, return TreeWalk<Cfg, Cfg::Levels-1>::PosInNode ( curr, pos, bit ) );
+
 	Vector3DI res = getRes3DI ( curr->mLev );
 	Vector3DI p = pos; p -= curr->mPos; 
 	Vector3DI range = getRange ( curr->mLev );
@@ -2895,16 +3475,17 @@ void VolumeGVDB::DebugNode ( slong nodeid )
 	
 	if ( curr->mLev < 4 && curr->mParent != ID_UNDEFL ) {
 		Vector3DF range = getRange ( curr->mLev+1 );
-		Vector3DI p = curr->mPos; p -= getNode(curr->mParent)->mPos; p *= getRes3DI ( curr->mLev+1 ); p /= range;
+		Vector3DI p = curr->mPos; p -= getNode(getParentId(curr))->mPos; p *= getRes3DI ( curr->mLev+1 ); p /= range;
 		b = getBitPos ( curr->mLev+1, p );
 	}
 #ifdef USE_BITMASKS
 	if ( curr->mLev > 0 ) {		
-		gprintf ( "%*s L%d #%d, Bit: %d, Pos: %d %d %d, Mask: %s\n", (5-curr->mLev)*2, "", (int) curr->mLev, ndx, b, curr->mPos.x, curr->mPos.y, curr->mPos.z, binaryStr( *curr->getMask() ) );
-		for (int n=0; n < curr->getNumChild(); n++ ) {
-			slong childid = getChildNode ( nodeid, n );
-			DebugNode ( childid );
-		}
+		gprintf ( "%*s L%d #%d, Bit: %d, Pos: %d %d %d, Mask: %s\n", (5-curr->mLev)*2, "", (int) curr->mLev, ndx, b, curr->mPos.x, curr->mPos.y, curr->mPos.z, binaryStr( *getMask(curr) ) );
+		std::vector<uint32> bits;
+		std::vector<uint64> refs;
+		GatherChildList ( curr, bits, refs );
+		for (size_t n=0; n < refs.size(); n++ )
+			DebugNode ( refs[n] );
 	} else {
 		gprintf ( "%*s L%d #%d, Bit: %d, Pos: %d %d %d, Atlas: %d %d %d\n", (5-curr->mLev)*2, "", (int) curr->mLev, ndx, b, curr->mPos.x, curr->mPos.y, curr->mPos.z, curr->mValue.x, curr->mValue.y, curr->mValue.z);
 	}
@@ -2953,23 +3534,12 @@ slong VolumeGVDB::FindParent(int lev,  Vector3DI pos)
 		int posInNodeY = static_cast<int>(floor(posInNode.y)); // IMPORTANT!!! truncate decimal 
 		int posInNodeZ = static_cast<int>(floor(posInNode.z)); // IMPORTANT!!! truncate decimal 
 		bitMaskPos = (posInNodeZ*res.x + posInNodeY)*res.x+ posInNodeX;
-#ifdef USE_BITMASKS
-		uint64 p = nd->countOn ( bitMaskPos );
-
 		l--;
 
-		uint64* clist = mPool->PoolData64(nd->mChildList);
-		if (l == lev) return clist[p];
+		uint64 childid = getChildRefAtBit ( nd, bitMaskPos );
+		if (l == lev || childid == ID_UNDEF64) return childid;
 
-		nd = getNode(clist[p]);
-#else
-		l--;
-
-		uint64* clist = mPool->PoolData64(nd->mChildList);
-		if (l == lev) return clist[bitMaskPos];
-
-		nd = getNode(clist[bitMaskPos]);
-#endif
+		nd = getNode(childid);
 	}
 
 	return ID_UNDEFL;
@@ -2981,46 +3551,41 @@ slong VolumeGVDB::InsertChild ( slong nodeid, slong childid, uint32 i )
 {
 	Node* curr = getNode ( nodeid );
 	Node* child = getNode ( childid );
-	child->mParent = nodeid;	// set parent of child
+	child->mParent = ElemRef ( nodeid );	// set parent of child
 
 #ifdef USE_BITMASKS
-	// determine child bit position	
-	assert ( ! curr->isOn ( i ) );			// check if child already exists
-	uint64 p = curr->countOn ( i );
-	uint64 cnum = curr->getNumChild();		// existing children count
-	curr->setOn ( i );
-
-	// add child list if doesn't exist
-	if ( curr->mChildList == ID_UNDEFL ) {
-		curr->mChildList = mPool->PoolAlloc ( 1, curr->mLev, true );		
-	}
-	uint64 max_child = mPool->getPoolWidth( 1, curr->mLev ) / sizeof(uint64);
-	if ( cnum + 1 > max_child ) {
-		gprintf ( "ERROR: Number of children exceed max of %d (lev %d)\n", max_child, curr->mLev );
-		gerror ();
-	}
-	
-	// insert into child list
-	uint64* clist = mPool->PoolData64 ( curr->mChildList );
-	if ( p < cnum ) {
-		//for (uint64* j = clist + cnum; j > clist + p; j-- ) 
-		//	*j = *(j-1);
-		memmove ( clist + p+1, clist + p, (cnum-p)*sizeof(uint64) );
-		*(clist + p) = childid;
-	} else {
-		*(clist + cnum) = childid;		
+	noderef* slot = getChildSlot ( curr, i );
+	if ( slot == 0x0 ) {
+		// move to the next capacity class if the list is full
+		uint64 cnum = ( curr->mChildList == ID_UNDEFL ) ? 0 : countOn ( curr );
+		if ( curr->mChildList == ID_UNDEFL || getChildClassCap ( ElemLev(getChildListId(curr)) ) < cnum + 1 ) {
+			std::vector<uint32> bits;
+			std::vector<uint64> refs;
+			GatherChildList ( curr, bits, refs );
+			WriteChildList ( curr, bits, refs, getChildClass ( cnum + 1 ) );
+		}
+		// insert in bit order
+		noderef* clist = getChildList ( curr );
+		if ( isDenseChildList ( curr ) ) {
+			slot = clist + i;
+		} else {
+			uint64 p = countOn ( curr, i );
+			if ( p < cnum ) memmove ( clist + p+1, clist + p, (cnum-p)*sizeof(noderef) );
+			slot = clist + p;
+		}
 	}
-	int cnt = curr->countOn();			// count children again
+	setOn ( curr, i );
+	*slot = ElemRef ( childid );
 #else
 	if ( curr->mChildList == ID_UNDEFL ) {
-		curr->mChildList = mPool->PoolAlloc ( 1, curr->mLev, true );	
-		uint64* clist = mPool->PoolData64 ( curr->mChildList );			
-		memset(clist, 0xFF, sizeof(uint64) * getVoxCnt(curr->mLev));
+		setChildListId ( curr, mPool->PoolAlloc ( 1, curr->mLev, true ) );
+		noderef* clist = getChildList ( curr );
+		memset(clist, 0xFF, sizeof(noderef) * getVoxCnt(curr->mLev));
 	}
 
 	// insert into child list
-	uint64* clist = mPool->PoolData64 ( curr->mChildList );
-	clist[i] = childid;		
+	noderef* clist = getChildList ( curr );
+	clist[i] = ElemRef ( childid );
 	
 #endif
 	return childid;
@@ -3030,65 +3595,337 @@ slong VolumeGVDB::InsertChild ( slong nodeid, slong childid, uint32 i )
 Node* VolumeGVDB::getChild(Node* curr, uint ndx)
 {
 	if (curr->mChildList == ID_UNDEFL) return 0x0;
-	uint64* clist = mPool->PoolData64(curr->mChildList);
-	uint64* cnext = (uint64*) mPool->PoolData ( ElemGrp(curr->mChildList), ElemLev(curr->mChildList), ElemNdx(curr->mChildList)+1 );
+	noderef* clist = getChildList ( curr );
 	uint64 ch;
-	#ifdef USE_BITMASKS
-		ch = *(clist + ndx);
-	#else
+	if ( !isDenseChildList ( curr ) ) {
+		if ( ndx >= countOn ( curr ) ) return 0x0;
+		ch = RefElem ( *(clist + ndx), 0, curr->mLev-1 );
+	} else {
 		int vox = 0;
 		uint sum = 0;
 		ndx++;
 		for (; sum < ndx && vox < getVoxCnt(curr->mLev); vox++ ) {
-			if ( *(clist + vox) != ID_UNDEF64) sum++;
+			if ( *(clist + vox) != ID_UNDEFREF && !isElemTile(RefElem(*(clist + vox), 0, curr->mLev-1)) ) sum++;
 		}		
-		if (vox >= getVoxCnt(curr->mLev)) return 0x0;		
-		ch = *(clist + (vox-1) );		
-	#endif
+		if (sum < ndx) return 0x0;		
+		ch = RefElem ( *(clist + (vox-1)), 0, curr->mLev-1 );
+	}
 	return getNode(ch);
 }
 
 // Get child node at bit position
 Node* VolumeGVDB::getChildAtBit (Node* curr, uint b)
 {
-	if (curr->mChildList == ID_UNDEFL) return 0x0;
-	uint64* clist = mPool->PoolData64(curr->mChildList);
+	uint64 ch = getChildRefAtBit ( curr, b );
+	return ( ch == ID_UNDEF64 ) ? 0x0 : getNode(ch);
+}
+
+uint64 VolumeGVDB::getChildRefAtBit(Node* curr, uint b)
+{
+	noderef* slot = getChildSlot ( curr, b );
+	if (slot == 0x0) return ID_UNDEF64;
+	uint64 ch = RefElem ( *slot, 0, curr->mLev-1 );
+	return isElemTile(ch) ? ID_UNDEF64 : ch;
+}
+
+// Get child node at bit position
+uint64 VolumeGVDB::getChildNode ( slong nodeid, uint b )
+{
+	return getChildRefAtBit ( getNode ( nodeid ), b );
+}
+
+// Capacity class for a child list of `cnt` entries
+int VolumeGVDB::getChildClass ( uint64 cnt )
+{
+	int c = 0;
+	while ( getChildClassCap(c) < cnt ) c++;
+	return c;
+}
+
+// Pool reference of a node's child list, or ID_UNDEFL
+uint64 VolumeGVDB::getChildListId ( Node* node )
+{
+#ifdef USE_COMPACT_NODES
+	return ( node->mChildList == ID_UNDEFREF ) ? ID_UNDEFL : Elem ( 1, node->mListCls, node->mChildList );
+#else
+	return node->mChildList;
+#endif
+}
+
+void VolumeGVDB::setChildListId ( Node* node, uint64 id )
+{
+#ifdef USE_COMPACT_NODES
+	node->mChildList = ElemRef ( id );
+	node->mListCls = ( node->mChildList == ID_UNDEFREF ) ? 0 : ElemLev ( id );
+#else
+	node->mChildList = id;
+#endif
+}
+
+bool VolumeGVDB::isDenseChildList ( Node* node )
+{
 #ifdef USE_BITMASKS
-	uint32 ndx = curr->countOn(b);
-	uint64 ch = *(clist + ndx);	
-#else		
-	uint64 ch = *(clist + b);
+	return ElemLev ( getChildListId(node) ) == getChildClass ( getVoxCnt(node->mLev) );
+#else
+	(void) node;
+	return true;
 #endif
-	if (ch == ID_UNDEF64) return 0x0;
-	return getNode(ch);
 }
 
-uint64 VolumeGVDB::getChildRefAtBit(Node* curr, uint b)
+uint64 VolumeGVDB::getChildListLen ( Node* node )
+{
+	if ( node->mLev == 0 || node->mChildList == ID_UNDEFL ) return 0;
+	return isDenseChildList ( node ) ? getVoxCnt ( node->mLev ) : countOn ( node );
+}
+
+noderef* VolumeGVDB::getChildSlot ( Node* node, uint32 b )
+{
+	if ( node->mLev == 0 || node->mChildList == ID_UNDEFL ) return 0x0;
+	noderef* clist = getChildList ( node );
+	if ( isDenseChildList ( node ) ) return clist + b;
+	return isOn ( node, b ) ? clist + countOn ( node, b ) : 0x0;
+}
+
+void VolumeGVDB::CreateChildList ( Node* node )
 {
-	if (curr->mChildList == ID_UNDEFL) return ID_UNDEF64;
-	uint64* clist = mPool->PoolData64(curr->mChildList);
 #ifdef USE_BITMASKS
-	uint32 ndx = curr->countOn(b);
-	return *(clist + ndx);
+	int c = getChildClass ( getVoxCnt(node->mLev) );
+	clearMask ( node );
 #else
-	return *(clist + b);
+	int c = node->mLev;
 #endif
+	setChildListId ( node, mPool->PoolAlloc ( 1, c, true ) );
+	memset ( getChildList ( node ), 0xFF, sizeof(noderef) * getVoxCnt(node->mLev) );
+}
+
+// Children of a node in bit order, from either layout. Dense lists are read by entry, so their
+// bitmask may be stale (lists linked on the GPU, or read from a non-bitmask file).
+void VolumeGVDB::GatherChildList ( Node* node, std::vector<uint32>& bits, std::vector<uint64>& refs, uint64* tiles )
+{
+	bits.clear ();
+	refs.clear ();
+	if ( node->mLev == 0 || node->mChildList == ID_UNDEFL ) return;
+	noderef* clist = getChildList ( node );
+	if ( isDenseChildList ( node ) ) {
+		uint64 vox = getVoxCnt ( node->mLev );
+		for (uint64 b = 0; b < vox; b++) {
+			if ( clist[b] == ID_UNDEFREF ) continue;
+			uint64 ch = RefElem ( clist[b], 0, node->mLev-1 );
+			if ( isElemTile(ch) ) { if ( tiles ) (*tiles)++; continue; }
+			bits.push_back ( uint32(b) );
+			refs.push_back ( ch );
+		}
+	} else {
+		uint64* mask = getMask ( node );
+		uint64 words = getMaskWords ( node );
+		for (uint64 w = 0; w < words; w++) {
+			for (uint64 v = mask[w]; v != 0; v &= v - 1) {
+				bits.push_back ( uint32( w*64 + firstBitOn(v) ) );
+				refs.push_back ( RefElem ( clist[ refs.size() ], 0, node->mLev-1 ) );
+			}
+		}
+	}
 }
 
-// Get child node at bit position
-uint64 VolumeGVDB::getChildNode ( slong nodeid, uint b )
+// Replace a node's child list with the given children (in bit order) in capacity class `cls`,
+// or the smallest class that fits if cls < 0, and rebuild its bitmask. Without USE_BITMASKS the
+// list is always dense.
+void VolumeGVDB::WriteChildList ( Node* node, const std::vector<uint32>& bits, const std::vector<uint64>& refs, int cls )
 {
-	Node* curr = getNode ( nodeid );
-	if (curr->mChildList == ID_UNDEFL) return ID_UNDEF64;	
-	uint64* clist = mPool->PoolData64 ( curr->mChildList );
+	uint64 old = getChildListId ( node );
+#ifdef USE_BITMASKS
+	int full = getChildClass ( getVoxCnt(node->mLev) );
+	bool fit = ( cls < 0 );
+	if ( fit ) cls = getChildClass ( refs.size() );
+	if ( cls > full ) cls = full;
+	clearMask ( node );
+	for (size_t k = 0; k < bits.size(); k++) setOn ( node, bits[k] );
+	if ( refs.empty() && fit ) {
+		setChildListId ( node, ID_UNDEFL );			// no children, no list
+		if ( old != ID_UNDEFL ) mPool->PoolFree ( old );
+		return;
+	}
+	if ( old == ID_UNDEFL || ElemLev(old) != cls )
+		setChildListId ( node, mPool->PoolAlloc ( 1, cls, true ) );
+	noderef* clist = getChildList ( node );
+	memset ( clist, 0xFF, sizeof(noderef) * getChildClassCap(cls) );
+	if ( cls == full ) {
+		for (size_t k = 0; k < bits.size(); k++) clist[ bits[k] ] = ElemRef ( refs[k] );
+	} else {
+		for (size_t k = 0; k < refs.size(); k++) clist[k] = ElemRef ( refs[k] );
+	}
+	if ( old != ID_UNDEFL && old != getChildListId(node) ) mPool->PoolFree ( old );
+#else
+	(void) cls;
+	if ( old == ID_UNDEFL ) CreateChildList ( node );
+	noderef* clist = getChildList ( node );
+	memset ( clist, 0xFF, sizeof(noderef) * getVoxCnt(node->mLev) );
+	for (size_t k = 0; k < bits.size(); k++) clist[ bits[k] ] = ElemRef ( refs[k] );
+#endif
+}
 
+// Give every internal node a dense child list, so the GPU link and delink kernels can
+// address children by bit position. Undone by ConvertNonBitmaskToBitmask.
+void VolumeGVDB::ExpandChildLists ( int levs )
+{
 #ifdef USE_BITMASKS
-	uint32 ndx = curr->countOn ( b );	
-	return *(clist + ndx);
-#else		
-	return *(clist + b);
+	std::vector<uint32> bits;
+	std::vector<uint64> refs;
+	for (int lev = 1; lev < levs; lev++) {
+		int full = getChildClass ( getVoxCnt(lev) );
+		for (uint64 n = 0; n < mPool->getPoolTotalCnt(0, lev); n++) {
+			Node* node = getNode ( 0, lev, n );
+			if ( node->mChildList == ID_UNDEFL ) { CreateChildList ( node ); continue; }
+			if ( isDenseChildList ( node ) ) continue;
+			GatherChildList ( node, bits, refs );
+			WriteChildList ( node, bits, refs, full );
+		}
+	}
+#else
+	(void) levs;
+#endif
+}
+
+void VolumeGVDB::ConvertNonBitmaskToBitmask ( int levs )
+{
+#ifdef USE_BITMASKS
+	std::vector<uint32> bits;
+	std::vector<uint64> refs;
+	uint64 tiles = 0;
+	for (int lev = 1; lev < levs; lev++) {
+		for (uint64 n = 0; n < mPool->getPoolTotalCnt(0, lev); n++) {
+			Node* node = getNode ( 0, lev, n );
+			if ( node->mChildList == ID_UNDEFL || !isDenseChildList ( node ) ) continue;
+			GatherChildList ( node, bits, refs, &tiles );
+			WriteChildList ( node, bits, refs );
+		}
+	}
+	if ( tiles > 0 ) gprintf ( "WARNING: ConvertNonBitmaskToBitmask dropped %llu tiles, not supported with bitmasks.\n", (unsigned long long) tiles );
+#else
+	(void) levs;
+#endif
+}
+
+// Read one level of VBX child lists (one row per list, `wid` bytes each, entries of `refbytes`)
+// and rebuild them in the in-memory layout. Packed rows hold children in bit order of the node's
+// mask; dense rows are indexed by bit. Node pools must already be read, with mChildList holding
+// row ids.
+void VolumeGVDB::ReadChildLists ( FILE* fp, int lev, int cnt, int wid, bool packed, int refbytes )
+{
+	uint64 rowlen = wid / refbytes;
+	std::vector<char> rows ( uint64(wid) * cnt );
+	if ( cnt > 0 && wid > 0 ) fread ( rows.data(), wid, cnt, fp );
+	if ( lev == 0 ) return;
+
+	std::vector<uint32> bits;
+	std::vector<uint64> refs;
+	uint64 tiles = 0;
+	uint64 vox = getVoxCnt ( lev );
+	for (uint64 n = 0; n < mPool->getPoolTotalCnt(0, lev); n++) {
+		Node* node = getNode ( 0, lev, n );
+		uint64 row = getChildListId ( node );
+		setChildListId ( node, ID_UNDEFL );
+		if ( row == ID_UNDEFL || ElemNdx(row) >= uint64(cnt) ) {
+#ifdef USE_BITMASKS
+			clearMask ( node );
+#endif
+			continue;
+		}
+		const char* entry = &rows[ ElemNdx(row) * wid ];
+		bits.clear ();
+		refs.clear ();
+		if ( packed ) {
+			uint64* mask = getMask ( node );
+			uint64 words = getMaskWords ( node );
+			for (uint64 w = 0; w < words; w++) {
+				for (uint64 v = mask[w]; v != 0 && refs.size() < rowlen; v &= v - 1) {
+					bits.push_back ( uint32( w*64 + firstBitOn(v) ) );
+					refs.push_back ( ReadFileRef ( entry + refs.size()*refbytes, refbytes, 0, lev-1, ID_UNDEF64 ) );
+				}
+			}
+		} else {
+			for (uint64 b = 0; b < std::min ( rowlen, vox ); b++) {
+				uint64 ch = ReadFileRef ( entry + b*refbytes, refbytes, 0, lev-1, ID_UNDEF64 );
+				if ( ch == ID_UNDEF64 ) continue;
+				if ( isElemTile(ch) ) { tiles++; continue; }
+				bits.push_back ( uint32(b) );
+				refs.push_back ( ch );
+			}
+		}
+		WriteChildList ( node, bits, refs );
+	}
+	if ( tiles > 0 ) gprintf ( "WARNING: LoadVBX dropped %llu tiles, not supported in this build.\n", (unsigned long long) tiles );
+}
+
+// Read one level of VBX nodes stored with the other node reference width (`refbytes`, see
+// noderef), converting parent and child list references. Both layouts match up to mValue,
+// and keep the bitmask in their last 8 header bytes.
+void VolumeGVDB::ReadNodes ( FILE* fp, int lev, int cnt, int wid, int refbytes )
+{
+	const int hdr = VBX_NODE_HDR ( refbytes );
+	const int ref_off = hdr - 8 - 2*refbytes;			// mParent, then mChildList
+	const uint64 stride = mPool->getPoolWidth ( 0, lev );
+	const uint64 maskcap = stride - offsetof(Node, mMask);
+	std::vector<char> row ( wid );
+	for (int i = 0; i < cnt; i++) {
+		fread ( row.data(), wid, 1, fp );
+		Node* node = getNode ( mPool->PoolAlloc ( 0, lev, true ) );
+		memset ( (void*) node, 0, stride );
+		memcpy ( (void*) node, row.data(), offsetof(Node, mValue) + sizeof(Vector3DI) );		// mLev..mValue; mVRange is not converted
+		node->mParent = ElemRef ( ReadFileRef ( &row[ref_off], refbytes, 0, lev+1, ID_UNDEFL ) );
+		setChildListId ( node, ReadFileRef ( &row[ref_off + refbytes], refbytes, 1, lev, ID_UNDEFL ) );
+		if ( wid > hdr - 8 )
+			memcpy ( getMask(node), &row[hdr - 8], std::min ( maskcap, uint64(wid - (hdr - 8)) ) );
+	}
+}
+
+// Set child slot to a constant-value tile
+void VolumeGVDB::SetTile ( slong nodeid, uint b, float val )
+{
+#ifndef GVDB_TILES
+	(void) nodeid; (void) b; (void) val;
+	gprintf ( "ERROR: Tiles require dense child lists of full pool references.\n" );
+	gerror ();
+#else
+	Node* curr = getNode ( nodeid );
+	if ( curr->mChildList == ID_UNDEFL ) CreateChildList ( curr );
+	noderef* clist = getChildList ( curr );
+	clist[b] = ElemTile ( val );
+#endif
+}
+
+// Get constant-value tile at bit position
+bool VolumeGVDB::getTile ( Node* curr, uint b, float& val )
+{
+#ifndef GVDB_TILES
+	(void) curr; (void) b; (void) val;
+	return false;
+#else
+	if ( curr->mLev == 0 || curr->mChildList == ID_UNDEFL ) return false;
+	uint64 ch = *(getChildList ( curr ) + b);
+	if ( !isElemTile(ch) ) return false;
+	val = ElemTileValue ( ch );
+	return true;
 #endif
+}
 
+// Count tiles at all levels
+uint64 VolumeGVDB::CountTiles ()
+{
+	uint64 cnt = 0;
+#ifdef GVDB_TILES
+	for (int lev = 1; lev < mPool->getNumLevels(); lev++) {
+		uint64 vox = getVoxCnt ( lev );
+		for (uint64 n = 0; n < mPool->getPoolTotalCnt(0, lev); n++) {
+			Node* curr = getNode ( 0, lev, n );
+			if ( curr->mChildList == ID_UNDEFL ) continue;
+			noderef* clist = getChildList ( curr );
+			for (uint64 b = 0; b < vox; b++)
+				if ( isElemTile(clist[b]) ) cnt++;
+		}
+	}
+#endif
+	return cnt;
 }
 
 // Get child a given local 3D brick position
@@ -3307,17 +4144,28 @@ void VolumeGVDB::AuxGeometryUnmap ( Model* model, int vertaux, int elemaux )
 }
 
 // Activate a region of space
+// Neighboring cells in x mostly share a parent, so each descent starts from the parent of the
+// previous node rather than the root. ActivateSpace climbs back up when a cell lies outside it.
 int VolumeGVDB::ActivateRegion ( int lev, Extents& e )
 {
 	Vector3DI pos;
-	uint64 leaf;		
+	slong leaf;
+	slong start = mRoot;
+	bool bnew;
 	int cnt = 0;
 	assert ( lev == e.lev-1 );		// make sure extens match desired level
 	for (int z=e.imin.z; z <= e.imax.z; z++ )
 		for (int y=e.imin.y; y <= e.imax.y; y++ )
 			for (int x=e.imin.x; x <= e.imax.x; x++ ) {
 				pos.Set(x, y, z); pos *= e.cover;
-				leaf = ActivateSpaceAtLevel ( e.lev-1, pos );
+				bnew = false;
+				leaf = ActivateSpace ( start, pos, bnew, ID_UNDEFL, e.lev-1 );
+				if ( leaf != ID_UNDEFL ) {
+					slong parent = getParentId ( getNode(leaf) );
+					start = ( parent != ID_UNDEFL ) ? parent : leaf;
+				} else {
+					start = mRoot;
+				}
 				cnt++;
 			}
 
@@ -3477,6 +4325,7 @@ int VolumeGVDB::VoxelizeNode ( Node* node, uchar chan, Matrix4F* xform, float bd
 // SolidVoxelize - Voxelize a polygonal mesh to a sparse volume
 void VolumeGVDB::SolidVoxelize ( uchar chan, Model* model, Matrix4F* xform, float val_surf, float val_inside, float vthresh )
 {
+	UnshareBricks ();
 	PUSH_CTX
 
 	//TimerStart();
@@ -3794,6 +4643,16 @@ Vector3DF VolumeGVDB::MemoryUsage(std::string name, std::vector<std::string>& ou
 	sprintf(str, "%s, Volume Total: %6.2f MB (%4.2f%%)\n", name.c_str(), vol_total, float(vol_total*100.0 / mem.x));
 	outlist.push_back(str);
 
+	// Bricks shared after DedupBricks, and the atlas memory they would otherwise take
+	if ( mNumSharedBricks > 0 ) {
+		uint64 br = mPool->getAtlasBrickres(0);
+		float saved = 0;
+		for (int n = 0; n < mPool->getNumAtlas(); n++)
+			saved += float(mNumSharedBricks * br*br*br * mPool->getSize(mPool->getAtlas(n).type)) / MB;
+		sprintf(str, "%s, Shared Bricks: %llu, saving %6.2f MB\n", name.c_str(), (unsigned long long) mNumSharedBricks, saved);
+		outlist.push_back(str);
+	}
+
 	float aux_total = 0;
 	for (int n = 0; n < MAX_AUX; n++) {
 		if (mAux[n].size > 0) {
@@ -3806,11 +4665,34 @@ Vector3DF VolumeGVDB::MemoryUsage(std::string name, std::vector<std::string>& ou
 	sprintf(str, "%s, Aux Total: %6.2f MB (%4.2f%%)\n", name.c_str(), aux_total, float(aux_total*100.0 / mem.x));
 	outlist.push_back(str);
 
+	// Tracked host and device memory, all categories
+	MemUsage tot = getMemTotal();
+	sprintf(str, "%s, Tracked Host: %6.2f MB (peak %6.2f MB), Device: %6.2f MB (peak %6.2f MB)\n", name.c_str(),
+		tot.cpu / MB, tot.cpuPeak / MB, tot.gpu / MB, tot.gpuPeak / MB);
+	outlist.push_back(str);
+
 	POP_CTX
 
 	return mem;
 }
 
+// Memory accounting, see Allocator::MemTrack
+std::vector<MemUsage> VolumeGVDB::getMemUsage ()
+{
+	return (mPool == 0x0) ? std::vector<MemUsage>() : mPool->getMemUsage();
+}
+MemUsage VolumeGVDB::getMemTotal ()
+{
+	MemUsage m;
+	memset ( &m, 0, sizeof(MemUsage) );
+	m.category = -1;
+	return (mPool == 0x0) ? m : mPool->getMemTotal();
+}
+void VolumeGVDB::ResetMemPeaks ()
+{
+	if ( mPool != 0x0 ) mPool->ResetMemPeaks ();
+}
+
 // Measure pools
 float VolumeGVDB::MeasurePools ()
 {
@@ -3818,10 +4700,10 @@ float VolumeGVDB::MeasurePools ()
 	int levs = mPool->getNumLevels ();
 	float MB = 1024.0*1024.0;
 
-	for (int n=0; n < levs; n++ ) {
+	for (int n=0; n < levs; n++ )
 		pool0_total += mPool->getPoolSize ( 0, n );
-		pool1_total += mPool->getPoolSize ( 1, n );
-	}
+	for (int c=0; c < mPool->getNumPools(1); c++ )
+		pool1_total += mPool->getPoolSize ( 1, c );
 	return (pool0_total + pool1_total) / MB;
 }
 
@@ -3961,11 +4843,13 @@ void VolumeGVDB::PrepareVDB ()
 			mVDBInfo.noderange[n]	= getRange(n);		// integer (cannot send cover)
 			mVDBInfo.nodecnt[n]		= static_cast<int>(mPool->getPoolTotalCnt(0, n));
 			mVDBInfo.nodewid[n]		= static_cast<int>(mPool->getPoolWidth(0, n));
-			mVDBInfo.childwid[n]	= static_cast<int>(mPool->getPoolWidth(1, n));
 			mVDBInfo.nodelist[n]	= mPool->getPoolGPU(0, n);
-			mVDBInfo.childlist[n]	= mPool->getPoolGPU(1, n);								
 			if ( mVDBInfo.nodecnt[n] == 1 ) tlev = n;		// get top level for rendering
 		}
+		for (int c=0; c < mPool->getNumPools(1); c++ ) {	// child list pools (per level, or per class with bitmasks)
+			mVDBInfo.childwid[c]	= static_cast<int>(mPool->getPoolWidth(1, c));
+			mVDBInfo.childlist[c]	= mPool->getPoolGPU(1, c);
+		}
 		mVDBInfo.atlas_map			= mPool->getAtlasMapGPU(0);		
 		mVDBInfo.atlas_apron		= mPool->getAtlas(0).apron;	
 		mVDBInfo.atlas_cnt			= mPool->getAtlas(0).subdim;		// number of bricks on each axis of atlas
@@ -4005,11 +4889,13 @@ void VolumeGVDB::PrepareVDBPartially ()
 		mVDBInfo.noderange[n]	= getRange(n);		// integer (cannot send cover)
 		mVDBInfo.nodecnt[n]		= static_cast<int>(mPool->getPoolTotalCnt(0, n));
 		mVDBInfo.nodewid[n]		= static_cast<int>(mPool->getPoolWidth(0, n));
-		mVDBInfo.childwid[n]	= static_cast<int>(mPool->getPoolWidth(1, n));
 		mVDBInfo.nodelist[n]	= mPool->getPoolGPU(0, n);
-		mVDBInfo.childlist[n]	= mPool->getPoolGPU(1, n);								
 		if ( mVDBInfo.nodecnt[n] == 1 ) tlev = n;		// get top level for rendering
 	}
+	for (int c=0; c < mPool->getNumPools(1); c++ ) {
+		mVDBInfo.childwid[c]	= static_cast<int>(mPool->getPoolWidth(1, c));
+		mVDBInfo.childlist[c]	= mPool->getPoolGPU(1, c);
+	}
 	mVDBInfo.top_lev			= tlev;		
 	mVDBInfo.bmin				= mObjMin;
 	mVDBInfo.bmax				= mObjMax;
@@ -4498,6 +5384,7 @@ void VolumeGVDB::UpdateApronFaces (uchar chan)
 
 void VolumeGVDB::ComputeKernel (CUmodule user_module, CUfunction user_kernel, uchar channel, bool bUpdateApron, bool skipOverAprons)
 {
+	UnshareBricks ();
 	PERF_PUSH ("ComputeKernel");
 
 	SetModule ( user_module );
@@ -4531,6 +5418,7 @@ void VolumeGVDB::ComputeKernel (CUmodule user_module, CUfunction user_kernel, uc
 
 void VolumeGVDB::Compute (int effect, uchar channel, int num_iterations, Vector3DF parameters, bool bUpdateApron, bool skipOverAprons, float boundval)
 { 
+	UnshareBricks ();
 	PERF_PUSH ("Compute");
 
 	// Send VDB Info	
@@ -4624,6 +5512,7 @@ Vector3DF VolumeGVDB::Reduction(uchar chan)
 
 void VolumeGVDB::Resample ( uchar chan, Matrix4F xform, Vector3DI in_res, char in_aux, Vector3DF inr, Vector3DF outr )
 {
+	UnshareBricks ();
 	PrepareVDB ();
 
 	PUSH_CTX
@@ -4649,6 +5538,8 @@ void VolumeGVDB::Resample ( uchar chan, Matrix4F xform, Vector3DI in_res, char i
 
 uint64 VolumeGVDB::getNodeAtPoint (uint64 nodeid, Vector3DF pos)
 {
+	TREE_DISPATCH ( getNode(nodeid)->mLev, return TreeWalk<Cfg, Cfg::Levels-1>::NodeAtPoint ( this, nodeid, pos ) );
+
 	// Recurse to find node	
 	Node* curr = getNode( nodeid );
 	Vector3DF p = pos; p -= curr->mPos;
@@ -4663,27 +5554,197 @@ uint64 VolumeGVDB::getNodeAtPoint (uint64 nodeid, Vector3DF pos)
 		if (isLeaf(nodeid)) {
 			return nodeid;
 		} else {
-#ifdef USE_BITMASKS			
-			uint32 i = getBitPos(curr->mLev, p);
-			uint32 b = curr->countOn(i);
-			slong childid;
-			if (curr->isOn(i)) {
-				childid = getChildNode(nodeid, b);
-				return getNodeAtPoint( childid, pos);
-			}
-#else
 			uint32 i = getBitPos(curr->mLev, p);
 			slong childid;
 			if (isOn(nodeid, i)) {
 				childid = getChildNode(nodeid, i);
 				return getNodeAtPoint( childid, pos);
 			}
-#endif
 		}
 	}	
 	return ID_UNDEFL;
 }
 
+// Box vs. frustum planes (a,b,c,d), inside where ax+by+cz+d > 0
+enum { CULL_OUT = 0, CULL_PART, CULL_IN };
+
+static int classifyBox ( const float planes[6][4], const Vector3DF& bmin, const Vector3DF& bmax )
+{
+	int ret = CULL_IN;
+	for (int p = 0; p < 6; p++) {
+		const float* f = planes[p];
+		// Farthest and nearest corners along the plane normal
+		float dfar  = f[0] * (f[0] > 0 ? bmax.x : bmin.x) + f[1] * (f[1] > 0 ? bmax.y : bmin.y) + f[2] * (f[2] > 0 ? bmax.z : bmin.z) + f[3];
+		if ( dfar <= 0 ) return CULL_OUT;
+		float dnear = f[0] * (f[0] > 0 ? bmin.x : bmax.x) + f[1] * (f[1] > 0 ? bmin.y : bmax.y) + f[2] * (f[2] > 0 ? bmin.z : bmax.z) + f[3];
+		if ( dnear <= 0 ) ret = CULL_PART;
+	}
+	return ret;
+}
+
+void VolumeGVDB::CullSubtree ( uint64 nodeid, int lev, const float planes[6][4], bool inside, std::vector<uint64>& out )
+{
+	Node* node = getNode ( nodeid );
+	if ( node->mLev == 0 && !node->mFlags ) return;
+	if ( !inside ) {
+		Vector3DF bmin = node->mPos;
+		int c = classifyBox ( planes, bmin, bmin + getCover(node->mLev) );
+		if ( c == CULL_OUT ) return;
+		inside = (c == CULL_IN);		// accept whole subtree
+	}
+	if ( node->mLev == lev ) { out.push_back ( nodeid ); return; }
+	if ( node->mChildList == ID_UNDEFL ) return;
+
+	noderef* clist = getChildList ( node );
+	uint64 cnt = getChildListLen ( node );
+	for (uint64 i = 0; i < cnt; i++) {
+		uint64 ch = RefElem ( clist[i], 0, node->mLev-1 );
+		if ( ch == ID_UNDEF64 || isElemTile(ch) ) continue;		// tiles have no node
+		CullSubtree ( ch, lev, planes, inside, out );
+	}
+}
+
+std::vector<uint64> VolumeGVDB::CullNodes ( Camera3D& cam, int lev )
+{
+	std::vector<uint64> out;
+	if ( mRoot == ID_UNDEFL || lev < 0 || lev > getNode(mRoot)->mLev ) return out;
+
+	PERF_PUSH ( "CullNodes" );
+
+	// Bring the world-space frustum planes into voxel space: plane(mXform * p) is affine in p,
+	// so the node boxes are tested exactly, not as loose world-space AABBs.
+	float planes[6][4];
+	Vector3DF o  = mXform.TransformPoint ( Vector3DF(0, 0, 0) );
+	Vector3DF ax = mXform.TransformDir ( Vector3DF(1, 0, 0) );
+	Vector3DF ay = mXform.TransformDir ( Vector3DF(0, 1, 0) );
+	Vector3DF az = mXform.TransformDir ( Vector3DF(0, 0, 1) );
+	for (int p = 0; p < 6; p++) {
+		const float* f = cam.frustum[p];
+		planes[p][0] = f[0]*ax.x + f[1]*ax.y + f[2]*ax.z;
+		planes[p][1] = f[0]*ay.x + f[1]*ay.y + f[2]*ay.z;
+		planes[p][2] = f[0]*az.x + f[1]*az.y + f[2]*az.z;
+		planes[p][3] = f[0]*o.x  + f[1]*o.y  + f[2]*o.z + f[3];
+	}
+
+	// Expand the top of the tree serially until there is enough work to split across threads.
+	// A frontier entry is a node and whether it is already known to be fully inside.
+	int nth = getNumThreads ();
+	std::vector< std::pair<uint64, bool> > front, next;
+	front.push_back ( std::make_pair ( mRoot, false ) );
+	while ( front.size() < (size_t) nth * 8 ) {
+		if ( getNode ( front[0].first )->mLev <= lev ) break;
+		next.clear ();
+		for (size_t n = 0; n < front.size(); n++) {
+			Node* node = getNode ( front[n].first );
+			bool inside = front[n].second;
+			if ( !inside ) {
+				Vector3DF bmin = node->mPos;
+				int c = classifyBox ( planes, bmin, bmin + getCover(node->mLev) );
+				if ( c == CULL_OUT ) continue;
+				inside = (c == CULL_IN);
+			}
+			if ( node->mChildList == ID_UNDEFL ) continue;
+			noderef* clist = getChildList ( node );
+			uint64 cnt = getChildListLen ( node );
+			for (uint64 i = 0; i < cnt; i++) {
+				uint64 ch = RefElem ( clist[i], 0, node->mLev-1 );
+				if ( ch == ID_UNDEF64 || isElemTile(ch) ) continue;
+				next.push_back ( std::make_pair ( ch, inside ) );
+			}
+		}
+		front.swap ( next );
+		if ( front.empty() ) break;
+	}
+
+	// Cull the frontier subtrees in parallel; per-chunk lists are joined in order.
+	std::vector< std::vector<uint64> > part ( nth );
+	ParallelChunks ( front.size(), nth, [&]( int c, uint64 s, uint64 e ) {
+		for (uint64 n = s; n < e; n++)
+			CullSubtree ( front[n].first, lev, planes, front[n].second, part[c] );
+	} );
+	size_t total = 0;
+	for (int c = 0; c < nth; c++) total += part[c].size();
+	out.reserve ( total );
+	for (int c = 0; c < nth; c++) out.insert ( out.end(), part[c].begin(), part[c].end() );
+
+	PERF_POP ();
+	return out;
+}
+
+
+// Active leaves overlapping [bmin, bmax], bucketed by atlas layer. Returns how many layers to
+// read back at once (see AtlasLayerBatch).
+int VolumeGVDB::GetLeafLayers ( uchar chan, Vector3DI bmin, Vector3DI bmax, std::vector< std::vector<uint64> >& layers )
+{
+	layers.clear ();
+	if ( chan >= mPool->getNumAtlas() || mPool->getNumLevels() == 0 ) return 1;
+
+	const int br = mPool->getAtlasBrickres ( chan );
+	const int apron = mPool->getAtlas(chan).apron;
+	const int res0 = getRes ( 0 );
+	const Vector3DI acnt = mPool->getAtlasCnt ( chan );
+	layers.resize ( std::max(acnt.z, 0) );
+	for (uint64 n = 0; n < mPool->getPoolTotalCnt(0, 0); n++) {
+		Node* node = getNode ( 0, 0, n );
+		if ( !node->mFlags ) continue;
+		Vector3DI p = node->mPos;
+		if ( p.x > bmax.x || p.y > bmax.y || p.z > bmax.z ) continue;
+		if ( p.x + res0 <= bmin.x || p.y + res0 <= bmin.y || p.z + res0 <= bmin.z ) continue;
+		int l = (node->mValue.z - apron) / br;
+		if ( l >= 0 && l < acnt.z ) layers[l].push_back ( Elem(0, 0, n) );
+	}
+	return AtlasLayerBatch ( chan );
+}
+
+// How many atlas layers of a channel to read back at once, about 64 MB
+int VolumeGVDB::AtlasLayerBatch ( uchar chan )
+{
+	const Vector3DI ares = mPool->getAtlasRes ( chan );
+	const uint64 layer = uint64(ares.x) * ares.y * mPool->getAtlasBrickres ( chan ) * mPool->getAtlasVoxelBytes ( chan );
+	return (int) std::max<uint64> ( 1, (uint64(64) << 20) / std::max<uint64>(layer, 1) );
+}
+
+// Read atlas layers [l0, l1) of a channel into host memory
+void VolumeGVDB::ReadAtlasLayers ( uchar chan, int l0, int l1, std::vector<uchar>& buf )
+{
+	const int br = mPool->getAtlasBrickres ( chan );
+	const Vector3DI ares = mPool->getAtlasRes ( chan );
+	const uint64 plane = uint64(ares.x) * ares.y * mPool->getAtlasVoxelBytes ( chan );
+	const uint64 cap = buf.capacity ();
+	buf.resize ( plane * br * (l1-l0) );
+	if ( buf.capacity() > cap ) mPool->MemTrack ( MemTag(MEM_STAGING, 0), false, sint64(buf.capacity() - cap) );
+
+	PUSH_CTX
+	mPool->AtlasRetrieveSlices ( chan, l0*br, (l1-l0)*br, &buf[0] );
+	POP_CTX
+}
+
+// Release a buffer filled by ReadAtlasLayers
+void VolumeGVDB::EndAtlasLayers ( std::vector<uchar>& buf )
+{
+	mPool->MemTrack ( MemTag(MEM_STAGING, 0), false, -sint64(buf.capacity()) );
+	std::vector<uchar>().swap ( buf );
+}
+
+// View of a leaf's brick in layers read by ReadAtlasLayers from layer l0
+BrickView VolumeGVDB::getBrickView ( uchar chan, uint64 nodeid, const std::vector<uchar>& buf, int l0 )
+{
+	const Vector3DI ares = mPool->getAtlasRes ( chan );
+	BrickView v;
+	v.nodeid = nodeid;
+	v.node = getNode ( nodeid );
+	v.esize = mPool->getAtlasVoxelBytes ( chan );
+	v.res = getRes ( 0 );
+	v.ystride = ares.x;
+	v.zstride = uint64(ares.x) * ares.y;
+	Vector3DI a = v.node->mValue;									// first voxel past the apron
+	a.z -= l0 * mPool->getAtlasBrickres ( chan );
+	v.data = (const char*) &buf[ (a.z*v.zstride + a.y*v.ystride + a.x) * v.esize ];
+	v.origin = v.node->mPos;
+	v.world = mXform.TransformPoint ( Vector3DF(v.origin) );
+	return v;
+}
+
 
 bool  VolumeGVDB::isActive(Vector3DI wpos)
 {
@@ -4692,6 +5753,8 @@ bool  VolumeGVDB::isActive(Vector3DI wpos)
 
 bool  VolumeGVDB::isActive( Vector3DI pos, slong nodeid)
 {
+	TREE_DISPATCH ( getNode(nodeid)->mLev, return TreeWalk<Cfg, Cfg::Levels-1>::IsActive ( this, nodeid, pos ) );
+
 	// Recurse to leaf	
 	unsigned int b;
 
@@ -4713,6 +5776,8 @@ bool  VolumeGVDB::isActive( Vector3DI pos, slong nodeid)
 
 float VolumeGVDB::getValue ( slong nodeid, Vector3DF pos, float* atlas )
 {
+	TREE_DISPATCH ( getNode(nodeid)->mLev, return TreeWalk<Cfg, Cfg::Levels-1>::Value ( this, nodeid, pos, atlas, mPool->getAtlasRes(0) ) );
+
 	// Recurse to find value
 	Node* curr = getNode ( nodeid );	
 	Vector3DF p = pos; p -= curr->mPos;
@@ -4733,22 +5798,14 @@ float VolumeGVDB::getValue ( slong nodeid, Vector3DF pos, float* atlas )
 			return atlas [ (int(p.z)*atlasres.y + int(p.y) )*atlasres.x + int(p.x) ];
 
 		} else {
-#ifdef USE_BITMASKS			
-			uint32 i = getBitPos ( curr->mLev, p );
-			uint32 b = curr->countOn ( i );
-			slong childid;			
-			if ( curr->isOn ( i ) ) {
-				childid = getChildNode ( nodeid, b );
-				return getValue ( childid, pos, atlas );
-			}		
-#else
 			uint32 i = getBitPos ( curr->mLev, p );
 			slong childid;			
+			float tile;
 			if ( isOn (nodeid, i ) ) {
 				childid = getChildNode ( nodeid, i );
 				return getValue ( childid, pos, atlas );
 			}
-#endif
+			if ( getTile ( curr, i, tile ) ) return tile;
 		}
 	} 
 	return 0.0;	
@@ -4821,9 +5878,18 @@ void VolumeGVDB::PrefixSum ( CUdeviceptr inArray, CUdeviceptr outArray, int numE
 void VolumeGVDB::AllocData ( DataPtr& ptr, int cnt, int stride, bool bCPU )
 {
 	PUSH_CTX
-	if ( (ptr.cpu == 0 && bCPU) || ptr.gpu==0 || cnt > ptr.max || stride != ptr.stride )
+	if ( (ptr.cpu == 0 && bCPU) || ptr.gpu==0 || cnt > ptr.max || stride != ptr.stride ) {
+		ptr.memtag = MemTag ( MEM_DATA, 0 );
 		mPool->CreateMemLinear ( ptr, 0x0, stride, cnt, bCPU );		// always reallocates	
+	}
+	POP_CTX
+}
+DataBuffer VolumeGVDB::AllocData ( int cnt, int stride, bool bCPU )
+{
+	PUSH_CTX
+	DataBuffer buf = mPool->CreateBuffer ( stride, cnt, bCPU );
 	POP_CTX
+	return buf;
 }
 void VolumeGVDB::FreeData( DataPtr& ptr )
 {
@@ -4897,37 +5963,72 @@ void VolumeGVDB::CommitTransferFunc ()
 	POP_CTX
 }
 
+// Points given as DataPtrs belong to the caller. GVDB keeps a non-owning copy, so neither
+// CleanAux nor the caller's FreeData releases them twice. Whatever GVDB held in these
+// slots before is released, unless the same buffer is passed again.
+void VolumeGVDB::SetAuxView ( int id, const DataPtr& p )
+{
+	if ( mAux[id].gpu != p.gpu && mAuxOwned[id].gpu() != p.gpu ) CleanAux ( id );
+	mAux[id] = p;
+	mAux[id].memcpu = 0; mAux[id].memgpu = 0;		// owned by the caller
+	mAux[id].capcpu = 0; mAux[id].capgpu = 0;
+}
+
 void VolumeGVDB::SetPoints ( DataPtr& pntpos, DataPtr& pntvel, DataPtr& pntclr )
 {
-	mAux[AUX_PNTPOS] = pntpos;
-	mAux[AUX_PNTVEL] = pntvel;
-	mAux[AUX_PNTCLR] = pntclr;
+	PUSH_CTX
+	SetAuxView ( AUX_PNTPOS, pntpos );
+	SetAuxView ( AUX_PNTVEL, pntvel );
+	SetAuxView ( AUX_PNTCLR, pntclr );
 
 	if ( pntvel.gpu==0 ) CleanAux ( AUX_SUBCELL_PNT_VEL );
 	if ( pntclr.gpu==0 ) CleanAux ( AUX_SUBCELL_PNT_CLR );
+	POP_CTX
+}
+
+void VolumeGVDB::SetPoints ( DataBuffer&& pntpos, DataBuffer&& pntvel, DataBuffer&& pntclr )
+{
+	PUSH_CTX
+	CleanAux ( AUX_PNTPOS );							// releases the previous buffers
+	CleanAux ( AUX_PNTVEL );
+	CleanAux ( AUX_PNTCLR );
+	mAuxOwned[AUX_PNTPOS] = std::move ( pntpos );
+	mAuxOwned[AUX_PNTVEL] = std::move ( pntvel );
+	mAuxOwned[AUX_PNTCLR] = std::move ( pntclr );
+	POP_CTX
+
+	DataPtr pos = mAuxOwned[AUX_PNTPOS].view ();
+	DataPtr vel = mAuxOwned[AUX_PNTVEL].view ();
+	DataPtr clr = mAuxOwned[AUX_PNTCLR].view ();
+	SetPoints ( pos, vel, clr );
 }
 
 void VolumeGVDB::SetDiv ( DataPtr div )
 {
-	mAux[AUX_DIV] = div;
+	PUSH_CTX
+	SetAuxView ( AUX_DIV, div );
+	POP_CTX
 }
 
 void VolumeGVDB::SetSupportPoints ( DataPtr& pntpos, DataPtr& dirpos )
 {
-	mAux[AUX_PNTPOS] = pntpos;
-	mAux[AUX_PNTDIR] = dirpos;
+	PUSH_CTX
+	SetAuxView ( AUX_PNTPOS, pntpos );
+	SetAuxView ( AUX_PNTDIR, dirpos );
+	POP_CTX
 }
 
+// Auxiliary buffers are backed by the allocator's recycling arena. PrepareAux keeps a
+// buffer's blocks while they are large enough and CleanAux(id) returns them to the arena,
+// so per-frame resizing does not reallocate. Buffers assigned by the user (SetPoints..)
+// own nothing and are only detached. CleanAux() keeps the cached blocks for the next
+// frame; TrimAux releases them.
 void VolumeGVDB::CleanAux()
 {
 	PUSH_CTX
 
-	for (int id = 0; id < MAX_AUX; id++) {
-		mAux[id].lastEle = 0; mAux[id].usedNum = 0;
-		mAux[id].max = 0; mAux[id].size = 0; mAux[id].stride = 0;
-		if (mAux[id].cpu != 0x0) { free(mAux[id].cpu); mAux[id].cpu = 0x0;}
-		if (mAux[id].gpu != 0x0) {	(cuMemFree(mAux[id].gpu), "cuMemFree", "CleanAux");	mAux[id].gpu = 0x0; }
-	}
+	for (int id = 0; id < MAX_AUX; id++)
+		CleanAux ( id );
 
 	POP_CTX
 }
@@ -4936,31 +6037,62 @@ void VolumeGVDB::CleanAux(int id)
 {
 	PUSH_CTX
 	//std::cout << "clean aux " << id << std::endl;
+	if ( !mAuxOwned[id].empty() ) {					// mAux[id] is a view of an owned buffer
+		mAuxOwned[id].reset ();
+		mAux[id].cpu = 0x0;
+		mAux[id].gpu = 0x0;
+	}
 	mAux[id].lastEle = 0;
 	mAux[id].usedNum = 0;
 	mAux[id].max = 0;
 	mAux[id].size = 0;
 	mAux[id].stride = 0;
-	if (mAux[id].cpu != 0x0)
+	if ( mPool != 0x0 ) mPool->ArenaRelease ( mAux[id] );
+	if (mAux[id].cpu != 0x0 && mAux[id].memcpu != 0)
 	{
 		free(mAux[id].cpu);
-		mAux[id].cpu = 0x0;
 	}
-	if (mAux[id].gpu != 0x0) 
+	if (mAux[id].gpu != 0x0 && mAux[id].memgpu != 0) 
 	{
 		(cuMemFree(mAux[id].gpu), "cuMemFree", "CleanAux");
-		mAux[id].gpu = 0x0;
 	}
+	mAux[id].cpu = 0x0;
+	mAux[id].gpu = 0x0;
+	if ( mPool != 0x0 ) { mPool->MemTrackData ( mAux[id], false, 0 ); mPool->MemTrackData ( mAux[id], true, 0 ); }
+	POP_CTX
+}
+
+// Moves an aux buffer out of GVDB. Arena blocks return to the arena when the
+// buffer is destroyed. The aux slot is left empty.
+DataBuffer VolumeGVDB::TakeAux ( int id )
+{
+	DataBuffer buf;
+	DataPtr& p = mAux[id];
+	if ( !mAuxOwned[id].empty() ) {
+		buf = std::move ( mAuxOwned[id] );
+	} else if ( p.memcpu != 0 || p.memgpu != 0 || p.capcpu != 0 || p.capgpu != 0 ) {
+		buf = DataBuffer ( p );
+	}												// else the caller's own buffer: nothing to hand over
+	int tag = mAux[id].memtag;
+	mAux[id] = DataPtr();
+	mAux[id].memtag = tag;
+	return buf;
+}
+
+// Release cached aux blocks, e.g. under memory pressure. Keeps at most keep_bytes cached.
+void VolumeGVDB::TrimAux ( uint64 keep_bytes )
+{
+	PUSH_CTX
+	mPool->ArenaTrim ( keep_bytes );
 	POP_CTX
 }
 
 void VolumeGVDB::PrepareAux ( int id, int cnt, int stride, bool bZero, bool bCPU )
 {
 	PUSH_CTX
-	if ( mAux[id].lastEle < cnt || mAux[id].stride != stride ) {
-		mPool->CreateMemLinear ( mAux[id], 0x0, stride, cnt, bCPU );
-	}
-	if ( bZero ) {
+	mAux[id].memtag = MemTag ( MEM_AUX, id );
+	mPool->ArenaAcquire ( mAux[id], stride, cnt, bCPU );
+	if ( bZero && mAux[id].size > 0 ) {
 		cudaCheck ( cuMemsetD8 ( mAux[id].gpu, 0, mAux[id].size ), "VolumeGVDB", "PrepareAux", "cuMemsetD8", "", mbDebug);
 	}
 	POP_CTX
@@ -5317,6 +6449,7 @@ void VolumeGVDB::ScalePntPos (int num_pnts, float scale)
 
 void VolumeGVDB::GatherDensity ( int subcell_size, int num_pnts, float radius, Vector3DF trans, int& pSCPntsLength, int chanDensity, int chanClr, bool bAccum )
 {
+	UnshareBricks ();
 	int num_brick = static_cast<int>(mPool->getPoolUsedCnt(0, 0));
 	if (pSCPntsLength==0) return;
 	if (num_brick == 0) return;
@@ -5347,6 +6480,7 @@ void VolumeGVDB::GatherDensity ( int subcell_size, int num_pnts, float radius, V
 
 void VolumeGVDB::GatherLevelSet (int subcell_size, int num_pnts, float radius, Vector3DF trans, int& pSCPntsLength, int chanDensity, int chanClr, bool bAccum )
 {
+	UnshareBricks ();
 	int num_brick = static_cast<int>(mPool->getPoolUsedCnt(0, 0));
 	if (num_brick == 0) return;
 
@@ -5374,6 +6508,7 @@ void VolumeGVDB::GatherLevelSet (int subcell_size, int num_pnts, float radius, V
 
 void VolumeGVDB::GatherLevelSet_FP16(int subcell_size, int num_pnts, float radius, Vector3DF trans, int& pSCPntsLength, int chanDensity, int chanClr)
 {
+	UnshareBricks ();
 	int num_brick = static_cast<int>(mPool->getPoolUsedCnt(0, 0));
 	if (num_brick == 0) return;
 
@@ -5623,6 +6758,7 @@ void VolumeGVDB::CheckVal(float slice, int chanVx, int chanVy, int chanVz, int c
 
 void VolumeGVDB::ScatterDensity ( int num_pnts, float radius, float amp, Vector3DF trans, bool expand, bool avgColor )
 {
+	UnshareBricks ();
 	uint num_voxels; 
 
 	PrepareVDB ();	
@@ -5684,6 +6820,7 @@ void VolumeGVDB::ConvertAndTransform(DataPtr& psrc, char psrcbits, DataPtr& pdes
 
 void VolumeGVDB::AddSupportVoxel ( int num_pnts, float radius, float offset, float amp, Vector3DF trans, bool expand, bool avgColor )
 {
+	UnshareBricks ();
 	PrepareVDB ();	
 
 	PUSH_CTX
@@ -5722,21 +6859,18 @@ void VolumeGVDB::PrintPool(uchar grp, uchar lev)
 		
 #ifdef USE_BITMASKS	
 		if ((int)lev > 0) {
-			std::cout << "      mMask: " << nd->countOn() << std::endl;
-			uint64* w1 = (uint64*) &nd->mMask;
-			uint64* we = (uint64*) &nd->mMask + nd->getMaskWords();
-			
+			std::cout << "      mMask: " << countOn(nd) << std::endl;
 		}
 		std::cout << "   Parent ID:" << nd->mParent << std::endl;
 		std::cout << "   Childlist address:" << (int)nd->mChildList << std::endl;
 		std::cout << "   Child ID:" << std::endl;
 		if ((int)nd->mChildList > 0) {
-			int numChild = nd->countOn();
-			uint64* clist = mPool->PoolData64 ( nd->mChildList );
+			uint64 childlistLen = getChildListLen ( nd );
+			noderef* clist = getChildList ( nd );
 			std::cout << "   ";
-			for (int i = 0; i < numChild; i++)
+			for (uint64 i = 0; i < childlistLen; i++)
 			{
-				std::cout << clist[i] << " ";
+				if ( clist[i] != ID_UNDEFREF ) std::cout << RefElem(clist[i], 0, lev-1) << " ";
 			}
 			std::cout << std::endl;
 		}	
@@ -5750,12 +6884,14 @@ void VolumeGVDB::PrintPool(uchar grp, uchar lev)
 		std::cout << "   Childlist length:" << childlistLen << std::endl;
 		std::cout << "   Child ID:" << std::endl;
 		if ((int)nd->mChildList > 0) {
-			uint64* clist = mPool->PoolData64 ( nd->mChildList );
+			noderef* clist = getChildList ( nd );
 			for (int i = 0; i < childlistLen; i++)
 			{
-				if ( clist[i] != ID_UNDEF64)
+				if ( clist[i] != ID_UNDEFREF)
 				{
-					std::cout << i << " " << clist[i] << " ";
+					uint64 ch = RefElem(clist[i], 0, lev-1);
+					if ( isElemTile(ch) )	std::cout << i << " tile " << ElemTileValue(ch) << " ";
+					else					std::cout << i << " " << ch << " ";
 				}		
 			}
 			std::cout << std::endl;
@@ -5794,6 +6930,16 @@ void VolumeGVDB::SetTransform(Vector3DF pretrans, Vector3DF scal, Vector3DF angs
 }
 
 // Node queries
+Counters VolumeGVDB::getCounters ()
+{
+	if ( mPool == 0x0 ) { Counters c; memset ( &c, 0, sizeof(c) ); return c; }
+	return mPool->getCounters ();
+}
+void VolumeGVDB::ResetCounters ()
+{
+	if ( mPool != 0x0 ) mPool->ResetCounters ();
+}
+
 uint64 VolumeGVDB::getNumUsedNodes ( int lev )		{ return mPool->getPoolUsedCnt(0, lev); }
 uint64 VolumeGVDB::getNumTotalNodes ( int lev )		{ return mPool->getPoolTotalCnt(0, lev); }
 Node* VolumeGVDB::getNodeAtLevel ( int n, int lev )	{ return (Node*) (mPool->PoolData( 0, lev, n )); }
@@ -14,6 +14,9 @@
 	#include "gvdb_node.h"	
 	#include "gvdb_volume_base.h"
 	#include "gvdb_allocator.h"		
+	#include "gvdb_tree_config.h"
+	#include "gvdb_parallel.h"
+	#include <climits>
 
 	using namespace nvdb;
 
@@ -69,9 +72,9 @@
 		Vector3DI		noderange[MAXLEV]; // How many voxels on a side a node of each level covers
 		int				nodecnt[MAXLEV]; // Total number of allocated nodes per level
 		int				nodewid[MAXLEV]; // Size of a node at each level in bytes
-		int				childwid[MAXLEV]; // Size of the child list per node at each level in bytes
+		int				childwid[MAXLEV]; // Size of a child list in bytes, per level (per capacity class with USE_BITMASKS)
 		CUdeviceptr		nodelist[MAXLEV]; // GPU pointer to each level's pool group 0 (nodes)
-		CUdeviceptr		childlist[MAXLEV]; // GPU pointer to each level's pool group 1 (child lists)
+		CUdeviceptr		childlist[MAXLEV]; // GPU pointer to each pool in group 1 (child lists), indexed like childwid
 		CUdeviceptr		atlas_map; // GPU pointer to the atlas map (which maps from atlas to world space)
 		Vector3DI		atlas_cnt; // Number of bricks on each axis of the atlas
 		Vector3DI		atlas_res; // Total resolution in voxels of the atlas
@@ -315,6 +318,41 @@
 		int			icnt;
 	};
 
+	// Host view of one brick (leaf) of a channel, as handed to ForEachLeaf functors. `data` points at
+	// the brick's first voxel, past the apron, in a host copy of the atlas; voxel (x,y,z) of the brick
+	// is element z*zstride + y*ystride + x, esize bytes each (16 for T_FLOAT3, which is stored padded).
+	// Views are read-only and only valid during the call.
+	struct BrickView {
+		uint64			nodeid;			// pool reference of the leaf
+		Node*			node;
+		const char*		data;			// voxel (0,0,0) of the brick
+		int				esize;			// bytes per voxel
+		int				res;			// voxels per side, apron excluded
+		uint64			ystride;		// elements between rows
+		uint64			zstride;		// elements between slices
+		Vector3DI		origin;			// index-space position of voxel (0,0,0), i.e. node->mPos
+		Vector3DF		world;			// origin in application coordinates (after getTransform())
+
+		// First voxel of a row. Index it as row[x] only if sizeof(T) == esize; otherwise use at().
+		template<typename T> const T* row ( int y, int z ) const		{ return (const T*) ( data + (z*zstride + y*ystride) * esize ); }
+		template<typename T> const T& at ( int x, int y, int z ) const	{ return *(const T*) ( data + (z*zstride + y*ystride + x) * esize ); }
+	};
+
+	// Iterates the voxels of a brick view, x fastest:
+	//   for ( VoxelIterator v ( view ); v; ++v ) sum += v.value<float>();
+	class VoxelIterator {
+	public:
+		VoxelIterator ( const BrickView& view ) : mView(view), mX(0), mY(0), mZ(0) {}
+		explicit operator bool () const		{ return mZ < mView.res; }
+		VoxelIterator& operator++ ()		{ if ( ++mX == mView.res ) { mX = 0; if ( ++mY == mView.res ) { mY = 0; mZ++; } } return *this; }
+		Vector3DI	local () const			{ return Vector3DI ( mX, mY, mZ ); }
+		Vector3DI	pos () const			{ return mView.origin + local(); }
+		template<typename T> const T& value () const	{ return mView.at<T> ( mX, mY, mZ ); }
+	private:
+		const BrickView&	mView;
+		int					mX, mY, mZ;
+	};
+
 	
 	class GVDB_API VolumeGVDB : public VolumeBase {
 	public:
@@ -382,6 +420,9 @@
 			void AddPath ( const char* path );
 			bool FindFile ( std::string fname, char* path );		
 			void ConvertBitmaskToNonBitmask(int levs);
+			// Inverse of ConvertBitmaskToNonBitmask for USE_BITMASKS builds: repacks dense child
+			// lists into capacity classes and rebuilds their bitmasks. Tiles are dropped. No-op otherwise.
+			void ConvertNonBitmaskToBitmask(int levs);
 
 			// Topology Functions
 			void Configure ( int r4, int r3, int r2, int r1, int r0 );		// Initialize VDB configuration
@@ -404,6 +445,14 @@
 			void SetupAtlasAccess ();
 			void FinishTopology (bool pCommitPool = true, bool pComputeBounds = true);						
 			void UpdateAtlas ();
+			// Brick deduplication. Leaves whose bricks are identical in every channel (aprons
+			// included) are pointed at one shared atlas slot, and the atlas is compacted to the
+			// unique bricks. Returns the number of leaves sharing another leaf's slot. Shared slots
+			// are read-only: calls that write the atlas first run UnshareBricks, which gives each
+			// leaf its own slot again. UpdateAtlas also drops sharing.
+			uint64 DedupBricks ();
+			void UnshareBricks ();
+			uint64 getNumSharedBricks ()	{ return mNumSharedBricks; }
 			void UpdateApron ();
 			void UpdateApron ( uchar chan, float boundval = 0.0f, bool changeCtx = true );
 			void UpdateApronFaces(uchar chan);
@@ -413,6 +462,13 @@
 
 			void SetBounds(Vector3DF pMin, Vector3DF pMax);
 
+			// Replace uniform bricks with constant-value tiles. Bricks whose values are all within
+			// `tolerance` of each other become a tile in their level-1 parent, and nodes filled
+			// with equal tiles collapse into a tile one level up. The tree is rebuilt, so freed
+			// bricks return to the atlas. Requires a volume with a single T_FLOAT channel.
+			// Returns the number of bricks removed.
+			uint64 CollapseTiles ( float tolerance = 0.0f );
+
 			// Topology
 			void ClearPoolCPU();
 			void FetchPoolCPU();
@@ -459,6 +515,33 @@
 			// Get the pool reference to the child that corresponds to bit `b`. If there is no child
 			// at that bit, or if curr's childList was undefined, returns ID_UNDEF64.
 			uint64 getChildRefAtBit(Node* curr, uint b);
+			// Child list layout. Without USE_BITMASKS every child list is dense, one entry per child
+			// slot. With USE_BITMASKS a list holds only the children whose bits are on, in bit order,
+			// and lives in the smallest capacity class that fits (pool group 1, level = class, 8^(c+1)
+			// entries); a list in the class covering every slot is kept dense instead.
+			bool   isDenseChildList ( Node* node );
+			// Number of entries to scan in the child list (empty entries are ID_UNDEF64).
+			uint64 getChildListLen ( Node* node );
+			// Pointer to the child list entry for bit `b`, or 0x0 if there is none.
+			noderef* getChildSlot ( Node* node, uint32 b );
+			// Nodes store references as noderef (see gvdb_types.h). These give the full pool
+			// reference of a node's child list (ID_UNDEFL if none) and of its parent; child list
+			// entries convert with RefElem/ElemRef.
+			uint64   getChildListId ( Node* node );
+			void     setChildListId ( Node* node, uint64 id );
+			noderef* getChildList ( Node* node )	{ return (noderef*) mPool->PoolData ( getChildListId(node) ); }
+			uint64   getParentId ( Node* node )		{ return ( node->mParent == ID_UNDEFL ) ? ID_UNDEFL : RefElem ( node->mParent, 0, node->mLev+1 ); }
+			// Allocate an empty dense child list, e.g. for the GPU topology builders to link into.
+			void   CreateChildList ( Node* node );
+			int    getChildClass ( uint64 cnt );
+			uint64 getChildClassCap ( int c )		{ return uint64(8) << (3*c); }
+			// Constant-value tiles. A tile fills the region of child slot `b` with a single value
+			// instead of a child node; the getChild* functions above treat tile slots as empty.
+			// SetTile replaces whatever the slot held without freeing it. getTile returns false if
+			// the slot is not a tile.
+			void  SetTile ( slong nodeid, uint b, float val );
+			bool  getTile ( Node* curr, uint b, float& val );
+			uint64 CountTiles ();
 			bool  isActive(Vector3DI wpos);
 			bool  isActive(Vector3DI wpos, slong nodeid);	// recursive
 			// Returns true if the given pool reference is at level = 0.
@@ -489,6 +572,11 @@
 			Vector3DF MemoryUsage(std::string name, std::vector<std::string>& outlist);			// Detailed info
 			void Measure ( bool bPrint );			
 			float MeasurePools ();
+			Counters getCounters ();				// Snapshot of always-on performance counters
+			void ResetCounters ();					// Reset counters, e.g. once per frame
+			std::vector<MemUsage> getMemUsage ();	// Tracked host/device bytes per category (current and peak)
+			MemUsage getMemTotal ();				// Tracked totals over all categories
+			void ResetMemPeaks ();					// Restart peak tracking from current usage
 
 			// Voxelization
 			Extents ComputeExtents ( Node* node );
@@ -528,9 +616,12 @@
 			void CleanAux(int id);
 			void CleanAux();
 			void PrepareAux ( int id, int cnt, int stride, bool bZero, bool bCPU=false );
+			void TrimAux ( uint64 keep_bytes = 0 );		// release aux blocks cached by the allocator arena
 			void PrepareV3D ( Vector3DI ires, uchar dtype );
 			void AllocData ( DataPtr& ptr, int cnt, int stride, bool bCPU=true );
+			DataBuffer AllocData ( int cnt, int stride, bool bCPU=true );			// owning buffer, freed on destruction
 			void FreeData ( DataPtr& ptr );
+			DataBuffer TakeAux ( int id );										// hand an aux buffer to the caller, no copy
 			void RetrieveData ( DataPtr ptr );			
 			void CommitData ( DataPtr ptr );			
 			void CommitData ( DataPtr& ptr, int cnt, char* cptr, int offs, int stride );
@@ -539,6 +630,7 @@
 			char* getDataCPU ( DataPtr ptr, int n, int stride );
 			void PrefixSum ( CUdeviceptr outArray, CUdeviceptr inArray, int numElements );
 			void SetPoints ( DataPtr& pntpos, DataPtr& pntvel, DataPtr& clrpos );
+			void SetPoints ( DataBuffer&& pntpos, DataBuffer&& pntvel, DataBuffer&& pntclr );	// GVDB takes ownership
 			void InsertPoints ( int num_pnts, Vector3DF trans, bool bPrefix=false );					
 			Vector3DI InsertTriangles ( Model* model, Matrix4F* xform, float& ydiv );
 
@@ -587,6 +679,10 @@
 			Vector3DI getNearestAbsVox ( int lev, Vector3DF pnt );
 			// Gets the log base 2 branching factor per side of a node at the given level.
 			int getLD(int lev)			{ return mLogDim[lev]; }
+			// Gets the compile-time tree shape used by host queries (TreeConfigID), or TREE_CFG_RUNTIME.
+			int getTreeConfig()			{ return mTreeCfg; }
+			// Turns the compile-time shape off (runtime path only) or back on, e.g. to time both paths.
+			void SetTreeSpecialize ( bool b )	{ mTreeCfg = b ? getTreeConfigID ( mPool->getNumLevels(), mLogDim ) : TREE_CFG_RUNTIME; }
 			// Gets the branching factor per side (number of child nodes or child voxels per side) of a node
 			// at the given level.
 			int getRes(int lev)			{ return (1 << mLogDim[lev]); }
@@ -641,9 +737,33 @@
 			uint64	getNumTotalNodes ( int lev );
 			// Gets node `n` at level `lev`.
 			Node*	getNodeAtLevel ( int n, int lev );
+			// Gets the pool reference of the root node (ID_UNDEFL if no topology has been built).
+			uint64	getRootID ()		{ return mRoot; }
 			// Gets the pool reference of the leaf (level 0 node) that is a child of the pool reference `nodeid` and
 			// contains the point `pos` (in voxel coordinates). Returns ID_UNDEFL if no such leaf exists.
 			uint64	getNodeAtPoint ( uint64 nodeid, Vector3DF pos);
+			// Gets the pool references of all active nodes at level `lev` whose bounding boxes intersect the view
+			// frustum of `cam`. Bounds are tested in application coordinates (after `getTransform()`), top-down;
+			// subtrees fully inside the frustum are accepted without further tests. Results are in tree order.
+			std::vector<uint64> CullNodes ( Camera3D& cam, int lev );
+			// Calls func(chunk, view) with a BrickView of channel `chan` for every active leaf, in parallel over
+			// bricks. `chunk` is below getNumThreads(), so the functor can keep per-thread results; it must
+			// otherwise be safe to call concurrently. The channel is read back a batch of atlas layers at a time.
+			// The bbox variant skips leaves that do not overlap [bmin, bmax] (inclusive, voxel coordinates).
+			template<typename F> void ForEachLeaf ( uchar chan, F func );
+			template<typename F> void ForEachLeaf ( uchar chan, Vector3DI bmin, Vector3DI bmax, F func );
+			// Calls func(chunk, pos, value) for every voxel of an active leaf inside [bmin, bmax], as ForEachLeaf.
+			// T is the channel's value type, e.g. float for T_FLOAT.
+			template<typename T, typename F> void ForEachActiveVoxel ( uchar chan, Vector3DI bmin, Vector3DI bmax, F func );
+			// Building blocks of ForEachLeaf, for readbacks that need their own loop. GetLeafLayers buckets the
+			// pool references of the active leaves overlapping [bmin, bmax] by atlas layer and returns how many
+			// layers to read at once (AtlasLayerBatch, about 64 MB). ReadAtlasLayers reads layers [l0, l1) of
+			// the channel into `buf`, getAtlasVoxelBytes per voxel; reuse `buf` across batches and release it
+			// with EndAtlasLayers, which also ends its staging memory accounting.
+			int  GetLeafLayers ( uchar chan, Vector3DI bmin, Vector3DI bmax, std::vector< std::vector<uint64> >& layers );
+			int  AtlasLayerBatch ( uchar chan );
+			void ReadAtlasLayers ( uchar chan, int l0, int l1, std::vector<uchar>& buf );
+			void EndAtlasLayers ( std::vector<uchar>& buf );
 			
 			// Gets the inclusive lower bound of the node's bounding box in voxel coordinates (i.e. `node->mPos`).
 			// This function's return type may be changed to `Vector3DI` in the future.
@@ -815,8 +935,15 @@
 			void SetBias(float b) { m_bias = b; }
 
 	protected:
+			// Host iteration (see ForEachLeaf)
+			BrickView getBrickView ( uchar chan, uint64 nodeid, const std::vector<uchar>& buf, int l0 );
+
+			// Aux slot pointing at a caller's buffer (see SetPoints)
+			void SetAuxView ( int id, const DataPtr& p );
+
 			// VDB Settings
 			int				mLogDim[MAXLEV];	// internal res config
+			int				mTreeCfg;			// specialized shape of mLogDim (TreeConfigID), or TREE_CFG_RUNTIME
 			Vector3DF		mClrDim[MAXLEV];
 			int				mVCFG[MAXLEV];		// user selected vdb config
 			int				mApron;
@@ -827,6 +954,16 @@
 			Vector3DI		mAtlasResize;
 			Vector3DI		mDefaultAxiscnt;
 						
+			// Frustum culling
+			void CullSubtree ( uint64 nodeid, int lev, const float planes[6][4], bool inside, std::vector<uint64>& out );
+
+			// Child lists (see isDenseChildList)
+			void GatherChildList ( Node* node, std::vector<uint32>& bits, std::vector<uint64>& refs, uint64* tiles = 0x0 );
+			void WriteChildList ( Node* node, const std::vector<uint32>& bits, const std::vector<uint64>& refs, int cls = -1 );
+			void ExpandChildLists ( int levs );
+			void ReadChildLists ( FILE* fp, int lev, int cnt, int wid, bool packed, int refbytes );
+			void ReadNodes ( FILE* fp, int lev, int cnt, int wid, int refbytes );
+
 			// Root node
 			uint64			mRoot;
 			Vector3DI		mPnt;
@@ -853,8 +990,13 @@
 			std::vector< Vector3DF >	leaf_pos;
 			std::vector< uint64 >		leaf_ptr;
 
+			// Brick sharing (see DedupBricks)
+			std::vector< uint64 >		mBrickOwner;		// per leaf: index of the leaf whose atlas slot it shares, or ID_UNDEF64
+			uint64						mNumSharedBricks;
+
 			// Auxiliary buffers
 			DataPtr			mAux[MAX_AUX];		// Auxiliary
+			DataBuffer		mAuxOwned[MAX_AUX];	// Auxiliary buffers owned by GVDB (from SetPoints)
 			std::string		mAuxName[MAX_AUX];
 
 			Volume3D*		mV3D;			// Volume 3D
@@ -900,6 +1042,67 @@
 #endif // #ifdef BUILD_OPENVDB
 		};
 
+	// Iterates the active leaves (bricks) of a volume in pool order:
+	//   for ( LeafIterator it ( gvdb ); it; ++it ) { Node* leaf = it.node(); .. }
+	class LeafIterator {
+	public:
+		LeafIterator ( VolumeGVDB& vdb ) : mVDB(vdb), mNdx(0), mCnt(vdb.getNumTotalNodes(0)) { skip (); }
+		explicit operator bool () const		{ return mNdx < mCnt; }
+		LeafIterator& operator++ ()			{ mNdx++; skip (); return *this; }
+		uint64		id () const				{ return Elem ( 0, 0, mNdx ); }
+		Node*		node () const			{ return mVDB.getNode ( 0, 0, mNdx ); }
+		Vector3DI	pos () const			{ return node()->mPos; }
+	private:
+		void		skip ()					{ while ( mNdx < mCnt && !node()->mFlags ) mNdx++; }
+		VolumeGVDB&	mVDB;
+		uint64		mNdx, mCnt;
+	};
+
+	template<typename F> void VolumeGVDB::ForEachLeaf ( uchar chan, F func )
+	{
+		ForEachLeaf ( chan, Vector3DI(INT_MIN, INT_MIN, INT_MIN), Vector3DI(INT_MAX, INT_MAX, INT_MAX), func );
+	}
+
+	template<typename F> void VolumeGVDB::ForEachLeaf ( uchar chan, Vector3DI bmin, Vector3DI bmax, F func )
+	{
+		std::vector< std::vector<uint64> > layers;
+		const int batch = GetLeafLayers ( chan, bmin, bmax, layers );
+		std::vector<uint64> nodes;
+		std::vector<uchar> buf;
+		for (int l0 = 0; l0 < (int) layers.size(); l0 += batch) {
+			int l1 = std::min ( (int) layers.size(), l0 + batch );
+			nodes.clear ();
+			for (int l = l0; l < l1; l++) nodes.insert ( nodes.end(), layers[l].begin(), layers[l].end() );
+			if ( nodes.empty() ) continue;
+			ReadAtlasLayers ( chan, l0, l1, buf );
+			ParallelChunks ( nodes.size(), 0, [&]( int c, uint64 s, uint64 e ) {
+				for (uint64 i = s; i < e; i++) func ( c, getBrickView ( chan, nodes[i], buf, l0 ) );
+			} );
+		}
+		EndAtlasLayers ( buf );
+	}
+
+	template<typename T, typename F> void VolumeGVDB::ForEachActiveVoxel ( uchar chan, Vector3DI bmin, Vector3DI bmax, F func )
+	{
+		// T is the channel's value (e.g. Vector3DF for T_FLOAT3) or the whole stored voxel (Vector4DF)
+		if ( chan < mPool->getNumAtlas() && sizeof(T) != (size_t) mPool->getSize ( mPool->getAtlas(chan).type )
+			 && sizeof(T) != (size_t) mPool->getAtlasVoxelBytes ( chan ) ) {
+			gprintf ( "ERROR: ForEachActiveVoxel value type does not match channel %d.\n", (int) chan );
+			return;
+		}
+		ForEachLeaf ( chan, bmin, bmax, [&]( int c, const BrickView& b ) {
+			// clip the brick to the box
+			Vector3DI lo ( std::max(bmin.x, b.origin.x), std::max(bmin.y, b.origin.y), std::max(bmin.z, b.origin.z) );
+			Vector3DI hi ( std::min(bmax.x, b.origin.x + b.res-1), std::min(bmax.y, b.origin.y + b.res-1), std::min(bmax.z, b.origin.z + b.res-1) );
+			lo -= b.origin;
+			hi -= b.origin;
+			for (int z = lo.z; z <= hi.z; z++)
+				for (int y = lo.y; y <= hi.y; y++)
+					for (int x = lo.x; x <= hi.x; x++)
+						func ( c, Vector3DI ( b.origin.x + x, b.origin.y + y, b.origin.z + z ), b.at<T> ( x, y, z ) );
+		} );
+	}
+
 	}
 
 #endif